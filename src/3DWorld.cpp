@@ -67,7 +67,7 @@ char *lighting_file[NUM_LIGHTING_TYPES] = {0};
 bool combined_gu(0), underwater(0), kbd_text_mode(0), univ_stencil_shadows(1), use_waypoint_app_spots(0), enable_tiled_mesh_ao(0), tiled_terrain_only(0);
 bool show_lightning(0), disable_shader_effects(0), use_waypoints(0), group_back_face_cull(0), start_maximized(0), claim_planet(0), skip_light_vis_test(0);
 bool no_smoke_over_mesh(0), enable_model3d_tex_comp(0), global_lighting_update(0), lighting_update_offline(0), mesh_difuse_tex_comp(1), smoke_dlights(0), keep_keycards_on_death(0);
-bool texture_alpha_in_red_comp(0), use_model2d_tex_mipmaps(1), mt_cobj_tree_build(0), two_sided_lighting(0), inf_terrain_scenery(1), invert_model_nmap_bscale(0);
+bool texture_alpha_in_red_comp(0), use_model2d_tex_mipmaps(1), mt_cobj_tree_build(0), refit_dynamic_cobj_tree(0), sah_cobj_tree_build(0), cpu_mesh_noise_gen(0), two_sided_lighting(0), inf_terrain_scenery(1), invert_model_nmap_bscale(0);
 bool gen_tree_roots(1), fast_water_reflect(0), vsync_enabled(0), use_voxel_cobjs(0), disable_sound(0), enable_depth_clamp(0), volume_lighting(0), no_subdiv_model(0);
 bool detail_normal_map(0), init_core_context(0), use_core_context(0), enable_multisample(1), dynamic_smap_bias(0), model3d_wn_normal(0), snow_shadows(0), user_action_key(0);
 bool enable_dlight_shadows(1), tree_indir_lighting(0), ctrl_key_pressed(0), only_pine_palm_trees(0), enable_gamma_correct(0), use_z_prepass(0), reflect_dodgeballs(0);
@@ -77,7 +77,7 @@ bool enable_model3d_custom_mipmaps(1), flatten_tt_mesh_under_models(0), show_map
 bool enable_dpart_shadows(0), enable_tt_model_reflect(1), enable_tt_model_indir(0), auto_calc_tt_model_zvals(0), use_model_lod_blocks(0), enable_translocator(0), enable_grass_fire(0);
 bool disable_model_textures(0), start_in_inf_terrain(0), allow_shader_invariants(1), config_unlimited_weapons(0), disable_tt_water_reflect(0), allow_model3d_quads(1);
 bool enable_timing_profiler(0), fast_transparent_spheres(0), force_ref_cmap_update(0), use_instanced_pine_trees(0), enable_postproc_recolor(0), draw_building_interiors(0);
-bool toggle_room_light(0);
+bool toggle_room_light(0), headless_mode(0);
 int xoff(0), yoff(0), xoff2(0), yoff2(0), rand_gen_index(0), mesh_rgen_index(0), camera_change(1), camera_in_air(0), auto_time_adv(0);
 int animate(1), animate2(1), draw_model(0), init_x(STARTING_INIT_X), fire_key(0), do_run(0), init_num_balls(-1), change_wmode_frame(0);
 int game_mode(0), map_mode(0), load_hmv(0), load_coll_objs(1), read_landscape(0), screen_reset(0), mesh_seed(0), rgen_seed(1);
@@ -95,13 +95,13 @@ int enable_fsource(0), run_forward(0), advanced(0), dynamic_mesh_scroll(0);
 int read_snow_file(0), write_snow_file(0), mesh_detail_tex(NOISE_TEX);
 int read_light_files[NUM_LIGHTING_TYPES] = {0}, write_light_files[NUM_LIGHTING_TYPES] = {0};
 unsigned num_snowflakes(0), create_voxel_landscape(0), hmap_filter_width(0), num_dynam_parts(100), snow_coverage_resolution(2), num_birds_per_tile(2), num_fish_per_tile(15);
-unsigned erosion_iters(0), erosion_iters_tt(0), video_framerate(60), num_video_threads(0), skybox_tid(0);
+unsigned erosion_iters(0), erosion_iters_tt(0), video_framerate(60), num_video_threads(0), skybox_tid(0), wide_cobj_trees(0), lighting_bake_passes(1), erosion_bench_iters(0), headless_num_frames(0), sine_sum_bench_iters(0);
 float NEAR_CLIP(DEF_NEAR_CLIP), FAR_CLIP(DEF_FAR_CLIP), system_max_orbit(1.0), sky_occlude_scale(0.0), tree_slope_thresh(5.0), mouse_sensitivity(1.0), tt_grass_scale_factor(1.0);
 float water_plane_z(0.0), base_gravity(1.0), crater_depth(1.0), crater_radius(1.0), disabled_mesh_z(FAR_CLIP), vegetation(1.0), atmosphere(1.0), biome_x_offset(0.0);
-float mesh_file_scale(1.0), mesh_file_tz(0.0), speed_mult(1.0), mesh_z_cutoff(-FAR_CLIP), relh_adj_tex(0.0), dodgeball_metalness(1.0), ray_step_size_mult(1.0);
+float mesh_file_scale(1.0), mesh_file_tz(0.0), speed_mult(1.0), mesh_z_cutoff(-FAR_CLIP), relh_adj_tex(0.0), dodgeball_metalness(1.0), ray_step_size_mult(1.0), lighting_bake_converge_thresh(0.0);
 float water_h_off(0.0), water_h_off_rel(0.0), perspective_fovy(0.0), perspective_nclip(0.0), read_mesh_zmm(0.0), indir_light_exp(1.0), cloud_height_offset(0.0);
 float snow_depth(0.0), snow_random(0.0), cobj_z_bias(DEF_Z_BIAS), init_temperature(DEF_TEMPERATURE), indir_vert_offset(0.25), sm_tree_density(1.0), fog_dist_scale(1.0);
-float CAMERA_RADIUS(DEF_CAMERA_RADIUS), C_STEP_HEIGHT(0.6), waypoint_sz_thresh(1.0), model3d_alpha_thresh(0.9), model3d_texture_anisotropy(1.0), dist_to_fire_sq(0.0);
+float CAMERA_RADIUS(DEF_CAMERA_RADIUS), C_STEP_HEIGHT(0.6), waypoint_sz_thresh(1.0), waypoint_max_conn_dist(0.0), model3d_alpha_thresh(0.9), model3d_texture_anisotropy(1.0), dist_to_fire_sq(0.0);
 float ocean_wave_height(DEF_OCEAN_WAVE_HEIGHT), tree_density_thresh(0.55), model_auto_tc_scale(0.0), model_triplanar_tc_scale(0.0), shadow_map_pcf_offset(0.0);
 float custom_glaciate_exp(0.0), tree_type_rand_zone(0.0), jump_height(1.0), force_czmin(0.0), force_czmax(0.0), smap_thresh_scale(1.0), dlight_intensity_scale(1.0);
 float model_mat_lod_thresh(5.0), clouds_per_tile(0.5), def_atmosphere(1.0), def_vegetation(1.0), ocean_depth_opacity_mult(1.0), erode_amount(1.0), ambient_scale(1.0);
@@ -109,6 +109,7 @@ float light_int_scale[NUM_LIGHTING_TYPES] = {1.0, 1.0, 1.0, 1.0, 1.0}, first_ray
 double camera_zh(0.0);
 point mesh_origin(all_zeros), camera_pos(all_zeros), cube_map_center(all_zeros);
 string user_text, cobjs_out_fn, sphere_materials_fn, hmap_out_fn, skybox_cube_map_name;
+vector<string> erosion_bench_fns;
 colorRGB ambient_lighting_scale(1,1,1), mesh_color_scale(1,1,1);
 colorRGBA bkg_color, flower_color(ALPHA0);
 set<unsigned char> keys, keyset;
@@ -124,20 +125,20 @@ char player_name[MAX_CHARS] = "Player";
 bool vert_opt_flags[3] = {0}; // {enable, full_opt, verbose}
 
 
-extern bool clear_landscape_vbo, use_dense_voxels, tree_4th_branches, model_calc_tan_vect, water_is_lava, use_grass_tess, def_tex_compress, ship_cube_map_reflection;
+extern bool clear_landscape_vbo, use_dense_voxels, tree_4th_branches, model_calc_tan_vect, model_hash_vertex_map, parallel_model_load, model3d_write_coll_tree, universe_prefetch, async_planet_textures, water_is_lava, use_grass_tess, def_tex_compress, ship_cube_map_reflection, mem_stats_print, show_mem_stats;
 extern int camera_flight, DISABLE_WATER, DISABLE_SCENERY, camera_invincible, onscreen_display, mesh_freq_filter, show_waypoints, last_inventory_frame;
-extern int tree_coll_level, GLACIATE, UNLIMITED_WEAPONS, destroy_thresh, MAX_RUN_DIST, mesh_gen_mode, mesh_gen_shape, map_drag_x, map_drag_y;
+extern int tree_coll_level, GLACIATE, UNLIMITED_WEAPONS, destroy_thresh, MAX_RUN_DIST, mesh_gen_mode, mesh_gen_shape, map_drag_x, map_drag_y, replay_bench_exit_code;
 extern unsigned NPTS, NRAYS, LOCAL_RAYS, GLOBAL_RAYS, DYNAMIC_RAYS, NUM_THREADS, MAX_RAY_BOUNCES, grass_density, max_unique_trees, shadow_map_sz;
-extern unsigned scene_smap_vbo_invalid, spheres_mode, max_cube_map_tex_sz, DL_GRID_BS;
+extern unsigned scene_smap_vbo_invalid, spheres_mode, max_cube_map_tex_sz, DL_GRID_BS, tile_cache_max_mb, replay_bench_warmup, mem_stats_interval, model3d_file_version;
 extern float fticks, team_damage, self_damage, player_damage, smiley_damage, smiley_speed, tree_deadness, tree_dead_prob, lm_dz_adj, nleaves_scale, flower_density, universe_ambient_scale;
 extern float mesh_scale, tree_scale, mesh_height_scale, smiley_acc, hmv_scale, last_temp, grass_length, grass_width, branch_radius_scale, tree_height_scale, planet_update_rate;
-extern float MESH_START_MAG, MESH_START_FREQ, MESH_MAG_MULT, MESH_FREQ_MULT, def_tex_aniso;
+extern float MESH_START_MAG, MESH_START_FREQ, MESH_MAG_MULT, MESH_FREQ_MULT, def_tex_aniso, replay_bench_tolerance;
 extern double map_x, map_y;
 extern point hmv_pos, camera_last_pos;
 extern colorRGBA sunlight_color;
 extern int coll_id[];
 extern float tree_lod_scales[4];
-extern string read_hmap_modmap_fn, write_hmap_modmap_fn, read_voxel_brush_fn, write_voxel_brush_fn, font_texture_atlas_fn;
+extern string read_hmap_modmap_fn, write_hmap_modmap_fn, read_voxel_brush_fn, write_voxel_brush_fn, font_texture_atlas_fn, tile_cache_dir, replay_bench_report, replay_bench_baseline, profiler_trace_fn;
 extern vector<bbox> team_starts;
 extern player_state *sstates;
 extern pt_line_drawer obj_pld;
@@ -193,6 +194,7 @@ bool get_gl_error(unsigned loc_id) {
 bool check_gl_error(unsigned loc_id) {
 
 	bool had_error(0);
+	if (headless_mode) return 0; // no GL context
 #ifdef _DEBUG
 	had_error = get_gl_error(loc_id);
 	assert(!had_error); // currently fatal
@@ -238,7 +240,8 @@ void clear_context() { // free all textures, shaders, VBOs, etc.; used on contex
 void quit_3dworld() { // called once at the end for proper cleanup
 
 	cout << "quitting" << endl;
-	kill_current_raytrace_threads();
+	shutdown_raytrace_threads();
+	flush_tiled_terrain_disk_cache(); // tiles generated since the last index save, and tiles that are still live
 	clear_context();
 	exit_openal();
 
@@ -875,6 +878,8 @@ void keyboard_proc(unsigned char key, int x, int y) {
 	case 'f': // print framerate and stats
 		show_framerate = 1;
 		timing_profiler_stats();
+		print_mem_stats();
+		if (world_mode == WMODE_GROUND) {print_cobj_tree_update_stats();}
 		break;
 	case 'g': // pause/resume playback of eventlist
 		pause_frame = !pause_frame;
@@ -1608,6 +1613,9 @@ int load_config(string const &config_file) {
 	kwmb.add("gen_tree_roots", gen_tree_roots);
 	kwmb.add("no_smoke_over_mesh", no_smoke_over_mesh);
 	kwmb.add("use_waypoints", use_waypoints);
+	kwmb.add("headless_mode", headless_mode);
+	kwmb.add("mem_stats_print", mem_stats_print);
+	kwmb.add("show_mem_stats", show_mem_stats);
 	kwmb.add("use_waypoint_app_spots", use_waypoint_app_spots);
 	kwmb.add("group_back_face_cull", group_back_face_cull);
 	kwmb.add("inf_terrain_scenery", inf_terrain_scenery);
@@ -1620,6 +1628,9 @@ int load_config(string const &config_file) {
 	kwmb.add("use_dense_voxels", use_dense_voxels);
 	kwmb.add("use_voxel_cobjs", use_voxel_cobjs);
 	kwmb.add("mt_cobj_tree_build", mt_cobj_tree_build);
+	kwmb.add("refit_dynamic_cobj_tree", refit_dynamic_cobj_tree);
+	kwmb.add("sah_cobj_tree_build", sah_cobj_tree_build);
+	kwmb.add("cpu_mesh_noise_gen", cpu_mesh_noise_gen);
 	kwmb.add("global_lighting_update", global_lighting_update);
 	kwmb.add("lighting_update_offline", lighting_update_offline);
 	kwmb.add("two_sided_lighting", two_sided_lighting);
@@ -1635,6 +1646,11 @@ int load_config(string const &config_file) {
 	kwmb.add("tree_4th_branches", tree_4th_branches);
 	kwmb.add("skip_light_vis_test", skip_light_vis_test);
 	kwmb.add("model_calc_tan_vect", model_calc_tan_vect);
+	kwmb.add("model_hash_vertex_map", model_hash_vertex_map);
+	kwmb.add("parallel_model_load", parallel_model_load);
+	kwmb.add("model3d_write_coll_tree", model3d_write_coll_tree);
+	kwmb.add("universe_prefetch", universe_prefetch);
+	kwmb.add("async_planet_textures", async_planet_textures);
 	kwmb.add("invert_model_nmap_bscale", invert_model_nmap_bscale);
 	kwmb.add("enable_dlight_shadows", enable_dlight_shadows);
 	kwmb.add("tree_indir_lighting", tree_indir_lighting);
@@ -1721,11 +1737,16 @@ int load_config(string const &config_file) {
 	kwmu.add("grass_density", grass_density);
 	kwmu.add("max_unique_trees", max_unique_trees);
 	kwmu.add("shadow_map_sz", shadow_map_sz);
+	kwmu.add("headless_num_frames", headless_num_frames);
 	kwmu.add("max_ray_bounces", MAX_RAY_BOUNCES);
 	kwmu.add("num_test_snowflakes", num_snowflakes);
 	kwmu.add("hmap_filter_width", hmap_filter_width);
 	kwmu.add("erosion_iters", erosion_iters);
 	kwmu.add("erosion_iters_tt", erosion_iters_tt);
+	kwmu.add("tile_cache_max_mb", tile_cache_max_mb);
+	kwmu.add("replay_bench_warmup", replay_bench_warmup);
+	kwmu.add("mem_stats_interval", mem_stats_interval);
+	kwmu.add("model3d_file_version", model3d_file_version);
 	kwmu.add("num_dynam_parts", num_dynam_parts);
 	kwmu.add("num_birds_per_tile", num_birds_per_tile);
 	kwmu.add("num_fish_per_tile", num_fish_per_tile);
@@ -1734,18 +1755,22 @@ int load_config(string const &config_file) {
 	kwmu.add("dlight_grid_bitshift", DL_GRID_BS);
 	kwmu.add("video_framerate", video_framerate);
 	kwmu.add("num_video_threads", num_video_threads);
+	kwmu.add("wide_cobj_trees", wide_cobj_trees); // 0=binary, 1=4-wide float, 2=4-wide quantized
+	kwmu.add("lighting_bake_passes", lighting_bake_passes);
 
 	kw_to_val_map_t<float> kwmf(error);
 	kwmf.add("gravity", base_gravity);
 	kwmf.add("mesh_height", mesh_height_scale);
 	kwmf.add("mesh_scale", mesh_scale);
 	kwmf.add("mesh_z_cutoff", mesh_z_cutoff);
+	kwmf.add("replay_bench_tolerance", replay_bench_tolerance);
 	kwmf.add("disabled_mesh_z", disabled_mesh_z);
 	kwmf.add("relh_adj_tex", relh_adj_tex);
 	kwmf.add("set_czmax", czmax);
 	kwmf.add("camera_radius", CAMERA_RADIUS);
 	kwmf.add("camera_step_height", C_STEP_HEIGHT);
 	kwmf.add("waypoint_sz_thresh", waypoint_sz_thresh);
+	kwmf.add("waypoint_max_conn_dist", waypoint_max_conn_dist); // 0 = auto, negative = unbounded
 	kwmf.add("tree_deadness", tree_deadness);
 	kwmf.add("tree_dead_prob", tree_dead_prob);
 	kwmf.add("sun_rot", sun_rot);
@@ -1805,6 +1830,7 @@ int load_config(string const &config_file) {
 	kwmf.add("erode_amount", erode_amount);
 	kwmf.add("ambient_scale", ambient_scale);
 	kwmf.add("ray_step_size_mult", ray_step_size_mult);
+	kwmf.add("lighting_bake_converge_thresh", lighting_bake_converge_thresh);
 	kwmf.add("system_max_orbit", system_max_orbit);
 	kwmf.add("sky_occlude_scale", sky_occlude_scale);
 	kwmf.add("mouse_sensitivity", mouse_sensitivity);
@@ -1827,6 +1853,10 @@ int load_config(string const &config_file) {
 
 	kw_to_val_map_t<string> kwms(error);
 	kwms.add("cobjs_out_filename", cobjs_out_fn);
+	kwms.add("tile_cache_dir", tile_cache_dir);
+	kwms.add("replay_bench_report", replay_bench_report);
+	kwms.add("replay_bench_baseline", replay_bench_baseline);
+	kwms.add("profiler_trace_file", profiler_trace_fn);
 
 	while (read_str(fp, strc)) { // slow but should be OK: these ones require special handling
 		string const str(strc);
@@ -2027,6 +2057,14 @@ int load_config(string const &config_file) {
 		else if (str == "write_heightmap_png") {
 			if (!read_string(fp, hmap_out_fn)) cfg_err("write_heightmap_png command", error);
 		}
+		else if (str == "erosion_benchmark") { // can be specified multiple times; uses the last num_iters
+			string fn;
+			if (!read_uint(fp, erosion_bench_iters) || !read_string(fp, fn)) cfg_err("erosion_benchmark command", error);
+			erosion_bench_fns.push_back(fn);
+		}
+		else if (str == "sine_sum_benchmark") {
+			if (!read_uint(fp, sine_sum_bench_iters)) cfg_err("sine_sum_benchmark command", error);
+		}
 		else if (str == "mesh_diffuse_tex_fn") {
 			alloc_if_req(mesh_diffuse_tex_fn, NULL);
 			if (fscanf(fp, "%255s", mesh_diffuse_tex_fn) != 1) cfg_err("mesh_diffuse_tex_fn command", error);
@@ -2193,6 +2231,62 @@ void init_debug_callback() {
 }
 
 
+void gen_initial_scene() { // universe mode should be able to do without these initializations
+
+	reset_planet_defaults(); // set atmosphere and vegetation
+	init_objects();
+	alloc_matrices();
+	t_trees.resize(num_trees);
+	init_models();
+	init_terrain_mesh();
+	init_lights();
+	check_gl_error(7774);
+	gen_scene(1, (world_mode == WMODE_GROUND), 0, 0, 0);
+	check_gl_error(7775);
+	gen_snow_coverage();
+	if (enable_grass_fire) {init_ground_fire();}
+	create_object_groups();
+	init_game_state();
+	check_gl_error(7776);
+
+	if (game_mode) {
+		gamemode_rand_appear();
+		camera_mode = 1; // on the ground
+	}
+	get_landscape_texture_color(0, 0); // hack to force creation of the cached_ls_colors vector in the master thread (before build_lightmap())
+	build_lightmap(1);
+}
+
+
+void run_headless() { // generate the scene and run simulation frames without a window or GL context, then exit
+
+	cout << "Running headless for " << headless_num_frames << " frames" << endl;
+	disable_sound = 1; // no audio device either
+	cpu_mesh_noise_gen = 1; // GPU simplex mesh noise (mesh_gen_mode >= MGEN_SIMPLEX_GPU) uses a compute shader
+	load_textures(); // CPU side only; GL uploads are skipped in headless mode
+	if (!universe_only) {gen_initial_scene();}
+	if (world_mode == WMODE_UNIVERSE || combined_gu) {gen_universe_headless();}
+	else if (world_mode == WMODE_INF_TERRAIN) {gen_tiled_terrain_buildings();}
+	if (enable_timing_profiler) {toggle_timing_profiler();}
+	double const start_time(get_bench_time_ms());
+	unsigned num_frames(0);
+
+	for (; num_frames < headless_num_frames || replay_bench_active; ++num_frames) { // replay benchmark runs until the event list is done
+		advance_headless_frame();
+		if (num_frames > 0 && (num_frames % 100) == 0) {cout << "frame " << num_frames << endl;}
+	}
+	if (num_frames > 0) {cout << "Headless frames: " << num_frames << ", average frame time: " << (get_bench_time_ms() - start_time)/num_frames << "ms" << endl;}
+	if (enable_timing_profiler) {timing_profiler_stats();}
+
+	if (!universe_only) {
+		free_models();
+		free_scenery_cobjs();
+		delete_matrices();
+	}
+	exit(replay_bench_exit_code);
+}
+
+
 int main(int argc, char** argv) {
 
 	cout << "Starting 3DWorld" << endl;
@@ -2206,12 +2300,24 @@ int main(int argc, char** argv) {
 	load_texture_names(); // needs to be before config file load
 	load_top_level_config(defaults_file);
 	gen_gauss_rand_arr(); // after reading seed from config file
+	init_replay_bench(); // after reading the benchmark report filename from config file
+
+	if (!erosion_bench_fns.empty()) { // run the benchmark and exit
+		run_erosion_benchmark(erosion_bench_fns, erosion_bench_iters);
+		exit(0);
+	}
+	if (sine_sum_bench_iters > 0) { // run the benchmark and exit
+		run_sine_sum_benchmark(sine_sum_bench_iters);
+		exit(0);
+	}
+	if (headless_mode) {run_headless();} // never returns
 	cout << "Loading."; cout.flush();
 	
  	// Initialize GLUT
 	progress();
  	glutInit(&argc, argv);
 	progress();
+
  	glutInitDisplayMode(GLUT_RGBA | GLUT_DOUBLE | GLUT_DEPTH | GLUT_STENCIL | GLUT_MULTISAMPLE);
 	//glutInitDisplayString("rgba double depth>=16 samples>=8");
 	glutInitWindowSize(window_width, window_height);
@@ -2250,30 +2356,7 @@ int main(int argc, char** argv) {
 	check_gl_error(7773);
 	//cout << "Extensions: " << get_all_gl_extensions() << endl;
 
-	if (!universe_only) { // universe mode should be able to do without these initializations
-		reset_planet_defaults(); // set atmosphere and vegetation
-		init_objects();
-		alloc_matrices();
-		t_trees.resize(num_trees);
-		init_models();
-		init_terrain_mesh();
-		init_lights();
-		check_gl_error(7774);
-		gen_scene(1, (world_mode == WMODE_GROUND), 0, 0, 0);
-		check_gl_error(7775);
-		gen_snow_coverage();
-		if (enable_grass_fire) {init_ground_fire();}
-		create_object_groups();
-		init_game_state();
-		check_gl_error(7776);
-
-		if (game_mode) {
-			gamemode_rand_appear();
-			camera_mode = 1; // on the ground
-		}
-		get_landscape_texture_color(0, 0); // hack to force creation of the cached_ls_colors vector in the master thread (before build_lightmap())
-		build_lightmap(1);
-	}
+	if (!universe_only) {gen_initial_scene();}
 	check_gl_error(7777);
 	glutMainLoop(); // Switch to main loop
 	quit_3dworld(); // never actually gets here
@@ -1210,6 +1210,7 @@ protected:
 public:
 	static colorRGBA gen_color(rand_gen_t &rgen);
 	static void calc_unscaled_points(bool simplified);
+	static void ensure_unscaled_points(bool simplified) {if (unscaled_points[simplified].empty()) {calc_unscaled_points(simplified);}}
 	vector<vert_type_t> const &get_points() const {return points;}
 	void gen_pts(vector3d const &size, point const &pos=all_zeros, bool simplified=0);
 	void gen_pts(float radius, point const &pos=all_zeros, bool simplified=0) {gen_pts(vector3d(radius, radius, radius), pos, simplified);}
@@ -1323,6 +1324,33 @@ void register_timing_value(const char *str, int delta_time);
 void toggle_timing_profiler();
 void timing_profiler_stats();
 
+// replay benchmark subsystems (see profiler.cpp)
+enum {BENCH_PHYSICS=0, BENCH_AI, BENCH_TRAFFIC, BENCH_TILES, BENCH_LIGHTING, NUM_BENCH_SUBSYS};
+extern bool replay_bench_active;
+double get_bench_time_ms();
+void add_replay_bench_time(unsigned subsys, double time_ms);
+void init_replay_bench();
+void replay_bench_next_frame();
+
+// memory accounting (see profiler.cpp); each subsystem adds its current usage when polled
+enum {MEM_TILES=0, MEM_TREES, MEM_GRASS, MEM_BUILDINGS, MEM_CITY, MEM_MODELS, MEM_TEXTURES, MEM_LIGHTMAP, MEM_VOXELS, MEM_COBJS, MEM_COBJ_BVH, MEM_COBJ_WBVH, NUM_MEM_SUBSYS};
+
+struct mem_usage_t {
+	uint64_t cpu, gpu; // in bytes
+	unsigned count; // number of objects; meaning depends on the subsystem
+	mem_usage_t() : cpu(0), gpu(0), count(0) {}
+	void add(uint64_t cpu_, uint64_t gpu_, size_t count_=0) {cpu += cpu_; gpu += gpu_; count += (unsigned)count_;}
+};
+void update_mem_stats();
+void print_mem_stats();
+void draw_mem_stats();
+
+// hierarchical scoped profiler (see profiler.cpp)
+extern bool hier_profiler_enabled;
+unsigned get_profile_name_id(char const *const name);
+unsigned profile_scope_begin(unsigned name_id);
+void profile_scope_end(unsigned depth);
+
 // macros
 #define GET_TIME_MS()    glutGet(GLUT_ELAPSED_TIME)
 #define RESET_TIME       int const timer1(GET_TIME_MS());
@@ -1344,15 +1372,39 @@ void timing_profiler_stats();
 #define PRINT_TIME2(str) {cout << str << " time = " << GET_DELTA_TIME << endl;}
 #endif
 
+class profile_scope_t { // adds a nested scope to this thread's call tree and trace buffer when the profiler is enabled
+	unsigned depth;
+	bool active;
+public:
+	profile_scope_t(unsigned name_id) : depth(0), active(hier_profiler_enabled) {if (active) {depth = profile_scope_begin(name_id);}}
+	profile_scope_t(char const *const name) : depth(0), active(hier_profiler_enabled) {if (active) {depth = profile_scope_begin(get_profile_name_id(name));}}
+	~profile_scope_t() {end();}
+	void end() {if (active) {profile_scope_end(depth); active = 0;}}
+};
+// name must be a string literal; the name lookup is done only once per call site
+#define PROFILE_SCOPE(name) static unsigned const profile_scope_id(get_profile_name_id(name)); profile_scope_t profile_scope(profile_scope_id)
+
 class timer_t {
 	std::string name;
 	int timer1;
-	bool enabled;
+	bool enabled; // only controls printing/flat stats; the hierarchical profiler always records
+	profile_scope_t prof_scope;
 public:
-	timer_t(char const *const name_,  bool enabled_=1) : name(name_), timer1(GET_TIME_MS()), enabled(enabled_) {}
-	timer_t(std::string const &name_, bool enabled_=1) : name(name_), timer1(GET_TIME_MS()), enabled(enabled_) {}
+	timer_t(char const *const name_,  bool enabled_=1) : name(name_), timer1(GET_TIME_MS()), enabled(enabled_), prof_scope(name_) {}
+	timer_t(std::string const &name_, bool enabled_=1) : name(name_), timer1(GET_TIME_MS()), enabled(enabled_), prof_scope(name_.c_str()) {}
 	~timer_t() {end();}
-	void end() {if (enabled && !name.empty()) {register_timing_value(name.c_str(), GET_DELTA_TIME); name.clear();}}
+	void end() {
+		prof_scope.end();
+		if (enabled && !name.empty()) {register_timing_value(name.c_str(), GET_DELTA_TIME); name.clear();}
+	}
+};
+
+class bench_timer_t { // adds the elapsed time of its scope to a replay benchmark subsystem; does nothing when not benchmarking
+	unsigned subsys;
+	double start;
+public:
+	bench_timer_t(unsigned subsys_) : subsys(subsys_), start(replay_bench_active ? get_bench_time_ms() : -1.0) {}
+	~bench_timer_t() {if (start >= 0.0) {add_replay_bench_time(subsys, (get_bench_time_ms() - start));}}
 };
 
 
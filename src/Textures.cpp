@@ -202,7 +202,7 @@ float def_tex_aniso(2.0);
 unsigned char *landscape0 = NULL;
 
 
-extern bool mesh_difuse_tex_comp, water_is_lava, invert_bump_maps;
+extern bool mesh_difuse_tex_comp, water_is_lava, invert_bump_maps, headless_mode;
 extern unsigned smoke_tid, dl_tid, elem_tid, gb_tid, reflection_tid, depth_tid, empty_smap_tid, frame_buffer_RGB_tid, skybox_tid, skybox_cube_tid, univ_reflection_tid;
 extern int world_mode, read_landscape, default_ground_tex, xoff2, yoff2, DISABLE_WATER;
 extern int scrolling, dx_scroll, dy_scroll, display_mode, iticks, universe_only, window_width, window_height;
@@ -302,6 +302,7 @@ void load_textures() {
 	}
 	textures[TREE_HEMI_TEX].set_color_alpha_to_one();
 	textures_inited = 1;
+	if (headless_mode) return;
 
 	glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &max_tius);
 	glGetIntegerv(GL_MAX_COMBINED_TEXTURE_IMAGE_UNITS, &max_ctius);
@@ -322,6 +323,8 @@ unsigned get_loaded_textures_gpu_mem() { // Note: ignores texture compression
 	return mem;
 }
 
+void add_textures_mem_usage(mem_usage_t *usage) {usage[MEM_TEXTURES].add(get_loaded_textures_cpu_mem(), get_loaded_textures_gpu_mem(), textures.size());}
+
 
 int texture_lookup(string const &name) {
 	
@@ -526,6 +529,8 @@ GLenum texture_t::calc_format() const {
 
 void texture_t::do_gl_init(bool free_after_upload) {
 
+	if (headless_mode) return; // no GL context; keep the CPU data
+
 	if (SHOW_TEXTURE_MEMORY) {
 		static unsigned tmem(0);
 		unsigned tsize(num_bytes());
@@ -620,6 +625,7 @@ void texture_t::merge_in_alpha_channel(texture_t const &at) {
 void texture_t::build_mipmaps() {
 
 	if (use_mipmaps != 2) return; // not enabled
+	if (headless_mode) return; // gluScaleImage() reads pixel store state from the GL context; mipmaps are only used for upload
 	assert(width == height);
 	if (!mm_offsets.empty()) {assert(mm_data); return;} // already built
 	assert(mm_data == NULL);
@@ -1007,6 +1013,7 @@ void setup_texture(unsigned &tid, bool mipmap, bool wrap_s, bool wrap_t, bool mi
 
 	assert(tid == 0);
 	assert(!nearest || !mipmap);
+	if (headless_mode) return; // no GL context; tid stays 0 (unallocated)
 	glGenTextures(1, &tid);
 	check_gl_error(600);
 
@@ -1035,6 +1042,7 @@ void setup_1d_texture(unsigned &tid, bool mipmap, bool wrap, bool mirror, bool n
 
 	assert(tid == 0);
 	assert(!nearest || !mipmap);
+	if (headless_mode) return;
 	glGenTextures(1, &tid);
 	bind_1d_texture(tid);
 	glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, (nearest ? GL_NEAREST : (mipmap ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR))); // GL_LINEAR_MIPMAP_NEAREST?
@@ -1046,6 +1054,7 @@ void setup_1d_texture(unsigned &tid, bool mipmap, bool wrap, bool mirror, bool n
 void setup_cube_map_texture(unsigned &tid, unsigned tex_size, bool allocate, bool use_mipmaps, float aniso) { // Note: no mipmaps
 
 	assert(tid == 0);
+	if (headless_mode) return;
 	glGenTextures(1, &tid);
 	bind_cube_map_texture(tid);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, (use_mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR));
@@ -1598,6 +1607,7 @@ void texture_t::update_texture_data(int x1, int y1, int x2, int y2) {
 		x1   = max((x1 - xadd), 0);
 		assert(((x2 - x1) & am) == 0);
 	}
+	if (headless_mode) return; // no GL context; the CPU data was already modified by the caller
 	check_init();
 	bind_gl();
 	glPixelStorei(GL_UNPACK_ROW_LENGTH, width);
@@ -2364,6 +2364,10 @@ unsigned tree_cont_t::get_gpu_mem() const {
 	return mem;
 }
 
+void add_trees_mem_usage(mem_usage_t *usage) { // ground mode trees; tiled terrain trees are counted per tile
+	usage[MEM_TREES].add(t_trees.capacity()*sizeof(tree), (t_trees.get_gpu_mem() + tree_data_manager.get_gpu_mem()), t_trees.size());
+}
+
 float tree_cont_t::get_rmax() const {
 	float rmax(0.0);
 	for (const_iterator i = begin(); i != end(); ++i) {rmax = max(rmax, i->get_radius());}
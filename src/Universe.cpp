@@ -8,6 +8,7 @@
 #include "shaders.h"
 #include "gl_ext_arb.h"
 #include "asteroid.h"
+#include <future>
 
 
 // temperatures
@@ -39,6 +40,7 @@ unsigned const MAX_SYSTEMS_PER_GALAXY  = 500;
 unsigned const MAX_PLANETS_PER_SYSTEM  = 16;
 unsigned const MAX_MOONS_PER_PLANET    = 8;
 unsigned const GAS_GIANT_TSIZE         = 1024;
+unsigned const PLANET_PLACEHOLDER_TSIZE= 32; // shown while a higher resolution texture is generated in the background
 unsigned const GAS_GIANT_BANDS         = 63;
 
 int   const RAND_CONST       = 1;
@@ -55,6 +57,7 @@ unsigned const noise_tu_id = 11; // so as not to conflict with other ground mode
 
 
 bool have_sun(1);
+bool universe_prefetch(1);
 unsigned star_cache_ix(0);
 int uxyz[3] = {0, 0, 0};
 unsigned char water_c[3] = {0}, ice_c[3] = {0};
@@ -62,12 +65,12 @@ unsigned char const *const wic[2] = {water_c, ice_c};
 float univ_sun_rad(AVG_STAR_SIZE), univ_temp(0.0), cloud_time(0.0), universe_ambient_scale(1.0), planet_update_rate(1.0);
 point univ_sun_pos(all_zeros);
 colorRGBA sun_color(SUN_LT_C);
-s_object current;
+thread_local s_object current; // object being generated; per-thread so that cells can be generated in the background
 universe_t universe; // the top level universe
 vector<uobject const *> show_info_uobjs;
 
 
-extern bool enable_multisample, using_tess_shader, no_shift_universe;
+extern bool enable_multisample, using_tess_shader, no_shift_universe, async_planet_textures;
 extern int window_width, window_height, animate2, display_mode, onscreen_display, show_scores, iticks, frame_counter;
 extern unsigned enabled_lights;
 extern float fticks, system_max_orbit;
@@ -81,6 +84,7 @@ int gen_rand_seed2(point const &center);
 bool is_shadowed(point const &pos, float radius, bool expand, ussystem const &sol, uobject const *&sobj);
 unsigned get_texture_size(float psize);
 bool get_gravity(s_object &result, point pos, vector3d &gravity, int offset);
+void parse_str_tables();
 void set_sun_loc_color(point const &pos, colorRGBA const &color, float radius, bool shadowed, bool no_ambient, float a_scale, float d_scale, shader_t *shader=NULL);
 void set_light_galaxy_ambient_only(shader_t *shader=NULL);
 void set_universe_ambient_color(colorRGBA const &color, shader_t *shader=NULL);
@@ -1098,10 +1102,83 @@ void universe_t::init() {
 }
 
 
+class univ_cell_prefetcher_t { // generates the slab of cells exposed by an upcoming shift_cells() call on a background thread
+
+	int dim, dir, uxyz_after[3]; // shift direction and universe offset after the shift
+	point camera; // player position relative to the cell grid after the shift
+	vector<ucell> slab; // U_BLOCKS_SQ cells, indexed by get_slab_ix()
+	std::future<void> job;
+
+	bool matches(int dim_, int dir_, int const uxyz_[3]) const {
+		return (dim == dim_ && dir == dir_ && uxyz_after[0] == uxyz_[0] && uxyz_after[1] == uxyz_[1] && uxyz_after[2] == uxyz_[2]);
+	}
+	bool busy() const {return (job.valid() && job.wait_for(std::chrono::seconds(0)) != std::future_status::ready);}
+
+	void gen_slab() { // runs on the worker thread; only touches the cells in slab, which the main thread doesn't see until take()
+		point const upt(CELL_SIZE*uxyz_after[0], CELL_SIZE*uxyz_after[1], CELL_SIZE*uxyz_after[2]);
+		int ii[3];
+		ii[dim] = ((dir > 0) ? int(U_BLOCKS)-1 : 0);
+		slab.resize(U_BLOCKS_SQ);
+
+		for (ii[(dim+1)%3] = 0; ii[(dim+1)%3] < int(U_BLOCKS); ++ii[(dim+1)%3]) {
+			for (ii[(dim+2)%3] = 0; ii[(dim+2)%3] < int(U_BLOCKS); ++ii[(dim+2)%3]) {
+				ucell &cell(slab[get_slab_ix(ii, dim)]);
+				cell.gen_cell(ii, upt);
+
+				for (unsigned g = 0; g < cell.galaxies->size(); ++g) { // also create systems for galaxies that will be drawn soon after the shift
+					ugalaxy &galaxy((*cell.galaxies)[g]);
+					if (calc_sphere_size((cell.rel_center + galaxy.pos), camera, STAR_MAX_SIZE, -galaxy.radius) < 0.09) continue; // half the draw threshold
+					UNROLL_3X(current.cellxyz[i_] = ii[i_] + uxyz_after[i_];)
+					current.galaxy = g;
+					galaxy.process(cell);
+				}
+			}
+		}
+	}
+
+public:
+	univ_cell_prefetcher_t() : dim(-1), dir(0), camera(all_zeros) {UNROLL_3X(uxyz_after[i_] = 0;)}
+	static unsigned get_slab_ix(int const ii[3], int dim_) {return ii[(dim_+1)%3]*U_BLOCKS + ii[(dim_+2)%3];}
+
+	void request(int dim_, int dir_, point const &camera_) { // called on the main thread when a shift in this direction is imminent
+		int next_uxyz[3] = {uxyz[0], uxyz[1], uxyz[2]};
+		next_uxyz[dim_] += dir_;
+		if (matches(dim_, dir_, next_uxyz) || busy()) return; // already generated, or still working on a different slab
+		parse_str_tables(); // init shared tables here rather than on the worker thread
+		volume_part_cloud::ensure_unscaled_points(0);
+		dim    = dim_;
+		dir    = dir_;
+		camera = camera_;
+		camera[dim] -= dir*CELL_SIZE;
+		UNROLL_3X(uxyz_after[i_] = next_uxyz[i_];)
+		slab.clear();
+		job = std::async(std::launch::async, &univ_cell_prefetcher_t::gen_slab, this);
+	}
+	bool take(int dim_, int dir_, vector<ucell> &cells) { // called by shift_cells() after uxyz has been updated
+		if (!job.valid() || !matches(dim_, dir_, uxyz)) return 0;
+		job.get(); // wait for the worker thread to finish, if needed
+		cells.swap(slab);
+		slab.clear();
+		dim = -1;
+		return 1;
+	}
+};
+
+univ_cell_prefetcher_t cell_prefetcher;
+
+
+void universe_t::prefetch_shift(int dim, int dir, point const &camera) {
+	if (universe_prefetch) {cell_prefetcher.request(dim, dir, camera);}
+}
+
+
 void universe_t::shift_cells(int dx, int dy, int dz) {
 
 	assert((abs(dx) + abs(dy) + abs(dz)) == 1);
 	vector3d const vxyz((float)dx, (float)dy, (float)dz);
+	int const dim(dx ? 0 : (dy ? 1 : 2)), dir(dx + dy + dz);
+	vector<ucell> slab;
+	bool const prefetched(cell_prefetcher.take(dim, dir, slab));
 
 	for (unsigned i = 0; i < U_BLOCKS; ++i) { // z
 		for (unsigned j = 0; j < U_BLOCKS; ++j) { // y
@@ -1113,8 +1190,14 @@ void universe_t::shift_cells(int dx, int dy, int dz) {
 
 				if (xout || yout || zout) { // allocate new cell
 					int const ii[3]     = {(int)k, (int)j, (int)i};
-					temp.cells[i][j][k].gen = 0;
-					temp.cells[i][j][k].gen_cell(ii);
+
+					if (prefetched) { // generated in the background
+						temp.cells[i][j][k] = slab[univ_cell_prefetcher_t::get_slab_ix(ii, dim)];
+					}
+					else {
+						temp.cells[i][j][k].gen = 0;
+						temp.cells[i][j][k].gen_cell(ii);
+					}
 				}
 				else {
 					cells[i2][j2][k2].gen           = 1;
@@ -1153,11 +1236,14 @@ inline int gen_rand_seed2(point const &center) {
 }
 
 
-void ucell::gen_cell(int const ii[3]) {
+void ucell::gen_cell(int const ii[3]) {gen_cell(ii, get_scaled_upt());}
+
+
+void ucell::gen_cell(int const ii[3], point const &upt) { // upt is the universe offset, passed in so that this can be called from another thread
 
 	if (gen) return; // already generated
 	UNROLL_3X(rel_center[i_] = CELL_SIZE*(float(ii[i_] - (int)U_BLOCKSo2));)
-	pos    = rel_center + get_scaled_upt();
+	pos    = rel_center + upt;
 	radius = 0.5*CELL_SIZE;
 	set_rand2_state(gen_rand_seed1(pos), gen_rand_seed2(pos));
 	get_rseeds();
@@ -2067,28 +2153,27 @@ void urev_body::check_gen_texture(unsigned size) {
 		return;
 	}
 	unsigned const tsize0(get_texture_size(size));
+	bool const have_tex(glIsTexture(tid) != 0);
+	if (have_tex && tsize0 == tsize) return; // nothing to do
+	p_planet_tex_t tex(get_planet_texture(*this, tsize0, (async_planet_textures && tsize0 > PLANET_PLACEHOLDER_TSIZE)));
 
-	if (!glIsTexture(tid)) { // texture has not been generated
-		gen_surface();
-	}
-	else if (tsize0 != tsize) { // new texture size
-		::free_texture(tid); // delete old texture
+	if (tex == nullptr) { // being generated in the background
+		if (have_tex) return; // keep using the current texture until the new one is ready
+		tex = get_planet_texture(*this, PLANET_PLACEHOLDER_TSIZE, 0); // low resolution placeholder
 	}
-	else {
-		return; // nothing to do
-	}
-	create_rocky_texture(tsize0); // new texture
+	create_rocky_texture(*tex); // new texture
 }
 
 
-void urev_body::create_rocky_texture(unsigned size) {
+void urev_body::create_rocky_texture(planet_tex_t const &tex) {
 
-	tsize = size;
-	assert(tsize <= MAX_TEXTURE_SIZE);
-	vector<unsigned char> data(3*tsize*tsize);
-	gen_texture_data_and_heightmap(&data.front(), tsize);
+	assert(tex.surface != nullptr && tex.size <= MAX_TEXTURE_SIZE);
+	::free_texture(tid); // delete old texture, if any
+	if (surface != nullptr && surface != tex.surface) {surface->free_context();} // old heightmap may be cached for reuse, but its VBOs aren't needed
+	surface = tex.surface;
+	tsize   = tex.size;
 	setup_texture(tid, 0, 1, 0);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, tsize, tsize, 0, GL_RGB, GL_UNSIGNED_BYTE, &data.front());
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, tsize, tsize, 0, GL_RGB, GL_UNSIGNED_BYTE, &tex.data.front());
 }
 
 
@@ -2136,7 +2221,20 @@ void urev_body::upload_colors_to_shader(shader_t &s) const {
 }
 
 
-void urev_body::get_surface_color(unsigned char *data, float val, float phi) const { // val in [0,1]
+void urev_body::get_surface_color(unsigned char *data, float val, float phi) const {
+	rocky_surface_colors_t(*this).get_surface_color(data, val, phi);
+}
+
+
+rocky_surface_colors_t::rocky_surface_colors_t(urev_body const &body) : temp(body.temp), atmos(body.atmos), water(body.water),
+	lava(body.lava), wr_scale(1.0/max(0.01, (1.0 - body.water))), snow_thresh(body.snow_thresh)
+{
+	body.get_colors(a, b);
+	RGB_BLOCK_COPY(wcolor, wic[temp < FREEZE_TEMP]);
+}
+
+
+void rocky_surface_colors_t::get_surface_color(unsigned char *data, float val, float phi) const { // val in [0,1]
 
 	bool const frozen(temp < FREEZE_TEMP);
 	unsigned char const white[3] = {255, 255, 255};
@@ -2144,7 +2242,7 @@ void urev_body::get_surface_color(unsigned char *data, float val, float phi) con
 	float const coldness(frozen ? 0.0 : fabs(phi - PI_TWO)*2.0*PI_INV); // phi=PI/2 => equator, phi=0.0 => north pole, phi=PI => south pole
 
 	if (water >= 1.0 || val < water) { // underwater
-		RGB_BLOCK_COPY(data, wic[frozen]);
+		RGB_BLOCK_COPY(data, wcolor);
 
 		if (coldness > 0.8) { // ice
 			float const blend_val(CLIP_TO_01(5.0f*(coldness - 0.8f) + 1.0f*(val - water)));
@@ -2172,7 +2270,7 @@ void urev_body::get_surface_color(unsigned char *data, float val, float phi) con
 	}
 	else if (temp < BOIL_TEMP) { // handle water/ice/snow
 		if (val < water + water_adj) { // close to water line (can have a little water even if water == 0)
-			BLEND_COLOR(data, data, wic[frozen], (val - water)/water_adj);
+			BLEND_COLOR(data, data, wcolor, (val - water)/water_adj);
 			
 			if (coldness > 0.8) { // ice
 				float const blend_val(CLIP_TO_01(5.0f*(coldness - 0.8f) + 1.0f*(val - water)));
@@ -2762,7 +2860,7 @@ string ustar::get_info() const {
 
 // if not find_largest then find closest
 int universe_t::get_closest_object(s_object &result, point pos, int max_level, bool include_asteroids,
-	bool offset, float expand, bool get_destroyed, float g_expand, float r_add, int galaxy_hint) const
+	bool offset, float expand, bool get_destroyed, float g_expand, float r_add, int galaxy_hint, univ_search_hint_t *hint) const
 {
 	float min_gdist(CELL_SIZE);
 	if (offset) offset_pos(pos);
@@ -2784,7 +2882,9 @@ int universe_t::get_closest_object(s_object &result, point pos, int max_level, b
 	pos -= cell.pos;
 	float const planet_thresh(expand*4.0*MAX_PLANET_EXTENT + r_add), moon_thresh(expand*2.0*MAX_PLANET_EXTENT + r_add);
 	float const pt_sq(planet_thresh*planet_thresh), mt_sq(moon_thresh*moon_thresh);
-	static int last_galaxy(-1), last_cluster(-1), last_system(-1);
+	static univ_search_hint_t shared_hint; // used when the caller doesn't provide a hint; not thread safe
+	univ_search_hint_t &last(hint ? *hint : shared_hint);
+	int &last_galaxy(last.galaxy), &last_cluster(last.cluster), &last_system(last.system);
 	int const first_galaxy_to_try((galaxy_hint >= 0) ? galaxy_hint : last_galaxy);
 	unsigned const ng((unsigned)cell.galaxies->size());
 	unsigned const go((first_galaxy_to_try >= 0 && first_galaxy_to_try < int(ng)) ? last_galaxy : 0);
@@ -2797,7 +2897,8 @@ int universe_t::get_closest_object(s_object &result, point pos, int max_level, b
 		if (!galaxy.gen) continue; // not yet generated
 		float const distg(p2p_dist(pos, galaxy.pos));
 		if (distg > g_expand*(galaxy.radius + MAX_SYSTEM_EXTENT) + r_add) continue;
-		float const galaxy_radius(galaxy.get_radius_at((pos - galaxy.pos)/max(distg, TOLERANCE)));
+		// the per-galaxy last query cache is shared, so callers with their own hint (possibly on other threads) compute the exact radius
+		float const galaxy_radius(galaxy.get_radius_at((pos - galaxy.pos)/max(distg, TOLERANCE), (hint != nullptr)));
 		if (distg > g_expand*(galaxy_radius + MAX_SYSTEM_EXTENT) + r_add) continue;
 
 		if (max_level == UTYPE_GALAXY) { // galaxy
@@ -3220,15 +3321,68 @@ float get_temp_in_system(s_object const &clobj, point const &pos, point &sun_pos
 }
 
 
-float universe_t::get_point_temperature(s_object const &clobj, point const &pos, point &sun_pos) const {
+float universe_t::get_point_temperature(s_object const &clobj, point const &pos, point &sun_pos, univ_search_hint_t *hint) const {
 
 	if (clobj.system >= 0) {return get_temp_in_system(clobj, pos, sun_pos);} // existing system is valid
 	s_object result; // invalid system - expand the search radius and try again
-	if (!get_closest_object(result, pos, UTYPE_SYSTEM, 0, 1, 4.0, 0, 1.0, 0.0, clobj.galaxy) || result.system < 0) return 0.0;
+	if (!get_closest_object(result, pos, UTYPE_SYSTEM, 0, 1, 4.0, 0, 1.0, 0.0, clobj.galaxy, hint) || result.system < 0) return 0.0;
 	return get_temp_in_system(result, pos, sun_pos);
 }
 
 
+struct univ_query_order_t { // sort key that groups queries by cell, then by position within the cell
+
+	int key[4];
+	unsigned ix;
+
+	univ_query_order_t(int const cellxyz[3], point const &pos, unsigned ix_) : ix(ix_) {
+		key[0] = (cellxyz[2]*int(U_BLOCKS) + cellxyz[1])*int(U_BLOCKS) + cellxyz[0];
+		UNROLL_3X(key[i_+1] = int(floor(pos[i_]/MAX_SYSTEM_EXTENT));) // nearby queries are likely in the same system
+	}
+	bool operator<(univ_query_order_t const &o) const {
+		for (unsigned i = 0; i < 4; ++i) {
+			if (key[i] != o.key[i]) {return (key[i] < o.key[i]);}
+		}
+		return (ix < o.ix);
+	}
+};
+
+
+// resolves the closest object, temperature, and gravity for each query in parallel; queries are processed in cell/position order
+// so that each thread's search hint usually points to the right galaxy/cluster/system; the universe isn't modified, including
+// the galaxy radius cache, so the results don't depend on query order or thread count
+void universe_t::query_objects(vector<univ_obj_query_t> &queries) const {
+
+	vector<univ_query_order_t> order;
+	order.reserve(queries.size());
+	point const cell_origin(cells[0][0][0].pos);
+
+	for (unsigned i = 0; i < queries.size(); ++i) {
+		point pos(queries[i].pos);
+		offset_pos(pos);
+		int cellxyz[3];
+		UNROLL_3X(cellxyz[i_] = int(floor((pos[i_] + CELL_SIZEo2 - cell_origin[i_])/CELL_SIZE));)
+		order.push_back(univ_query_order_t(cellxyz, pos, i));
+	}
+	sort(order.begin(), order.end());
+	int const num((int)order.size());
+
+#pragma omp parallel if (num > 64)
+	{
+		univ_search_hint_t hint; // per-thread
+
+#pragma omp for schedule(dynamic,16)
+		for (int i = 0; i < num; ++i) {
+			univ_obj_query_t &q(queries[order[i].ix]);
+			if (q.find_closest) {q.found_close = get_object_closest_to_pos(q.clobj, q.pos, q.include_asteroids, 1.0, q.r_add, &hint);}
+			bool const close_body(q.found_close && q.clobj.type != UTYPE_ASTEROID); // star, planet, or moon
+			if (q.calc_temp || close_body) {q.temperature = get_point_temperature(q.clobj, q.pos, q.sun_pos, &hint);}
+			if (q.calc_gravity && close_body) {get_gravity(q.clobj, q.pos, q.gravity, 1);}
+		}
+	}
+}
+
+
 bool get_gravity(s_object &result, point pos, vector3d &gravity, int offset) {
 
 	gravity.assign(0.0, 0.0, 0.0);
@@ -48,6 +48,7 @@ extern universe_t universe;
 
 
 void process_univ_objects();
+void process_ships(int timer1);
 void check_shift_universe();
 void draw_universe_sun_flare();
 void sort_uobjects();
@@ -107,6 +108,21 @@ void do_univ_init() {
 }
 
 
+void gen_universe_headless() { // generate the galaxies and systems near the player without drawing them
+
+	do_univ_init();
+	set_univ_pdu();
+	universe.get_object_closest_to_pos(clobj0, get_player_pos2(), 0, 4.0);
+	universe.draw_all_cells(clobj0, 1, 1, 0, 1, 1); // gen_only=1
+}
+
+void advance_universe_headless() { // one frame of ship/object simulation without drawing
+	process_ships(GET_TIME_MS());
+	gen_universe_headless(); // generate any cells/systems the player has moved into
+	check_shift_universe();
+}
+
+
 bool player_near_system() {return (clobj0.system >= 0);}
 
 bool player_inside_system() {
@@ -334,27 +350,47 @@ void proc_collision(free_obj *const uobj, upos_point_type const &cpos, point con
 }
 
 
+bool calc_uobj_gravity(free_obj const *const uobj) {
+	return (((uobj->get_time() + unsigned(size_t(uobj)>>8)) & (GRAV_CHECK_MOD-1)) == 0);
+}
+
+
 void process_univ_objects() {
 
 	vector<free_obj const*> stat_obj_query_res;
+	static vector<univ_obj_query_t> queries;
+	static vector<unsigned> query_objs;
+	queries.clear();
+	query_objs.clear();
 
+	// gather the closest object/temperature/gravity queries; these only read the universe, so they can be run in parallel
 	for (unsigned i = 0; i < uobjs.size(); ++i) { // can we use cached_objs?
-		free_obj *const uobj(uobjs[i]);
+		free_obj const *const uobj(uobjs[i]);
 		bool const no_coll(uobj->no_coll()), particle(uobj->is_particle()), projectile(uobj->is_proj());
 		if (no_coll && particle)   continue; // no collisions, gravity, or temperature on this object
 		if (uobj->is_stationary()) continue;
+		float const radius(uobj->get_c_radius()*(no_coll ? 0.5 : 1.0));
+		// skip orbiting objects (no collisions or gravity effects, temperature is mostly constant)
+		// disable particle-asteroid collisions because they're too slow
+		queries.push_back(univ_obj_query_t(uobj->get_pos(), (no_coll ? 0.0 : radius), !uobj->is_orbiting(), !particle, (!particle && !projectile), calc_uobj_gravity(uobj)));
+		query_objs.push_back(i);
+	}
+	universe.query_objects(queries);
+
+	// apply the query results; this modifies objects and is done serially
+	for (unsigned qix = 0; qix < queries.size(); ++qix) {
+		univ_obj_query_t &query(queries[qix]);
+		free_obj *const uobj(uobjs[query_objs[qix]]);
+		bool const no_coll(uobj->no_coll()), projectile(uobj->is_proj());
 		bool const is_ship(uobj->is_ship()), orbiting(uobj->is_orbiting());
-		bool const calc_gravity(((uobj->get_time() + unsigned(size_t(uobj)>>8)) & (GRAV_CHECK_MOD-1)) == 0);
+		bool const calc_gravity(query.calc_gravity);
 		bool const lod_coll(PLAYER_SLOW_PLANET_APPROACH && is_ship && uobj->is_player_ship()); // enable if we want to do close planet flyby
 		float const radius(uobj->get_c_radius()*(no_coll ? 0.5 : 1.0));
 		upos_point_type const &obj_pos(uobj->get_pos());
-		vector3d gravity(zero_vector); // sum of gravity from sun, planets, possibly some moons, and possibly asteroids
-		point sun_pos(all_zeros);
-
-		// skip orbiting objects (no collisions or gravity effects, temperature is mostly constant)
-		s_object clobj; // closest object
-		bool const include_asteroids(!particle); // disable particle-asteroid collisions because they're too slow
-		int const found_close(orbiting ? 0 : universe.get_object_closest_to_pos(clobj, obj_pos, include_asteroids, 1.0, (no_coll ? 0.0 : radius)));
+		vector3d gravity(query.gravity); // sum of gravity from sun, planets, possibly some moons, and possibly asteroids
+		point const &sun_pos(query.sun_pos);
+		s_object &clobj(query.clobj); // closest object
+		int const found_close(query.found_close);
 		bool temp_known(0), has_rings(0);
 		float limit_speed_dist(clobj.dist);
 
@@ -388,7 +424,7 @@ void process_univ_objects() {
 				assert(clobj.object != NULL);
 				float const clobj_radius(clobj.object->get_radius());
 				point const clobj_pos(clobj.object->get_pos());
-				float const temperature(universe.get_point_temperature(clobj, obj_pos, sun_pos)*(FOBJ_TEMP_SCALE - uobj->get_shadow_val())); // shadow_val = 0-3
+				float const temperature(query.temperature*(FOBJ_TEMP_SCALE - uobj->get_shadow_val())); // shadow_val = 0-3
 				uobj->set_temp(temperature, sun_pos);
 				temp_known = 1;
 				float hmap_scale(0.0);
@@ -426,7 +462,8 @@ void process_univ_objects() {
 					} // collision
 					if (is_ship) {uobj->near_sobj(clobj, coll);}
 				} // planet or moon
-				if (calc_gravity) {get_gravity(clobj, obj_pos, gravity, 1);}
+				// the query pass used the pre-collision position; recompute at the current position if the object was moved
+				if (calc_gravity && point(obj_pos) != query.pos) {get_gravity(clobj, obj_pos, gravity, 1);}
 
 				if (clobj.type == UTYPE_PLANET) {
 					// when near a planet with rings, use the dist to the outer rings to limit speed so that we don't fly through the rings too quickly
@@ -436,11 +473,7 @@ void process_univ_objects() {
 				}
 			}
 		} // found_close
-		if (!temp_known) {
-			float temperature(0.0);
-			if (!particle && !projectile) {temperature = universe.get_point_temperature(clobj, obj_pos, sun_pos)*FOBJ_TEMP_SCALE;}
-			uobj->set_temp(temperature, sun_pos);
-		}
+		if (!temp_known) {uobj->set_temp(query.temperature*FOBJ_TEMP_SCALE, sun_pos);} // temperature is zero for particles and projectiles
 		if (calc_gravity) {
 			bool near_b_hole(0);
 			vector3d swp_accel(zero_vector);
@@ -541,6 +574,17 @@ void check_shift_universe() {
 	}
 	if (moved) {shift_univ_objs(move, 1);} // advance all free objects by a cell
 	had_init_shift = 1;
+	if (no_shift_universe) return;
+	vector3d const &velocity(get_player_velocity());
+	unsigned dim(0);
+	float min_edge_dist(CELL_SIZEo2);
+
+	for (unsigned d = 0; d < 3; ++d) { // find the cell boundary the player is approaching most closely
+		float const edge_dist(CELL_SIZEo2 - fabs(camera[d]));
+		if (edge_dist < min_edge_dist && velocity[d]*camera[d] > 0.0) {min_edge_dist = edge_dist; dim = d;}
+	}
+	// start generating the next cells in the background so that shift_cells() doesn't need to
+	if (min_edge_dist < 0.25*CELL_SIZE) {universe.prefetch_shift(dim, ((camera[dim] < 0.0) ? -1 : 1), camera);}
 }
 
 
@@ -75,7 +75,7 @@ string gen_random_name(rand_gen_t &rgen) {
 	return name;
 }
 
-extern rand_gen_t global_rand_gen;
+extern thread_local rand_gen_t global_rand_gen;
 
 void named_obj::gen_name(s_object const &sobj) {
 
@@ -8,6 +8,10 @@
 #include "openal_wrap.h"
 #include "shaders.h"
 #include "gl_ext_arb.h"
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ENABLE_SSE_RIPPLES
+#endif
 
 
 float    const RIPPLE_DAMP1        = 0.95;
@@ -46,6 +50,7 @@ bool     const DEBUG_WATER_TIME    = 0; // DEBUGGING
 bool     const DEBUG_RIPPLE_TIME   = 0;
 bool     const NO_ICE_RIPPLES      = 0;
 bool     const USE_SEA_FOAM        = 1;
+bool     const USE_RIPPLE_SOLVER   = 1; // SoA gather form, SIMD + OpenMP; 0 = original in-place scalar scatter (bit identical results)
 int      const UPDATE_UW_LANDSCAPE = 2;
 
 float const w_spec[2][2] = {{0.9, 80.0}, {0.5, 60.0}};
@@ -695,97 +700,308 @@ inline void update_water_edges(int i, int j) {
 }
 
 
-void compute_ripples() {
+// original in-place scatter form: each cell adds its deltas to the acc of its in-water neighbors, visiting cells in row-major order
+bool compute_ripple_acc_scatter(float rm_atten) {
 
-	if (DISABLE_WATER) return;
-	static unsigned dtime1(0), dtime2(0), counter(0);
-	bool const update_iter((counter%UPDATE_STEP) == 0);
-	RESET_TIME;
+	bool moving(0);
 
-	if (temperature > W_FREEZE_POINT && (start_ripple || first_water_run)) {
-		float const tstep(max(fticks, 0.25f)); // ensure some min amount of damping to prevent unstable ripples when the framerate is very high
-		float const rm_atten(pow(RIPPLE_MAT_ATTEN, tstep)), rdamp1(pow(RIPPLE_DAMP1, tstep)), rdamp2(RIPPLE_DAMP2*tstep);
-		start_ripple = 0;
+	for (int i = 0; i < MESH_Y_SIZE; ++i) {
+		for (int j = 0; j < MESH_X_SIZE; ++j) {
+			if (!wminside[i][j] || water_matrix[i][j] < z_min_matrix[i][j] /*|| !get_water_enabled(j, i)*/) continue;
+			short const i8(watershed_matrix[i][j].inside8);
+			fix_fp_mag(ripples[i][j].rval);
+			float const rmij(ripples[i][j].rval);
+			float &acc(ripples[i][j].acc);
+			fix_fp_mag(acc);
+			acc *= rm_atten;
+			if (!moving && fabs(acc) > 1.0E-6) moving = 1;
 
-		for (int i = 0; i < MESH_Y_SIZE; ++i) {
-			for (int j = 0; j < MESH_X_SIZE; ++j) {
-				if (!wminside[i][j] || water_matrix[i][j] < z_min_matrix[i][j] /*|| !get_water_enabled(j, i)*/) continue;
-				short const i8(watershed_matrix[i][j].inside8);
-				fix_fp_mag(ripples[i][j].rval);
-				float const rmij(ripples[i][j].rval);
-				float &acc(ripples[i][j].acc);
+			// 00 0- -0 0+ +0 -- +- ++ -+  22  11
+			// 01 02 04 08 10 20 40 80 100 200 400
+			if (point_interior_to_mesh(j, i)) { // fast mode
+				float const d0( rmij - ripples[i  ][j-1].rval);
+				if (i8 & 0x02)  ripples[i  ][j-1].acc += d0;
+				float const d2( rmij - ripples[i  ][j+1].rval);
+				if (i8 & 0x08)  ripples[i  ][j+1].acc += d2;
+				float const d4((rmij - ripples[i-1][j-1].rval)*SQRTOFTWOINV);
+				if (i8 & 0x20)  ripples[i-1][j-1].acc += d4;
+				float const d1( rmij - ripples[i-1][j  ].rval);
+				if (i8 & 0x04)  ripples[i-1][j  ].acc += d1;
+				float const d7((rmij - ripples[i-1][j+1].rval)*SQRTOFTWOINV);
+				if (i8 & 0x100) ripples[i-1][j+1].acc += d7;
+				float const d5((rmij - ripples[i+1][j-1].rval)*SQRTOFTWOINV);
+				if (i8 & 0x40)  ripples[i+1][j-1].acc += d5;
+				float const d3( rmij - ripples[i+1][j  ].rval);
+				if (i8 & 0x10)  ripples[i+1][j  ].acc += d3;
+				float const d6((rmij - ripples[i+1][j+1].rval)*SQRTOFTWOINV);
+				if (i8 & 0x80)  ripples[i+1][j+1].acc += d6;
+				acc -= d0 + d1 + d2 + d3 + d4 + d5 + d6 + d7;
 				fix_fp_mag(acc);
-				acc *= rm_atten;
-				if (!start_ripple && fabs(acc) > 1.0E-6) start_ripple = 1;
-
-				// 00 0- -0 0+ +0 -- +- ++ -+  22  11
-				// 01 02 04 08 10 20 40 80 100 200 400
-				if (point_interior_to_mesh(j, i)) { // fast mode
-					float const d0( rmij - ripples[i  ][j-1].rval);
-					if (i8 & 0x02)  ripples[i  ][j-1].acc += d0;
-					float const d2( rmij - ripples[i  ][j+1].rval);
-					if (i8 & 0x08)  ripples[i  ][j+1].acc += d2;
-					float const d4((rmij - ripples[i-1][j-1].rval)*SQRTOFTWOINV);
-					if (i8 & 0x20)  ripples[i-1][j-1].acc += d4;
-					float const d1( rmij - ripples[i-1][j  ].rval);
-					if (i8 & 0x04)  ripples[i-1][j  ].acc += d1;
-					float const d7((rmij - ripples[i-1][j+1].rval)*SQRTOFTWOINV);
-					if (i8 & 0x100) ripples[i-1][j+1].acc += d7;
-					float const d5((rmij - ripples[i+1][j-1].rval)*SQRTOFTWOINV);
-					if (i8 & 0x40)  ripples[i+1][j-1].acc += d5;
-					float const d3( rmij - ripples[i+1][j  ].rval);
-					if (i8 & 0x10)  ripples[i+1][j  ].acc += d3;
-					float const d6((rmij - ripples[i+1][j+1].rval)*SQRTOFTWOINV);
-					if (i8 & 0x80)  ripples[i+1][j+1].acc += d6;
-					acc -= d0 + d1 + d2 + d3 + d4 + d5 + d6 + d7;
-					fix_fp_mag(acc);
-					continue;
-				}
-				if (j > 0) {
-					float const dz(rmij - ripples[i][j-1].rval);
-					if (i8 & 0x02) ripples[i][j-1].acc += dz;
-					acc -= dz;
+				continue;
+			}
+			if (j > 0) {
+				float const dz(rmij - ripples[i][j-1].rval);
+				if (i8 & 0x02) ripples[i][j-1].acc += dz;
+				acc -= dz;
 
-					if (i > 0) {
-						float const dz((rmij - ripples[i-1][j-1].rval)*SQRTOFTWOINV);
-						if (i8 & 0x20) ripples[i-1][j-1].acc += dz;
-						acc -= dz;
-					}
-					if (i < MESH_Y_SIZE-1) {
-						float const dz((rmij - ripples[i+1][j-1].rval)*SQRTOFTWOINV);
-						if (i8 & 0x40) ripples[i+1][j-1].acc += dz;
-						acc -= dz;
-					}
-				}
 				if (i > 0) {
-					float const dz(rmij - ripples[i-1][j].rval);
-					if (i8 & 0x04) ripples[i-1][j].acc += dz;
+					float const dz((rmij - ripples[i-1][j-1].rval)*SQRTOFTWOINV);
+					if (i8 & 0x20) ripples[i-1][j-1].acc += dz;
 					acc -= dz;
 				}
-				if (j < MESH_X_SIZE-1) {
-					float const dz(rmij - ripples[i][j+1].rval);
-					if (i8 & 0x08) ripples[i][j+1].acc += dz;
+				if (i < MESH_Y_SIZE-1) {
+					float const dz((rmij - ripples[i+1][j-1].rval)*SQRTOFTWOINV);
+					if (i8 & 0x40) ripples[i+1][j-1].acc += dz;
 					acc -= dz;
-
-					if (i < MESH_Y_SIZE-1) {
-						float const dz((rmij - ripples[i+1][j+1].rval)*SQRTOFTWOINV);
-						if (i8 & 0x80) ripples[i+1][j+1].acc += dz;
-						acc -= dz;
-					}
-					if (i > 0) {
-						float const dz((rmij - ripples[i-1][j+1].rval)*SQRTOFTWOINV);
-						if (i8 & 0x100) ripples[i-1][j+1].acc += dz;
-						acc -= dz;
-					}
 				}
+			}
+			if (i > 0) {
+				float const dz(rmij - ripples[i-1][j].rval);
+				if (i8 & 0x04) ripples[i-1][j].acc += dz;
+				acc -= dz;
+			}
+			if (j < MESH_X_SIZE-1) {
+				float const dz(rmij - ripples[i][j+1].rval);
+				if (i8 & 0x08) ripples[i][j+1].acc += dz;
+				acc -= dz;
+
 				if (i < MESH_Y_SIZE-1) {
-					float const dz(rmij - ripples[i+1][j].rval);
-					if (i8 & 0x10) ripples[i+1][j].acc += dz;
+					float const dz((rmij - ripples[i+1][j+1].rval)*SQRTOFTWOINV);
+					if (i8 & 0x80) ripples[i+1][j+1].acc += dz;
 					acc -= dz;
 				}
-				fix_fp_mag(acc);
-			} // for j
-		} // for i
+				if (i > 0) {
+					float const dz((rmij - ripples[i-1][j+1].rval)*SQRTOFTWOINV);
+					if (i8 & 0x100) ripples[i-1][j+1].acc += dz;
+					acc -= dz;
+				}
+			}
+			if (i < MESH_Y_SIZE-1) {
+				float const dz(rmij - ripples[i+1][j].rval);
+				if (i8 & 0x10) ripples[i+1][j].acc += dz;
+				acc -= dz;
+			}
+			fix_fp_mag(acc);
+		} // for j
+	} // for i
+	return moving;
+}
+
+
+// SoA gather form of compute_ripple_acc_scatter(); each cell reads only the previous state, so rows can be processed in parallel and
+// interior cells four at a time with SSE2 when available. To get bit identical results it reproduces the scatter's row-major visit order: contributions
+// from neighbors visited before a cell are summed into its acc before attenuation and see its rval before fix_fp_mag(), while
+// contributions from neighbors visited after it are added last and see the fixed rval.
+class ripple_solver_t {
+
+	int nx, ny;
+	vector<float> rfix, rorig, acc_in, acc_out; // double buffered acc
+	vector<int> mask; // inside8 bits | RS_ACTIVE for cells that update, 0 otherwise
+
+#ifdef ENABLE_SSE_RIPPLES
+	static __m128 select4(__m128 const &m, __m128 const &a, __m128 const &b) {return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b));}
+	static __m128 abs4(__m128 const &v) {return _mm_and_ps(v, _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF)));}
+	static __m128 fix_fp_mag4(__m128 const &v) {return _mm_andnot_ps(_mm_cmplt_ps(abs4(v), _mm_set1_ps(TOLERANCE)), v);}
+	__m128 has_bit4(int k, int bit) const {
+		__m128i const b(_mm_set1_epi32(bit));
+		return _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(_mm_loadu_si128((__m128i const *)&mask[k]), b), b));
+	}
+	__m128 load4(vector<float> const &v, int k) const {return _mm_loadu_ps(&v[k]);}
+	bool calc_interior_acc4(int k, float rm_atten) const;
+#endif // ENABLE_SSE_RIPPLES
+
+	float calc_cell_acc(int i, int j, float rm_atten, bool &moving) const;
+	bool solve_row(int i, float rm_atten);
+
+public:
+	static int const RS_ACTIVE = 0x800;
+
+	ripple_solver_t() : nx(0), ny(0) {}
+
+	void init(int nx_, int ny_) {
+		if (nx_ == nx && ny_ == ny) return;
+		nx = nx_; ny = ny_;
+		size_t const sz(nx*ny);
+		rfix.resize(sz); rorig.resize(sz); acc_in.resize(sz); acc_out.resize(sz); mask.resize(sz);
+	}
+	void set_cell(int i, int j, float rval, float acc, bool active, short inside8) {
+		int const k(i*nx + j);
+		rorig [k] = rval;
+		if (active) {fix_fp_mag(rval);}
+		rfix  [k] = rval;
+		acc_in[k] = acc;
+		mask  [k] = (active ? (inside8 | RS_ACTIVE) : 0);
+	}
+	void get_cell(int i, int j, float &rval, float &acc) const {
+		int const k(i*nx + j);
+		rval = rfix[k];
+		acc  = acc_out[k];
+	}
+	bool solve(float rm_atten);
+};
+
+ripple_solver_t ripple_solver;
+
+
+float ripple_solver_t::calc_cell_acc(int i, int j, float rm_atten, bool &moving) const {
+
+	int const k(i*nx + j);
+	float const rco(rorig[k]), rcf(rfix[k]);
+	float acc(acc_in[k]);
+	// 00 0- -0 0+ +0 -- +- ++ -+  22  11
+	// 01 02 04 08 10 20 40 80 100 200 400
+
+	// neighbors visited before this cell; they see its rval before fix_fp_mag()
+	if (i > 0) {
+		if (j > 0    && (mask[k-nx-1] & 0x80)) {acc += (rfix[k-nx-1] - rco)*SQRTOFTWOINV;}
+		if (            (mask[k-nx  ] & 0x10)) {acc +=  rfix[k-nx  ] - rco;}
+		if (j < nx-1 && (mask[k-nx+1] & 0x40)) {acc += (rfix[k-nx+1] - rco)*SQRTOFTWOINV;}
+	}
+	if (j > 0 && (mask[k-1] & 0x08)) {acc += rfix[k-1] - rco;}
+
+	if (mask[k] & RS_ACTIVE) { // this cell; it sees the fixed rval of neighbors visited before it
+		fix_fp_mag(acc);
+		acc *= rm_atten;
+		if (fabs(acc) > 1.0E-6) {moving = 1;}
+
+		if (i > 0 && j > 0 && i < ny-1 && j < nx-1) { // interior
+			float const d0( rcf - rfix [k-1]);
+			float const d2( rcf - rorig[k+1]);
+			float const d4((rcf - rfix [k-nx-1])*SQRTOFTWOINV);
+			float const d1( rcf - rfix [k-nx]);
+			float const d7((rcf - rfix [k-nx+1])*SQRTOFTWOINV);
+			float const d5((rcf - rorig[k+nx-1])*SQRTOFTWOINV);
+			float const d3( rcf - rorig[k+nx]);
+			float const d6((rcf - rorig[k+nx+1])*SQRTOFTWOINV);
+			acc -= d0 + d1 + d2 + d3 + d4 + d5 + d6 + d7;
+		}
+		else {
+			if (j > 0) {
+				acc -= rcf - rfix[k-1];
+				if (i > 0   ) {acc -= (rcf - rfix [k-nx-1])*SQRTOFTWOINV;}
+				if (i < ny-1) {acc -= (rcf - rorig[k+nx-1])*SQRTOFTWOINV;}
+			}
+			if (i > 0) {acc -= rcf - rfix[k-nx];}
+
+			if (j < nx-1) {
+				acc -= rcf - rorig[k+1];
+				if (i < ny-1) {acc -= (rcf - rorig[k+nx+1])*SQRTOFTWOINV;}
+				if (i > 0   ) {acc -= (rcf - rfix [k-nx+1])*SQRTOFTWOINV;}
+			}
+			if (i < ny-1) {acc -= rcf - rorig[k+nx];}
+		}
+		fix_fp_mag(acc);
+	}
+	// neighbors visited after this cell; they see its fixed rval
+	if (j < nx-1 && (mask[k+1] & 0x02)) {acc += rfix[k+1] - rcf;}
+
+	if (i < ny-1) {
+		if (j > 0    && (mask[k+nx-1] & 0x100)) {acc += (rfix[k+nx-1] - rcf)*SQRTOFTWOINV;}
+		if (            (mask[k+nx  ] & 0x04 )) {acc +=  rfix[k+nx  ] - rcf;}
+		if (j < nx-1 && (mask[k+nx+1] & 0x20 )) {acc += (rfix[k+nx+1] - rcf)*SQRTOFTWOINV;}
+	}
+	return acc;
+}
+
+
+#ifdef ENABLE_SSE_RIPPLES
+// same as calc_cell_acc() for four interior cells starting at index k, using masked selects in place of the branches
+bool ripple_solver_t::calc_interior_acc4(int k, float rm_atten) const {
+
+	__m128 const w(_mm_set1_ps(SQRTOFTWOINV)), rco(load4(rorig, k)), rcf(load4(rfix, k));
+	__m128 acc(load4(acc_in, k));
+	acc = select4(has_bit4(k-nx-1, 0x80), _mm_add_ps(acc, _mm_mul_ps(_mm_sub_ps(load4(rfix, k-nx-1), rco), w)), acc);
+	acc = select4(has_bit4(k-nx,   0x10), _mm_add_ps(acc,            _mm_sub_ps(load4(rfix, k-nx  ), rco)),     acc);
+	acc = select4(has_bit4(k-nx+1, 0x40), _mm_add_ps(acc, _mm_mul_ps(_mm_sub_ps(load4(rfix, k-nx+1), rco), w)), acc);
+	acc = select4(has_bit4(k-1,    0x08), _mm_add_ps(acc,            _mm_sub_ps(load4(rfix, k-1   ), rco)),     acc);
+	// active cells
+	__m128 const active(has_bit4(k, RS_ACTIVE));
+	__m128 a(_mm_mul_ps(fix_fp_mag4(acc), _mm_set1_ps(rm_atten)));
+	// Note: 1.0E-6f rounds down, so for floats (x > 1.0E-6f) == (x > 1.0E-6)
+	__m128 const moving(_mm_and_ps(active, _mm_cmpgt_ps(abs4(a), _mm_set1_ps(1.0E-6f))));
+	__m128 const d0(           _mm_sub_ps(rcf, load4(rfix,  k-1   )));
+	__m128 const d2(           _mm_sub_ps(rcf, load4(rorig, k+1   )));
+	__m128 const d4(_mm_mul_ps(_mm_sub_ps(rcf, load4(rfix,  k-nx-1)), w));
+	__m128 const d1(           _mm_sub_ps(rcf, load4(rfix,  k-nx  )));
+	__m128 const d7(_mm_mul_ps(_mm_sub_ps(rcf, load4(rfix,  k-nx+1)), w));
+	__m128 const d5(_mm_mul_ps(_mm_sub_ps(rcf, load4(rorig, k+nx-1)), w));
+	__m128 const d3(           _mm_sub_ps(rcf, load4(rorig, k+nx  )));
+	__m128 const d6(_mm_mul_ps(_mm_sub_ps(rcf, load4(rorig, k+nx+1)), w));
+	__m128 dsum(_mm_add_ps(d0, d1));
+	dsum = _mm_add_ps(dsum, d2);
+	dsum = _mm_add_ps(dsum, d3);
+	dsum = _mm_add_ps(dsum, d4);
+	dsum = _mm_add_ps(dsum, d5);
+	dsum = _mm_add_ps(dsum, d6);
+	dsum = _mm_add_ps(dsum, d7);
+	acc = select4(active, fix_fp_mag4(_mm_sub_ps(a, dsum)), acc);
+	// later neighbors
+	acc = select4(has_bit4(k+1,    0x02 ), _mm_add_ps(acc,            _mm_sub_ps(load4(rfix, k+1   ), rcf)),     acc);
+	acc = select4(has_bit4(k+nx-1, 0x100), _mm_add_ps(acc, _mm_mul_ps(_mm_sub_ps(load4(rfix, k+nx-1), rcf), w)), acc);
+	acc = select4(has_bit4(k+nx,   0x04 ), _mm_add_ps(acc,            _mm_sub_ps(load4(rfix, k+nx  ), rcf)),     acc);
+	acc = select4(has_bit4(k+nx+1, 0x20 ), _mm_add_ps(acc, _mm_mul_ps(_mm_sub_ps(load4(rfix, k+nx+1), rcf), w)), acc);
+	_mm_storeu_ps((float *)&acc_out[k], acc);
+	return (_mm_movemask_ps(moving) != 0);
+}
+#endif // ENABLE_SSE_RIPPLES
+
+
+bool ripple_solver_t::solve_row(int i, float rm_atten) {
+
+	bool moving(0);
+	int j(0);
+#ifdef ENABLE_SSE_RIPPLES
+	if (i > 0 && i < ny-1 && nx >= 6) { // interior row
+		acc_out[i*nx] = calc_cell_acc(i, 0, rm_atten, moving);
+		for (j = 1; j+4 < nx; j += 4) {moving |= calc_interior_acc4(i*nx + j, rm_atten);}
+	}
+#endif
+	for (; j < nx; ++j) {acc_out[i*nx + j] = calc_cell_acc(i, j, rm_atten, moving);} // border rows, remainder, and last column
+	return moving;
+}
+
+
+bool ripple_solver_t::solve(float rm_atten) {
+
+	int moving(0);
+#pragma omp parallel for schedule(static) reduction(|:moving)
+	for (int i = 0; i < ny; ++i) {moving |= (int)solve_row(i, rm_atten);}
+	return (moving != 0);
+}
+
+
+bool compute_ripple_acc_gather(float rm_atten) {
+
+	ripple_solver.init(MESH_X_SIZE, MESH_Y_SIZE);
+
+#pragma omp parallel for schedule(static)
+	for (int i = 0; i < MESH_Y_SIZE; ++i) {
+		for (int j = 0; j < MESH_X_SIZE; ++j) {
+			bool const active(wminside[i][j] && !(water_matrix[i][j] < z_min_matrix[i][j]));
+			ripple_solver.set_cell(i, j, ripples[i][j].rval, ripples[i][j].acc, active, watershed_matrix[i][j].inside8);
+		}
+	}
+	bool const moving(ripple_solver.solve(rm_atten));
+
+#pragma omp parallel for schedule(static)
+	for (int i = 0; i < MESH_Y_SIZE; ++i) {
+		for (int j = 0; j < MESH_X_SIZE; ++j) {ripple_solver.get_cell(i, j, ripples[i][j].rval, ripples[i][j].acc);}
+	}
+	return moving;
+}
+
+
+void compute_ripples() {
+
+	if (DISABLE_WATER) return;
+	static unsigned dtime1(0), dtime2(0), counter(0);
+	bool const update_iter((counter%UPDATE_STEP) == 0);
+	RESET_TIME;
+
+	if (temperature > W_FREEZE_POINT && (start_ripple || first_water_run)) {
+		float const tstep(max(fticks, 0.25f)); // ensure some min amount of damping to prevent unstable ripples when the framerate is very high
+		float const rm_atten(pow(RIPPLE_MAT_ATTEN, tstep)), rdamp1(pow(RIPPLE_DAMP1, tstep)), rdamp2(RIPPLE_DAMP2*tstep);
+		start_ripple = (USE_RIPPLE_SOLVER ? compute_ripple_acc_gather(rm_atten) : compute_ripple_acc_scatter(rm_atten));
 		if (DEBUG_RIPPLE_TIME) dtime1 += GET_DELTA_TIME;
 		
 		for (int i = 0; i < MESH_Y_SIZE; ++i) {
@@ -27,7 +27,7 @@ vector<point> app_spots;
 vector<od_data> oddatav; // used as a temporary
 
 
-extern bool has_wpt_goal, use_waypoint_app_spots, enable_init_shields, smileys_chase_player, enable_translocator, keep_keycards_on_death;
+extern bool has_wpt_goal, use_waypoint_app_spots, enable_init_shields, smileys_chase_player, enable_translocator, keep_keycards_on_death, headless_mode;
 extern int iticks, num_smileys, free_for_all, teams, frame_counter, display_mode;
 extern int DISABLE_WATER, xoff, yoff, world_mode, spectate, camera_reset, camera_mode, following, game_mode;
 extern int recreated, mesh_scale_change, UNLIMITED_WEAPONS, camera_coll_id, init_num_balls;
@@ -1163,6 +1163,7 @@ void add_damage_to_smiley_texture(vector3d const &dir, float size, int smiley_id
 		y1 = 0;
 		y2 = SMILEY_TEX_SIZE;
 	}
+	if (headless_mode) return; // no GL context; keep the CPU data
 	select_smiley_texture(smiley_id); // update a strip from y1 to y2
 	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y1, SMILEY_TEX_SIZE, (y2-y1), GL_RGB, GL_UNSIGNED_BYTE, (tdata + 3*SMILEY_TEX_SIZE*y1));
 }
@@ -1216,6 +1217,7 @@ void init_smiley_texture(int smiley_id) {
 			}
 		}
 	}
+	if (headless_mode) return; // no GL context; keep the CPU data
 	if (sstates[smiley_id].tid == 0) {
 		setup_texture(sstates[smiley_id].tid, 0, 0, 0);
 	}
@@ -50,7 +50,7 @@ vector<colorRGBA> colors_by_id; // for keycards
 vector<popup_text_t> popup_text;
 cube_light_src_vect sky_cube_lights, global_cube_lights;
 
-extern bool clear_landscape_vbo, use_voxel_cobjs, tree_4th_branches, lm_alloc, reflect_dodgeballs, begin_motion, disable_fire_delay;
+extern bool clear_landscape_vbo, use_voxel_cobjs, tree_4th_branches, lm_alloc, reflect_dodgeballs, begin_motion, disable_fire_delay, parallel_model_load;
 extern int camera_view, camera_mode, camera_reset, animate2, recreated, temp_change, preproc_cube_cobjs, precip_mode;
 extern int is_cloudy, num_smileys, load_coll_objs, world_mode, start_ripple, has_snow_accum, has_accumulation, scrolling, num_items, camera_coll_id;
 extern int num_dodgeballs, display_mode, game_mode, num_trees, tree_mode, has_scenery2, UNLIMITED_WEAPONS, ground_effects_level;
@@ -312,6 +312,8 @@ void set_global_state() {
 
 void process_groups() {
 
+	PROFILE_SCOPE("Process Groups");
+	bench_timer_t bench_timer(BENCH_PHYSICS);
 	if (animate2) {advance_physics_objects();}
 
 	if (display_mode & 0x0200) {
@@ -455,7 +457,7 @@ void process_groups() {
 			++num_objs;
 
 			if (obj.health < 0.0) {obj.status = 0;} // can get here for smileys?
-			else if (type == SMILEY) {advance_smiley(obj, j);}
+			else if (type == SMILEY) {bench_timer_t bench_timer(BENCH_AI); advance_smiley(obj, j);}
 			else {
 				if (obj.time >= 0) {
 					if (type == PLASMA && obj.velocity.mag_sq() < 1.0) {obj.disable();} // plasma dies when it stops
@@ -1193,6 +1195,55 @@ bool read_block_comment(FILE *fp) {
 }
 
 
+// reads the next whitespace-separated token from an in-memory scene file, skipping comments; quotes are handled as in read_quoted_string()
+bool read_next_scene_token(string const &buf, size_t &pos, string &tok) {
+
+	tok.clear();
+
+	while (pos < buf.size()) { // skip whitespace and comments
+		char const c(buf[pos]);
+		if (isspace((unsigned char)c)) {++pos;}
+		else if (c == '#') {while (pos < buf.size() && buf[pos] != '\n') {++pos;}}
+		else if (c == '/' && pos+1 < buf.size() && buf[pos+1] == '*') {
+			size_t const end(buf.find("*/", pos+2));
+			pos = ((end == string::npos) ? buf.size() : end+2);
+		}
+		else break;
+	}
+	bool in_quote(0);
+
+	for (; pos < buf.size(); ++pos) {
+		char const c(buf[pos]);
+		if (c == '"') {in_quote ^= 1;}
+		else if (isspace((unsigned char)c) && !in_quote) break;
+		else {tok.push_back(c);}
+	}
+	return !tok.empty();
+}
+
+// fast first pass over a scene file and its includes that only collects the filenames of model load ('O') commands in scene order;
+// the arguments of other commands are skipped as plain tokens, so the result is only a hint for preloading and may contain extra entries
+void scan_coll_obj_file_for_models(string const &fn, vector<string> &model_fns, unsigned depth=0) {
+
+	if (depth > 16) return; // include cycle?
+	FILE *fp(fopen(fn.c_str(), "rb"));
+	if (fp == NULL) return; // the error will be reported by read_coll_obj_file()
+	string buf, tok;
+	char block[65536];
+	size_t num_read(0), pos(0);
+	while ((num_read = fread(block, 1, sizeof(block), fp)) > 0) {buf.append(block, num_read);}
+	fclose(fp);
+
+	while (read_next_scene_token(buf, pos, tok)) {
+		if (tok == "q" || tok == "end") break; // end of file
+		bool const is_model(tok == "O"), is_include(tok == "i");
+		if (!(is_model || is_include) || !read_next_scene_token(buf, pos, tok)) continue;
+		if (is_model) {model_fns.push_back(tok);}
+		else {scan_coll_obj_file_for_models(tok, model_fns, depth+1);}
+	}
+}
+
+
 int read_coll_obj_file(const char *coll_obj_file, geom_xform_t xf, coll_obj cobj, bool has_layer, colorRGBA lcolor) {
 
 	assert(coll_obj_file != NULL);
@@ -2083,7 +2134,15 @@ int read_coll_objects(const char *filename) {
 	cobj.cp.draw    = 1;   // default
 	if (EXPLODE_EVERYTHING) {cobj.destroy = EXPLODEABLE;}
 	if (use_voxel_cobjs) {cobj.cp.cobj_type = COBJ_TYPE_VOX_TERRAIN;}
-	if (!read_coll_obj_file(filename, xf, cobj, 0, WHITE)) return 0;
+
+	if (parallel_model_load) { // start reading model3d files on worker threads while the scene file is parsed
+		vector<string> model_fns;
+		scan_coll_obj_file_for_models(filename, model_fns);
+		preload_model3d_files(model_fns);
+	}
+	bool const read_ok(read_coll_obj_file(filename, xf, cobj, 0, WHITE) != 0);
+	clear_preloaded_models(); // free any models that weren't used
+	if (!read_ok) return 0;
 	if (num_keycards > 0) {obj_groups[coll_id[KEYCARD]].enable();}
 	if (has_scenery2) {gen_scenery();} // need to call post_gen_setup() for leafy plants
 	cube_t const model_bcube(calc_and_return_all_models_bcube()); // calculate even if not using; will force internal transform bcubes to be calculated
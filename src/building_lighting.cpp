@@ -198,9 +198,8 @@ unsigned building_t::create_building_volume_light_texture() const {
 	unsigned const zsize(MESH_SIZE[2]); // not MESH_Z_SIZE; we want the clipped size that lmap uses rather than the user-specified size
 
 	if (!local_lmap_manager.is_allocated()) { // first time setup
-		unsigned const tot_sz(XY_MULT_SIZE*zsize);
 		lmcell init_lmcell;
-		local_lmap_manager.alloc(tot_sz, MESH_X_SIZE, MESH_Y_SIZE, zsize, (unsigned char **)nullptr, init_lmcell);
+		local_lmap_manager.alloc(MESH_X_SIZE, MESH_Y_SIZE, zsize, (unsigned char **)nullptr, init_lmcell);
 	}
 	float const weight(1.0);
 	ray_cast_building(&local_lmap_manager, weight);
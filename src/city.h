@@ -644,6 +644,10 @@ public:
 	bool empty() const {return cars.empty();}
 	void clear() {cars.clear(); car_blocks.clear();}
 	unsigned get_model_gpu_mem() const {return car_model_loader.get_gpu_mem();}
+	void add_mem_usage(mem_usage_t &usage) const {
+		size_t const cpu_mem(cars.capacity()*sizeof(car_t) + (car_blocks.capacity() + car_blocks_by_road.capacity())*sizeof(car_block_t) + cars_by_road.capacity()*sizeof(cube_with_ix_t));
+		usage.add(cpu_mem, get_model_gpu_mem(), cars.size());
+	}
 	void init_cars(unsigned num);
 	void add_parked_cars(vector<car_t> const &new_cars, vect_cube_t const &garages);
 	void finalize_cars();
@@ -797,6 +801,10 @@ public:
 	bool empty() const {return (peds.empty() && peds_b.empty());}
 	void clear() {peds.clear(); peds_b.clear(); by_city.clear();}
 	unsigned get_model_gpu_mem() const {return ped_model_loader.get_gpu_mem();}
+	void add_mem_usage(mem_usage_t &usage) const {
+		size_t const cpu_mem((peds.capacity() + peds_b.capacity())*sizeof(pedestrian_t) + by_city.capacity()*sizeof(city_ixs_t) + by_plot.capacity()*sizeof(unsigned));
+		usage.add(cpu_mem, get_model_gpu_mem(), (peds.size() + peds_b.size()));
+	}
 	void init(unsigned num_city, unsigned num_building);
 	bool proc_sphere_coll(point &pos, float radius, vector3d *cnorm) const;
 	bool line_intersect_peds(point const &p1, point const &p2, float &t) const;
@@ -3112,6 +3112,7 @@ public:
 	void next_ped_animation() {ped_manager.next_animation();}
 	void free_context() {car_manager.free_context(); ped_manager.free_context();}
 	unsigned get_model_gpu_mem() const {return (ped_manager.get_model_gpu_mem() + car_manager.get_model_gpu_mem());}
+	void add_mem_usage(mem_usage_t &usage) const {car_manager.add_mem_usage(usage); ped_manager.add_mem_usage(usage);} // Note: roads aren't counted
 }; // city_gen_t
 
 city_gen_t city_gen;
@@ -3134,7 +3135,7 @@ void gen_city_details() {city_gen.gen_details();} // called after gen_buildings(
 void get_city_bcubes(vect_cube_t &bcubes) {city_gen.get_city_bcubes(bcubes);}
 void get_city_road_bcubes(vect_cube_t &bcubes, bool connector_only) {city_gen.get_all_road_bcubes(bcubes, connector_only);}
 void get_city_plot_bcubes(vector<cube_with_zval_t> &bcubes) {city_gen.get_all_plot_bcubes(bcubes);}
-void next_city_frame(bool use_threads_2_3) {city_gen.next_frame(use_threads_2_3);}
+void next_city_frame(bool use_threads_2_3) {PROFILE_SCOPE("City Next Frame"); bench_timer_t bench_timer(BENCH_TRAFFIC); city_gen.next_frame(use_threads_2_3);}
 void draw_cities(int shadow_only, int reflection_pass, int trans_op_mask, vector3d const &xlate) {city_gen.draw(shadow_only, reflection_pass, trans_op_mask, xlate);}
 void setup_city_lights(vector3d const &xlate) {city_gen.setup_city_lights(xlate);}
 
@@ -3182,6 +3183,7 @@ void destroy_city_in_radius(point const &pos, float radius) {city_gen.destroy_in
 bool get_city_color_at_xy(float x, float y, colorRGBA &color) {return city_gen.get_color_at_xy(x, y, color);}
 cube_t get_city_lights_bcube() {return city_gen.get_lights_bcube();}
 unsigned get_city_model_gpu_mem() {return city_gen.get_model_gpu_mem();}
+void add_city_mem_usage(mem_usage_t *usage) {city_gen.add_mem_usage(usage[MEM_CITY]);}
 void next_pedestrian_animation() {city_gen.next_ped_animation();}
 void free_city_context() {city_gen.free_context();}
 bool has_city_trees() {return (city_params.max_trees_per_plot > 0);}
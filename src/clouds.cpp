@@ -474,7 +474,7 @@ void move_in_front_of_far_clip(point_d &pos, point const &camera, float &size, f
 // however, we allow it (but default it to (0,0,0)), since the part cloud could be drawn using a different shader
 void volume_part_cloud::gen_pts(vector3d const &size, point const &pos, bool simplified) {
 
-	if (unscaled_points[simplified].empty()) {calc_unscaled_points(simplified);}
+	ensure_unscaled_points(simplified);
 	points = unscaled_points[simplified]; // deep copy
 	for (unsigned i = 0; i < points.size(); ++i) {points[i].v *= size; points[i].v += pos;}
 }
@@ -4,14 +4,26 @@
 
 #include "3DWorld.h"
 #include "cobj_bsp_tree.h"
+#include <cfloat> // for FLT_MAX
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ENABLE_SSE_PACKETS
+#endif
 
 
 unsigned const MAX_LEAF_SIZE = 2;
 float const POLY_TOLER       = 1.0E-6;
 float const OVERLAP_AMT      = 0.02;
+float const REFIT_MAX_SA_GROWTH = 1.5; // rebuild subtrees whose surface area has grown by more than this factor since they were built
+unsigned const NUM_SAH_BINS      = 16;
+unsigned const SAH_MAX_LEAF_SIZE = 8;    // leaves up to this size are created when splitting isn't cheaper
+unsigned const SAH_MIN_TASK_OBJS = 4096; // smallest subtree built as a separate task in the multithreaded SAH build
+float const SAH_TRAV_COST        = 0.25; // cost of a node traversal step relative to a cobj intersection test
 
 
-extern bool mt_cobj_tree_build, begin_motion;
+extern bool mt_cobj_tree_build, refit_dynamic_cobj_tree, sah_cobj_tree_build, begin_motion;
+extern unsigned wide_cobj_trees;
 extern int display_mode, frame_counter, cobj_counter;
 extern coll_obj_group coll_objects;
 extern vector<unsigned> falling_cobjs;
@@ -145,6 +157,382 @@ bool cobj_tree_base::node_ix_mgr::check_node(unsigned &nix) const {
 }
 
 
+// *** cobj_tree_base 4-wide nodes ***
+
+
+unsigned const WIDE_STACK_SIZE = 512;
+
+
+void bvh4_node_t::set_child(unsigned k, cube_t const &c, unsigned ix_, unsigned num_) {
+
+	assert(k < 4);
+	UNROLL_3X(bounds[i_][0][k] = c.d[i_][0]; bounds[i_][1][k] = c.d[i_][1];)
+	ix [k] = ix_;
+	num[k] = num_;
+	valid_mask |= (1 << k);
+}
+
+
+bvh4_qnode_t::bvh4_qnode_t(bvh4_node_t const &n) : valid_mask(n.valid_mask) {
+
+	for (unsigned k = 0; k < 4; ++k) {ix[k] = n.ix[k]; num[k] = n.num[k];}
+
+	for (unsigned d = 0; d < 3; ++d) {
+		float lo(FLT_MAX), hi(-FLT_MAX);
+
+		for (unsigned k = 0; k < 4; ++k) {
+			if (valid_mask & (1 << k)) {lo = min(lo, n.bounds[d][0][k]); hi = max(hi, n.bounds[d][1][k]);}
+		}
+		assert(lo <= hi);
+		origin[d] = lo;
+		scale [d] = (hi - lo)/65535.0f;
+
+		for (bool conservative = 0; !conservative; scale[d] *= 1.001f) { // increase scale until dequantized bounds contain the original bounds
+			conservative = 1;
+
+			for (unsigned k = 0; k < 4; ++k) {
+				if (!(valid_mask & (1 << k))) {qbounds[d][0][k] = 65535; qbounds[d][1][k] = 0; continue;} // unused
+				float const v0(n.bounds[d][0][k]), v1(n.bounds[d][1][k]);
+				int q0((scale[d] > 0.0) ? max(0,     int(floor((v0 - lo)/scale[d]))) : 0);
+				int q1((scale[d] > 0.0) ? min(65535, int(ceil ((v1 - lo)/scale[d]))) : 0);
+				qbounds[d][0][k] = q0; qbounds[d][1][k] = q1;
+				while (q0 > 0     && get_bound(d, 0, k) > v0) {qbounds[d][0][k] = --q0;} // fix FP rounding errors
+				while (q1 < 65535 && get_bound(d, 1, k) < v1) {qbounds[d][1][k] = ++q1;}
+				conservative &= (get_bound(d, 0, k) <= v0 && get_bound(d, 1, k) >= v1);
+			}
+			if (conservative) break;
+			if (scale[d] == 0.0) {scale[d] = max(fabs(hi), fabs(lo))*1.0E-7f/65535.0f + FLT_MIN;} // zero extent with FP error, start with a small nonzero scale
+		}
+	}
+}
+
+
+unsigned cobj_tree_base::get_branch_kids(unsigned nix, unsigned kids[MAX_BRANCH_KIDS]) const {
+
+	tree_node const &n(nodes[nix]);
+	assert(n.start == n.end); // must be a branch
+	unsigned num(0);
+
+	for (unsigned kid = nix+1; kid < n.next_node_id; kid = nodes[kid].next_node_id) {
+		tree_node const &k(nodes[kid]);
+		if (k.start == k.end && k.d[0][0] > k.d[0][1]) break; // gap node (unused range)
+		assert(num < MAX_BRANCH_KIDS);
+		kids[num++] = kid;
+	}
+	return num;
+}
+
+
+// creates a wide node from binary branch node nix by collapsing its children and grandchildren, and returns its index
+unsigned cobj_tree_base::add_wide_node(unsigned nix, unsigned depth, unsigned &wide_depth) {
+
+	unsigned kids[MAX_BRANCH_KIDS];
+	unsigned const nkids(get_branch_kids(nix, kids));
+	return add_wide_node(kids, nkids, depth, wide_depth);
+}
+
+// creates a wide node with binary tree nodes kids[0:nkids] as children; if there are more than 4 kids (MT build root),
+// pairs of kids are placed under extra wide nodes, otherwise grandchildren are pulled up to fill the unused slots of kids[4]
+unsigned cobj_tree_base::add_wide_node(unsigned *kids, unsigned nkids, unsigned depth, unsigned &wide_depth) {
+
+	assert(nkids > 0 && nkids <= MAX_BRANCH_KIDS);
+	wide_depth = max(wide_depth, depth);
+	unsigned const wix(wnodes.size());
+	wnodes.push_back(bvh4_node_t());
+
+	if (nkids > 4) { // too many kids: the first (nkids - 4) slots each get a pair of kids
+		unsigned const num_pairs(nkids - 4);
+
+		for (unsigned k = 0, i = 0; k < 4; ++k) {
+			if (k < num_pairs) {
+				unsigned pair_kids[4] = {kids[i], kids[i+1]}; // copy, since grandchildren are pulled up into the unused slots
+				cube_t bcube(nodes[kids[i]]);
+				bcube.union_with_cube(nodes[kids[i+1]]);
+				unsigned const child_wix(add_wide_node(pair_kids, 2, depth+1, wide_depth)); // Note: invalidates references into wnodes
+				wnodes[wix].set_child(k, bcube, child_wix, 0);
+				i += 2;
+			}
+			else {set_wide_child(wix, k, kids[i++], depth, wide_depth);}
+		}
+		return wix;
+	}
+	while (nkids < 4) { // pull up the children of the branch child with the largest surface area if they fit
+		int best(-1);
+		float best_sa(0.0);
+
+		for (unsigned k = 0; k < nkids; ++k) {
+			tree_node const &n(nodes[kids[k]]);
+			if (n.start < n.end) continue; // leaf
+			unsigned gkids[MAX_BRANCH_KIDS];
+			if (nkids - 1 + get_branch_kids(kids[k], gkids) > 4) continue; // too many grandchildren
+			float const sa(n.dx()*n.dy() + n.dy()*n.dz() + n.dz()*n.dx());
+			if (best < 0 || sa > best_sa) {best = k; best_sa = sa;}
+		}
+		if (best < 0) break; // can't collapse any more
+		unsigned gkids[MAX_BRANCH_KIDS];
+		unsigned const ngkids(get_branch_kids(kids[best], gkids));
+		kids[best] = gkids[0];
+		for (unsigned k = 1; k < ngkids; ++k) {kids[nkids++] = gkids[k];}
+	}
+	for (unsigned k = 0; k < nkids; ++k) {set_wide_child(wix, k, kids[k], depth, wide_depth);}
+	return wix;
+}
+
+void cobj_tree_base::set_wide_child(unsigned wix, unsigned k, unsigned kid, unsigned depth, unsigned &wide_depth) {
+
+	tree_node const &n(nodes[kid]);
+	if (n.start < n.end) {wnodes[wix].set_child(k, n, n.start, (n.end - n.start)); return;} // leaf
+	unsigned const child_wix(add_wide_node(kid, depth+1, wide_depth)); // Note: invalidates references into wnodes
+	wnodes[wix].set_child(k, nodes[kid], child_wix, 0);
+}
+
+unsigned cobj_tree_base::get_num_leaf_objs() const { // sum of binary tree leaf sizes, skipping unused node ranges
+
+	unsigned num(0);
+
+	for (unsigned nix = 0; nix < nodes.size();) {
+		tree_node const &n(nodes[nix]);
+		if (n.start == n.end && n.d[0][0] > n.d[0][1]) {nix = n.next_node_id; continue;} // gap node
+		num += (n.end - n.start); // zero for branches
+		++nix;
+	}
+	return num;
+}
+
+// returns the number of objects under wide node wix, and counts the nodes visited; used to validate the wide tree after it's built
+template<typename N> unsigned cobj_tree_base::check_wide_subtree(vector<N> const &wn, unsigned wix, unsigned &nvisited) const {
+
+	assert(wix < wn.size());
+	N const &n(wn[wix]);
+	assert(n.valid_mask != 0);
+	unsigned num(0);
+	++nvisited;
+
+	for (unsigned k = 0; k < 4; ++k) {
+		if (!(n.valid_mask & (1 << k))) continue;
+		if (n.num[k] > 0) {num += n.num[k];} // leaf
+		else {assert(n.ix[k] > wix); num += check_wide_subtree(wn, n.ix[k], nvisited);} // kids always come after their parent
+	}
+	return num;
+}
+
+
+void cobj_tree_base::build_wide_tree() {
+
+	wnodes.clear();
+	wqnodes.clear();
+	if (wide_cobj_trees == 0 || nodes.empty()) return; // not enabled, or empty tree
+	tree_node const &root(nodes[0]);
+	unsigned wide_depth(0);
+
+	if (root.start < root.end) { // root is a leaf, create a single node with one child
+		wnodes.push_back(bvh4_node_t());
+		wnodes.back().set_child(0, root, root.start, (root.end - root.start));
+	}
+	else if (nodes.size() > 1) {add_wide_node(0, 0, wide_depth);}
+	else return; // empty tree
+
+	if (3*wide_depth + 4 > WIDE_STACK_SIZE) { // too deep for the traversal stack, use the binary tree
+		cout << "Warning: cobj tree is too deep for wide nodes: " << wide_depth << endl;
+		wnodes.clear();
+		return;
+	}
+	if (wide_cobj_trees == 2) { // quantized
+		wqnodes.reserve(wnodes.size());
+		for (auto i = wnodes.begin(); i != wnodes.end(); ++i) {wqnodes.emplace_back(*i);}
+		vector<bvh4_node_t>().swap(wnodes); // free the memory
+	}
+	// check that the wide tree references every object once and every node once; this is cheap compared to the build
+	unsigned nvisited(0);
+	unsigned const num_objs(wqnodes.empty() ? check_wide_subtree(wnodes, 0, nvisited) : check_wide_subtree(wqnodes, 0, nvisited));
+	assert(num_objs == get_num_leaf_objs());
+	assert(nvisited == (wqnodes.empty() ? wnodes.size() : wqnodes.size()));
+}
+
+
+// child bounds accessors, used by the wide traversal functions below
+#ifdef ENABLE_SSE_PACKETS
+inline void load_child_bounds(bvh4_node_t const &n, __m128 lo[3], __m128 hi[3]) {
+	UNROLL_3X(lo[i_] = _mm_loadu_ps(n.bounds[i_][0]); hi[i_] = _mm_loadu_ps(n.bounds[i_][1]);)
+}
+inline __m128 dequantize(uint16_t const q[4], float origin, float scale) {
+	__m128i const v(_mm_unpacklo_epi16(_mm_loadl_epi64((__m128i const *)q), _mm_setzero_si128())); // zero extend to 32 bits
+	return _mm_add_ps(_mm_set1_ps(origin), _mm_mul_ps(_mm_cvtepi32_ps(v), _mm_set1_ps(scale))); // same operation order as get_bound()
+}
+inline void load_child_bounds(bvh4_qnode_t const &n, __m128 lo[3], __m128 hi[3]) {
+	UNROLL_3X(lo[i_] = dequantize(n.qbounds[i_][0], n.origin[i_], n.scale[i_]); hi[i_] = dequantize(n.qbounds[i_][1], n.origin[i_], n.scale[i_]);)
+}
+#endif
+inline void get_child_bounds(bvh4_node_t  const &n, unsigned k, float d[3][2]) {UNROLL_3X(d[i_][0] = n.bounds[i_][0][k]; d[i_][1] = n.bounds[i_][1][k];)}
+inline void get_child_bounds(bvh4_qnode_t const &n, unsigned k, float d[3][2]) {UNROLL_3X(d[i_][0] = n.get_bound(i_, 0, k); d[i_][1] = n.get_bound(i_, 1, k);)}
+
+
+struct wide_line_t { // line in the form used for testing against all children of a wide node
+
+	point p1;
+	vector3d dinv;
+	bool neg[3];
+
+	wide_line_t(point const &p1_, point const &p2_) : p1(p1_), dinv(p2_ - p1_) {
+		dinv.invert();
+		UNROLL_3X(neg[i_] = (dinv[i_] < 0.0);)
+	}
+	template<typename N> unsigned test_kids(N const &n, float tmax_in, float tmins[4]) const { // returns a bit mask of intersected children
+#ifdef ENABLE_SSE_PACKETS
+		__m128 lo[3], hi[3], tmin(_mm_setzero_ps()), tmax(_mm_set1_ps(tmax_in));
+		load_child_bounds(n, lo, hi);
+
+		for (unsigned d = 0; d < 3; ++d) {
+			__m128 const p(_mm_set1_ps(p1[d])), di(_mm_set1_ps(dinv[d]));
+			__m128 const t1(_mm_mul_ps(_mm_sub_ps((neg[d] ? hi[d] : lo[d]), p), di)), t2(_mm_mul_ps(_mm_sub_ps((neg[d] ? lo[d] : hi[d]), p), di));
+			tmax = _mm_min_ps(t2, tmax); // Note: NaN handling matches get_line_clip()
+			tmin = _mm_max_ps(t1, tmin);
+		}
+		_mm_storeu_ps(tmins, tmin);
+		return (_mm_movemask_ps(_mm_cmplt_ps(tmin, tmax)) & n.valid_mask);
+#else
+		unsigned mask(0);
+
+		for (unsigned k = 0; k < 4; ++k) {
+			if (!(n.valid_mask & (1 << k))) continue;
+			float d[3][2], tmin(0.0), tmax(tmax_in);
+			get_child_bounds(n, k, d);
+
+			for (unsigned i = 0; i < 3; ++i) {
+				float const t1((d[i][neg[i]] - p1[i])*dinv[i]), t2((d[i][!neg[i]] - p1[i])*dinv[i]);
+				if (t2 < tmax) {tmax = t2;} if (t1 > tmin) {tmin = t1;}
+			}
+			tmins[k] = tmin;
+			if (tmin < tmax) {mask |= (1 << k);}
+		}
+		return mask;
+#endif
+	}
+};
+
+
+// calls leaf_func(start, end, tmax) for each leaf intersected by the line in approximate front-to-back order;
+// leaf_func can shorten the line by reducing tmax, and returns 2 to end the traversal
+template<typename N, typename F> void traverse_wide_line(vector<N> const &wn, point const &p1, point const &p2, float &tmax, F &leaf_func) {
+
+	assert(!wn.empty());
+	wide_line_t const line(p1, p2);
+	struct entry_t {unsigned ix, num; float tmin;} stack[WIDE_STACK_SIZE];
+	unsigned sp(0);
+	stack[sp++] = {0, 0, 0.0f};
+
+	while (sp > 0) {
+		entry_t const e(stack[--sp]);
+		if (e.tmin >= tmax) continue; // starts after an earlier hit
+		if (e.num > 0) {if (leaf_func(e.ix, e.ix+e.num, tmax) == 2) return; continue;} // leaf
+		N const &n(wn[e.ix]);
+		float tmins[4];
+		unsigned const mask(line.test_kids(n, tmax, tmins));
+		unsigned order[4], nhit(0);
+
+		for (unsigned k = 0; k < 4; ++k) { // insertion sort by decreasing tmin so that the closest child is on the top of the stack
+			if (!(mask & (1 << k))) continue;
+			unsigned pos(nhit++);
+			for (; pos > 0 && tmins[order[pos-1]] < tmins[k]; --pos) {order[pos] = order[pos-1];}
+			order[pos] = k;
+		}
+		assert(sp + nhit <= WIDE_STACK_SIZE);
+		for (unsigned i = 0; i < nhit; ++i) {unsigned const k(order[i]); stack[sp++] = {n.ix[k], n.num[k], tmins[k]};}
+	}
+}
+
+template<typename F> void traverse_wide_line_any(vector<bvh4_node_t> const &wn, vector<bvh4_qnode_t> const &wqn, point const &p1, point const &p2, float &tmax, F &leaf_func) {
+	if (!wn.empty()) {traverse_wide_line(wn, p1, p2, tmax, leaf_func);} else {traverse_wide_line(wqn, p1, p2, tmax, leaf_func);}
+}
+
+
+// calls leaf_func(start, end) for each leaf whose bounds pass test_kids, which returns a bit mask of children for a node
+template<typename N, typename T, typename F> void traverse_wide(vector<N> const &wn, T const &test_kids, F &leaf_func) {
+
+	assert(!wn.empty());
+	unsigned stack[WIDE_STACK_SIZE], sp(0);
+	stack[sp++] = 0;
+
+	while (sp > 0) {
+		N const &n(wn[stack[--sp]]);
+		unsigned const mask(test_kids(n));
+
+		for (unsigned k = 0; k < 4; ++k) {
+			if (!(mask & (1 << k))) continue;
+			if (n.num[k] > 0) {leaf_func(n.ix[k], n.ix[k]+n.num[k]);} // leaf
+			else {assert(sp < WIDE_STACK_SIZE); stack[sp++] = n.ix[k];}
+		}
+	}
+}
+
+template<typename T, typename F> void traverse_wide_any(vector<bvh4_node_t> const &wn, vector<bvh4_qnode_t> const &wqn, T const &test_kids, F &leaf_func) {
+	if (!wn.empty()) {traverse_wide(wn, test_kids, leaf_func);} else {traverse_wide(wqn, test_kids, leaf_func);}
+}
+
+
+struct sphere_kids_test_t { // returns a bit mask of children intersecting the sphere
+
+	point center;
+	float radius;
+
+	sphere_kids_test_t(point const &c, float r) : center(c), radius(r) {}
+
+	template<typename N> unsigned operator()(N const &n) const {
+#ifdef ENABLE_SSE_PACKETS
+		__m128 lo[3], hi[3], dist_sq(_mm_setzero_ps());
+		load_child_bounds(n, lo, hi);
+
+		for (unsigned d = 0; d < 3; ++d) {
+			__m128 const c(_mm_set1_ps(center[d]));
+			__m128 const dist(_mm_max_ps(_mm_max_ps(_mm_sub_ps(lo[d], c), _mm_sub_ps(c, hi[d])), _mm_setzero_ps())); // distance from the bounds
+			dist_sq = _mm_add_ps(dist_sq, _mm_mul_ps(dist, dist));
+		}
+		return (_mm_movemask_ps(_mm_cmple_ps(dist_sq, _mm_set1_ps(radius*radius))) & n.valid_mask);
+#else
+		unsigned mask(0);
+
+		for (unsigned k = 0; k < 4; ++k) {
+			if (!(n.valid_mask & (1 << k))) continue;
+			cube_t c;
+			get_child_bounds(n, k, c.d);
+			if (sphere_cube_intersect(center, radius, c)) {mask |= (1 << k);}
+		}
+		return mask;
+#endif
+	}
+};
+
+struct cube_kids_test_t { // returns a bit mask of children intersecting the cube, including adjacency
+
+	cube_t cube;
+
+	cube_kids_test_t(cube_t const &c) : cube(c) {}
+
+	template<typename N> unsigned operator()(N const &n) const {
+#ifdef ENABLE_SSE_PACKETS
+		__m128 lo[3], hi[3], outside(_mm_setzero_ps());
+		load_child_bounds(n, lo, hi);
+
+		for (unsigned d = 0; d < 3; ++d) {
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_set1_ps(cube.d[d][1]), lo[d]));
+			outside = _mm_or_ps(outside, _mm_cmpgt_ps(_mm_set1_ps(cube.d[d][0]), hi[d]));
+		}
+		return (~_mm_movemask_ps(outside) & n.valid_mask);
+#else
+		unsigned mask(0);
+
+		for (unsigned k = 0; k < 4; ++k) {
+			if (!(n.valid_mask & (1 << k))) continue;
+			cube_t c;
+			get_child_bounds(n, k, c.d);
+			if (c.intersects(cube)) {mask |= (1 << k);}
+		}
+		return mask;
+#endif
+	}
+};
+
+
 // *** cobj_tree_simple_type_t ***
 
 
@@ -234,6 +622,7 @@ template<typename T> void cobj_tree_simple_type_t<T>::build_tree_top(bool verbos
 	if (!objects.empty()) {build_tree(0, 0, 0);}
 	nodes[0].next_node_id = (unsigned)nodes.size();
 	for (unsigned i = 0; i < 3; ++i) {vector<T>().swap(temp_bins[i]);}
+	build_wide_tree();
 
 	if (verbose) {
 		cout << "objects: " << objects.size() << ", cap: " << objects.capacity() << ", nodes: " << nodes.size() << ", cap: " << nodes.capacity()
@@ -287,34 +676,63 @@ void cobj_tree_tquads_t::add_polygons(vector<polygon_t> const &polygons, bool ve
 }
 
 
-bool cobj_tree_tquads_t::check_coll_line(point const &p1, point const &p2, point &cpos, vector3d &cnorm, colorRGBA *color, int *cindex, int ignore_cobj, bool exact) const {
+struct cobj_tree_tquads_t::line_query_t {
 
-	if (nodes.empty()) return 0;
-	bool ret(0);
-	float t(0.0), tmin(0.0), tmax(1.0);
-	node_ix_mgr nixm(nodes, p1, p2);
-	unsigned const num_nodes((unsigned)nodes.size());
+	vector<coll_tquad> const &objects;
+	point const &p1, &p2;
+	point &cpos;
+	vector3d &cnorm;
+	colorRGBA *color;
+	int *cindex, ignore_cobj;
+	bool exact, ret;
 
-	for (unsigned nix = 0; nix < num_nodes;) {
-		tree_node const &n(nodes[nix]);
-		if (!nixm.check_node(nix)) continue; // Note: modifies nix
+	line_query_t(vector<coll_tquad> const &objs, point const &p1_, point const &p2_, point &cpos_, vector3d &cnorm_, colorRGBA *color_, int *cindex_, int ignore_cobj_, bool exact_)
+		: objects(objs), p1(p1_), p2(p2_), cpos(cpos_), cnorm(cnorm_), color(color_), cindex(cindex_), ignore_cobj(ignore_cobj_), exact(exact_), ret(0) {}
 
-		for (unsigned i = n.start; i < n.end; ++i) { // check leaves
+	unsigned operator()(unsigned start, unsigned end, float &tmax) { // returns 0 = no hit, 1 = hit and tmax was reduced, 2 = done
+		unsigned hit(0);
+		float t(0.0);
+
+		for (unsigned i = start; i < end; ++i) { // check leaves
 			// Note: we test cobj against the original (unclipped) p1 and p2 so that t is correct
 			// Note: we probably don't need to return cnorm and cpos in inexact mode, but it shouldn't be too expensive to do so
-			if (ignore_cobj >= 0 && (int)objects[i].cid == ignore_cobj)   continue;
-			if (!objects[i].line_int_exact(p1, p2, t, cnorm, tmin, tmax)) continue;
+			if (ignore_cobj >= 0 && (int)objects[i].cid == ignore_cobj)  continue;
+			if (!objects[i].line_int_exact(p1, p2, t, cnorm, 0.0, tmax)) continue;
 			if (cindex) *cindex = objects[i].cid;
 			if (color ) *color  = objects[i].color.get_c4();
 			cpos = p1 + (p2 - p1)*t;
-			if (!exact) return 1; // return first hit
-			nixm.dinv = vector3d(cpos - p1);
-			nixm.dinv.invert();
-			tmax = t;
 			ret  = 1;
+			if (!exact) return 2; // return first hit
+			tmax = t;
+			hit  = 1;
 		}
+		return hit;
 	}
-	return ret;
+};
+
+bool cobj_tree_tquads_t::check_coll_line(point const &p1, point const &p2, point &cpos, vector3d &cnorm, colorRGBA *color, int *cindex, int ignore_cobj, bool exact) const {
+
+	if (nodes.empty()) return 0;
+	line_query_t query(objects, p1, p2, cpos, cnorm, color, cindex, ignore_cobj, exact);
+	float tmax(1.0);
+
+	if (has_wide_tree()) {
+		traverse_wide_line_any(wnodes, wqnodes, p1, p2, tmax, query);
+		return query.ret;
+	}
+	node_ix_mgr nixm(nodes, p1, p2);
+	unsigned const num_nodes((unsigned)nodes.size());
+
+	for (unsigned nix = 0; nix < num_nodes;) {
+		tree_node const &n(nodes[nix]);
+		if (!nixm.check_node(nix)) continue; // Note: modifies nix
+		unsigned const leaf_ret(query(n.start, n.end, tmax));
+		if (leaf_ret == 2) break; // done
+		if (leaf_ret == 0) continue; // no hit
+		nixm.dinv = vector3d(cpos - p1);
+		nixm.dinv.invert();
+	}
+	return query.ret;
 }
 
 
@@ -340,9 +758,31 @@ void cobj_tree_sphere_t::add_spheres(vector<sphere_with_id_t> &spheres_, bool ve
 }
 
 
+struct cobj_tree_sphere_t::sphere_query_t {
+
+	vector<sphere_with_id_t> const &objects;
+	point const &center;
+	float radius;
+	vector<unsigned> &ids;
+
+	sphere_query_t(vector<sphere_with_id_t> const &objs, point const &center_, float radius_, vector<unsigned> &ids_) : objects(objs), center(center_), radius(radius_), ids(ids_) {}
+
+	void operator()(unsigned start, unsigned end) {
+		for (unsigned i = start; i < end; ++i) { // check leaves
+			if (dist_less_than(center, objects[i].pos, (radius + objects[i].radius))) {ids.push_back(objects[i].id);}
+		}
+	}
+};
+
 void cobj_tree_sphere_t::get_ids_int_sphere(point const &center, float radius, vector<unsigned> &ids) const {
 
 	if (objects.empty()) return;
+
+	if (has_wide_tree()) {
+		sphere_query_t query(objects, center, radius, ids);
+		traverse_wide_any(wnodes, wqnodes, sphere_kids_test_t(center, radius), query);
+		return;
+	}
 	unsigned const num_nodes((unsigned)nodes.size());
 
 	for (unsigned nix = 0; nix < num_nodes;) {
@@ -396,21 +836,33 @@ void cobj_bvh_tree::clear() {
 
 	cobj_tree_base::clear();
 	cixs.resize(0);
+	sorted_cixs.resize(0);
+	build_sa.resize(0);
 }
 
 
 void cobj_bvh_tree::add_cobjs(bool verbose) {
 
 	RESET_TIME;
+	double const start_time(get_bench_time_ms());
 	clear();
 	if (!create_cixs()) return; // nothing to be done
+	if (is_dynamic) {sorted_cixs = cixs;} // only dynamic trees can be refit; cixs are created in sorted order
 	bool const do_mt_build(mt_cobj_tree_build && cixs.size() > 10000);
 	build_tree_from_cixs(do_mt_build);
 
+	build_wide_tree();
+
+	if (is_dynamic) {
+		calc_build_sa();
+		++update_stats.num_rebuilds;
+		update_stats.rebuild_time += get_bench_time_ms() - start_time;
+	}
 	if (verbose) {
 		PRINT_TIME(" Cobj Tree Create");
 		cout << "cobjs: " << cobjs->size() << ", leaves: " << cixs.size() << ", nodes: " << nodes.size()
 				<< ", depth: " << max_depth << ", max_leaves: " << max_leaf_count << ", leaf_nodes: " << num_leaf_nodes << endl;
+		print_tree_quality("Cobj Tree");
 	}
 }
 
@@ -423,7 +875,10 @@ void cobj_bvh_tree::build_tree_from_cixs(bool do_mt_build) {
 	unsigned const root(0);
 	nodes[root] = tree_node(0, (unsigned)cixs.size());
 
-	if (do_mt_build) { // 2x faster build time, 10% slower traversal
+	if (sah_cobj_tree_build) {
+		build_tree_sah_top(do_mt_build);
+	}
+	else if (do_mt_build) { // 2x faster build time, 10% slower traversal
 		build_tree_top_level_omp();
 	}
 	else {
@@ -435,45 +890,306 @@ void cobj_bvh_tree::build_tree_from_cixs(bool do_mt_build) {
 }
 
 
+void cobj_bvh_tree::set_gap_node(unsigned nix, unsigned end_nix) { // unused range of nodes [nix, end_nix) that is skipped over by all queries
+
+	assert(nix < end_nix && end_nix <= nodes.size());
+	tree_node &n(nodes[nix]);
+	n = tree_node(0, 0);
+	UNROLL_3X(n.d[i_][0] = FLT_MAX; n.d[i_][1] = -FLT_MAX;) // inverted cube, fails all intersection tests
+	n.next_node_id = end_nix;
+}
+
+
+inline float get_cube_surface_area(cube_t const &c) {return 2.0f*(c.dx()*c.dy() + c.dy()*c.dz() + c.dz()*c.dx());}
+
+void cobj_bvh_tree::calc_build_sa() {
+
+	build_sa.resize(nodes.size());
+	for (unsigned i = 0; i < nodes.size(); ++i) {build_sa[i] = get_cube_surface_area(nodes[i]);}
+}
+
+
+// returns true if the set of cobjs in this tree is the same as when it was last built, meaning it can be refit rather than rebuilt
+bool cobj_bvh_tree::cobj_set_unchanged() {
+
+	if (sorted_cixs.empty()) return 0; // tree was not created with add_cobjs()
+	cixs.swap(temp_cixs);
+	cixs.resize(0);
+	create_cixs();
+	cixs.swap(temp_cixs);
+	return (temp_cixs == sorted_cixs);
+}
+
+
+// recompute node bounds bottom-up from the current cobj bcubes; also records the cixs range of each node in refit_ranges
+void cobj_bvh_tree::refit_node(unsigned nix) {
+
+	tree_node &n(nodes[nix]);
+
+	if (n.start < n.end) { // leaf
+		calc_node_bbox(n);
+		refit_ranges[nix] = make_pair(n.start, n.end);
+		return;
+	}
+	bool first(1);
+
+	for (unsigned kid = nix+1; kid < n.next_node_id; kid = nodes[kid].next_node_id) { // iterate over children
+		if (is_gap_node(kid)) break; // unused nodes at the end of the range
+		refit_node(kid);
+		if (first) {n.copy_from(nodes[kid]); refit_ranges[nix].first = refit_ranges[kid].first;} else {n.union_with_cube(nodes[kid]);}
+		refit_ranges[nix].second = refit_ranges[kid].second;
+		first = 0;
+	}
+	assert(!first); // must have at least one child
+}
+
+
+// rebuild the subtree rooted at nix (at the given depth) in place, using the nodes range [nix, next_node_id); returns false if the new subtree doesn't fit
+bool cobj_bvh_tree::rebuild_subtree(unsigned nix, unsigned depth) {
+
+	unsigned const cstart(refit_ranges[nix].first), cend(refit_ranges[nix].second), end_nix(nodes[nix].next_node_id);
+	assert(cstart < cend && cend <= cixs.size());
+	cobj_bvh_tree sub_tree(cobjs, is_static, is_dynamic, occluders_only, cubes_only, inc_voxel_cobjs);
+	sub_tree.add_cobj_ids(vector<unsigned>(cixs.begin()+cstart, cixs.begin()+cend));
+	sub_tree.build_tree_from_cixs(0);
+	unsigned const num_nodes(sub_tree.nodes.size());
+	if (nix + num_nodes > end_nix) return 0; // too many nodes, doesn't fit
+	std::copy(sub_tree.cixs.begin(), sub_tree.cixs.end(), cixs.begin()+cstart); // reordered cobjs
+
+	for (unsigned i = 0; i < num_nodes; ++i) { // copy nodes, offsetting indices
+		tree_node &n(nodes[nix+i]);
+		n = sub_tree.nodes[i];
+		if (n.start < n.end) {n.start += cstart; n.end += cstart;}
+		n.next_node_id += nix;
+		build_sa[nix+i] = get_cube_surface_area(n);
+	}
+	if (nix + num_nodes < end_nix) {set_gap_node(nix+num_nodes, end_nix);}
+	nodes[nix].next_node_id = end_nix;
+	max_depth = max(max_depth, depth + sub_tree.max_depth); // sub_tree depths are relative to nix; conservative since the old subtree may have been deeper
+	return 1;
+}
+
+
+// incremental update for dynamic cobjs: refit node bounds if the set of cobjs is unchanged, and rebuild subtrees whose quality degraded;
+// falls back to a full rebuild if cobjs were added or removed
+void cobj_bvh_tree::update_cobjs(bool verbose) {
+
+	if (nodes.empty() || build_sa.size() != nodes.size() || !cobj_set_unchanged()) {add_cobjs(verbose); return;} // can't refit
+	RESET_TIME;
+	double const start_time(get_bench_time_ms());
+	unsigned const num_nodes(nodes.size());
+	refit_ranges.resize(num_nodes);
+	refit_node(0);
+
+	if (get_cube_surface_area(nodes[0]) > REFIT_MAX_SA_GROWTH*build_sa[0]) { // root has degraded, rebuild everything
+		update_stats.refit_time += get_bench_time_ms() - start_time;
+		add_cobjs(verbose);
+		return;
+	}
+	unsigned num_subtree_rebuilds(0);
+	vector<unsigned> end_stack(1, nodes[0].next_node_id); // next_node_id of each ancestor of nix; size is the depth of nix
+
+	for (unsigned nix = 1; nix < num_nodes;) { // top-down: rebuild the largest degraded subtrees
+		while (!end_stack.empty() && end_stack.back() <= nix) {end_stack.pop_back();}
+		tree_node const &n(nodes[nix]);
+		bool const is_branch(n.start == n.end && !is_gap_node(nix));
+
+		if (is_branch && get_cube_surface_area(n) > REFIT_MAX_SA_GROWTH*build_sa[nix]) {
+			if (rebuild_subtree(nix, end_stack.size())) {++num_subtree_rebuilds;} else {++update_stats.num_subtree_fails;}
+			nix = nodes[nix].next_node_id; // skip the subtree
+		}
+		else if (is_gap_node(nix)) {nix = n.next_node_id;}
+		else {
+			if (is_branch) {end_stack.push_back(n.next_node_id);} // descend into the kids
+			++nix;
+		}
+	}
+	if (has_wide_tree()) {build_wide_tree();} // must rebuild from the refit binary tree
+	++update_stats.num_refits;
+	update_stats.num_subtree_rebuilds += num_subtree_rebuilds;
+	update_stats.refit_time += get_bench_time_ms() - start_time;
+	if (verbose) {PRINT_TIME(" Cobj Tree Refit"); cout << TXT(num_nodes) << TXT(num_subtree_rebuilds) << endl;}
+}
+
+
+void bvh_update_stats_t::print(char const *const name) const {
+	cout << name << ": " << TXT(num_rebuilds) << TXT(rebuild_time) << TXT(num_refits) << TXT(refit_time) << TXT(num_subtree_rebuilds) << TXTn(num_subtree_fails);
+}
+
+
 // test_alpha: 0 = allow any alpha value, 1 = require alpha = 1.0, 2 = get intersected cobj with max alpha, 3 = require alpha >= MIN_SHADOW_ALPHA
+struct cobj_bvh_tree::line_query_t {
+
+	cobj_bvh_tree const &tree;
+	point const &p1, &p2;
+	point &cpos;
+	vector3d &cnorm;
+	int &cindex;
+	int ignore_cobj, test_alpha;
+	bool exact, skip_non_drawn, skip_init_colls, skip_movable, ret;
+	float max_alpha;
+
+	line_query_t(cobj_bvh_tree const &tree_, point const &p1_, point const &p2_, point &cpos_, vector3d &cnorm_, int &cindex_, int ignore_cobj_,
+		bool exact_, int test_alpha_, bool skip_non_drawn_, bool skip_init_colls_, bool skip_movable_) : tree(tree_), p1(p1_), p2(p2_), cpos(cpos_), cnorm(cnorm_),
+		cindex(cindex_), ignore_cobj(ignore_cobj_), test_alpha(test_alpha_), exact(exact_), skip_non_drawn(skip_non_drawn_), skip_init_colls(skip_init_colls_),
+		skip_movable(skip_movable_), ret(0), max_alpha(0.0) {}
+
+	unsigned operator()(unsigned start, unsigned end, float &tmax) { // returns 0 = no hit, 1 = hit and tmax was reduced, 2 = done
+		unsigned hit(0);
+		float t(0.0);
+
+		for (unsigned i = start; i < end; ++i) { // check leaves
+			// Note: we test cobj against the original (unclipped) p1 and p2 so that t is correct
+			// Note: we probably don't need to return cnorm and cpos in inexact mode, but it shouldn't be too expensive to do so
+			if ((int)tree.cixs[i] == ignore_cobj) continue;
+			coll_obj const &c(tree.get_cobj(i));
+			if (tree.skip_line_query_cobj(c, p1, test_alpha, max_alpha, skip_non_drawn, skip_init_colls, skip_movable)) continue;
+			if (!c.line_int_exact(p1, p2, t, cnorm, 0.0, tmax)) continue;
+			cindex = tree.cixs[i];
+			cpos   = p1 + (p2 - p1)*t;
+			ret    = 1;
+			//if (c.type == COLL_POLYGON && dot_product((p2 - p1), c.norm) < 0.0) {} // back-facing polygon test
+			if (!exact && test_alpha != 2) return 2; // return first hit
+			max_alpha = c.cp.color.alpha; // we need all intersections to find the max alpha
+			tmax = t;
+			hit  = 1;
+		}
+		return hit;
+	}
+};
+
 bool cobj_bvh_tree::check_coll_line(point const &p1, point const &p2, point &cpos, vector3d &cnorm, int &cindex,
 	int ignore_cobj, bool exact, int test_alpha, bool skip_non_drawn, bool skip_init_colls, bool skip_movable) const
 {
 	if (nodes.empty()) return 0;
-	bool ret(0);
-	float t(0.0), tmin(0.0), tmax(1.0), max_alpha(0.0);
+	line_query_t query(*this, p1, p2, cpos, cnorm, cindex, ignore_cobj, exact, test_alpha, skip_non_drawn, skip_init_colls, skip_movable);
+	float tmax(1.0);
+
+	if (has_wide_tree() && test_alpha != 2) { // max alpha mode depends on the binary tree traversal order
+		traverse_wide_line_any(wnodes, wqnodes, p1, p2, tmax, query);
+		return query.ret;
+	}
 	node_ix_mgr nixm(nodes, p1, p2);
 	unsigned const num_nodes((unsigned)nodes.size());
 
 	for (unsigned nix = 0; nix < num_nodes;) {
 		tree_node const &n(nodes[nix]);
 		if (!nixm.check_node(nix)) continue; // Note: modifies nix
+		unsigned const leaf_ret(query(n.start, n.end, tmax));
+		if (leaf_ret == 2) break; // done
+		if (leaf_ret == 0) continue; // no hit
+		nixm.dinv = vector3d(cpos - p1);
+		nixm.dinv.invert();
+	}
+	return query.ret;
+}
 
-		for (unsigned i = n.start; i < n.end; ++i) { // check leaves
-			// Note: we test cobj against the original (unclipped) p1 and p2 so that t is correct
-			// Note: we probably don't need to return cnorm and cpos in inexact mode, but it shouldn't be too expensive to do so
-			if ((int)cixs[i] == ignore_cobj) continue;
-			coll_obj const &c(get_cobj(i));
-			if (!obj_ok(c))                  continue;
-			if (skip_non_drawn  && !c.cp.might_be_drawn())                    continue;
-			if (skip_movable    && c.is_movable())                            continue;
-			if (test_alpha == 1 && c.is_semi_trans())                         continue; // semi-transparent, can see through
-			if (test_alpha == 2 && c.cp.color.alpha <= max_alpha)             continue; // lower alpha than an earlier object
-			if (test_alpha == 3 && c.cp.color.alpha < MIN_SHADOW_ALPHA)       continue; // less than min alpha
-			if (skip_init_colls && c.contains_pt(p1) && c.contains_point(p1)) continue;
-			if (!c.line_int_exact(p1, p2, t, cnorm, tmin, tmax))              continue;
-			cindex = cixs[i];
-			cpos   = p1 + (p2 - p1)*t;
-			//if (c.type == COLL_POLYGON && dot_product((p2 - p1), c.norm) < 0.0) {} // back-facing polygon test
-			if (!exact && test_alpha != 2) return 1; // return first hit
-			max_alpha = c.cp.color.alpha; // we need all intersections to find the max alpha
-			nixm.dinv = vector3d(cpos - p1);
-			nixm.dinv.invert();
-			tmax = t;
-			ret  = 1;
+
+#ifdef ENABLE_SSE_PACKETS
+
+struct line_packet_t { // SoA ray data for COLL_LINE_PACKET_SIZE rays, in the same form as node_ix_mgr: start point and inverse delta
+
+	__m128 px, py, pz, dx, dy, dz, negx, negy, negz;
+
+	void set(coll_line_query_t const *const queries, unsigned num, vector3d const *const dinvs) {
+		alignas(16) float v[6][COLL_LINE_PACKET_SIZE] = {0};
+
+		for (unsigned r = 0; r < num; ++r) {
+			UNROLL_3X(v[i_][r] = queries[r].p1[i_]; v[i_+3][r] = dinvs[r][i_];)
 		}
+		px = _mm_load_ps(v[0]); py = _mm_load_ps(v[1]); pz = _mm_load_ps(v[2]);
+		dx = _mm_load_ps(v[3]); dy = _mm_load_ps(v[4]); dz = _mm_load_ps(v[5]);
+		__m128 const zero(_mm_setzero_ps());
+		negx = _mm_cmplt_ps(dx, zero); negy = _mm_cmplt_ps(dy, zero); negz = _mm_cmplt_ps(dz, zero); // same test as node_ix_mgr
+	}
+	static void clip_dim(float const d[2], __m128 const &p, __m128 const &dinv, __m128 const &neg, __m128 &tmin, __m128 &tmax) {
+		__m128 const lo(_mm_set1_ps(d[0])), hi(_mm_set1_ps(d[1]));
+		__m128 const t1(_mm_mul_ps(_mm_sub_ps(_mm_or_ps(_mm_and_ps(neg, hi), _mm_andnot_ps(neg, lo)), p), dinv)); // near side
+		__m128 const t2(_mm_mul_ps(_mm_sub_ps(_mm_or_ps(_mm_and_ps(neg, lo), _mm_andnot_ps(neg, hi)), p), dinv)); // far side
+		// Note: min/max return the second operand for NaNs, which matches the comparisons in get_line_clip()
+		tmax = _mm_min_ps(t2, tmax);
+		tmin = _mm_max_ps(t1, tmin);
+	}
+	// returns a bit mask of rays that intersect the cube; bit-exact with get_line_clip()
+	unsigned check_cube(float const d[3][2]) const {
+		__m128 tmin(_mm_setzero_ps()), tmax(_mm_set1_ps(1.0f));
+		clip_dim(d[0], px, dx, negx, tmin, tmax);
+		clip_dim(d[1], py, dy, negy, tmin, tmax);
+		clip_dim(d[2], pz, dz, negz, tmin, tmax);
+		return _mm_movemask_ps(_mm_cmplt_ps(tmin, tmax));
+	}
+};
+
+#endif // ENABLE_SSE_PACKETS
+
+
+// packet version of check_coll_line() that traverses the tree once for up to COLL_LINE_PACKET_SIZE coherent lines;
+// the results for each line are identical to calling check_coll_line() with that line
+void cobj_bvh_tree::check_coll_line_packet(coll_line_query_t *queries, unsigned num, bool exact, int test_alpha, bool skip_non_drawn, bool skip_movable) const {
+
+	assert(num <= COLL_LINE_PACKET_SIZE);
+	for (unsigned r = 0; r < num; ++r) {queries[r].coll = 0;}
+	if (nodes.empty() || num == 0) return;
+	unsigned const MAX_STACK_DEPTH = 256;
+#ifdef ENABLE_SSE_PACKETS
+	if (num > 1 && max_depth+2 < MAX_STACK_DEPTH) {
+		struct stack_entry_t {unsigned end_nix, mask;} stack[MAX_STACK_DEPTH]; // open branch nodes and the rays that intersect them
+		vector3d dinvs[COLL_LINE_PACKET_SIZE];
+		float max_alpha[COLL_LINE_PACKET_SIZE] = {0}, tmaxs[COLL_LINE_PACKET_SIZE] = {1.0, 1.0, 1.0, 1.0};
+		unsigned active((1 << num) - 1), sp(0);
+
+		for (unsigned r = 0; r < num; ++r) {
+			dinvs[r] = queries[r].p2 - queries[r].p1;
+			dinvs[r].invert();
+		}
+		line_packet_t packet;
+		packet.set(queries, num, dinvs);
+		unsigned const num_nodes((unsigned)nodes.size());
+
+		for (unsigned nix = 0; nix < num_nodes && active;) {
+			while (sp > 0 && nix >= stack[sp-1].end_nix) {--sp;} // exit completed subtrees
+			tree_node const &n(nodes[nix]);
+			unsigned const mask((sp ? stack[sp-1].mask : active) & active & packet.check_cube(n.d));
+
+			if (mask == 0) { // failed the bbox test for all rays
+				assert(n.next_node_id > nix);
+				nix = n.next_node_id;
+				continue;
+			}
+			++nix;
+			if (n.start == n.end) {stack[sp++] = {n.next_node_id, mask}; continue;} // branch node
+			bool dinv_changed(0);
+
+			for (unsigned i = n.start; i < n.end; ++i) { // check leaves
+				coll_obj const &c(get_cobj(i));
+
+				for (unsigned r = 0; r < num; ++r) {
+					if (!(mask & active & (1 << r))) continue;
+					coll_line_query_t &q(queries[r]);
+					float t(0.0);
+					if ((int)cixs[i] == q.ignore_cobj) continue;
+					if (skip_line_query_cobj(c, q.p1, test_alpha, max_alpha[r], skip_non_drawn, q.skip_init_colls, skip_movable)) continue;
+					if (!c.line_int_exact(q.p1, q.p2, t, q.cnorm, 0.0, tmaxs[r])) continue;
+					q.cindex = cixs[i];
+					q.cpos   = q.p1 + (q.p2 - q.p1)*t;
+					q.coll   = 1;
+					if (!exact && test_alpha != 2) {active &= ~(1 << r); continue;} // return first hit
+					max_alpha[r] = c.cp.color.alpha; // we need all intersections to find the max alpha
+					dinvs[r] = vector3d(q.cpos - q.p1);
+					dinvs[r].invert();
+					tmaxs[r] = t;
+					dinv_changed = 1;
+				}
+			}
+			if (dinv_changed) {packet.set(queries, num, dinvs);}
+		} // for nix
+		return;
+	}
+#endif // ENABLE_SSE_PACKETS
+	for (unsigned r = 0; r < num; ++r) { // scalar fallback
+		coll_line_query_t &q(queries[r]);
+		q.coll = check_coll_line(q.p1, q.p2, q.cpos, q.cnorm, q.cindex, q.ignore_cobj, exact, test_alpha, skip_non_drawn, q.skip_init_colls, skip_movable);
 	}
-	return ret;
 }
 
 
@@ -584,6 +1300,22 @@ void cobj_bvh_tree::get_coll_line_cobjs(point const &pos1, point const &pos2, in
 }
 
 
+struct cobj_bvh_tree::sphere_query_t {
+
+	cobj_bvh_tree const &tree;
+	cube_t const &bcube;
+	int ignore_cobj;
+	vert_coll_detector &vcd;
+
+	sphere_query_t(cobj_bvh_tree const &tree_, cube_t const &bcube_, int ignore_cobj_, vert_coll_detector &vcd_) : tree(tree_), bcube(bcube_), ignore_cobj(ignore_cobj_), vcd(vcd_) {}
+
+	void operator()(unsigned start, unsigned end) {
+		for (unsigned i = start; i < end; ++i) { // check leaves
+			if ((int)tree.cixs[i] != ignore_cobj && tree.get_cobj(i).intersects(bcube)) vcd.check_cobj(tree.cixs[i]);
+		}
+	}
+};
+
 // Note: actually, this only returns sphere intersection candidates
 void cobj_bvh_tree::get_coll_sphere_cobjs(point const &center, float radius, int ignore_cobj, vert_coll_detector &vcd) const {
 
@@ -592,6 +1324,12 @@ void cobj_bvh_tree::get_coll_sphere_cobjs(point const &center, float radius, int
 	cube_t bcube(center, center);
 	bcube.expand_by(radius);
 
+	if (has_wide_tree()) {
+		sphere_query_t query(*this, bcube, ignore_cobj, vcd);
+		traverse_wide_any(wnodes, wqnodes, cube_kids_test_t(bcube), query);
+		return;
+	}
+
 	for (unsigned nix = 0; nix < num_nodes;) {
 		tree_node const &n(nodes[nix]);
 
@@ -665,7 +1403,7 @@ void cobj_bvh_tree::build_tree_top_level_omp() { // single octtree level
 		build_tree(kid, ((count == num) ? 7 : 0), 1, ptd); // if all in one bin, make that bin a leaf
 		unsigned const next_kid(ptd.get_next_node_ix());
 		assert(next_kid <= end_nix);
-		if (next_kid < end_nix) {nodes[next_kid].next_node_id = end_nix;} // close the gap of unused nodes
+		if (next_kid < end_nix) {set_gap_node(next_kid, end_nix);} // close the gap of unused nodes
 		nodes[kid].next_node_id = end_nix;
 	}
 	nodes.resize(cur_nix);
@@ -730,16 +1468,7 @@ void cobj_bvh_tree::build_tree(unsigned nix, unsigned skip_dims, unsigned depth,
 	for (unsigned bix = 0; bix < 3; ++bix) {
 		unsigned const count(bin_count[bix]);
 		if (count == 0) continue; // empty bin
-		unsigned const kid(ptd.get_next_node_ix());
-		ptd.increment_node_ix();
-
-		if (ptd.at_node_end()) {
-			assert(ptd.can_be_resized);
-			unsigned const old_nodes_size(nodes.size());
-			nodes.resize(5*old_nodes_size/4); // increase by 25% (will invalidate n reference)
-			cout << "Warning: Resizing cobj_bvh_tree nodes from " << old_nodes_size << " to " << nodes.size() << endl;
-			ptd.advance_end_range(nodes.size());
-		}
+		unsigned const kid(alloc_node(ptd)); // will invalidate n reference
 		nodes[kid] = tree_node(cur, cur+count);
 		build_tree(kid, skip_dims, depth+1, ptd);
 		nodes[kid].next_node_id = ptd.get_next_node_ix();
@@ -749,6 +1478,272 @@ void cobj_bvh_tree::build_tree(unsigned nix, unsigned skip_dims, unsigned depth,
 	nodes[nix].start = nodes[nix].end = 0; // branch node has no leaves
 }
 
+unsigned cobj_bvh_tree::alloc_node(per_thread_data &ptd) { // returns the index of the next unused node, resizing nodes if needed
+
+	unsigned const nix(ptd.get_next_node_ix());
+	ptd.increment_node_ix();
+
+	if (ptd.at_node_end() && ptd.can_be_resized) {
+		unsigned const old_nodes_size(nodes.size());
+		nodes.resize(5*old_nodes_size/4); // increase by 25% (will invalidate node references)
+		cout << "Warning: Resizing cobj_bvh_tree nodes from " << old_nodes_size << " to " << nodes.size() << endl;
+		ptd.advance_end_range(nodes.size());
+	}
+	return nix;
+}
+
+
+// *** cobj_bvh_tree binned SAH build ***
+
+
+struct sah_binner_t { // maps object centers to bins along one dim
+
+	unsigned dim;
+	float lo, scale;
+
+	sah_binner_t(unsigned dim_, float lo_, float extent) : dim(dim_), lo(lo_), scale(NUM_SAH_BINS/extent) {assert(extent > 0.0);}
+	unsigned get_bin(point const &center) const {return min(NUM_SAH_BINS-1, unsigned(max(0.0f, (center[dim] - lo)*scale)));}
+};
+
+struct sah_bin_pred_t { // partitions objects into bins [0, split] and [split+1, NUM_SAH_BINS)
+
+	sah_binner_t binner;
+	unsigned split;
+
+	sah_bin_pred_t(sah_binner_t const &binner_, unsigned split_) : binner(binner_), split(split_) {}
+	template<typename T> bool operator()(T const &obj) const {return (binner.get_bin(obj.center) <= split);}
+};
+
+struct sah_bin_t {
+	cube_t bcube;
+	unsigned count;
+	sah_bin_t() : count(0) {}
+
+	void add(cube_t const &c, unsigned num) {
+		if (num == 0) return;
+		if (count == 0) {bcube = c;} else {bcube.union_with_cube(c);}
+		count += num;
+	}
+};
+
+
+// calculates the bbox of node nix and finds its best SAH split; if it should be split, the objects are partitioned and the number
+// of objects in the first child is returned, otherwise the node is made into a leaf and 0 is returned
+unsigned cobj_bvh_tree::split_node_sah(unsigned nix, unsigned depth, vector<sah_obj_t> &objs) {
+
+	tree_node &n(nodes[nix]);
+	assert(n.start < n.end && n.end <= objs.size());
+	unsigned const num(n.end - n.start);
+	cube_t cbounds(objs[n.start].center, objs[n.start].center); // bounds of object centers
+	n.copy_from(objs[n.start].bcube);
+
+	for (unsigned i = n.start+1; i < n.end; ++i) {
+		n.union_with_cube(objs[i].bcube);
+		cbounds.union_with_pt(objs[i].center);
+	}
+	max_depth = max(max_depth, depth);
+
+	if (num <= MAX_LEAF_SIZE) { // base case
+		register_leaf(num);
+		return 0;
+	}
+	float const node_sa(get_cube_surface_area(n)), inv_sa((node_sa > 0.0) ? 1.0/node_sa : 0.0);
+	float best_cost(FLT_MAX);
+	int best_dim(-1);
+	unsigned best_split(0);
+
+	for (unsigned dim = 0; dim < 3; ++dim) {
+		float const extent(cbounds.d[dim][1] - cbounds.d[dim][0]);
+		if (!(extent > 0.0)) continue; // all centers are the same in this dim
+		sah_binner_t const binner(dim, cbounds.d[dim][0], extent);
+		sah_bin_t bins[NUM_SAH_BINS], right[NUM_SAH_BINS], left;
+		for (unsigned i = n.start; i < n.end; ++i) {bins[binner.get_bin(objs[i].center)].add(objs[i].bcube, 1);}
+
+		for (unsigned b = NUM_SAH_BINS-1; b > 0; --b) { // sweep from the right to accumulate the bounds of bins [b, NUM_SAH_BINS)
+			right[b] = ((b+1 < NUM_SAH_BINS) ? right[b+1] : sah_bin_t());
+			right[b].add(bins[b].bcube, bins[b].count);
+		}
+		for (unsigned b = 0; b+1 < NUM_SAH_BINS; ++b) { // sweep from the left to evaluate the split after bin b
+			left.add(bins[b].bcube, bins[b].count);
+			sah_bin_t const &r(right[b+1]);
+			if (left.count == 0 || r.count == 0) continue; // not a split
+			float const cost(SAH_TRAV_COST + (get_cube_surface_area(left.bcube)*left.count + get_cube_surface_area(r.bcube)*r.count)*inv_sa);
+			if (cost < best_cost) {best_cost = cost; best_dim = dim; best_split = b;}
+		}
+	}
+	if (best_dim < 0 || (best_cost >= num && num <= SAH_MAX_LEAF_SIZE)) { // can't split, or splitting doesn't reduce the cost
+		register_leaf(num);
+		return 0;
+	}
+	sah_bin_pred_t const pred(sah_binner_t(best_dim, cbounds.d[best_dim][0], (cbounds.d[best_dim][1] - cbounds.d[best_dim][0])), best_split);
+	unsigned const num_left(std::partition(objs.begin()+n.start, objs.begin()+n.end, pred) - (objs.begin()+n.start));
+	assert(num_left > 0 && num_left < num);
+	return num_left;
+}
+
+
+// binary SAH BVH: builds the subtree rooted at nix using nodes allocated from ptd
+void cobj_bvh_tree::build_tree_sah(unsigned nix, unsigned depth, per_thread_data &ptd, vector<sah_obj_t> &objs) {
+
+	unsigned const num_left(split_node_sah(nix, depth, objs));
+	if (num_left == 0) return; // leaf
+	unsigned const start(nodes[nix].start), end(nodes[nix].end), counts[2] = {num_left, (end - start - num_left)};
+	unsigned cur(start);
+
+	for (unsigned k = 0; k < 2; ++k) {
+		unsigned const kid(alloc_node(ptd)); // Note: may invalidate node references
+		nodes[kid] = tree_node(cur, cur+counts[k]);
+		build_tree_sah(kid, depth+1, ptd, objs);
+		nodes[kid].next_node_id = ptd.cur_nix;
+		cur += counts[k];
+	}
+	assert(cur == end);
+	nodes[nix].start = nodes[nix].end = 0; // branch node has no leaves
+}
+
+
+// splits the top levels of the tree serially and adds subtrees with up to max_task_objs objects to tasks; node nix owns the nodes range [nix, end_nix),
+// where a binary subtree with N objects in leaves of at least one object needs at most 2N-1 nodes
+void cobj_bvh_tree::split_tree_sah_top(unsigned nix, unsigned end_nix, unsigned depth, vector<sah_obj_t> &objs, vector<sah_task_t> &tasks, unsigned max_task_objs) {
+
+	unsigned const num_left(split_node_sah(nix, depth, objs));
+
+	if (num_left == 0) { // leaf
+		if (nix+1 < end_nix) {set_gap_node(nix+1, end_nix);}
+		return;
+	}
+	unsigned const start(nodes[nix].start), end(nodes[nix].end), counts[2] = {num_left, (end - start - num_left)};
+	unsigned cur(start), cur_nix(nix+1);
+
+	for (unsigned k = 0; k < 2; ++k) {
+		unsigned const kid(cur_nix), kid_end(kid + 2*counts[k] - 1);
+		nodes[kid] = tree_node(cur, cur+counts[k]);
+		if (counts[k] > max_task_objs) {split_tree_sah_top(kid, kid_end, depth+1, objs, tasks, max_task_objs);}
+		else {tasks.push_back(sah_task_t(kid, kid_end, depth+1));}
+		nodes[kid].next_node_id = kid_end;
+		cur_nix = kid_end;
+		cur    += counts[k];
+	}
+	assert(cur == end && cur_nix == end_nix);
+	nodes[nix].start = nodes[nix].end = 0; // branch node has no leaves
+}
+
+
+void cobj_bvh_tree::build_tree_sah_top(bool do_mt_build) {
+
+	unsigned const num(cixs.size());
+	vector<sah_obj_t> objs(num);
+
+	for (unsigned i = 0; i < num; ++i) {
+		sah_obj_t &obj(objs[i]);
+		obj.bcube.copy_from(get_cobj(i));
+		obj.center = obj.bcube.get_cube_center();
+		obj.cix    = cixs[i];
+	}
+	nodes.resize(2*num - 1); // upper bound on the number of nodes; the root node is preserved
+
+	if (do_mt_build) { // split the top levels serially, then build the subtrees in parallel, largest first
+		vector<sah_task_t> tasks;
+		split_tree_sah_top(0, nodes.size(), 0, objs, tasks, max(SAH_MIN_TASK_OBJS, num/64));
+		sort(tasks.begin(), tasks.end());
+
+		#pragma omp parallel for schedule(dynamic,1)
+		for (int i = 0; i < (int)tasks.size(); ++i) {
+			sah_task_t const &task(tasks[i]);
+			per_thread_data ptd(task.nix+1, task.end_nix, 0);
+			build_tree_sah(task.nix, task.depth, ptd, objs);
+			if (ptd.cur_nix < task.end_nix) {set_gap_node(ptd.cur_nix, task.end_nix);} // close the gap of unused nodes
+		}
+		remove_gap_nodes();
+		tree_quality_t const tq(calc_tree_quality()); // recalculate stats that were updated by multiple threads
+		max_depth      = tq.max_depth;
+		max_leaf_count = tq.max_leaf_size;
+		num_leaf_nodes = tq.num_leaf_nodes;
+	}
+	else {
+		per_thread_data ptd(1, nodes.size(), 1);
+		build_tree_sah(0, 0, ptd, objs);
+		nodes.resize(ptd.cur_nix);
+	}
+	for (unsigned i = 0; i < num; ++i) {cixs[i] = objs[i].cix;} // write back the reordered cixs
+}
+
+
+// compacts the nodes by removing unused ranges left by the parallel build and remapping next_node_id
+void cobj_bvh_tree::remove_gap_nodes() {
+
+	unsigned const num_nodes(nodes.size());
+	vector<unsigned> new_ix(num_nodes+1);
+	unsigned num_used(0);
+
+	for (unsigned nix = 0; nix < num_nodes;) {
+		if (is_gap_node(nix)) { // skip the unused range
+			unsigned const end_nix(nodes[nix].next_node_id);
+			assert(end_nix > nix && end_nix <= num_nodes);
+			for (; nix < end_nix; ++nix) {new_ix[nix] = num_used;}
+		}
+		else {new_ix[nix++] = num_used++;}
+	}
+	new_ix[num_nodes] = num_used;
+	if (num_used == num_nodes) return; // no gaps
+
+	for (unsigned nix = 0; nix < num_nodes;) {
+		if (is_gap_node(nix)) {nix = nodes[nix].next_node_id; continue;}
+		unsigned const nnix(new_ix[nix]); // Note: nnix <= nix, so nodes can be moved in place
+		nodes[nnix] = nodes[nix];
+		nodes[nnix].next_node_id = new_ix[nodes[nnix].next_node_id];
+		++nix;
+	}
+	nodes.resize(num_used);
+}
+
+
+// *** cobj_tree_base quality report ***
+
+
+cobj_tree_base::tree_quality_t cobj_tree_base::calc_tree_quality() const {
+
+	tree_quality_t tq;
+	if (nodes.empty()) return tq;
+	float const root_sa(get_cube_surface_area(nodes[0])), inv_sa((root_sa > 0.0) ? 1.0/root_sa : 0.0);
+	vector<unsigned> end_stack; // next_node_id of the branch nodes containing the current node
+
+	for (unsigned nix = 0; nix < nodes.size();) {
+		while (!end_stack.empty() && nix >= end_stack.back()) {end_stack.pop_back();} // exit completed subtrees
+		tree_node const &n(nodes[nix]);
+		if (n.start == n.end && n.d[0][0] > n.d[0][1]) {nix = n.next_node_id; continue;} // skip gap node (unused range)
+		float const hit_prob(nix ? min(1.0f, get_cube_surface_area(n)*inv_sa) : 1.0f); // the root is always visited
+		++tq.num_nodes;
+		tq.max_depth = max(tq.max_depth, (unsigned)end_stack.size());
+
+		if (n.start < n.end) { // leaf
+			unsigned const num(n.end - n.start);
+			unsigned bin(0);
+			for (unsigned sz = 1; bin < 5 && num > sz; sz *= 2) {++bin;}
+			++tq.leaf_size_hist[bin];
+			++tq.num_leaf_nodes;
+			tq.max_leaf_size  = max(tq.max_leaf_size, num);
+			tq.expected_cost += hit_prob*num;
+		}
+		else { // branch
+			tq.expected_cost += hit_prob*SAH_TRAV_COST;
+			end_stack.push_back(n.next_node_id);
+		}
+		++nix;
+	}
+	return tq;
+}
+
+
+void cobj_tree_base::print_tree_quality(char const *const name) const {
+
+	tree_quality_t const tq(calc_tree_quality());
+	unsigned const *const hist(tq.leaf_size_hist);
+	cout << name << " quality: expected_cost=" << tq.expected_cost << " nodes=" << tq.num_nodes << " leaf_nodes=" << tq.num_leaf_nodes
+		 << " max_depth=" << tq.max_depth << " max_leaf_size=" << tq.max_leaf_size << endl;
+	cout << "leaf sizes: 1: " << hist[0] << ", 2: " << hist[1] << ", 3-4: " << hist[2] << ", 5-8: " << hist[3] << ", 9-16: " << hist[4] << ", 17+: " << hist[5] << endl;
+}
+
 
 // is_static is_dynamic occluders_only cubes_only inc_voxel_cobjs
 cobj_bvh_tree cobj_tree_static (&coll_objects, 1, 0, 0, 0, 0); // does not include voxels
@@ -762,6 +1757,14 @@ cobj_bvh_tree &get_tree(bool dynamic) {
 	return (dynamic ? cobj_tree_dynamic : cobj_tree_static);
 }
 
+void add_cobjs_mem_usage(mem_usage_t *usage) { // cobjs and their BVHs
+	usage[MEM_COBJS].add(coll_objects.capacity()*sizeof(coll_obj), 0, coll_objects.size());
+	cobj_tree_static.add_mem_usage(usage);
+	cobj_tree_dynamic.add_mem_usage(usage);
+	cobj_tree_occlude.add_mem_usage(usage);
+	cobj_tree_static_moving.add_mem_usage(usage);
+}
+
 void build_static_moving_cobj_tree() {
 
 	cobj_tree_static_moving.clear();
@@ -776,6 +1779,7 @@ void build_static_moving_cobj_tree() {
 	if (!moving_cids.empty()) {
 		cobj_tree_static_moving.add_cobj_ids(moving_cids);
 		cobj_tree_static_moving.build_tree_from_cixs(0);
+		cobj_tree_static_moving.build_wide_tree();
 	}
 }
 
@@ -788,11 +1792,17 @@ void build_cobj_tree(bool dynamic, bool verbose) {
 		//cobj_tree_triangles.add_cobjs(coll_objects, verbose);
 	}
 	else { // dynamic
-		if (begin_motion) {get_tree(1).add_cobjs(verbose);}
+		if (!begin_motion) {}
+		else if (refit_dynamic_cobj_tree) {get_tree(1).update_cobjs(verbose);}
+		else {get_tree(1).add_cobjs(verbose);}
 		//build_static_moving_cobj_tree();
 	}
 }
 
+void print_cobj_tree_update_stats() {
+	if (refit_dynamic_cobj_tree) {get_tree(1).get_update_stats().print("Dynamic Cobj Tree");}
+}
+
 // can use with ray trace lighting, snow collision?, maybe water reflections
 bool check_coll_line_exact_tree(point const &p1, point const &p2, point &cpos, vector3d &cnorm, int &cindex, int ignore_cobj,
 	bool dynamic, int test_alpha, bool skip_non_drawn, bool include_voxels, bool skip_init_colls, bool skip_movable, bool no_stat_moving)
@@ -805,6 +1815,19 @@ bool check_coll_line_exact_tree(point const &p1, point const &p2, point &cpos, v
 	return ret;
 }
 
+// packet version of check_coll_line_exact_tree() for static cobjs, used for coherent rays in lighting ray tracing; queries are updated in place
+void check_coll_line_exact_tree_packet(coll_line_query_t *queries, unsigned num, int test_alpha, bool skip_non_drawn, bool include_voxels, bool skip_movable, bool no_stat_moving) {
+
+	for (unsigned r = 0; r < num; ++r) {queries[r].cindex = -1;}
+	get_tree(0).check_coll_line_packet(queries, num, 1, test_alpha, skip_non_drawn, skip_movable);
+
+	for (unsigned r = 0; r < num; ++r) {
+		coll_line_query_t &q(queries[r]);
+		if (!no_stat_moving) {q.coll |= cobj_tree_static_moving.check_coll_line(q.p1, (q.coll ? q.cpos : q.p2), q.cpos, q.cnorm, q.cindex, q.ignore_cobj, 1, test_alpha, skip_non_drawn, q.skip_init_colls, skip_movable);}
+		if (include_voxels)  {q.coll |= check_voxel_coll_line(q.p1, (q.coll ? q.cpos : q.p2), q.cpos, q.cnorm, q.cindex, q.ignore_cobj, 1);}
+	}
+}
+
 // can use with snow shadows, grass shadows, tree leaf shadows
 bool check_coll_line_tree(point const &p1, point const &p2, int &cindex, int ignore_cobj, bool dynamic,
 	int test_alpha, bool skip_non_drawn, bool include_voxels, bool skip_init_colls, bool skip_movable)
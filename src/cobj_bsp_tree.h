@@ -5,8 +5,31 @@
 #define _COBJ_BSP_TREE_H_
 
 #include "physics_objects.h"
+#include <cstdint>
 
 
+// alternative flattened 4-ary node layouts built from the binary tree, with SoA child bounds
+struct bvh4_node_t { // size = 132
+	float bounds[3][2][4]; // {x,y,z}, {lo,hi}, child
+	unsigned ix[4], num[4]; // leaf child: object range [ix, ix+num); branch child: num=0, and ix is the index of the child node
+	unsigned valid_mask; // bit mask of used child slots
+
+	bvh4_node_t() : valid_mask(0) {}
+	void set_child(unsigned k, cube_t const &c, unsigned ix_, unsigned num_);
+};
+
+struct bvh4_qnode_t { // compressed bvh4_node_t: child bounds are conservatively quantized to 16 bits relative to the union of child bounds; size = 108
+	float origin[3], scale[3];
+	uint16_t qbounds[3][2][4]; // {x,y,z}, {lo,hi}, child
+	unsigned ix[4], num[4], valid_mask;
+
+	bvh4_qnode_t(bvh4_node_t const &n);
+	float get_bound(unsigned dim, unsigned dir, unsigned k) const {return (origin[dim] + float(qbounds[dim][dir][k])*scale[dim]);}
+};
+
+
+unsigned const MAX_BRANCH_KIDS = 8; // the MT build's root has one kid per octant
+
 class cobj_tree_base {
 
 protected:
@@ -21,6 +44,8 @@ protected:
 	};
 
 	vector<tree_node> nodes;
+	vector<bvh4_node_t> wnodes; // optional 4-wide copy of nodes
+	vector<bvh4_qnode_t> wqnodes; // optional quantized 4-wide copy of nodes
 	unsigned max_depth, max_leaf_count, num_leaf_nodes;
 
 	inline void register_leaf(unsigned num) {
@@ -29,6 +54,13 @@ protected:
 	}
 	bool check_for_leaf(unsigned num, unsigned skip_dims);
 	unsigned get_conservative_num_nodes(unsigned num) const {return (3*num/2 + 8);}
+	unsigned get_branch_kids(unsigned nix, unsigned kids[MAX_BRANCH_KIDS]) const;
+	unsigned add_wide_node(unsigned nix, unsigned depth, unsigned &wide_depth);
+	unsigned add_wide_node(unsigned *kids, unsigned nkids, unsigned depth, unsigned &wide_depth);
+	void set_wide_child(unsigned wix, unsigned k, unsigned kid, unsigned depth, unsigned &wide_depth);
+	unsigned get_num_leaf_objs() const;
+	template<typename N> unsigned check_wide_subtree(vector<N> const &wn, unsigned wix, unsigned &nvisited) const;
+	bool has_wide_tree() const {return (!wnodes.empty() || !wqnodes.empty());}
 
 	struct node_ix_mgr {
 		point const p1, p2;
@@ -41,10 +73,44 @@ protected:
 	};
 
 public:
+	struct tree_quality_t { // expected traversal cost is relative to one object intersection test, for a random ray hitting the root
+		unsigned num_nodes, num_leaf_nodes, max_depth, max_leaf_size, leaf_size_hist[6]; // leaf sizes 1, 2, 3-4, 5-8, 9-16, 17+
+		float expected_cost;
+		tree_quality_t() : num_nodes(0), num_leaf_nodes(0), max_depth(0), max_leaf_size(0), expected_cost(0.0) {for (unsigned i = 0; i < 6; ++i) {leaf_size_hist[i] = 0;}}
+	};
+	tree_quality_t calc_tree_quality() const;
+
 	cobj_tree_base() : max_depth(0), max_leaf_count(0), num_leaf_nodes(0) {}
 	bool is_empty() const {return nodes.empty();}
-	void clear() {nodes.resize(0);}
+	void clear() {nodes.resize(0); wnodes.clear(); wqnodes.clear();}
+	void add_mem_usage(mem_usage_t *usage) const { // the binary nodes are kept alongside the wide nodes, so both are counted
+		usage[MEM_COBJ_BVH ].add(nodes.capacity()*sizeof(tree_node), 0, nodes.size());
+		usage[MEM_COBJ_WBVH].add((wnodes.capacity()*sizeof(bvh4_node_t) + wqnodes.capacity()*sizeof(bvh4_qnode_t)), 0, (wnodes.size() + wqnodes.size()));
+	}
 	bool get_root_bcube(cube_t &bc) const;
+	void build_wide_tree(); // uses the wide_cobj_trees config option
+	void print_tree_quality(char const *const name) const;
+
+	// W and R are the model3d file writer/reader types, which serialize arrays as a count followed by raw elements
+	template<typename W> void write_nodes(W &w) const {
+		w.write_array(nodes);
+		w.write(max_depth);
+		w.write(max_leaf_count);
+		w.write(num_leaf_nodes);
+	}
+	template<typename R> bool read_nodes(R &r) { // the wide tree is rebuilt rather than stored
+		if (!r.read_array(nodes) || !r.read(max_depth) || !r.read(max_leaf_count) || !r.read(num_leaf_nodes)) return 0;
+		build_wide_tree();
+		return 1;
+	}
+	void swap_nodes(cobj_tree_base &t) {
+		nodes.swap(t.nodes);
+		wnodes.swap(t.wnodes);
+		wqnodes.swap(t.wqnodes);
+		std::swap(max_depth, t.max_depth);
+		std::swap(max_leaf_count, t.max_leaf_count);
+		std::swap(num_leaf_nodes, t.num_leaf_nodes);
+	}
 };
 
 
@@ -64,11 +130,20 @@ public:
 		objects.clear(); // reserve(0)?
 	}
 	void build_tree_top(bool verbose);
+	void swap(cobj_tree_simple_type_t &t) {swap_nodes(t); objects.swap(t.objects);}
+	template<typename W> void write_tree(W &w) const {w.write_array(objects); write_nodes(w);}
+	template<typename R> bool read_tree(R &r) {
+		clear();
+		if (r.read_array(objects) && read_nodes(r)) return 1;
+		clear();
+		return 0;
+	}
 };
 
 
 class cobj_tree_tquads_t : public cobj_tree_simple_type_t<coll_tquad> {
 
+	struct line_query_t; // leaf test functor
 	virtual void calc_node_bbox(tree_node &n) const;
 
 public:
@@ -96,6 +171,7 @@ struct sphere_with_id_t : public sphere_t {
 
 class cobj_tree_sphere_t : public cobj_tree_simple_type_t<sphere_with_id_t> {
 
+	struct sphere_query_t; // leaf test functor
 	virtual void calc_node_bbox(tree_node &n) const;
 
 public:
@@ -105,12 +181,43 @@ public:
 };
 
 
+unsigned const COLL_LINE_PACKET_SIZE = 4; // number of lines traversed together in a packet query (one SSE register)
+
+struct coll_line_query_t { // one line of a packet query: p1, p2, ignore_cobj, and skip_init_colls are inputs, the rest are outputs
+	point p1, p2, cpos;
+	vector3d cnorm;
+	int cindex, ignore_cobj;
+	bool skip_init_colls, coll;
+
+	coll_line_query_t() : cindex(-1), ignore_cobj(-1), skip_init_colls(0), coll(0) {}
+	coll_line_query_t(point const &p1_, point const &p2_, int ignore_cobj_=-1, bool sic=0)
+		: p1(p1_), p2(p2_), cpos(p2_), cnorm(zero_vector), cindex(-1), ignore_cobj(ignore_cobj_), skip_init_colls(sic), coll(0) {}
+};
+
+
+struct bvh_update_stats_t { // tracks the cost of full rebuilds vs. incremental refits
+	unsigned num_rebuilds, num_refits, num_subtree_rebuilds, num_subtree_fails;
+	double rebuild_time, refit_time; // in ms, from get_bench_time_ms() since per-frame refits are often under 1ms
+	bvh_update_stats_t() : num_rebuilds(0), num_refits(0), num_subtree_rebuilds(0), num_subtree_fails(0), rebuild_time(0.0), refit_time(0.0) {}
+	void print(char const *const name) const;
+};
+
+
 class cobj_bvh_tree : public cobj_tree_base {
 
 	coll_obj_group const *cobjs;
 	vector<unsigned> cixs;
 	bool is_static, is_dynamic, occluders_only, cubes_only, inc_voxel_cobjs;
 
+	// incremental refit state
+	vector<unsigned> sorted_cixs, temp_cixs; // cixs from the last full build (in creation order) and scratch space for comparing against it
+	vector<float> build_sa; // per-node surface area at the time the node was built
+	vector<pair<unsigned, unsigned>> refit_ranges; // per-node cixs range, valid after refit_node()
+	bvh_update_stats_t update_stats;
+
+	struct line_query_t; // leaf test functors
+	struct sphere_query_t;
+
 	struct per_thread_data {
 		vector<unsigned> temp_bins[3];
 		unsigned start_nix, end_nix, cur_nix;
@@ -123,13 +230,47 @@ class cobj_bvh_tree : public cobj_tree_base {
 		void increment_node_ix() {assert(cur_nix >= start_nix); cur_nix++;}
 	};
 
+	// binned SAH build state
+	struct sah_obj_t {
+		cube_t bcube;
+		point center;
+		unsigned cix;
+	};
+	struct sah_task_t { // subtree to be built by one thread, using the nodes range [nix, end_nix)
+		unsigned nix, end_nix, depth;
+		sah_task_t(unsigned nix_, unsigned end_nix_, unsigned depth_) : nix(nix_), end_nix(end_nix_), depth(depth_) {}
+		bool operator<(sah_task_t const &t) const {return ((end_nix - nix) > (t.end_nix - t.nix));} // largest first
+	};
+
 	void add_cobj(unsigned ix) {if (obj_ok((*cobjs)[ix])) {cixs.push_back(ix);}}
 	coll_obj const &get_cobj(unsigned ix) const {return (*cobjs)[cixs[ix]];}
 	bool create_cixs();
 	void calc_node_bbox(tree_node &n) const;
 	void build_tree_top_level_omp();
 	void build_tree(unsigned nix, unsigned skip_dims, unsigned depth, per_thread_data &ptd);
-
+	unsigned alloc_node(per_thread_data &ptd);
+	void build_tree_sah_top(bool do_mt_build);
+	void split_tree_sah_top(unsigned nix, unsigned end_nix, unsigned depth, vector<sah_obj_t> &objs, vector<sah_task_t> &tasks, unsigned max_task_objs);
+	void build_tree_sah(unsigned nix, unsigned depth, per_thread_data &ptd, vector<sah_obj_t> &objs);
+	unsigned split_node_sah(unsigned nix, unsigned depth, vector<sah_obj_t> &objs);
+	void remove_gap_nodes();
+	void set_gap_node(unsigned nix, unsigned end_nix);
+	bool is_gap_node(unsigned nix) const {tree_node const &n(nodes[nix]); return (n.start == n.end && n.d[0][0] > n.d[0][1]);}
+	void calc_build_sa();
+	bool cobj_set_unchanged();
+	void refit_node(unsigned nix);
+	bool rebuild_subtree(unsigned nix, unsigned depth);
+
+	bool skip_line_query_cobj(coll_obj const &c, point const &p1, int test_alpha, float max_alpha, bool skip_non_drawn, bool skip_init_colls, bool skip_movable) const {
+		if (!obj_ok(c))                  return 1;
+		if (skip_non_drawn  && !c.cp.might_be_drawn())                    return 1;
+		if (skip_movable    && c.is_movable())                            return 1;
+		if (test_alpha == 1 && c.is_semi_trans())                         return 1; // semi-transparent, can see through
+		if (test_alpha == 2 && c.cp.color.alpha <= max_alpha)             return 1; // lower alpha than an earlier object
+		if (test_alpha == 3 && c.cp.color.alpha < MIN_SHADOW_ALPHA)       return 1; // less than min alpha
+		if (skip_init_colls && c.contains_pt(p1) && c.contains_point(p1)) return 1;
+		return 0;
+	}
 	bool obj_ok(coll_obj const &c) const {
 		return (((is_static && c.status == COLL_STATIC) || (is_dynamic && c.status == COLL_DYNAMIC) || (!is_static && !is_dynamic)) &&
 			(!occluders_only || c.is_occluder()) && !(c.cp.flags & COBJ_NO_COLL) && (!cubes_only || c.type == COLL_CUBE) &&
@@ -141,12 +282,20 @@ public:
 		: cobjs(cobjs_), is_static(s), is_dynamic(d), occluders_only(o), cubes_only(c), inc_voxel_cobjs(v) {assert(cobjs);}
 
 	unsigned get_num_objs() const {return cixs.size();}
+	void add_mem_usage(mem_usage_t *usage) const { // build and refit data is counted with the binary nodes
+		cobj_tree_base::add_mem_usage(usage);
+		usage[MEM_COBJ_BVH].add(((cixs.capacity() + sorted_cixs.capacity() + temp_cixs.capacity())*sizeof(unsigned) +
+			build_sa.capacity()*sizeof(float) + refit_ranges.capacity()*sizeof(pair<unsigned, unsigned>)), 0);
+	}
 	void clear();
 	void add_cobj_ids(vector<unsigned> const &cids) {assert(cixs.empty() && !cids.empty()); cixs = cids;}
 	void add_cobjs(bool verbose);
 	void build_tree_from_cixs(bool do_mt_build);
+	void update_cobjs(bool verbose);
+	bvh_update_stats_t const &get_update_stats() const {return update_stats;}
 	bool check_coll_line(point const &p1, point const &p2, point &cpos, vector3d &cnorm, int &cindex, int ignore_cobj,
 		bool exact, int test_alpha, bool skip_non_drawn, bool skip_init_colls, bool skip_movable) const;
+	void check_coll_line_packet(coll_line_query_t *queries, unsigned num, bool exact, int test_alpha, bool skip_non_drawn, bool skip_movable) const;
 	bool check_point_contained(point const &p, int &cindex) const;
 	void get_intersecting_cobjs(cube_t const &cube, vector<unsigned> &cobjs, int ignore_cobj, float toler, bool check_ccounter, int id_for_cobj_int) const;
 	bool is_cobj_contained(point const &viewer, point const *const pts, unsigned npts, int ignore_cobj, int &cobj) const;
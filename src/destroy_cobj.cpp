@@ -13,6 +13,7 @@ bool const REMOVE_UNANCHORED = 1;
 
 int destroy_thresh(0);
 vector<unsigned> falling_cobjs;
+cube_t falling_cobjs_bcube(all_zeros); // region swept by falling cobjs since the last static cobj update
 
 extern unsigned scene_smap_vbo_invalid;
 extern float tstep, zmin, base_gravity;
@@ -255,7 +256,12 @@ void add_to_falling_cobjs(set<unsigned> const &ids) {
 }
 
 
-void invalidate_static_cobjs() {build_cobj_tree(0, 0);}
+void invalidate_static_cobjs(cube_t const &changed_bcube) {
+
+	pause_lighting_bake_for_cobj_update(); // background lighting can't use the cobj tree while it's being rebuilt
+	build_cobj_tree(0, 0);
+	invalidate_global_lighting(changed_bcube); // lighting in and around the changed region is now out of date
+}
 
 
 // Note: should be named partially_destroy_cube_area() or something like that
@@ -350,17 +356,21 @@ unsigned subtract_cube(vector<color_tid_vol> &cts, vector3d &cdir, csg_cube cons
 	} // end while()
 
 	// remove destroyed cobjs
+	cube_t removed_bcube(all_zeros);
+
 	for (vector<int>::const_iterator i = to_remove.begin(); i != to_remove.end(); ++i) {
+		if (removed_bcube.is_all_zeros()) {removed_bcube = cobjs[*i];} else {removed_bcube.union_with_cube(cobjs[*i]);} // new cobjs are inside the removed cobjs
 		if (!cobjs[*i].no_shadow_map()) {scene_smap_vbo_invalid = 2;} // full rebuild of shadowers
 		cobjs[*i].remove_waypoint();
 		remove_coll_object(*i); // remove old collision object
 	}
-	if (!to_remove.empty()) {invalidate_static_cobjs();} // after destroyed cobj removal
+	if (!to_remove.empty()) {invalidate_static_cobjs(removed_bcube);} // after destroyed cobj removal
 
 	// add new waypoints (after build_cobj_tree and end_batch)
 	for (vector<int>::const_iterator i = just_added.begin(); i != just_added.end(); ++i) {
 		cobjs[*i].add_connect_waypoint(); // slow
 	}
+	if (!to_remove.empty()) {reconnect_waypoints_near(cube);} // update edges through the modified region
 
 	// process unanchored cobjs
 	if (LET_COBJS_FALL || REMOVE_UNANCHORED) {
@@ -425,7 +435,9 @@ void check_falling_cobjs() {
 		coll_objects.get_cobj(ix).clear_internal_data();
 		coll_obj cobj(coll_objects[ix]); // make a copy
 		cobj.v_fall += accel; // terminal velocity?
+		if (falling_cobjs_bcube.is_all_zeros()) {falling_cobjs_bcube = cobj;} else {falling_cobjs_bcube.union_with_cube(cobj);}
 		cobj.shift_by(point(0.0, 0.0, tstep*cobj.v_fall), 1); // translate down
+		falling_cobjs_bcube.union_with_cube(cobj);
 		int const index(cobj.add_coll_cobj());
 		remove_coll_object(ix);
 		assert((int)ix != index);
@@ -438,7 +450,8 @@ void check_falling_cobjs() {
 	add_to_falling_cobjs(anchored[0]);
 	
 	if (falling_cobjs != last_falling) {
-		invalidate_static_cobjs();
+		invalidate_static_cobjs(falling_cobjs_bcube);
+		falling_cobjs_bcube.set_to_zeros();
 		scene_smap_vbo_invalid = 2; // full rebuild of shadowers
 	}
 	//PRINT_TIME("Check Falling Cobjs");
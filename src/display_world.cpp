@@ -301,6 +301,7 @@ void final_draw(float framerate) {
 	draw_inventory(); // drawn last, on top of everything else
 	draw_camera_filters(cfilters);
 	draw_frame_rate(framerate);
+	draw_mem_stats();
 	show_other_messages();
 	user_action_key = 0;
 }
@@ -726,6 +727,38 @@ void flashlight_next_frame() {
 	flashlight_on = 0;
 }
 
+// one fixed timestep frame of physics, AI, and traffic without any drawing; used in headless mode (see run_headless());
+// tiled terrain tiles aren't updated because tile generation creates GL textures, so the replay benchmark tiles column is always 0 here
+void advance_headless_frame() {
+
+	++cur_display_iter;
+	replay_bench_next_frame();
+	update_mem_stats();
+	fticks = 1.0;
+	iticks = 1;
+	tstep  = TIMESTEP*fticks;
+	uevent_advance_frame();
+
+	if (world_mode == WMODE_UNIVERSE) {
+		advance_universe_headless();
+		return;
+	}
+	auto_advance_time();
+	if (animate2) {total_wind += wind*fticks;}
+
+	if (world_mode == WMODE_INF_TERRAIN) {
+		next_city_frame(0); // cars and pedestrians
+	}
+	else if (world_mode == WMODE_GROUND) { // same updates as in map mode
+		process_platforms_falling_moving_and_light_triggers();
+		process_groups();
+		build_cobj_tree(1, 0);
+		if (game_mode) {update_blasts(); update_game_frame();}
+	}
+	if (combined_gu) {advance_universe_headless();}
+}
+
+
 void display() {
 
 	check_gl_error(0);
@@ -740,6 +773,8 @@ void display() {
 	static int init(0), frame_index(0), time_index(0), global_time(0), tticks(0);
 	static point old_spos(0.0, 0.0, 0.0);
 	++cur_display_iter;
+	replay_bench_next_frame();
+	update_mem_stats();
 	proc_kbd_events();
 
 	if (!init) { // the first frame
@@ -747,7 +782,7 @@ void display() {
 		fticks = 1.0;
 		time0  = timer1;
 	}
-	else if (animate && !DETERMINISTIC_TIME) {
+	else if (animate && !DETERMINISTIC_TIME && !replay_bench_active) { // replay benchmark uses a fixed timestep
 		double ftick(0.0);
 		static float carry(0.0);
 		double const time_delta((TICKS_PER_SECOND*(timer1 - time0))/1000.0f);
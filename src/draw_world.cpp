@@ -523,6 +523,8 @@ void setup_procedural_shaders(shader_t &s, float min_alpha, bool indir_lighting,
 void setup_object_render_data() {
 
 	RESET_TIME;
+	PROFILE_SCOPE("Setup Object Render Data");
+	bench_timer_t bench_timer(BENCH_LIGHTING);
 	bool const TIMETEST(0);
 	static float dlight_add_thresh(0.0);
 	calc_cur_ambient_diffuse();
@@ -4,14 +4,71 @@
 
 #include "3DWorld.h"
 #include "mesh.h"
+#include "heightmap.h"
 #include <cfloat> // for FLT_EPSILON
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+unsigned const EROSION_BATCH_SIZE = 256; // droplets in a batch read the heightmap from the start of the batch, so results don't depend on thread count
 
 
 extern float erode_amount, water_plane_z;
 
 
+unsigned get_max_erosion_threads() {
+#ifdef _OPENMP
+	return omp_get_max_threads();
+#else
+	return 1;
+#endif
+}
+
+
+class droplet_delta_map_t { // sparse heightmap deltas of one droplet; open addressing hash map from cell index to delta, with entries in insertion order
+
+	static unsigned const EMPTY = 0xFFFFFFFF;
+	vector<unsigned> slots; // index into entries, or EMPTY
+	vector<pair<unsigned, float> > entries; // {cell index, delta}
+	unsigned mask;
+
+	unsigned find_slot(unsigned ix) const {
+		for (unsigned s = ((ix*2654435761U) & mask); ; s = ((s + 1) & mask)) {
+			unsigned const e(slots[s]);
+			if (e == EMPTY || entries[e].first == ix) return s;
+		}
+	}
+	void rehash(unsigned new_size) {
+		slots.assign(new_size, EMPTY);
+		mask = new_size - 1;
+		for (unsigned e = 0; e < entries.size(); ++e) {slots[find_slot(entries[e].first)] = e;}
+	}
+public:
+	droplet_delta_map_t() : mask(0) {rehash(1024);}
+	vector<pair<unsigned, float> > const &get_entries() const {return entries;}
+
+	void clear() { // clear in reverse insertion order so that probe sequences of remaining entries stay intact
+		for (auto i = entries.rbegin(); i != entries.rend(); ++i) {slots[find_slot(i->first)] = EMPTY;}
+		entries.clear();
+	}
+	float get_val(vector<float> const &base, unsigned ix) const {
+		unsigned const e(slots[find_slot(ix)]);
+		return ((e == EMPTY) ? base[ix] : (base[ix] + entries[e].second));
+	}
+	void add(unsigned ix, float delta) {
+		unsigned const s(find_slot(ix));
+		if (slots[s] != EMPTY) {entries[slots[s]].second += delta; return;}
+		slots[s] = (unsigned)entries.size();
+		entries.push_back(make_pair(ix, delta));
+		if (2*entries.size() > slots.size()) {rehash(2*(unsigned)slots.size());}
+	}
+};
+
+
 // see http://ranmantaru.com/blog/2011/10/08/water-erosion-on-heightmap-terrain/
-void apply_erosion(float *heightmap, int xsize, int ysize, float min_zval, unsigned num_iters) {
+// Droplets are simulated in parallel in fixed size batches: each droplet reads the heightmap as of the start of its batch plus its own changes,
+// and the changes of a batch are merged in droplet order, which makes the result independent of the number of threads (num_threads=0 uses all)
+void apply_erosion(float *heightmap, int xsize, int ysize, float min_zval, unsigned num_iters, unsigned num_threads) {
 
 	if (num_iters == 0 || erode_amount <= 0.0) return; // erosion disabled
 	RESET_TIME;
@@ -24,8 +81,10 @@ void apply_erosion(float *heightmap, int xsize, int ysize, float min_zval, unsig
 	float const Kq=10, Kw=0.001f, Kr=0.9f, Kd=0.02f, Ki=0.1f, minSlope=0.05f, g=20, Kg=g*2;
 	int const PAD(4), NX(xsize+2*PAD), NY(ysize+2*PAD);
 	unsigned const MAX_PATH_LEN(4*NX*NY);
-	vector<vector2d> erosion(NX*NY, vector2d(0.0, 0.0));
+	int const nthreads(max(1U, (num_threads ? num_threads : get_max_erosion_threads())));
 	vector<float> mh_padded(NX*NY);
+	vector<droplet_delta_map_t> delta_maps(nthreads); // one per thread
+	vector<vector<pair<unsigned, float> > > batch_deltas(EROSION_BATCH_SIZE); // one per droplet in the batch
 
 	// pad mesh by 1 unit on each side to create a buffer of trash around the edges that can be discarded
 	for (int y = 0; y < NY; ++y) {
@@ -37,13 +96,11 @@ void apply_erosion(float *heightmap, int xsize, int ysize, float min_zval, unsig
 	}
 
 #define HMAP_INDEX(x, y) (NX*max(min(y, NY-1), 0) + max(min(x, NX-1), 0))
-#define HMAP(x, y) mh_padded[HMAP_INDEX(x, y)]
+#define HMAP(x, y) dmap.get_val(mh_padded, HMAP_INDEX(x, y))
 
 #define DEPOSIT_AT(X, Z, W) { \
 	float const delta = ds*erode_amount*(W); \
-	unsigned const ix(HMAP_INDEX((X), (Z))); \
-	erosion[ix].y += delta; \
-	if (!(X < 0 || Z < 0 || X >= NX || Z >= NY)) {mh_padded[ix] += delta;} \
+	if (!(X < 0 || Z < 0 || X >= NX || Z >= NY)) {dmap.add(HMAP_INDEX((X), (Z)), delta);} \
 }
 
 #define DEPOSIT(H) \
@@ -55,104 +112,109 @@ void apply_erosion(float *heightmap, int xsize, int ysize, float min_zval, unsig
 
 #define ERODE(X, Z, W) { \
 	float const delta=ds*erode_amount*(W); \
-	unsigned const ix(HMAP_INDEX((X), (Z))); \
-	mh_padded[ix]-=delta; \
-	vector2d &e=erosion[ix]; \
-	float r=e.x, d=e.y; \
-	if (delta<=d) {d-=delta;} else {r+=delta-d; d=0;} \
-	e.x=r; e.y=d; \
+	dmap.add(HMAP_INDEX((X), (Z)), -delta); \
 }
 
-#pragma omp parallel for schedule(dynamic,1)
-	for (int iter=0; iter < (int)num_iters; ++iter) {
-		rand_gen_t rgen;
-		rgen.set_state(iter+11, 79*iter+121);
-		int xi = PAD + (rgen.rand()%xsize);
-		int zi = PAD + (rgen.rand()%ysize);
-		float xp=xi, zp=zi, xf=0, zf=0, s=0, v=0, w=1, dx=0, dz=0;
-		float h=HMAP(xi, zi), h00=h, h10=HMAP(xi+1, zi), h01=HMAP(xi, zi+1), h11=HMAP(xi+1, zi+1);
-
-		unsigned numMoves=0;
-		for (; numMoves<MAX_PATH_LEN; ++numMoves) {
-			// calc gradient
-			float gx=h00+h01-h10-h11, gz=h00+h10-h01-h11;
-			// calc next pos
-			dx=(dx-gx)*Ki+gx;
-			dz=(dz-gz)*Ki+gz;
-
-			float dl=sqrtf(dx*dx+dz*dz);
-			if (dl<=FLT_EPSILON) { // pick random dir
-				float a=rgen.rand_float()*TWO_PI;
-				dx=cosf(a); dz=sinf(a);
-			}
-			else {
-				dx/=dl; dz/=dl;
-			}
-			float nxp=xp+dx, nzp=zp+dz;
-			// sample next height
-			int nxi=floor(nxp), nzi=floor(nzp);
-			float nxf=nxp-nxi, nzf=nzp-nzi;
-			float nh00=HMAP(nxi, nzi), nh10=HMAP(nxi+1, nzi), nh01=HMAP(nxi, nzi+1), nh11=HMAP(nxi+1, nzi+1);
-			float nh=(nh00*(1-nxf)+nh10*nxf)*(1-nzf)+(nh01*(1-nxf)+nh11*nxf)*nzf;
-			// adjust by HALF_DXY = average mesh texel size - this is river depth
-			if (max(max(nh00, nh10), max(nh01, nh11)) < water_plane_z - HALF_DXY) break; // reached ocean water, stop and ignore sediment
-
-			// if higher than current, try to deposit sediment up to neighbour height
-			bool const outside(xi < 0 || zi < 0 || xi >= NX || zi >= NY);
-			if (nh>=h || outside) {
-				float ds=(nh-h)+0.001f;
-
-				if (ds>=s || outside) {
-					ds=s;
-					DEPOSIT(h) // deposit all sediment
-					s=0;
-					break; // stop
+	for (unsigned batch_start = 0; batch_start < num_iters; batch_start += EROSION_BATCH_SIZE) {
+		int const batch_end(min(num_iters, (batch_start + EROSION_BATCH_SIZE)));
+
+#pragma omp parallel for schedule(dynamic,1) num_threads(nthreads)
+		for (int iter=batch_start; iter < batch_end; ++iter) {
+			droplet_delta_map_t &dmap(delta_maps[omp_get_thread_num_3dw()]);
+			dmap.clear();
+			rand_gen_t rgen;
+			rgen.set_state(iter+11, 79*iter+121);
+			int xi = PAD + (rgen.rand()%xsize);
+			int zi = PAD + (rgen.rand()%ysize);
+			float xp=xi, zp=zi, xf=0, zf=0, s=0, v=0, w=1, dx=0, dz=0;
+			float h=HMAP(xi, zi), h00=h, h10=HMAP(xi+1, zi), h01=HMAP(xi, zi+1), h11=HMAP(xi+1, zi+1);
+
+			unsigned numMoves=0;
+			for (; numMoves<MAX_PATH_LEN; ++numMoves) {
+				// calc gradient
+				float gx=h00+h01-h10-h11, gz=h00+h10-h01-h11;
+				// calc next pos
+				dx=(dx-gx)*Ki+gx;
+				dz=(dz-gz)*Ki+gz;
+
+				float dl=sqrtf(dx*dx+dz*dz);
+				if (dl<=FLT_EPSILON) { // pick random dir
+					float a=rgen.rand_float()*TWO_PI;
+					dx=cosf(a); dz=sinf(a);
+				}
+				else {
+					dx/=dl; dz/=dl;
 				}
-				DEPOSIT(h)
-				s-=ds;
-				v=0;
-			}
-			// compute transport capacity
-			float dh=h-nh;
-			float slope=dh;
-			//float slope=dh/sqrtf(dh*dh+1);
-			float q=max(slope, minSlope)*v*w*Kq;
-
-			// deposit/erode (don't erode more than dh)
-			float ds=s-q;
-			if (ds>=0) { // deposit
-				ds*=Kd;
-				//ds=minval(ds, 1.0f);
-				DEPOSIT(dh)
-				s-=ds;
-			}
-			else { // erode
-				ds*=-Kr;
-				ds=min(ds, dh*0.99f);
-				ds*=((get_bare_ls_tid(nh) == ROCK_TEX) ? 0.5 : 2.0); // rock erodes slower than dirt/sand
-
-				for (int z=zi-1; z<=zi+2; ++z) {
-					float zo=z-zp, zo2=zo*zo;
-
-					for (int x=xi-1; x<=xi+2; ++x) {
-						float xo=x-xp;
-						float w=1-(xo*xo+zo2)*0.25f;
-						if (w<=0) continue;
-						w*=0.1591549430918953f;
-						ERODE(x, z, w)
+				float nxp=xp+dx, nzp=zp+dz;
+				// sample next height
+				int nxi=floor(nxp), nzi=floor(nzp);
+				float nxf=nxp-nxi, nzf=nzp-nzi;
+				float nh00=HMAP(nxi, nzi), nh10=HMAP(nxi+1, nzi), nh01=HMAP(nxi, nzi+1), nh11=HMAP(nxi+1, nzi+1);
+				float nh=(nh00*(1-nxf)+nh10*nxf)*(1-nzf)+(nh01*(1-nxf)+nh11*nxf)*nzf;
+				// adjust by HALF_DXY = average mesh texel size - this is river depth
+				if (max(max(nh00, nh10), max(nh01, nh11)) < water_plane_z - HALF_DXY) break; // reached ocean water, stop and ignore sediment
+
+				// if higher than current, try to deposit sediment up to neighbour height
+				bool const outside(xi < 0 || zi < 0 || xi >= NX || zi >= NY);
+				if (nh>=h || outside) {
+					float ds=(nh-h)+0.001f;
+
+					if (ds>=s || outside) {
+						ds=s;
+						DEPOSIT(h) // deposit all sediment
+						s=0;
+						break; // stop
 					}
+					DEPOSIT(h)
+					s-=ds;
+					v=0;
 				}
-				dh-=ds;
-				s+=ds;
-			}
-			// move to the neighbor
-			v=sqrtf(v*v+Kg*dh);
-			w*=1-Kw;
-			xp=nxp; zp=nzp; xi=nxi; zi=nzi; xf=nxf; zf=nzf;
-			h=nh; h00=nh00; h10=nh10; h01=nh01; h11=nh11;
-		} // for numMoves
-		if (numMoves>=MAX_PATH_LEN) {cout << "droplet path is too long: " << iter << endl;}
-	} // for iter
+				// compute transport capacity
+				float dh=h-nh;
+				float slope=dh;
+				//float slope=dh/sqrtf(dh*dh+1);
+				float q=max(slope, minSlope)*v*w*Kq;
+
+				// deposit/erode (don't erode more than dh)
+				float ds=s-q;
+				if (ds>=0) { // deposit
+					ds*=Kd;
+					//ds=minval(ds, 1.0f);
+					DEPOSIT(dh)
+					s-=ds;
+				}
+				else { // erode
+					ds*=-Kr;
+					ds=min(ds, dh*0.99f);
+					ds*=((get_bare_ls_tid(nh) == ROCK_TEX) ? 0.5 : 2.0); // rock erodes slower than dirt/sand
+
+					for (int z=zi-1; z<=zi+2; ++z) {
+						float zo=z-zp, zo2=zo*zo;
+
+						for (int x=xi-1; x<=xi+2; ++x) {
+							float xo=x-xp;
+							float w=1-(xo*xo+zo2)*0.25f;
+							if (w<=0) continue;
+							w*=0.1591549430918953f;
+							ERODE(x, z, w)
+						}
+					}
+					dh-=ds;
+					s+=ds;
+				}
+				// move to the neighbor
+				v=sqrtf(v*v+Kg*dh);
+				w*=1-Kw;
+				xp=nxp; zp=nzp; xi=nxi; zi=nzi; xf=nxf; zf=nzf;
+				h=nh; h00=nh00; h10=nh10; h01=nh01; h11=nh11;
+			} // for numMoves
+			if (numMoves>=MAX_PATH_LEN) {cout << "droplet path is too long: " << iter << endl;}
+			batch_deltas[iter - batch_start] = dmap.get_entries();
+		} // for iter
+		for (int i = 0; i < batch_end - (int)batch_start; ++i) { // merge in droplet order
+			for (auto const &d : batch_deltas[i]) {mh_padded[d.first] += d.second;}
+		}
+	} // for batch_start
 
 	// remove padding and clamp to min_zval
 	for (int y = 0; y < ysize; ++y) {
@@ -163,3 +225,37 @@ void apply_erosion(float *heightmap, int xsize, int ysize, float min_zval, unsig
 	PRINT_TIME("Erosion");
 }
 
+
+
+// runs erosion on each heightmap with 1, 2, 4, ... threads, reporting the time and checking that the results are identical
+void run_erosion_benchmark(vector<std::string> const &fns, unsigned num_iters) {
+
+	unsigned const max_threads(get_max_erosion_threads());
+
+	for (auto fn = fns.begin(); fn != fns.end(); ++fn) {
+		heightmap_t hmap(0, 7, 0, 0, *fn, 0);
+		hmap.load(-1, 0, 1, 1);
+		unsigned const xsize(hmap.width), ysize(hmap.height);
+		vector<float> orig_vals(xsize*ysize), ref_vals;
+		assert(!orig_vals.empty());
+
+		for (unsigned y = 0; y < ysize; ++y) {
+			for (unsigned x = 0; x < xsize; ++x) {orig_vals[y*xsize + x] = hmap.get_heightmap_value(x, y);}
+		}
+		hmap.free_data();
+		float const min_zval(*min_element(orig_vals.begin(), orig_vals.end()));
+		double ref_time(0.0);
+
+		for (unsigned nt = 1; ; nt = min(2*nt, max_threads)) {
+			vector<float> vals(orig_vals);
+			double const start_time(get_bench_time_ms());
+			apply_erosion(&vals.front(), xsize, ysize, min_zval, num_iters, nt);
+			double const time(get_bench_time_ms() - start_time);
+			if (ref_vals.empty()) {ref_vals = vals; ref_time = time;}
+			bool const identical(memcmp(&vals.front(), &ref_vals.front(), vals.size()*sizeof(float)) == 0);
+			cout << "Erosion benchmark " << *fn << " " << xsize << "x" << ysize << " iters: " << num_iters << " threads: " << nt << " time: " << time
+				 << "ms speedup: " << ref_time/time << " identical: " << identical << endl;
+			if (nt == max_threads) break;
+		}
+	} // for fn
+}
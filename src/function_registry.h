@@ -9,6 +9,7 @@
 
 struct xform_matrix;
 struct cube_with_zval_t;
+struct coll_line_query_t;
 
 int omp_get_thread_num_3dw();
 
@@ -90,6 +91,7 @@ point get_sun_pos();
 point get_moon_pos();
 colorRGBA get_bkg_color(point const &p1, vector3d const &v12);
 void draw_scene_from_custom_frustum(pos_dir_up const &pdu, int cobj_id, int reflection_pass, bool inc_mesh, bool inc_grass, bool inc_water);
+void advance_headless_frame();
 
 // function prototypes - draw_world
 void set_fill_mode();
@@ -262,6 +264,7 @@ float get_tiled_terrain_height_tex(float xval, float yval, bool nearest_texel=0)
 vector3d get_tiled_terrain_height_tex_norm(int x, int y);
 bool write_default_hmap_modmap();
 float update_tiled_terrain(float &min_camera_dist);
+void add_tiled_terrain_mem_usage(mem_usage_t *usage);
 void pre_draw_tiled_terrain(bool reflection_pass);
 void render_tt_models(bool reflection_pass, bool transparent_pass);
 void draw_tiled_terrain(bool reflection_pass);
@@ -270,6 +273,7 @@ void end_tiled_terrain_lightning();
 void draw_tiled_terrain_clouds(bool reflection_pass);
 void draw_tiled_terrain_decid_tree_shadows();
 void clear_tiled_terrain(bool no_regen_buildings=0);
+void flush_tiled_terrain_disk_cache();
 void reset_tiled_terrain_state();
 void clear_tiled_terrain_shaders();
 float get_tiled_terrain_water_level();
@@ -290,6 +294,7 @@ void write_heightmap_png(std::string const &fn);
 void setup_tt_fog_pre(shader_t &s);
 void setup_tt_fog_post(shader_t &s);
 void setup_tile_shader_shadow_map(shader_t &s);
+void gen_tiled_terrain_buildings();
 
 // function prototypes - precipitation
 void draw_local_precipitation(bool no_update=0);
@@ -325,7 +330,10 @@ float do_glaciate_exp(float value);
 float get_rel_wpz();
 void init_terrain_mesh();
 float eval_mesh_sin_terms(float xv, float yv);
+void run_sine_sum_benchmark(unsigned num_iters);
 float get_exact_zval(float xval, float yval);
+void hash_add_bytes(uint64_t &hash, void const *data, size_t sz);
+uint64_t get_mesh_gen_params_hash();
 void reset_offsets();
 float get_median_height(float distribution_pos);
 float get_water_z_height();
@@ -338,7 +346,8 @@ bool load_state(const char *filename);
 bool save_state(const char *filename);
 
 // function prototypes - erosion
-void apply_erosion(float *heightmap, int xsize, int ysize, float min_zval, unsigned num_iters);
+void apply_erosion(float *heightmap, int xsize, int ysize, float min_zval, unsigned num_iters, unsigned num_threads=0);
+void run_erosion_benchmark(vector<std::string> const &fns, unsigned num_iters);
 
 // function prototypes - city_gen
 template<typename T> bool check_bcubes_sphere_coll(vector<T> const &bcubes, point const &sc, float radius, bool xy_only);
@@ -368,6 +377,7 @@ void destroy_city_in_radius(point const &pos, float radius);
 bool get_city_color_at_xy(float x, float y, colorRGBA &color);
 void set_city_lighting_shader_opts(shader_t &s, cube_t const &lights_bcube, bool use_dlights, bool use_smap, float pcf_scale=1.0);
 unsigned get_city_model_gpu_mem();
+void add_city_mem_usage(mem_usage_t *usage);
 cube_t get_city_lights_bcube();
 void next_pedestrian_animation();
 void free_city_context();
@@ -415,6 +425,7 @@ float highest_mesh_point(point const &pt, float radius);
 
 // function prototypes - collision detection
 void reserve_coll_objects(unsigned size);
+void add_cobjs_mem_usage(mem_usage_t *usage);
 bool swap_and_set_as_coll_objects(coll_obj_group &new_cobjs);
 void add_reflective_cobj(unsigned index);
 int  add_coll_cube(cube_t &cube, cobj_params const &cparams, int platform_id=-1, int dhcm=0);
@@ -448,8 +459,11 @@ void free_cobj_draw_group_vbos();
 // function prototypes - coll_cell_search
 void build_static_moving_cobj_tree();
 void build_cobj_tree(bool dynamic=0, bool verbose=1);
+void print_cobj_tree_update_stats();
 bool check_coll_line_exact_tree(point const &p1, point const &p2, point &cpos, vector3d &cnorm, int &cindex, int ignore_cobj,
 	bool dynamic=0, int test_alpha=0, bool skip_non_drawn=0, bool include_voxels=1, bool skip_init_colls=0, bool skip_movable=0, bool no_stat_moving=0);
+void check_coll_line_exact_tree_packet(coll_line_query_t *queries, unsigned num, int test_alpha=0, bool skip_non_drawn=0,
+	bool include_voxels=1, bool skip_movable=0, bool no_stat_moving=0);
 bool check_coll_line_tree(point const &p1, point const &p2, int &cindex, int ignore_cobj, bool dynamic=0, int test_alpha=0,
 	bool skip_non_drawn=0, bool include_voxels=1, bool skip_init_colls=0, bool skip_movable=0);
 bool cobj_contained_tree(point const &viewer, point const *const pts, unsigned npts, int ignore_cobj, int &cobj);
@@ -594,6 +608,7 @@ void load_texture_names();
 void load_textures();
 unsigned get_loaded_textures_cpu_mem();
 unsigned get_loaded_textures_gpu_mem();
+void add_textures_mem_usage(mem_usage_t *usage);
 int texture_lookup(std::string const &name);
 int get_texture_by_name(std::string const &name, bool is_normal_map=0, bool invert_y=0, int wrap_mir=1, float aniso=0.0);
 unsigned load_cube_map_texture(std::string const &name);
@@ -745,6 +760,7 @@ bool no_grass();
 void gen_grass();
 void update_grass_vbos();
 void draw_grass();
+void add_grass_mem_usage(mem_usage_t *usage);
 void modify_grass_at(point const &pos, float radius, bool crush=0, int burn=0, bool cut=0, bool check_uw=0, bool add_color=0, bool remove=0, colorRGBA const &color=BLACK);
 void grass_mesh_height_change(int xpos, int ypos);
 void flower_mesh_height_change(int xpos, int ypos, int rad);
@@ -759,6 +775,7 @@ void add_shape_coll_objs();
 void shift_hmv(vector3d const &vd);
 
 // function prototypes - tree + sm_tree (see also tree_3dw.h)
+void add_trees_mem_usage(mem_usage_t *usage);
 colorRGBA get_tree_trunk_color(int type, bool modulate_with_texture);
 int get_tree_class_from_height(float zpos, bool pine_trees_only);
 int get_tree_type_from_height(float zpos, rand_gen_t &rgen, bool for_scenery);
@@ -791,6 +808,8 @@ void setup_current_system(float sun_intensity=1.0);
 void apply_univ_physics();
 void draw_universe(bool static_only=0, bool skip_closest=0, bool no_move=0, int no_distant=0, bool gen_only=0, bool no_asteroid_dust=0);
 void draw_universe_stats();
+void gen_universe_headless();
+void advance_universe_headless();
 void clear_univ_obj_contexts();
 void clear_cached_shaders();
 
@@ -799,6 +818,7 @@ cube_t get_scene_bounds_bcube();
 void regen_lightmap();
 void clear_lightmap();
 void build_lightmap(bool verbose);
+void add_lightmap_mem_usage(mem_usage_t *usage);
 void update_flow_for_voxels(vector<cube_t> const &cubes);
 void add_player_flashlight_light_source(float radius_scale=1.0);
 void add_line_light(point const &p1, point const &p2, colorRGBA const &color, float size, float intensity=1.0);
@@ -819,6 +839,7 @@ bool is_any_dlight_visible(point const &p);
 // function prototypes - smoke
 void add_smoke(point const &pos, float val);
 void distribute_smoke();
+void add_smoke_mem_usage(mem_usage_t *usage);
 float get_smoke_at_pos(point const &pos);
 void update_smoke_indir_tex_range(unsigned x_start, unsigned x_end, unsigned y_start, unsigned y_end, unsigned z_start=0, unsigned z_end=0, bool update_lighting=1);
 bool upload_smoke_indir_texture();
@@ -856,6 +877,7 @@ bool crush_snow_at_pt(point const &p, float radius);
 // function prototypes - waypoints
 void create_waypoints(vector<user_waypt_t> const &user_waypoints);
 void shift_waypoints(vector3d const &vd);
+void reconnect_waypoints_near(cube_t const &region);
 void draw_waypoints();
 
 // function prototypes - destroy_cobj
@@ -879,6 +901,9 @@ void free_shadow_map_textures();
 // function prototypes - raytrace
 float get_scene_radius();
 void kill_current_raytrace_threads();
+void shutdown_raytrace_threads();
+void pause_lighting_bake_for_cobj_update();
+void invalidate_global_lighting(cube_t const &bcube);
 void check_update_global_lighting(unsigned lights);
 void check_all_platform_cobj_lighting_update();
 
@@ -887,6 +912,7 @@ void gen_voxel_landscape();
 bool gen_voxels_from_cobjs(coll_obj_group &cobjs);
 float gen_voxel_rock(voxel_model &model, point const &center, float radius, unsigned size, unsigned num_blocks=1, int rseed=456);
 bool parse_voxel_option(FILE *fp);
+void add_voxels_mem_usage(mem_usage_t *usage);
 void render_voxel_data(bool shadow_pass);
 void free_voxel_context();
 bool point_inside_voxel_terrain(point const &pos);
@@ -1008,6 +1034,7 @@ void get_building_bcubes(cube_t const &xy_range, vect_cube_t &bcubes);
 bool get_buildings_line_hit_color(point const &p1, point const &p2, colorRGBA &color);
 bool have_buildings();
 unsigned get_buildings_gpu_mem_usage();
+void add_buildings_mem_usage(mem_usage_t *usage);
 vector3d get_buildings_max_extent();
 void clear_building_vbos();
 void create_buildings_tile(int x, int y);
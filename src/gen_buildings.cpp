@@ -1469,6 +1469,25 @@ struct building_lights_manager_t : public city_lights_manager_t {
 building_lights_manager_t building_lights_manager;
 
 
+void add_building_mem_usage(building_t const &b, uint64_t &cpu_mem, uint64_t &gpu_mem) { // approximate: only counts the larger vectors
+
+	cpu_mem += b.parts.capacity()*sizeof(cube_t) + b.details.capacity()*sizeof(roof_obj_t) + (b.roof_tquads.capacity() + b.doors.capacity())*sizeof(tquad_with_ix_t);
+	if (!b.has_interior()) return;
+	building_interior_t const &i(*b.interior);
+	cpu_mem += sizeof(building_interior_t) + (i.floors.capacity() + i.ceilings.capacity() + i.walls[0].capacity() + i.walls[1].capacity())*sizeof(cube_t);
+	cpu_mem += i.stairwells.capacity()*sizeof(stairwell_t) + i.doors.capacity()*sizeof(door_t) + i.landings.capacity()*sizeof(landing_t);
+	cpu_mem += i.rooms.capacity()*sizeof(room_t) + i.elevators.capacity()*sizeof(elevator_t);
+	if (!i.room_geom) return;
+	building_room_geom_t const &rg(*i.room_geom);
+	cpu_mem += sizeof(building_room_geom_t) + rg.objs.capacity()*sizeof(room_object_t) + rg.light_bcubes.capacity()*sizeof(cube_t);
+
+	for (auto m = rg.materials.begin(); m != rg.materials.end(); ++m) {
+		cpu_mem += sizeof(rgeom_mat_t) + (m->tri_verts.capacity() + m->quad_verts.capacity())*sizeof(rgeom_mat_t::vertex_t);
+		gpu_mem += (m->num_tverts + m->num_qverts)*sizeof(rgeom_mat_t::vertex_t);
+	}
+}
+
+
 class building_creator_t {
 
 	unsigned grid_sz, gpu_mem_usage;
@@ -1641,6 +1660,13 @@ public:
 	}
 	unsigned get_num_buildings() const {return buildings.size();}
 	unsigned get_gpu_mem_usage() const {return gpu_mem_usage;}
+
+	void add_mem_usage(mem_usage_t &usage) const {
+		uint64_t cpu_mem(buildings.capacity()*sizeof(building_t) + (grid.capacity() + grid_by_tile.capacity())*sizeof(grid_elem_t)), gpu_mem(gpu_mem_usage);
+		for (auto b = buildings.begin(); b != buildings.end(); ++b) {add_building_mem_usage(*b, cpu_mem, gpu_mem);}
+		for (auto g = grid.begin(); g != grid.end(); ++g) {cpu_mem += g->bc_ixs.capacity()*sizeof(cube_with_ix_t);}
+		usage.add(cpu_mem, gpu_mem, buildings.size());
+	}
 	vector3d const &get_max_extent() const {return max_extent;}
 	building_t const &get_building(unsigned ix) const {assert(ix < buildings.size()); return buildings[ix];}
 	building_t       &get_building(unsigned ix)       {assert(ix < buildings.size()); return buildings[ix];} // non-const version; not intended to be used to change geometry
@@ -2747,6 +2773,9 @@ public:
 			if (i->second.is_visible(xlate)) {bcs.push_back(&i->second);}
 		}
 	}
+	void add_mem_usage(mem_usage_t &usage) const {
+		for (auto i = tiles.begin(); i != tiles.end(); ++i) {i->second.add_mem_usage(usage);}
+	}
 	unsigned get_tot_num_buildings() const {
 		unsigned num(0);
 		for (auto i = tiles.begin(); i != tiles.end(); ++i) {num += i->second.get_num_buildings();}
@@ -2823,6 +2852,11 @@ bool get_buildings_line_hit_color(point const &p1, point const &p2, colorRGBA &c
 }
 bool have_buildings() {return (!building_creator.empty() || !building_creator_city.empty() || !building_tiles.empty());} // for postproc effects
 bool no_grass_under_buildings() {return (world_mode == WMODE_INF_TERRAIN && !building_creator.empty() && global_building_params.flatten_mesh);}
+void add_buildings_mem_usage(mem_usage_t *usage) {
+	building_creator.add_mem_usage(usage[MEM_BUILDINGS]);
+	building_creator_city.add_mem_usage(usage[MEM_BUILDINGS]);
+	building_tiles.add_mem_usage(usage[MEM_BUILDINGS]);
+}
 unsigned get_buildings_gpu_mem_usage() {return (building_creator.get_gpu_mem_usage() + building_creator_city.get_gpu_mem_usage());}
 
 vector3d get_buildings_max_extent() { // used for TT shadow bounds + map mode
@@ -25,7 +25,7 @@ obj_vector_t<decal_obj> decals(MAX_DECALS);
 water_particle_manager water_part_man;
 physics_particle_manager explosion_part_man[2]; // {lit, emissive}
 float gauss_rand_arr[N_RAND_DIST+2];
-rand_gen_t global_rand_gen;
+thread_local rand_gen_t global_rand_gen; // per-thread so that universe cells can be generated in the background
 
 
 extern bool begin_motion;
@@ -7,7 +7,7 @@
 #include "inlines.h" // for render_to_texture_t::render() stuff
 
 
-extern bool use_core_context;
+extern bool use_core_context, headless_mode;
 
 
 void init_glew() {
@@ -63,12 +63,14 @@ void bind_texture_tu(unsigned tid, unsigned tu_id, bool is_cube_map) {
 
 void bind_3d_texture(unsigned tid) {
 
+	if (headless_mode) return;
 	glBindTexture(GL_TEXTURE_3D, tid);
 	assert(glIsTexture(tid));
 }
 
 void setup_3d_texture(unsigned &tid, int filter, int wrap) {
 
+	if (headless_mode) return; // tid is unchanged
 	glGenTextures(1, &tid);
 	bind_3d_texture(tid);
 	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, filter); // GL_LINEAR_MIPMAP_LINEAR?
@@ -82,6 +84,7 @@ unsigned create_3d_texture(unsigned xsz, unsigned ysz, unsigned zsz, unsigned nc
 
 	assert(data.size() == ncomp*bytes_per_pixel*xsz*ysz*zsz);
 	unsigned tid(0);
+	if (headless_mode) return tid; // no GL context; data is not uploaded
 	setup_3d_texture(tid, filter, wrap);
 
 	if (bytes_per_pixel == 1) { // 8-bit texture
@@ -101,6 +104,7 @@ unsigned create_3d_texture(unsigned xsz, unsigned ysz, unsigned zsz, unsigned nc
 void update_3d_texture(unsigned tid, unsigned xoff, unsigned yoff, unsigned zoff, unsigned xsz, unsigned ysz, unsigned zsz,
 					   unsigned ncomp, unsigned char const *const data)
 {
+	if (headless_mode) return;
 	bind_3d_texture(tid);
 	glTexSubImage3D(GL_TEXTURE_3D, 0, xoff, yoff, zoff, xsz, ysz, zsz, get_texture_format(ncomp), GL_UNSIGNED_BYTE, data);
 }
@@ -117,6 +121,7 @@ void set_3d_texture_as_current(unsigned tid, unsigned tu_id) { // end with activ
 
 
 unsigned create_vbo() {
+	if (headless_mode) return 0; // no GL context; callers treat this as unallocated
 	unsigned vbo;
 	assert(glGenBuffers);
 	glGenBuffers(1, &vbo);
@@ -127,13 +132,13 @@ unsigned create_vbo() {
 int get_buffer_target(bool is_index) {return (is_index ? GL_ELEMENT_ARRAY_BUFFER : GL_ARRAY_BUFFER);}
 
 void bind_vbo(unsigned vbo, bool is_index) { // okay if vbo is zero
-	if (use_core_context && vbo == 0) return; // no point in binding 0
+	if (headless_mode || (use_core_context && vbo == 0)) return; // no point in binding 0
 	glBindBuffer(get_buffer_target(is_index), vbo);
 	//if (vbo) {assert(glIsBuffer(vbo));}
 }
 
 void delete_vbo(unsigned vbo) {
-	if (vbo != 0) {glDeleteBuffers(1, &vbo);}
+	if (vbo != 0 && !headless_mode) {glDeleteBuffers(1, &vbo);}
 }
 
 void upload_vbo_data(void const *const data, size_t size, bool is_index, int dynamic_level) {
@@ -144,16 +149,19 @@ void upload_vbo_data(void const *const data, size_t size, bool is_index, int dyn
 	case 2: mode = GL_STREAM_DRAW;  break;
 	default: assert(0);
 	}
+	if (headless_mode) return;
 	glBufferData(get_buffer_target(is_index), size, data, mode);
 }
 
 void upload_vbo_sub_data(void const *const data, int offset, size_t size, bool is_index) {
+	if (headless_mode) return;
 	glBufferSubData(get_buffer_target(is_index), offset, size, data);
 }
 
 void upload_vbo_sub_data_no_sync(void const *data, unsigned start_byte, unsigned size_bytes, bool is_index) {
 
 	assert(data && size_bytes > 0);
+	if (headless_mode) return;
 	int const target(get_buffer_target(is_index));
 	void *buffer(glMapBufferRange(target, start_byte, size_bytes, (GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT)));
 	if (buffer == nullptr) {check_gl_error(132);}
@@ -164,6 +172,7 @@ void upload_vbo_sub_data_no_sync(void const *data, unsigned start_byte, unsigned
 
 
 unsigned create_vao() {
+	if (headless_mode) return 0;
 	unsigned vao;
 	assert(glGenVertexArrays);
 	glGenVertexArrays(1, &vao); 
@@ -176,6 +185,7 @@ unsigned default_vao(0);
 void clear_default_vao() {delete_and_zero_vao(default_vao);}
 
 void bind_vao(unsigned vao) { // okay if vao is zero
+	if (headless_mode) return;
 	if (use_core_context && vao == 0) {
 		if (!default_vao) {default_vao = create_vao();}
 		check_bind_vao(default_vao);
@@ -185,7 +195,7 @@ void bind_vao(unsigned vao) { // okay if vao is zero
 }
 
 void delete_vao(unsigned vao) {
-	if (vao != 0) {glDeleteVertexArrays(1, &vao);}
+	if (vao != 0 && !headless_mode) {glDeleteVertexArrays(1, &vao);}
 }
 
 
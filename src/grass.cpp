@@ -1104,6 +1104,10 @@ void update_grass_vbos() {
 	flower_manager.clear_vbo();
 }
 
+void add_grass_mem_usage(mem_usage_t *usage) { // ground mode grass and flowers; tiled terrain grass is counted in tiled_mesh.cpp
+	usage[MEM_GRASS].add((grass_manager.get_cpu_mem() + flower_manager.get_cpu_mem()), (grass_manager.get_gpu_mem() + flower_manager.get_gpu_mem()), grass_manager.size());
+}
+
 void draw_grass() { // and flowers
 	if (!no_grass() && (display_mode & 0x02)) {
 		grass_manager.draw();
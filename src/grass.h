@@ -49,6 +49,8 @@ public:
 	// can't free in the destructor because the gl context may be destroyed before this point
 	//~grass_manager_t() {clear();}
 	size_t size() const {return grass.size ();} // 2 points per grass blade
+	size_t get_cpu_mem() const {return grass.capacity()*sizeof(grass_t);}
+	unsigned get_gpu_mem() const {return (vbo ? 3*size()*sizeof(grass_data_t) : 0);}
 	bool empty()  const {return grass.empty();}
 	void clear();
 	void add_grass_blade(point const &pos, float cscale, bool on_mesh) {add_grass_blade_int(pos, cscale, on_mesh, grass, rgen);}
@@ -71,7 +73,6 @@ class grass_tile_manager_t : public grass_manager_t {
 public:
 	grass_tile_manager_t() : start_render_ix(0), end_render_ix(0) {}
 	void clear();
-	unsigned get_gpu_mem() const {return (vbo ? 3*size()*sizeof(grass_data_t) : 0);}
 	void upload_data();
 	void gen_grass();
 	void update();
@@ -114,6 +115,7 @@ public:
 	void gen_density_cache(mesh_xy_grid_cache_t density_gen[2], int x1, int y1);
 	void scale_flowers(float lscale, float wscale);
 	unsigned get_gpu_mem() const {return (vbo_valid() ? flowers.size()*sizeof(vert_norm_comp_color) : 0);}
+	size_t get_cpu_mem() const {return flowers.capacity()*sizeof(flower_t);}
 };
 
 
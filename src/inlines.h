@@ -21,7 +21,7 @@ extern colorRGB uw_atten_max, uw_atten_scale;
 extern pos_dir_up camera_pdu, player_pdu;
 extern unsigned char **mesh_draw;
 extern float SCENE_SIZE[];
-extern rand_gen_t global_rand_gen;
+extern thread_local rand_gen_t global_rand_gen;
 
 template<typename T> void clear_cont(T &cont) {T().swap(cont);}
 
@@ -181,6 +181,10 @@ void reset_cobj_counters() {
 	for (unsigned i = 0; i < (unsigned)coll_objects.size(); ++i) {coll_objects[i].counter = -1;}
 }
 
+void add_lightmap_mem_usage(mem_usage_t *usage) { // Note: dynamic light textures are small and not counted; smoke is counted in smoke.cpp
+	usage[MEM_LIGHTMAP].add((lmap_manager.get_cpu_mem() + ldynamic.capacity()*sizeof(dls_cell) + ldynamic_enabled.capacity()), 0, lmap_manager.get_num_cells());
+}
+
 
 void lmcell::get_final_color(colorRGB &color, float max_indir, float indir_scale, float extra_ambient) const {
 
@@ -201,49 +205,90 @@ void lmcell::set_outside_colors() {
 }
 
 
+lmap_cell_range_t::lmap_cell_range_t(cube_t const &c) :
+	x1(max(get_xpos_round_down(c.d[0][0]), 0)), x2(min(get_xpos_round_down(c.d[0][1])+1, MESH_X_SIZE)),
+	y1(max(get_ypos_round_down(c.d[1][0]), 0)), y2(min(get_ypos_round_down(c.d[1][1])+1, MESH_Y_SIZE)),
+	z1(max(get_zpos(c.d[2][0]), 0)), z2(min(get_zpos(c.d[2][1])+1, MESH_SIZE[2])) {}
+
+bool lmap_cell_range_t::contains_pt(point const &p) const {return contains(get_xpos_round_down(p.x), get_ypos_round_down(p.y), get_zpos(p.z));}
+
+
 inline bool is_inside_lmap(int x, int y, int z) {return (z >= 0 && z < MESH_SIZE[2] && !point_outside_mesh(x, y));}
-bool lmap_manager_t::is_valid_cell(int x, int y, int z) const {return (is_inside_lmap(x, y, z) && vlmap[y][x] != NULL);}
+bool lmap_manager_t::is_valid_cell(int x, int y, int z) const {return (is_inside_lmap(x, y, z) && get_lmcell_ptr(x, y, z) != NULL);}
 
 // Note: only intended to work in ground mode where sizes are MESH_X_SIZE and MESH_Y_SIZE
 lmcell *lmap_manager_t::get_lmcell_round_down(point const &p) { // round down
 	int const x(get_xpos_round_down(p.x)), y(get_ypos_round_down(p.y)), z(get_zpos(p.z));
-	return (is_valid_cell(x, y, z) ? &vlmap[y][x][z] : NULL);
+	return (is_inside_lmap(x, y, z) ? get_lmcell_ptr(x, y, z) : NULL);
 }
 lmcell *lmap_manager_t::get_lmcell(point const &p) { // round to center
 	int const x(get_xpos(p.x)), y(get_ypos(p.y)), z(get_zpos(p.z));
-	return (is_valid_cell(x, y, z) ? &vlmap[y][x][z] : NULL);
+	return (is_inside_lmap(x, y, z) ? get_lmcell_ptr(x, y, z) : NULL);
 }
 
-template<typename T> void lmap_manager_t::alloc(unsigned nbins, unsigned xsize, unsigned ysize, unsigned zsize, T **nonempty_bins, lmcell const &init_lmcell) {
+// nonempty_bins selects the used {x, y} columns (all if NULL); col_zmax optionally limits the z range of each column; only the z segments of
+// used columns below their zmax are allocated, so the number of cells is at most the number of used columns times zsize
+template<typename T> void lmap_manager_t::alloc(unsigned xsize, unsigned ysize, unsigned zsize, T **nonempty_bins, lmcell const &init_lmcell, unsigned **col_zmax_) {
 
 	lm_xsize = xsize; lm_ysize = ysize; lm_zsize = zsize;
-	if (vlmap == NULL) {matrix_gen_2d(vlmap, lm_xsize, lm_ysize);} // create column headers once
-	vldata_alloc.resize(max(nbins, 1U), init_lmcell); // make size at least 1, even if there are no bins, so we can test on emptiness
-	unsigned cur_v(0);
+	bxsize   = (xsize + LMAP_BRICK_MASK) >> LMAP_BRICK_BITS;
+	bysize   = (ysize + LMAP_BRICK_MASK) >> LMAP_BRICK_BITS;
+	bzsize   = (zsize + LMAP_BRICK_MASK) >> LMAP_BRICK_BITS;
+	col_zmax.resize(xsize*ysize);
+	brick_ixs.resize(bxsize*bysize*bzsize);
+	bricks.clear();
+	num_cells = num_cols = 0;
 
-	// initialize light volume
 	for (unsigned i = 0; i < lm_ysize; ++i) {
 		for (unsigned j = 0; j < lm_xsize; ++j) {
-			if (nonempty_bins != nullptr && !nonempty_bins[i][j]) { // nonempty_bins is used for sparse mode
-				vlmap[i][j] = NULL;
-				continue;
+			bool const used(nonempty_bins == nullptr || nonempty_bins[i][j]); // nonempty_bins is used for sparse mode
+			col_zmax[i*lm_xsize + j] = (used ? (col_zmax_ ? max(1U, min(col_zmax_[i][j], lm_zsize)) : lm_zsize) : 0); // used columns have at least one cell
+			num_cols  += used;
+			num_cells += col_zmax[i*lm_xsize + j];
+		}
+	}
+	unsigned num_alloc(0);
+
+	for (unsigned bz = 0; bz < bzsize; ++bz) { // allocate bricks that contain at least one cell, and one z segment for each column of the brick that has cells
+		unsigned const z1(bz << LMAP_BRICK_BITS), seg_len(get_seg_len(z1));
+
+		for (unsigned by = 0; by < bysize; ++by) {
+			for (unsigned bx = 0; bx < bxsize; ++bx) {
+				lmap_brick_t brick;
+				brick.base = num_alloc;
+				unsigned nsegs(0);
+
+				for (unsigned y = (by << LMAP_BRICK_BITS); y < min(lm_ysize, ((by+1) << LMAP_BRICK_BITS)); ++y) {
+					for (unsigned x = (bx << LMAP_BRICK_BITS); x < min(lm_xsize, ((bx+1) << LMAP_BRICK_BITS)); ++x) {
+						if (col_zmax[y*lm_xsize + x] > z1) {brick.slot[get_col_off(x, y)] = (unsigned char)(nsegs++);}
+					}
+				}
+				unsigned &bix(brick_ixs[(bz*bysize + by)*bxsize + bx]);
+				if (nsegs == 0) {bix = LMAP_EMPTY_BRICK; continue;}
+				bix = (unsigned)bricks.size();
+				bricks.push_back(brick);
+				num_alloc += nsegs*seg_len;
 			}
-			assert(cur_v + lm_zsize <= vldata_alloc.size());
-			vlmap[i][j] = &vldata_alloc[cur_v];
-			cur_v      += lm_zsize;
 		}
 	}
-	assert(cur_v == nbins);
+	vldata_alloc.clear(); // reset all cells to init_lmcell
+	vldata_alloc.resize(max(num_alloc, 1U), init_lmcell); // make size at least 1, even if there are no bins, so we can test on emptiness
 }
 
-template void lmap_manager_t::alloc(unsigned nbins, unsigned xsize, unsigned ysize, unsigned zsize, unsigned char **nonempty_bins, lmcell const &init_lmcell); // explicit instantiation
+template void lmap_manager_t::alloc(unsigned xsize, unsigned ysize, unsigned zsize, unsigned char **nonempty_bins, lmcell const &init_lmcell, unsigned **col_zmax); // explicit instantiation
 
 
 void lmap_manager_t::init_from(lmap_manager_t const &src) {
 
 	//assert(!is_allocated());
 	//clear_cells(); // probably unnecessary
-	alloc(src.vldata_alloc.size(), src.lm_xsize, src.lm_ysize, src.lm_zsize, src.vlmap, lmcell());
+	lm_xsize  = src.lm_xsize;  lm_ysize = src.lm_ysize; lm_zsize = src.lm_zsize;
+	bxsize    = src.bxsize;    bysize   = src.bysize;   bzsize   = src.bzsize;
+	num_cells = src.num_cells; num_cols = src.num_cols;
+	bricks    = src.bricks; // copy the brick layout
+	brick_ixs = src.brick_ixs;
+	col_zmax  = src.col_zmax;
+	vldata_alloc.resize(src.vldata_alloc.size());
 	copy_data(src);
 }
 
@@ -251,9 +296,8 @@ void lmap_manager_t::init_from(lmap_manager_t const &src) {
 // *this = blend_weight*dest + (1.0 - blend_weight)*(*this)
 void lmap_manager_t::copy_data(lmap_manager_t const &src, float blend_weight) {
 
-	assert(vlmap && src.vlmap);
 	assert(src.lm_xsize == lm_xsize && src.lm_ysize == lm_ysize && src.lm_zsize == lm_zsize);
-	assert(src.vldata_alloc.size() == vldata_alloc.size());
+	assert(src.vldata_alloc.size() == vldata_alloc.size()); // same brick layout
 	assert(blend_weight >= 0.0);
 	if (blend_weight == 0.0) return; // keep existing dest
 
@@ -261,15 +305,8 @@ void lmap_manager_t::copy_data(lmap_manager_t const &src, float blend_weight) {
 		vldata_alloc = src.vldata_alloc; // deep copy all lmcell data
 		return;
 	}
-	for (unsigned i = 0; i < lm_ysize; ++i) { // openmp?
-		for (unsigned j = 0; j < lm_xsize; ++j) {
-			if (!vlmap[i][j]) {assert(!src.vlmap[i][j]); continue;}
-			assert(src.vlmap[i][j]);
-			
-			for (unsigned z = 0; z < lm_zsize; ++z) {
-				vlmap[i][j][z].mix_lighting_with(src.vlmap[i][j][z], blend_weight);
-			}
-		}
+	for (unsigned i = 0; i < vldata_alloc.size(); ++i) { // openmp?
+		vldata_alloc[i].mix_lighting_with(src.vldata_alloc[i], blend_weight); // includes cells above zmax in partial column segments, which is harmless
 	}
 }
 
@@ -530,8 +567,7 @@ void clear_lightmap() {
 void calc_flow_profile(r_profile flow_prof[3], int i, int j, bool proc_cobjs, float zstep) {
 
 	assert(zstep > 0.0);
-	lmcell *vldata(lmap_manager.get_column(j, i));
-	if (vldata == NULL) return;
+	if (!lmap_manager.has_column(j, i)) return;
 	float const bbz[2][2] = {{get_xval(j), get_xval(j+1)}, {get_yval(i), get_yval(i+1)}}; // X x Y
 	vector<pair<float, unsigned> > cobj_z;
 
@@ -559,13 +595,15 @@ void calc_flow_profile(r_profile flow_prof[3], int i, int j, bool proc_cobjs, fl
 	unsigned const ncv2((unsigned)cobj_z.size());
 
 	for (int v = MESH_SIZE[2]-1; v >= 0; --v) { // top to bottom
+		lmcell *const lmc(lmap_manager.get_lmcell_ptr(j, i, v));
+		if (lmc == NULL) continue; // unallocated brick above the column zmax
 		float zb(czmin0 + v*zstep), zt(zb + zstep); // cell Z bounds
 		
 		if (zt < mesh_height[i][j]) { // under mesh
-			UNROLL_3X(vldata[v].pflow[i_] = 0;) // all zeros
+			UNROLL_3X(lmc->pflow[i_] = 0;) // all zeros
 		}
 		else if (!proc_cobjs /*|| ncv2 == 0*/) { // ignore cobjs or no cobjs
-			UNROLL_3X(vldata[v].pflow[i_] = 255;) // all ones
+			UNROLL_3X(lmc->pflow[i_] = 255;) // all ones
 		}
 		else { // above mesh case
 			float const bb[3][2]  = {{bbz[0][0], bbz[0][1]}, {bbz[1][0], bbz[1][1]}, {zb, zt}};
@@ -591,7 +629,7 @@ void calc_flow_profile(r_profile flow_prof[3], int i, int j, bool proc_cobjs, fl
 			for (unsigned e = 0; e < 3; ++e) {
 				float const fv(flow_prof[e].den_inv());
 				assert(fv > -TOLER);
-				vldata[v].pflow[e] = (unsigned char)(255.5*CLIP_TO_01(fv));
+				lmc->pflow[e] = (unsigned char)(255.5*CLIP_TO_01(fv));
 			}
 		} // if above mesh
 	} // for v
@@ -680,6 +718,19 @@ void build_lightmap(bool verbose) {
 	MESH_SIZE[2] = zsize; // override MESH_SIZE[2]
 	float const zstep(czspan/zsize);
 	if (verbose) {cout << "Lightmap zsize= " << zsize << ", nonempty= " << nonempty << ", bins= " << nbins << ", czmin= " << czmin0 << ", czmax= " << czmax << endl;}
+	unsigned **col_zmax = NULL;
+
+	if (!use_dense_voxels) { // limit each column to just above its highest cobj so that the empty cells above the scene aren't allocated
+		matrix_gen_2d(col_zmax);
+
+		for (int i = 0; i < MESH_Y_SIZE; ++i) {
+			for (int j = 0; j < MESH_X_SIZE; ++j) {
+				if (need_lmcell[i][j] & 2) {col_zmax[i][j] = zsize; continue;} // keep the full column near static light sources
+				coll_cell const &cell(v_collision_matrix[i][j]);
+				col_zmax[i][j] = ((cell.zmax < cell.zmin) ? 0U : (unsigned)max(0, min((int)zsize, (get_zpos(cell.zmax) + 2)))); // one cell of padding
+			}
+		}
+	}
 	assert(zstep > 0.0);
 	bool raytrace_lights[NUM_LIGHTING_TYPES] = {0};
 	for (unsigned i = 0; i < NUM_LIGHTING_TYPES; ++i) {raytrace_lights[i] = (read_light_files[i] || write_light_files[i]);}
@@ -690,8 +741,11 @@ void build_lightmap(bool verbose) {
 		init_lmcell.sv = init_lmcell.gv = DEF_SKY_GLOBAL_LT;
 		UNROLL_3X(init_lmcell.sc[i_] = init_lmcell.gc[i_] = 1.0;)
 	}
-	lmap_manager.alloc(nbins, MESH_X_SIZE, MESH_Y_SIZE, zsize, need_lmcell, init_lmcell);
+	lmap_manager.alloc(MESH_X_SIZE, MESH_Y_SIZE, zsize, need_lmcell, init_lmcell, col_zmax);
 	assert(!ldynamic.empty() && lmap_manager.is_allocated());
+	if (col_zmax) {matrix_delete_2d(col_zmax);}
+	if (verbose) {cout << "Lightmap cells= " << lmap_manager.get_num_cells() << ", allocated= " << lmap_manager.size() << " of " << nbins << " bins, mem= " << (lmap_manager.size()*sizeof(lmcell) >> 10) << "KB" << endl;}
+	assert(lmap_manager.size() <= max(nbins, 1U)); // never more than the dense columns
 	using_lightmap = (nonempty > 0);
 	lm_alloc       = 1;
 
@@ -723,7 +777,7 @@ void build_lightmap(bool verbose) {
 
 			for (int y = bnds[1][0]; y <= bnds[1][1]; ++y) {
 				for (int x = bnds[0][0]; x <= bnds[0][1]; ++x) {
-					assert(lmap_manager.get_column(x, y));
+					assert(lmap_manager.has_column(x, y));
 					float const xv(get_xval(x)), yv(get_yval(y));
 
 					for (int z = bnds[2][0]; z <= bnds[2][1]; ++z) {
@@ -811,13 +865,14 @@ unsigned indir_light_tex_from_lmap(lmap_manager_t const &local_lmap_manager, uns
 	for (unsigned y = 0; y < ysize; ++y) {
 		for (unsigned x = 0; x < xsize; ++x) {
 			unsigned const off(zsize*(y*xsize + x));
-			lmcell const *const vlm(local_lmap_manager.get_column(x, y));
-			assert(vlm != nullptr); // not supported in this flow
+			assert(local_lmap_manager.has_column(x, y)); // sparse columns not supported in this flow
 
 			for (unsigned z = 0; z < zsize; ++z) {
 				unsigned const off2(ncomp*(off + z));
+				lmcell const *const lmc(local_lmap_manager.get_lmcell_ptr(x, y, z));
+				assert(lmc != nullptr);
 				colorRGB color;
-				vlm[z].get_final_color(color, 1.0, 1.0);
+				lmc->get_final_color(color, 1.0, 1.0);
 				if (lighting_exponent != 1.0) {UNROLL_3X(color[i_] = pow(color[i_], lighting_exponent););}
 				//color = colorRGBA(float(y)/ysize, float(x)/xsize, float(z)/zsize, 1.0); // for debugging
 				UNROLL_3X(tex_data[off2+i_] = (unsigned char)(255*CLIP_TO_01(color[i_]));)
@@ -1290,8 +1345,10 @@ void get_indir_light(colorRGBA &a, point const &p) { // used for particle clouds
 	if (!point_outside_mesh(x, y) && p.z > czmin0) { // inside the mesh range and above the lowest cobj
 		float val(get_voxel_terrain_ao_lighting_val(p));
 		
-		if (using_lightmap && p.z < czmax && lmap_manager.get_column(x, y) != NULL) { // not above all collision objects and not empty cell
-			lmap_manager.get_lmcell(x, y, z).get_final_color(cscale, 0.5, val);
+		lmcell const *const lmc((using_lightmap && p.z < czmax && z < MESH_SIZE[2]) ? lmap_manager.get_lmcell_ptr(x, y, z) : NULL);
+
+		if (lmc != NULL) { // not above all collision objects and not empty cell
+			lmc->get_final_color(cscale, 0.5, val);
 		}
 		else if (val < 1.0) {
 			cscale *= val;
@@ -44,35 +44,76 @@ struct lmcell { // size = 52
 };
 
 
-class lmap_manager_t {
+unsigned const LMAP_BRICK_BITS  = 3; // bricks of 8x8x8 lmcells
+unsigned const LMAP_BRICK_SIZE  = (1 << LMAP_BRICK_BITS);
+unsigned const LMAP_BRICK_MASK  = (LMAP_BRICK_SIZE - 1);
+unsigned const LMAP_BRICK_COLS  = (LMAP_BRICK_SIZE*LMAP_BRICK_SIZE);
+unsigned const LMAP_EMPTY_BRICK = 0xFFFFFFFF;
+
+struct lmap_brick_t { // the used columns of one 8x8x8 brick; each used column stores one z segment of the brick's height
+	unsigned base; // index of the first cell in vldata_alloc
+	unsigned char slot[LMAP_BRICK_COLS]; // segment index of each {x, y} column in the brick, {y, x} order
+};
+
+struct lmap_cell_range_t { // half open range of lightmap cells, used to limit incremental lighting updates to a region
+	int x1, x2, y1, y2, z1, z2;
+
+	lmap_cell_range_t() : x1(0), x2(0), y1(0), y2(0), z1(0), z2(0) {}
+	lmap_cell_range_t(cube_t const &c); // all cells that overlap c
+	bool is_empty() const {return (x1 >= x2 || y1 >= y2 || z1 >= z2);}
+	bool contains(int x, int y, int z) const {return (x >= x1 && x < x2 && y >= y1 && y < y2 && z >= z1 && z < z2);}
+	bool contains_pt(point const &p) const; // uses the same rounding as lmap_manager_t::get_lmcell_round_down()
+};
 
-	vector<lmcell> vldata_alloc;
-	unsigned lm_xsize, lm_ysize, lm_zsize;
-	lmcell ***vlmap; // y, x, z (size is determined by {MESH_Y_SIZE, MESH_X_SIZE, MESH_Z_SIZE}
+class lmap_manager_t { // sparse lmcell storage: cells are allocated in bricks, and cells in unused columns or above a column's zmax don't exist (are outside)
+
+	vector<lmcell> vldata_alloc; // z segments of the used columns of allocated bricks
+	vector<lmap_brick_t> bricks;
+	vector<unsigned> brick_ixs; // brick grid, x fastest: index into bricks, or LMAP_EMPTY_BRICK
+	vector<unsigned> col_zmax; // number of cells in each {x, y} column, 0 for unused columns
+	unsigned lm_xsize, lm_ysize, lm_zsize, bxsize, bysize, bzsize, num_cells, num_cols;
 
 	lmap_manager_t(lmap_manager_t const &) = delete; // forbidden
 	void operator=(lmap_manager_t const &) = delete; // forbidden
 
+	unsigned get_brick_ix(int x, int y, int z) const {return brick_ixs[((z >> LMAP_BRICK_BITS)*bysize + (y >> LMAP_BRICK_BITS))*bxsize + (x >> LMAP_BRICK_BITS)];}
+	static unsigned get_col_off(int x, int y) {return ((y & LMAP_BRICK_MASK) << LMAP_BRICK_BITS) + (x & LMAP_BRICK_MASK);}
+	unsigned get_seg_len(int z) const {return min(LMAP_BRICK_SIZE, (lm_zsize - (z & ~LMAP_BRICK_MASK)));} // the top brick may be partial
+
 public:
 	bool was_updated;
 	cube_t update_bcube;
 
-	lmap_manager_t() : lm_xsize(0), lm_ysize(0), lm_zsize(0), vlmap(NULL), was_updated(0) {update_bcube.set_to_zeros();}
-	void clear_cells() {vldata_alloc.clear();} // vlmap matrix headers are not cleared
-	bool is_allocated() const {return (vlmap != NULL && !vldata_alloc.empty());}
+	lmap_manager_t() : lm_xsize(0), lm_ysize(0), lm_zsize(0), bxsize(0), bysize(0), bzsize(0), num_cells(0), num_cols(0), was_updated(0) {update_bcube.set_to_zeros();}
+	void clear_cells() {vldata_alloc.clear(); bricks.clear(); brick_ixs.clear(); col_zmax.clear(); num_cells = num_cols = 0;}
+	bool is_allocated() const {return !vldata_alloc.empty();}
 	size_t size() const {return vldata_alloc.size();}
+	unsigned get_num_cells() const {return num_cells;} // cells below the zmax of used columns
+	unsigned get_num_dense_cells() const {return num_cols*lm_zsize;} // cells of the used columns in a dense lightmap
+	size_t get_cpu_mem() const {return (vldata_alloc.capacity()*sizeof(lmcell) + bricks.capacity()*sizeof(lmap_brick_t) + (brick_ixs.capacity() + col_zmax.capacity())*sizeof(unsigned));}
 	bool read_data_from_file(char const *const fn, int ltype);
 	bool write_data_to_file(char const *const fn, int ltype) const;
 	void clear_lighting_values(int ltype);
+	void clear_lighting_values(int ltype, lmap_cell_range_t const &range);
 	bool is_valid_cell(int x, int y, int z) const;
-	lmcell const *get_column(int x, int y) const {return vlmap[y][x];} // Note: no bounds checking
-	lmcell *get_column(int x, int y) {return vlmap[y][x];} // Note: no bounds checking
-	lmcell &get_lmcell(int x, int y, int z) {return get_column(x, y)[z];} // Note: no bounds checking
+	bool has_column(int x, int y) const {return (!col_zmax.empty() && col_zmax[y*lm_xsize + x] != 0);} // Note: no bounds checking
+	unsigned get_column_zmax(int x, int y) const {return (col_zmax.empty() ? 0 : col_zmax[y*lm_xsize + x]);} // Note: no bounds checking
+
+	lmcell const *get_lmcell_ptr(int x, int y, int z) const { // returns NULL for empty cells; Note: no bounds checking
+		if (unsigned(z) >= get_column_zmax(x, y)) return NULL; // unused column or above zmax
+		unsigned const bix(get_brick_ix(x, y, z));
+		assert(bix != LMAP_EMPTY_BRICK); // bricks are allocated for all cells below zmax
+		lmap_brick_t const &b(bricks[bix]);
+		return &vldata_alloc[b.base + b.slot[get_col_off(x, y)]*get_seg_len(z) + (z & LMAP_BRICK_MASK)];
+	}
+	lmcell *get_lmcell_ptr(int x, int y, int z) {return const_cast<lmcell *>(static_cast<lmap_manager_t const *>(this)->get_lmcell_ptr(x, y, z));}
+	lmcell &get_lmcell(int x, int y, int z) {lmcell *const lmc(get_lmcell_ptr(x, y, z)); assert(lmc); return *lmc;} // cell must exist
 	lmcell *get_lmcell_round_down(point const &p);
 	lmcell *get_lmcell(point const &p);
-	template<typename T> void alloc(unsigned nbins, unsigned xsize, unsigned ysize, unsigned zsize, T **nonempty_bins, lmcell const &init_lmcell);
+	template<typename T> void alloc(unsigned xsize, unsigned ysize, unsigned zsize, T **nonempty_bins, lmcell const &init_lmcell, unsigned **col_zmax=nullptr);
 	void init_from(lmap_manager_t const &src);
 	void copy_data(lmap_manager_t const &src, float blend_weight=1.0);
+	float copy_ltype_data(lmap_manager_t const &src, int ltype, float scale);
 };
 
 
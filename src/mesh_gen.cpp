@@ -10,6 +10,10 @@
 #include "shaders.h"
 #include "gl_ext_arb.h"
 #include <glm/gtc/noise.hpp>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h> // SSE2
+#define ENABLE_SSE_NOISE
+#endif
 
 
 int      const NUM_FREQ_COMP      = 9;
@@ -30,6 +34,7 @@ bool     const GEN_SCROLLING_MESH = 1;
 float    const S_GEN_ATTEN_DIST   = 128.0;
 
 int   const F_TABLE_SIZE = NUM_FREQ_COMP*N_RAND_SIN2;
+int   const F_TABLE_STRIDE = (F_TABLE_SIZE + 3) & ~3; // rows padded with zeros to a multiple of 4 floats for SSE
 
 
 // Global Variables
@@ -49,7 +54,7 @@ vector<float> height_histogram;
 hmap_params_t hmap_params;
 
 
-extern bool combined_gu;
+extern bool combined_gu, cpu_mesh_noise_gen;
 extern int xoff, yoff, xoff2, yoff2, world_mode, rand_gen_index, mesh_rgen_index, mesh_scale_change, display_mode;
 extern int read_heightmap, read_landscape, do_read_mesh, mesh_seed, scrolling, camera_mode, invert_mh_image;
 extern unsigned erosion_iters;
@@ -66,6 +71,8 @@ void estimate_zminmax(bool using_eq);
 void set_zvals();
 void update_temperature(bool verbose);
 void compute_scale();
+unsigned get_num_noise_octaves();
+void get_noise_zval_row(float x0, float dx, float yval, unsigned n, float *zvals, int mode, int shape, unsigned num_octaves);
 
 bool using_hmap_with_detail();
 
@@ -595,6 +602,10 @@ bool mesh_xy_grid_cache_t::build_arrays(float x0, float y0, float dx, float dy,
 	do_glaciate = 0; // must set enable_glaciate() after this call if needed
 	cached_vals.clear();
 
+	if (gen_mode != MGEN_SINE && (gen_mode < MGEN_SIMPLEX_GPU || cpu_mesh_noise_gen)) { // CPU simplex/perlin noise
+		if (cache_values || gen_mode >= MGEN_SIMPLEX_GPU) {gen_cpu_noise_vals();} // GPU modes always use cached values
+		return 1; // results are available; sine tables are unused
+	}
 	if (gen_mode >= MGEN_SIMPLEX_GPU) { // GPU simplex noise - always cache values
 		bool const is_running(cshader && cshader->get_is_running());
 		if (!is_running) {run_gpu_simplex();} // launch the job
@@ -602,8 +613,8 @@ bool mesh_xy_grid_cache_t::build_arrays(float x0, float y0, float dx, float dy,
 		cache_gpu_simplex_vals();
 		return 1; // results are available
 	}
-	yterms_start = nx*F_TABLE_SIZE;
-	xyterms.resize((nx + ny)*F_TABLE_SIZE, 0.0);
+	yterms_start = nx*F_TABLE_STRIDE;
+	xyterms.resize((nx + ny)*F_TABLE_STRIDE, 0.0); // padding entries are never written and stay zero
 	float const msx(mesh_scale*DX_VAL_INV), msy(mesh_scale*DY_VAL_INV), ms2(0.5*mesh_scale);
 
 	for (int k = start_eval_sin; k < F_TABLE_SIZE; ++k) {
@@ -614,12 +625,12 @@ bool mesh_xy_grid_cache_t::build_arrays(float x0, float y0, float dx, float dy,
 		for (unsigned i = 0; i < nx; ++i) {
 			float sin_val(SINF(xmdx*i + x_const));
 			//apply_noise_shape_per_term(sin_val, gen_shape);
-			xyterms[i*F_TABLE_SIZE+k] = sin_val;
+			xyterms[i*F_TABLE_STRIDE+k] = sin_val;
 		}
 		for (unsigned i = 0; i < ny; ++i) {
 			float sin_val(SINF(ymdy*i + y_const));
 			//apply_noise_shape_per_term(sin_val, gen_shape);
-			xyterms[yterms_start + i*F_TABLE_SIZE+k] = y_scale*sin_val;
+			xyterms[yterms_start + i*F_TABLE_STRIDE+k] = y_scale*sin_val;
 		}
 	}
 	if (cache_values) {
@@ -693,6 +704,18 @@ void mesh_xy_grid_cache_t::cache_gpu_simplex_vals() {
 	}
 }
 
+void mesh_xy_grid_cache_t::gen_cpu_noise_vals() {
+
+	bool const gpu_mode(gen_mode >= MGEN_SIMPLEX_GPU);
+	unsigned const num_octaves(gpu_mode ? NUM_FREQ_COMP : get_num_noise_octaves()); // the GPU shader always uses all octaves
+	cached_vals.resize(cur_nx*cur_ny);
+
+#pragma omp parallel for schedule(static,1)
+	for (int y = 0; y < (int)cur_ny; ++y) {
+		get_noise_zval_row(mx0, mdx, (y*mdy + my0)*DY_VAL_INV, cur_nx, &cached_vals[y*cur_nx], gen_mode, gen_shape, num_octaves);
+	}
+}
+
 void mesh_xy_grid_cache_t::clear_context() { // for GPU-mode cached state
 	free_texture(tid);
 	if (cshader != nullptr) {cshader->end_shader(); free_cshader();}
@@ -702,10 +725,11 @@ void mesh_xy_grid_cache_t::free_cshader() { // don't make any GPU calls - hard r
 }
 
 
-float gen_noise(float xv, float yv, int mode, int shape) {
+unsigned get_num_noise_octaves() {return (NUM_FREQ_COMP - start_eval_sin/N_RAND_SIN2);}
+
+float gen_noise(float xv, float yv, int mode, int shape, unsigned end_octave) {
 
 	float zval(0.0), mag(1.0), freq(1.0), rx, ry;
-	unsigned const end_octave(NUM_FREQ_COMP - start_eval_sin/N_RAND_SIN2);
 	float const lacunarity(1.92), gain(0.5);
 	gen_rx_ry(rx, ry);
 
@@ -727,10 +751,11 @@ float gen_noise(float xv, float yv, int mode, int shape) {
 	}
 	return zval;
 }
+float gen_noise(float xv, float yv, int mode, int shape) {return gen_noise(xv, yv, mode, shape, get_num_noise_octaves());}
 
 // mode: 0=sine tables, 1=simplex, 2=perlin, 3=GPU simplex, 4=GPU domain warp
 // shape: 0=linear, 1=billowy, 2=ridged
-float get_noise_zval(float xval, float yval, int mode, int shape) {
+float get_noise_zval(float xval, float yval, int mode, int shape, unsigned num_octaves) {
 
 	assert(mode != MGEN_SINE); // mode 0 not supported by this function
 	float const xy_scale(MESH_SCALE_FACTOR*mesh_scale);
@@ -738,16 +763,163 @@ float get_noise_zval(float xval, float yval, int mode, int shape) {
 
 	if (mode == MGEN_DWARP_GPU) { // domain warping
 		float const scale(0.2);
-		float const dx1(gen_noise(xv+0.0, yv+0.0, mode, shape));
-		float const dy1(gen_noise(xv+5.2, yv+1.3, mode, shape));
-		float const dx2(gen_noise((xv + scale*dx1 + 1.7), (yv + scale*dy1 + 9.2), mode, shape));
-		float const dy2(gen_noise((xv + scale*dx1 + 8.3), (yv + scale*dy1 + 2.8), mode, shape));
+		float const dx1(gen_noise(xv+0.0, yv+0.0, mode, shape, num_octaves));
+		float const dy1(gen_noise(xv+5.2, yv+1.3, mode, shape, num_octaves));
+		float const dx2(gen_noise((xv + scale*dx1 + 1.7), (yv + scale*dy1 + 9.2), mode, shape, num_octaves));
+		float const dy2(gen_noise((xv + scale*dx1 + 8.3), (yv + scale*dy1 + 2.8), mode, shape, num_octaves));
 		xv += scale*dx2; yv += scale*dy2;
 	}
-	float zval(gen_noise(xv, yv, mode, shape));
+	float zval(gen_noise(xv, yv, mode, shape, num_octaves));
 	postproc_noise_zval(zval);
 	return zval*get_hmap_scale(mode);
 }
+float get_noise_zval(float xval, float yval, int mode, int shape) {return get_noise_zval(xval, yval, mode, shape, get_num_noise_octaves());}
+
+
+#ifdef ENABLE_SSE_NOISE
+// SSE versions of glm::simplex() and glm::perlin() for 2D that evaluate 4 points at once;
+// these follow the operation order of glm so that results match the scalar versions to within FP rounding
+
+inline __m128 floor_sse(__m128 v) { // SSE2 has no floor; valid for |v| < 2^31
+	__m128 const t(_mm_cvtepi32_ps(_mm_cvttps_epi32(v)));
+	return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, v), _mm_set1_ps(1.0f)));
+}
+inline __m128 fract_sse (__m128 v) {return _mm_sub_ps(v, floor_sse(v));}
+inline __m128 abs_sse   (__m128 v) {return _mm_andnot_ps(_mm_set1_ps(-0.0f), v);}
+inline __m128 mod_sse   (__m128 v, float m) {__m128 const mv(_mm_set1_ps(m)); return _mm_sub_ps(v, _mm_mul_ps(mv, floor_sse(_mm_div_ps(v, mv))));}
+inline __m128 mod289_sse(__m128 v) {return _mm_sub_ps(v, _mm_mul_ps(floor_sse(_mm_mul_ps(v, _mm_set1_ps(1.0f/289.0f))), _mm_set1_ps(289.0f)));}
+inline __m128 permute_sse(__m128 v) {return mod289_sse(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(v, _mm_set1_ps(34.0f)), _mm_set1_ps(1.0f)), v));}
+inline __m128 mix_sse(__m128 a, __m128 b, __m128 t) {return _mm_add_ps(a, _mm_mul_ps(t, _mm_sub_ps(b, a)));}
+inline __m128 dot2_sse(__m128 ax, __m128 ay, __m128 bx, __m128 by) {return _mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by));}
+
+inline __m128 simplex_grad_sse(__m128 p, __m128 &m, __m128 x, __m128 y) { // returns the gradient dot product and scales m
+	__m128 const gx(_mm_sub_ps(_mm_mul_ps(_mm_set1_ps(2.0f), fract_sse(_mm_mul_ps(p, _mm_set1_ps(0.024390243902439f)))), _mm_set1_ps(1.0f)));
+	__m128 const h(_mm_sub_ps(abs_sse(gx), _mm_set1_ps(0.5f)));
+	__m128 const a0(_mm_sub_ps(gx, floor_sse(_mm_add_ps(gx, _mm_set1_ps(0.5f)))));
+	m = _mm_mul_ps(m, _mm_sub_ps(_mm_set1_ps(1.79284291400159f), _mm_mul_ps(_mm_set1_ps(0.85373472095314f), dot2_sse(a0, h, a0, h))));
+	return dot2_sse(a0, h, x, y);
+}
+
+__m128 simplex_sse(__m128 vx, __m128 vy) {
+
+	__m128 const C0(_mm_set1_ps(0.211324865405187f)), C1(_mm_set1_ps(0.366025403784439f)), C2(_mm_set1_ps(-0.577350269189626f));
+	__m128 const zero(_mm_setzero_ps()), one(_mm_set1_ps(1.0f)), half(_mm_set1_ps(0.5f));
+	// first corner
+	__m128 const s(dot2_sse(vx, vy, C1, C1));
+	__m128 ix(floor_sse(_mm_add_ps(vx, s))), iy(floor_sse(_mm_add_ps(vy, s)));
+	__m128 const t(dot2_sse(ix, iy, C0, C0));
+	__m128 const x0x(_mm_add_ps(_mm_sub_ps(vx, ix), t)), x0y(_mm_add_ps(_mm_sub_ps(vy, iy), t));
+	// other corners
+	__m128 const i1x(_mm_and_ps(_mm_cmpgt_ps(x0x, x0y), one)), i1y(_mm_sub_ps(one, i1x));
+	__m128 const x1x(_mm_sub_ps(_mm_add_ps(x0x, C0), i1x)), x1y(_mm_sub_ps(_mm_add_ps(x0y, C0), i1y));
+	__m128 const x2x(_mm_add_ps(x0x, C2)), x2y(_mm_add_ps(x0y, C2));
+	// permutations
+	ix = mod_sse(ix, 289.0f);
+	iy = mod_sse(iy, 289.0f);
+	__m128 const p0(permute_sse(_mm_add_ps(permute_sse(iy), ix)));
+	__m128 const p1(permute_sse(_mm_add_ps(_mm_add_ps(permute_sse(_mm_add_ps(iy, i1y)), ix), i1x)));
+	__m128 const p2(permute_sse(_mm_add_ps(_mm_add_ps(permute_sse(_mm_add_ps(iy, one)), ix), one)));
+	__m128 m0(_mm_max_ps(_mm_sub_ps(half, dot2_sse(x0x, x0y, x0x, x0y)), zero));
+	__m128 m1(_mm_max_ps(_mm_sub_ps(half, dot2_sse(x1x, x1y, x1x, x1y)), zero));
+	__m128 m2(_mm_max_ps(_mm_sub_ps(half, dot2_sse(x2x, x2y, x2x, x2y)), zero));
+	m0 = _mm_mul_ps(m0, m0); m0 = _mm_mul_ps(m0, m0);
+	m1 = _mm_mul_ps(m1, m1); m1 = _mm_mul_ps(m1, m1);
+	m2 = _mm_mul_ps(m2, m2); m2 = _mm_mul_ps(m2, m2);
+	// gradients
+	__m128 const g0(simplex_grad_sse(p0, m0, x0x, x0y)), g1(simplex_grad_sse(p1, m1, x1x, x1y)), g2(simplex_grad_sse(p2, m2, x2x, x2y));
+	return _mm_mul_ps(_mm_set1_ps(130.0f), _mm_add_ps(dot2_sse(m0, m1, g0, g1), _mm_mul_ps(m2, g2)));
+}
+
+inline __m128 perlin_grad_sse(__m128 i, __m128 fx, __m128 fy) { // returns the normalized gradient dot product for one corner
+	__m128 gx(_mm_sub_ps(_mm_mul_ps(_mm_set1_ps(2.0f), fract_sse(_mm_div_ps(i, _mm_set1_ps(41.0f)))), _mm_set1_ps(1.0f)));
+	__m128 const gy(_mm_sub_ps(abs_sse(gx), _mm_set1_ps(0.5f)));
+	gx = _mm_sub_ps(gx, floor_sse(_mm_add_ps(gx, _mm_set1_ps(0.5f))));
+	__m128 const norm(_mm_sub_ps(_mm_set1_ps(1.79284291400159f), _mm_mul_ps(_mm_set1_ps(0.85373472095314f), dot2_sse(gx, gy, gx, gy))));
+	return dot2_sse(_mm_mul_ps(gx, norm), _mm_mul_ps(gy, norm), fx, fy);
+}
+
+__m128 perlin_sse(__m128 vx, __m128 vy) {
+
+	__m128 const one(_mm_set1_ps(1.0f));
+	__m128 const fx0(fract_sse(vx)), fy0(fract_sse(vy)), fx1(_mm_sub_ps(fx0, one)), fy1(_mm_sub_ps(fy0, one));
+	__m128 const ix0(floor_sse(vx)), iy0(floor_sse(vy));
+	__m128 const px0(permute_sse(mod_sse(ix0, 289.0f))), px1(permute_sse(mod_sse(_mm_add_ps(ix0, one), 289.0f)));
+	__m128 const iy0m(mod_sse(iy0, 289.0f)), iy1m(mod_sse(_mm_add_ps(iy0, one), 289.0f));
+	__m128 const n00(perlin_grad_sse(permute_sse(_mm_add_ps(px0, iy0m)), fx0, fy0));
+	__m128 const n10(perlin_grad_sse(permute_sse(_mm_add_ps(px1, iy0m)), fx1, fy0));
+	__m128 const n01(perlin_grad_sse(permute_sse(_mm_add_ps(px0, iy1m)), fx0, fy1));
+	__m128 const n11(perlin_grad_sse(permute_sse(_mm_add_ps(px1, iy1m)), fx1, fy1));
+	// fade(t) = t^3*(t*(6t - 15) + 10)
+	__m128 const fade_x(_mm_mul_ps(_mm_mul_ps(_mm_mul_ps(fx0, fx0), fx0), _mm_add_ps(_mm_mul_ps(fx0, _mm_sub_ps(_mm_mul_ps(fx0, _mm_set1_ps(6.0f)), _mm_set1_ps(15.0f))), _mm_set1_ps(10.0f))));
+	__m128 const fade_y(_mm_mul_ps(_mm_mul_ps(_mm_mul_ps(fy0, fy0), fy0), _mm_add_ps(_mm_mul_ps(fy0, _mm_sub_ps(_mm_mul_ps(fy0, _mm_set1_ps(6.0f)), _mm_set1_ps(15.0f))), _mm_set1_ps(10.0f))));
+	return _mm_mul_ps(_mm_set1_ps(2.3f), mix_sse(mix_sse(n00, n10, fade_x), mix_sse(n01, n11, fade_x), fade_y));
+}
+
+// SSE version of gen_noise() for 4 points
+__m128 gen_noise_sse(__m128 xv, __m128 yv, bool is_simplex, int shape, unsigned num_octaves, float rx, float ry) {
+
+	__m128 zval(_mm_setzero_ps());
+	float mag(1.0), freq(1.0);
+	float const lacunarity(1.92), gain(0.5);
+
+	for (unsigned i = 0; i < num_octaves; ++i) {
+		__m128 const fv(_mm_set1_ps(freq));
+		__m128 const px(_mm_add_ps(_mm_mul_ps(fv, xv), _mm_set1_ps(rx))), py(_mm_add_ps(_mm_mul_ps(fv, yv), _mm_set1_ps(ry)));
+		__m128 noise(is_simplex ? simplex_sse(px, py) : perlin_sse(px, py));
+		switch (shape) {
+		case 0: break; // linear - do nothing
+		case 1: noise = _mm_sub_ps(abs_sse(noise), _mm_set1_ps(0.40f)); break; // billowy
+		case 2: noise = _mm_sub_ps(_mm_set1_ps(0.45f), abs_sse(noise)); break; // ridged
+		}
+		zval  = _mm_add_ps(zval, _mm_mul_ps(_mm_set1_ps(mag), noise));
+		mag  *= gain;
+		freq *= lacunarity;
+		rx   *= 1.5;
+		ry   *= 1.5;
+	}
+	return zval;
+}
+
+// computes get_noise_zval() for a row of n points at x = (i*dx + x0)*DX_VAL_INV, 4 points at a time; num_octaves is normally get_num_noise_octaves()
+void get_noise_zval_row(float x0, float dx, float yval, unsigned n, float *zvals, int mode, int shape, unsigned num_octaves) {
+
+	assert(mode != MGEN_SINE); // mode 0 not supported by this function
+	bool const is_simplex(mode == MGEN_SIMPLEX || mode == MGEN_SIMPLEX_GPU || mode == MGEN_DWARP_GPU);
+	float const xy_scale(MESH_SCALE_FACTOR*mesh_scale), zscale(get_hmap_scale(mode));
+	__m128 const yv(_mm_set1_ps(xy_scale*yval));
+	float rx, ry;
+	gen_rx_ry(rx, ry); // same for all points
+
+	for (unsigned i = 0; i < n; i += 4) {
+		float xvals[4], res[4];
+		for (unsigned k = 0; k < 4; ++k) {xvals[k] = xy_scale*(((i + k)*dx + x0)*DX_VAL_INV);} // may extend past the end of the row
+		__m128 xv(_mm_loadu_ps(xvals)), yv2(yv);
+
+		if (mode == MGEN_DWARP_GPU) { // domain warping
+			__m128 const scale(_mm_set1_ps(0.2f));
+			__m128 const dx1(gen_noise_sse(xv, yv, is_simplex, shape, num_octaves, rx, ry));
+			__m128 const dy1(gen_noise_sse(_mm_add_ps(xv, _mm_set1_ps(5.2f)), _mm_add_ps(yv, _mm_set1_ps(1.3f)), is_simplex, shape, num_octaves, rx, ry));
+			__m128 const wx(_mm_add_ps(xv, _mm_mul_ps(scale, dx1))), wy(_mm_add_ps(yv, _mm_mul_ps(scale, dy1)));
+			__m128 const dx2(gen_noise_sse(_mm_add_ps(wx, _mm_set1_ps(1.7f)), _mm_add_ps(wy, _mm_set1_ps(9.2f)), is_simplex, shape, num_octaves, rx, ry));
+			__m128 const dy2(gen_noise_sse(_mm_add_ps(wx, _mm_set1_ps(8.3f)), _mm_add_ps(wy, _mm_set1_ps(2.8f)), is_simplex, shape, num_octaves, rx, ry));
+			xv  = _mm_add_ps(xv, _mm_mul_ps(scale, dx2));
+			yv2 = _mm_add_ps(yv, _mm_mul_ps(scale, dy2));
+		}
+		_mm_storeu_ps(res, gen_noise_sse(xv, yv2, is_simplex, shape, num_octaves, rx, ry));
+
+		for (unsigned k = 0; k < 4 && i + k < n; ++k) {
+			postproc_noise_zval(res[k]);
+			zvals[i + k] = res[k]*zscale;
+		}
+	}
+}
+
+#else // scalar fallback for targets without SSE2
+
+void get_noise_zval_row(float x0, float dx, float yval, unsigned n, float *zvals, int mode, int shape, unsigned num_octaves) {
+	for (unsigned i = 0; i < n; ++i) {zvals[i] = get_noise_zval((i*dx + x0)*DX_VAL_INV, yval, mode, shape, num_octaves);}
+}
+#endif // ENABLE_SSE_NOISE
 
 
 float mesh_xy_grid_cache_t::eval_index(unsigned x, unsigned y, int min_start_sin, bool use_cache) const {
@@ -763,19 +935,11 @@ float mesh_xy_grid_cache_t::eval_index(unsigned x, unsigned y, int min_start_sin
 		zval += get_noise_zval(xval, yval, gen_mode, gen_shape);
 	}
 	else { // sine tables
-		float const *const xptr(&xyterms.front() + x*F_TABLE_SIZE);
-		float const *const yptr(&xyterms.front() + yterms_start + y*F_TABLE_SIZE);
+		float const *const xptr(&xyterms.front() + x*F_TABLE_STRIDE);
+		float const *const yptr(&xyterms.front() + yterms_start + y*F_TABLE_STRIDE);
 		int const start_ix(max(start_eval_sin, min_start_sin));
-		// performance critical
-		if (start_ix == 0) { // common case
-			for (int i = 0; i < F_TABLE_SIZE; ++i) {zval += xptr[i]*yptr[i];}
-		}
-		else if (start_ix == 50) { // another common case
-			for (int i = 50; i < F_TABLE_SIZE; ++i) {zval += xptr[i]*yptr[i];}
-		}
-		else {
-			for (int i = start_ix; i < F_TABLE_SIZE; ++i) {zval += xptr[i]*yptr[i];}
-		}
+		// performance critical; includes the zero padding so that full rows have no scalar tail
+		zval += dot_product_sse(xptr + start_ix, yptr + start_ix, F_TABLE_STRIDE - start_ix);
 		apply_noise_shape_final(zval, gen_shape);
 	}
 	if (do_glaciate) {
@@ -814,6 +978,102 @@ float eval_mesh_sin_terms_scaled(float xval, float yval, float xy_scale) {
 }
 
 
+// compares the SSE sine sum kernels to the scalar loops they replaced on synthetic tables, reporting time and max abs error;
+// covers the mesh xy term dot product, the planet texture table lookup path, and the planet exact sin (pole) path
+void run_sine_sum_benchmark(unsigned num_iters) {
+
+	unsigned const num_rows(256), num_planet_sines(96); // planets use a multiple of 12 sines
+	vector<float> mesh_terms(2*num_rows*F_TABLE_STRIDE, 0.0), params(5*num_planet_sines);
+	float *const z(&params.front()), *const xf(z + num_planet_sines), *const xp(xf + num_planet_sines), *const yf(xp + num_planet_sines), *const yp(yf + num_planet_sines);
+
+	for (unsigned r = 0; r < 2*num_rows; ++r) {
+		for (int k = 0; k < F_TABLE_SIZE; ++k) {mesh_terms[r*F_TABLE_STRIDE + k] = sinf(0.37f*r + 1.13f*k);}
+	}
+	for (unsigned k = 0; k < num_planet_sines; ++k) {
+		z[k] = 1.0/(k+1); xf[k] = 2.0 + 0.5*k; xp[k] = 0.1*k; yf[k] = 3.0 - 0.02*k; yp[k] = 0.3*k;
+	}
+	float const *const xrows(&mesh_terms.front()), *const yrows(xrows + num_rows*F_TABLE_STRIDE);
+
+	for (unsigned test = 0; test < 3; ++test) {
+		char const *const names[3] = {"mesh dot", "planet table", "planet exact sin"};
+		double ref_sum(0.0), sse_sum(0.0);
+		float max_err(0.0);
+		double times[2] = {0.0, 0.0};
+
+		for (unsigned use_sse = 0; use_sse < 2; ++use_sse) {
+			double const start_time(get_bench_time_ms());
+			double sum(0.0);
+
+			for (unsigned n = 0; n < num_iters; ++n) {
+				for (unsigned y = 0; y < num_rows; ++y) {
+					for (unsigned x = 0; x < num_rows; ++x) {
+						float const *const xptr(xrows + x*F_TABLE_STRIDE), *const yptr(yrows + y*F_TABLE_STRIDE);
+						float val(0.0);
+
+						if (test == 0) {
+							if (use_sse) {val = dot_product_sse(xptr, yptr, F_TABLE_STRIDE);}
+							else {for (int i = 0; i < F_TABLE_SIZE; ++i) {val += xptr[i]*yptr[i];}}
+						}
+						else if (test == 1) {
+							if (use_sse) {val = dot_product3_sse(z, xptr, yptr, num_planet_sines);}
+							else {for (unsigned k = 0; k < num_planet_sines; ++k) {val += z[k]*xptr[k]*yptr[k];}}
+						}
+						else {
+							float const xval(2.0*x/num_rows - 1.0), yval(2.0*y/num_rows - 1.0);
+							if (use_sse) {val = sine_sum_2d_sse(z, xf, xp, yf, yp, num_planet_sines, xval, yval);}
+							else {for (unsigned k = 0; k < num_planet_sines; ++k) {val += z[k]*SINF(xf[k]*xval + xp[k])*SINF(yf[k]*yval + yp[k]);}}
+						}
+						if (n == 0) { // compare against exact sines
+							float exact(0.0);
+							if (test == 0) {for (int i = 0; i < F_TABLE_SIZE; ++i) {exact += xptr[i]*yptr[i];}}
+							else if (test == 1) {for (unsigned k = 0; k < num_planet_sines; ++k) {exact += z[k]*xptr[k]*yptr[k];}}
+							else {
+								float const xval(2.0*x/num_rows - 1.0), yval(2.0*y/num_rows - 1.0);
+								for (unsigned k = 0; k < num_planet_sines; ++k) {exact += z[k]*sinf(xf[k]*xval + xp[k])*sinf(yf[k]*yval + yp[k]);}
+							}
+							if (use_sse) {max_err = max(max_err, fabs(val - exact));}
+						}
+						sum += val;
+					} // for x
+				} // for y
+			} // for n
+			times[use_sse] = get_bench_time_ms() - start_time;
+			(use_sse ? sse_sum : ref_sum) = sum; // printed below so that the loops aren't optimized away
+		} // for use_sse
+		cout << "Sine sum benchmark " << names[test] << " evals: " << num_iters*num_rows*num_rows << " scalar: " << times[0] << "ms SSE: " << times[1]
+			 << "ms speedup: " << times[0]/times[1] << " max SSE error: " << max_err << " sums: " << ref_sum << " " << sse_sum << endl;
+	} // for test
+}
+
+
+void hash_add_bytes(uint64_t &hash, void const *data, size_t sz) { // FNV-1a
+	unsigned char const *const bytes((unsigned char const *)data);
+	for (size_t i = 0; i < sz; ++i) {hash = (hash ^ bytes[i])*1099511628211ULL;}
+}
+template<typename T> void hash_add_val(uint64_t &hash, T const &val) {hash_add_bytes(hash, &val, sizeof(T));}
+
+// hash of all state that procedural mesh heights depend on; used to key cached heights so that they're regenerated when any parameter changes
+uint64_t get_mesh_gen_params_hash() {
+
+	uint64_t hash(14695981039346656037ULL);
+	float rx, ry;
+	gen_rx_ry(rx, ry); // includes the mesh seed
+	hash_add_val(hash, mesh_gen_mode);
+	hash_add_val(hash, mesh_gen_shape);
+	hash_add_val(hash, get_num_noise_octaves());
+	hash_add_val(hash, cpu_mesh_noise_gen);
+	hash_add_val(hash, start_eval_sin);
+	hash_add_val(hash, GLACIATE);
+	hash_add_val(hash, rx);
+	hash_add_val(hash, ry);
+	float const fvals[] = {mesh_scale, mesh_scale_z, mesh_height_scale, glaciate_exp, zmax_est, zmax_est2, MESH_HEIGHT, DX_VAL, DY_VAL};
+	hash_add_bytes(hash, fvals, sizeof(fvals));
+	hash_add_bytes(hash, sinTable, sizeof(sinTable));
+	hash_add_bytes(hash, &hmap_params, sizeof(hmap_params));
+	return hash;
+}
+
+
 float get_exact_zval(float xval_in, float yval_in) {
 
 	float xval((xval_in + X_SCENE_SIZE)*DX_VAL_INV + 0.5); // convert from real to index space, as in get_xpos()/get_ypos() but as FP
@@ -18,9 +18,15 @@ bool const ENABLE_BUMP_MAPS  = 1;
 bool const ENABLE_SPEC_MAPS  = 1;
 bool const ENABLE_INTER_REFLECTIONS = 1;
 unsigned const MAGIC_NUMBER  = 42987143; // arbitrary file signature
+unsigned const MAGIC_NUMBER_V2 = 42987144; // file signature of the sectioned v2 format
+unsigned const MODEL3D_V2_VERSION = 2;
 unsigned const BLOCK_SIZE    = 32768; // in vertex indices
 
 bool model_calc_tan_vect(1); // slower and more memory but sometimes better quality/smoother transitions
+bool model_hash_vertex_map(1); // use a flat hash map rather than a std::map for vertex deduplication when loading object files
+bool parallel_model_load(1); // read model3d files referenced by the scene file on worker threads while the scene file is parsed
+bool model3d_write_coll_tree(0); // build the collision BVH before writing a model3d file and store it in the file
+unsigned model3d_file_version(2); // 1 = original streamed format, 2 = sectioned format with precomputed bounding volumes, blocks, and optional collision BVH
 
 extern bool group_back_face_cull, enable_model3d_tex_comp, disable_shader_effects, texture_alpha_in_red_comp, use_model2d_tex_mipmaps, enable_model3d_bump_maps;
 extern bool two_sided_lighting, have_indir_smoke_tex, use_core_context, model3d_wn_normal, invert_model_nmap_bscale, use_z_prepass, all_model3d_ref_update;
@@ -169,6 +175,63 @@ template<typename V> void read_vector(istream &in, V &v) {
 }
 
 
+// model3d v2 file layout: {magic, version, num_sections, pad}, then a table of {id, pad, offset, size} per section, then the sections;
+// sections and the data of every array within them start on 16-byte boundaries, and arrays are stored as a 64-bit count followed by raw elements
+enum {M3D_SECT_HEADER=0, M3D_SECT_UNBOUND_GEOM, M3D_SECT_MATERIALS, M3D_SECT_COLL_TREE, NUM_M3D_SECTS};
+
+struct model3d_section_t {
+	uint32_t id, pad;
+	uint64_t offset, size;
+	model3d_section_t(uint32_t id_=0, uint64_t offset_=0, uint64_t size_=0) : id(id_), pad(0), offset(offset_), size(size_) {}
+};
+
+size_t align16(size_t sz) {return ((sz + 15) & ~size_t(15));}
+
+class model3d_file_writer_t { // builds one section in memory
+
+	vector<char> buf;
+public:
+	void align() {buf.resize(align16(buf.size()), 0);}
+	void write_bytes(void const *data, size_t sz) {buf.insert(buf.end(), (char const *)data, (char const *)data + sz);}
+	template<typename T> void write(T const &v) {write_bytes(&v, sizeof(T));}
+
+	template<typename V> void write_array(V const &v) {
+		write(uint64_t(v.size()));
+		align();
+		if (!v.empty()) {write_bytes(&v[0], v.size()*sizeof(typename V::value_type));}
+	}
+	vector<char> const &get_buf() const {return buf;}
+};
+
+class model3d_file_reader_t { // reads one section from the in-memory file, copying arrays directly into their vectors
+
+	char const *data;
+	size_t pos, end;
+	bool error;
+public:
+	model3d_file_reader_t(char const *data_, size_t size) : data(data_), pos(0), end(size), error(0) {}
+	bool had_error() const {return error;}
+	void align() {pos = min(end, align16(pos));}
+
+	bool read_bytes(void *dest, size_t sz) {
+		if (error || sz > end - pos) {error = 1; return 0;} // truncated section
+		memcpy(dest, data+pos, sz);
+		pos += sz;
+		return 1;
+	}
+	template<typename T> bool read(T &v) {return read_bytes(&v, sizeof(T));}
+
+	template<typename V> bool read_array(V &v) {
+		uint64_t num(0);
+		if (!read(num)) return 0;
+		align();
+		if (num > (end - pos)/sizeof(typename V::value_type)) {error = 1; return 0;} // count is larger than the rest of the section
+		v.resize((size_t)num);
+		return (v.empty() || read_bytes(&v[0], v.size()*sizeof(typename V::value_type)));
+	}
+};
+
+
 // ************ vntc_vect_t/indexed_vntc_vect_t ************
 
 // explicit template instantiations of vert_norm case, used for voxel_model, where tc=0.0
@@ -555,6 +618,19 @@ template<typename T> void vntc_vect_t<T>::read(istream &in) {
 	calc_bounding_volumes();
 }
 
+template<typename T> void vntc_vect_t<T>::write_v2(model3d_file_writer_t &w) const {
+	w.write_array(static_cast<vector<T> const &>(*this));
+	w.write(finalized);
+	w.write(obj_id);
+	w.write(bsphere);
+	w.write(bcube);
+}
+
+template<typename T> bool vntc_vect_t<T>::read_v2(model3d_file_reader_t &r) { // bounding volumes are stored, so they don't need to be recalculated
+	has_tangents = (sizeof(T) == sizeof(vert_norm_tc_tan)); // HACK to get the type
+	return (r.read_array(static_cast<vector<T> &>(*this)) && r.read(finalized) && r.read(obj_id) && r.read(bsphere) && r.read(bcube));
+}
+
 
 // Note: non-const due to VBO caching
 template<typename T> void indexed_vntc_vect_t<T>::render(shader_t &shader, bool is_shadow_pass, point const *const xlate, unsigned npts, bool no_vfc) {
@@ -647,16 +723,12 @@ template<typename T> unsigned indexed_vntc_vect_t<T>::add_vertex(T const &v, ver
 
 	T v2(v);
 	if (vmap.get_average_normals()) {v2.n = zero_vector;}
-	auto it(vmap.find(v2));
-	unsigned ix;
+	unsigned const new_ix((unsigned)size()), ix(vmap.insert_or_find(v2, new_ix));
 
-	if (it == vmap.end()) { // not found
-		ix = (unsigned)size();
+	if (ix == new_ix) { // not found, was inserted
 		this->push_back(v);
-		vmap[v2] = ix;
 	}
 	else { // found
-		ix = it->second;
 		assert(ix < size());
 
 		if (vmap.get_average_normals()) {
@@ -775,6 +847,22 @@ template<typename T> void indexed_vntc_vect_t<T>::read(istream &in) {
 	read_vector(in, indices);
 }
 
+template<typename T> void indexed_vntc_vect_t<T>::write_v2(model3d_file_writer_t &w) const {
+	vntc_vect_t<T>::write_v2(w);
+	w.write_array(indices);
+	w.write_array(blocks);
+	w.write_array(lod_blocks);
+	w.write(optimized);
+	w.write(avg_area_per_tri);
+	w.write(amin);
+	w.write(amax);
+}
+
+template<typename T> bool indexed_vntc_vect_t<T>::read_v2(model3d_file_reader_t &r) { // blocks and LOD blocks are stored, so finalize() isn't needed
+	return (vntc_vect_t<T>::read_v2(r) && r.read_array(indices) && r.read_array(blocks) && r.read_array(lod_blocks) &&
+		r.read(optimized) && r.read(avg_area_per_tri) && r.read(amin) && r.read(amax));
+}
+
 
 // ************ polygon_t ************
 
@@ -918,6 +1006,25 @@ template<typename T> bool vntc_vect_block_t<T>::read(istream &in) {
 	return 1;
 }
 
+template<typename T> void vntc_vect_block_t<T>::write_v2(model3d_file_writer_t &w) const {
+
+	w.write(uint64_t(this->size()));
+	for (auto i = begin(); i != end(); ++i) {i->write_v2(w);}
+}
+
+template<typename T> bool vntc_vect_block_t<T>::read_v2(model3d_file_reader_t &r) {
+
+	uint64_t num(0);
+	this->clear();
+	if (!r.read(num)) return 0;
+	this->resize((size_t)num);
+
+	for (auto i = begin(); i != end(); ++i) {
+		if (!i->read_v2(r)) return 0;
+	}
+	return 1;
+}
+
 
 // ************ geometry_t ************
 
@@ -1220,6 +1327,23 @@ bool material_t::read(istream &in) {
 }
 
 
+void material_t::write_v2(model3d_file_writer_t &w) const {
+
+	w.write_bytes(static_cast<material_params_t const *>(this), sizeof(material_params_t));
+	w.write_array(name);
+	w.write_array(filename);
+	geom.write_v2(w);
+	geom_tan.write_v2(w);
+}
+
+
+bool material_t::read_v2(model3d_file_reader_t &r) {
+
+	return (r.read_bytes(static_cast<material_params_t *>(this), sizeof(material_params_t)) &&
+		r.read_array(name) && r.read_array(filename) && geom.read_v2(r) && geom_tan.read_v2(r));
+}
+
+
 // ************ model3d ************
 
 
@@ -1936,7 +2060,7 @@ void model3d::create_indir_texture() {
 	lmap_manager_t local_lmap_manager; // store in the model3d and cache for reuse on context change (at the cost of more CPU memory usage)? only matters when ray tracing (below)?
 	lmcell init_lmcell;
 	unsigned char **need_lmcell = nullptr; // not used - dense mode
-	local_lmap_manager.alloc(tot_sz, xsize, ysize, zsize, need_lmcell, init_lmcell);
+	local_lmap_manager.alloc(xsize, ysize, zsize, need_lmcell, init_lmcell);
 	float const init_weight(light_int_scale[LIGHTING_SKY]); // record orig value
 
 	if (!sky_lighting_fn.empty() && local_lmap_manager.read_data_from_file(sky_lighting_fn.c_str(), LIGHTING_SKY)) {
@@ -2119,6 +2243,7 @@ void model3d::show_stats() const {
 
 bool model3d::write_to_disk(string const &fn) const { // Note: transforms not written
 
+	if (model3d_file_version >= 2) {return write_to_disk_v2(fn);}
 	ofstream out(fn, ios::out | ios::binary);
 	
 	if (!out.good()) {
@@ -2151,6 +2276,7 @@ bool model3d::read_from_disk(string const &fn) { // Note: transforms not read
 	}
 	clear(); // ???
 	unsigned const magic_number_comp(read_uint(in));
+	if (magic_number_comp == MAGIC_NUMBER_V2) {return read_from_disk_v2(in, fn);}
 
 	if (magic_number_comp != MAGIC_NUMBER) {
 		cerr << "Error reading model3d file " << fn << ": Invalid file format (magic number check failed)." << endl;
@@ -2173,6 +2299,111 @@ bool model3d::read_from_disk(string const &fn) { // Note: transforms not read
 	return in.good();
 }
 
+bool model3d::write_to_disk_v2(string const &fn) const {
+
+	model3d_file_writer_t sections[NUM_M3D_SECTS];
+	sections[M3D_SECT_HEADER].write(bcube);
+	unbound_geom.write_v2(sections[M3D_SECT_UNBOUND_GEOM]);
+	sections[M3D_SECT_MATERIALS].write(uint64_t(materials.size()));
+	for (deque<material_t>::const_iterator m = materials.begin(); m != materials.end(); ++m) {m->write_v2(sections[M3D_SECT_MATERIALS]);}
+	unsigned const num_sects(coll_tree.is_empty() ? M3D_SECT_COLL_TREE : NUM_M3D_SECTS); // collision tree is optional
+	if (num_sects > M3D_SECT_COLL_TREE) {coll_tree.write_tree(sections[M3D_SECT_COLL_TREE]);}
+	vector<model3d_section_t> table;
+	size_t offset(align16(4*sizeof(uint32_t) + num_sects*sizeof(model3d_section_t)));
+
+	for (unsigned i = 0; i < num_sects; ++i) {
+		size_t const size(sections[i].get_buf().size());
+		table.push_back(model3d_section_t(i, offset, size));
+		offset = align16(offset + size);
+	}
+	ofstream out(fn, ios::out | ios::binary);
+	
+	if (!out.good()) {
+		cerr << "Error opening model3d file for write: " << fn << endl;
+		return 0;
+	}
+	cout << "Writing model3d v2 file " << fn << endl;
+	uint32_t const header[4] = {MAGIC_NUMBER_V2, MODEL3D_V2_VERSION, num_sects, 0};
+	out.write((char const *)header, sizeof(header));
+	out.write((char const *)table.data(), table.size()*sizeof(model3d_section_t));
+	size_t cur_pos(sizeof(header) + table.size()*sizeof(model3d_section_t));
+	char const zeros[16] = {0};
+
+	for (unsigned i = 0; i < num_sects; ++i) {
+		out.write(zeros, table[i].offset - cur_pos); // pad to the section start
+		vector<char> const &buf(sections[i].get_buf());
+		out.write(buf.data(), buf.size());
+		cur_pos = table[i].offset + buf.size();
+	}
+	return out.good();
+}
+
+bool model3d::read_from_disk_v2(istream &in, string const &fn) { // the magic number has already been read
+
+	// read the whole file with one call; each section is then copied into place without per-element parsing or recalculation
+	in.seekg(0, ios::end);
+	size_t const file_size((size_t)in.tellg());
+	vector<char> file_data(file_size);
+	in.seekg(0, ios::beg);
+	if (file_size > 0) {in.read(file_data.data(), file_size);}
+	uint32_t header[4] = {0};
+	if (!in.good() || file_size < sizeof(header)) {cerr << "Error reading model3d file " << fn << endl; return 0;}
+	memcpy(header, file_data.data(), sizeof(header));
+
+	if (header[1] != MODEL3D_V2_VERSION) {
+		cerr << "Error reading model3d file " << fn << ": Unsupported file version " << header[1] << "." << endl;
+		return 0;
+	}
+	unsigned const num_sects(header[2]);
+	if (num_sects > (file_size - sizeof(header))/sizeof(model3d_section_t)) {cerr << "Error reading model3d file " << fn << ": Invalid section table." << endl; return 0;}
+	vector<model3d_section_t> table(num_sects);
+	if (num_sects > 0) {memcpy(table.data(), file_data.data()+sizeof(header), num_sects*sizeof(model3d_section_t));}
+	char const *sect_data[NUM_M3D_SECTS] = {0};
+	size_t sect_size[NUM_M3D_SECTS] = {0};
+
+	for (vector<model3d_section_t>::const_iterator s = table.begin(); s != table.end(); ++s) {
+		if (s->offset > file_size || s->size > file_size - s->offset) {cerr << "Error reading model3d file " << fn << ": Section past end of file." << endl; return 0;}
+		if (s->id >= NUM_M3D_SECTS) continue; // unknown section from a newer writer, skip it
+		sect_data[s->id] = file_data.data() + s->offset;
+		sect_size[s->id] = (size_t)s->size;
+	}
+	for (unsigned i = 0; i < M3D_SECT_COLL_TREE; ++i) { // all sections before the collision tree are required
+		if (sect_data[i] == nullptr) {cerr << "Error reading model3d file " << fn << ": Missing section " << i << "." << endl; return 0;}
+	}
+	cout << "Reading model3d v2 file " << fn << endl;
+	from_model3d_file = 1;
+	model3d_file_reader_t header_reader(sect_data[M3D_SECT_HEADER], sect_size[M3D_SECT_HEADER]);
+	model3d_file_reader_t geom_reader(sect_data[M3D_SECT_UNBOUND_GEOM], sect_size[M3D_SECT_UNBOUND_GEOM]);
+	model3d_file_reader_t mat_reader(sect_data[M3D_SECT_MATERIALS], sect_size[M3D_SECT_MATERIALS]);
+	uint64_t num_materials(0);
+	if (!header_reader.read(bcube) || !unbound_geom.read_v2(geom_reader) || !mat_reader.read(num_materials)) {cerr << "Error reading model3d file " << fn << endl; return 0;}
+	materials.resize((size_t)num_materials);
+	
+	for (deque<material_t>::iterator m = materials.begin(); m != materials.end(); ++m) {
+		if (!m->read_v2(mat_reader)) {
+			cerr << "Error reading material" << endl;
+			return 0;
+		}
+		mat_map[m->name] = (m - materials.begin());
+	}
+	if (sect_data[M3D_SECT_COLL_TREE] != nullptr) {
+		model3d_file_reader_t tree_reader(sect_data[M3D_SECT_COLL_TREE], sect_size[M3D_SECT_COLL_TREE]);
+		if (!coll_tree.read_tree(tree_reader)) {cerr << "Warning: Ignoring invalid collision tree in model3d file " << fn << endl;} // will be rebuilt when needed
+	}
+	return 1;
+}
+
+void model3d::swap_file_data(model3d &m) { // swaps everything set by read_from_disk(); used to take a model3d file read on another thread
+
+	std::swap(bcube, m.bcube);
+	unbound_geom.triangles.swap(m.unbound_geom.triangles);
+	unbound_geom.quads.swap(m.unbound_geom.quads);
+	materials.swap(m.materials);
+	mat_map.swap(m.mat_map);
+	coll_tree.swap(m.coll_tree);
+	std::swap(from_model3d_file, m.from_model3d_file);
+}
+
 
 void model3d::proc_model_normals(vector<counted_normal> &cn, int recalc_normals, float nmag_thresh) {
 
@@ -2418,6 +2649,13 @@ void get_cur_model_polygons(vector<coll_tquad> &ppts, model3d_xform_t const &xf,
 
 unsigned get_loaded_models_gpu_mem() {return all_models.get_gpu_mem();}
 
+void add_models_mem_usage(mem_usage_t *usage) { // approximate CPU memory from vertex and index counts
+	model3d_stats_t stats;
+	for (auto m = all_models.begin(); m != all_models.end(); ++m) {m->get_stats(stats);}
+	uint64_t const cpu_mem(stats.verts*sizeof(vert_norm_tc) + (3ULL*stats.tris + 4ULL*stats.quads)*sizeof(unsigned) + all_models.tmgr.get_cpu_mem());
+	usage[MEM_MODELS].add(cpu_mem, all_models.get_gpu_mem(), all_models.size());
+}
+
 cube_t get_polygons_bcube(vector<coll_tquad> const &ppts) {
 
 	cube_t bcube(all_zeros);
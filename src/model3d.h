@@ -16,6 +16,9 @@ using namespace std;
 
 typedef map<string, unsigned> string_map_t;
 
+class model3d_file_writer_t; // forward declaration
+class model3d_file_reader_t; // forward declaration
+
 unsigned const MAX_VMAP_SIZE     = (1 << 18); // 256K
 unsigned const BUILTIN_TID_START = (1 << 16); // 65K
 float const POLY_COPLANAR_THRESH = 0.98;
@@ -183,21 +186,97 @@ template<typename T> struct hash_by_bytes { // should work with all packed verte
 	//uint32_t operator()(T const &v) const {return jenkins_one_at_a_time_hash((const uint32_t*)&v, sizeof(T)>>2);} // faster but lower quality hash
 };
 
+template<typename T> struct hash_vertex_floats { // for vertex types made entirely of floats; consistent with operator<, which treats -0.0 and 0.0 as equal
+	uint64_t operator()(T const &v) const {
+		static_assert((sizeof(T) % sizeof(float)) == 0, "vertex type must be composed of floats");
+		float const *const fv((float const *)&v);
+		uint64_t hash(0);
+
+		for (unsigned i = 0; i < sizeof(T)/sizeof(float); ++i) {
+			float const f(fv[i] + 0.0f); // convert -0.0 to 0.0
+			uint32_t bits;
+			memcpy(&bits, &f, sizeof(bits));
+			hash = (hash ^ bits)*0x9E3779B97F4A7C15ULL;
+		}
+		return (hash ^ (hash >> 32));
+	}
+};
+
+// open addressing hash map from vertex to index with linear probing; entries are stored densely in insertion order so that clear() is O(size)
+template<typename T> class flat_vertex_map_t {
+
+	struct slot_t {
+		unsigned ix, hash; // ix is entry index + 1, 0 = empty
+		slot_t(unsigned ix_=0, unsigned hash_=0) : ix(ix_), hash(hash_) {}
+	};
+	struct entry_t {
+		T v;
+		unsigned ix, hash;
+		entry_t(T const &v_, unsigned ix_, unsigned hash_) : v(v_), ix(ix_), hash(hash_) {}
+	};
+	vector<entry_t> entries;
+	vector<slot_t> slots; // size is a power of 2
+	hash_vertex_floats<T> hasher;
+
+	static bool is_equal(T const &a, T const &b) {return !(a < b) && !(b < a);} // same equivalence as map<T, unsigned>
+
+	unsigned find_slot(T const &v, unsigned hash) const {
+		unsigned const mask((unsigned)slots.size() - 1);
+
+		for (unsigned s = (hash & mask); ; s = ((s + 1) & mask)) {
+			slot_t const &slot(slots[s]);
+			if (slot.ix == 0 || (slot.hash == hash && is_equal(entries[slot.ix-1].v, v))) return s;
+		}
+		return 0; // never gets here
+	}
+	void grow() { // reinsert in insertion order so that clear() can remove entries in reverse order
+		size_t const new_size(max((size_t)1024, 2*slots.size()));
+		slots.clear();
+		slots.resize(new_size);
+		for (unsigned i = 0; i < entries.size(); ++i) {slots[find_slot(entries[i].v, entries[i].hash)] = slot_t(i+1, entries[i].hash);}
+	}
+public:
+	size_t size() const {return entries.size();}
+
+	// returns the index of v if present, otherwise inserts it with index new_ix and returns new_ix
+	unsigned insert_or_find(T const &v, unsigned new_ix) {
+		if (4*(entries.size() + 1) > 3*slots.size()) {grow();} // max load factor of 0.75
+		unsigned const hash((unsigned)hasher(v)), s(find_slot(v, hash));
+		if (slots[s].ix > 0) {return entries[slots[s].ix-1].ix;} // found
+		entries.push_back(entry_t(v, new_ix, hash));
+		slots[s] = slot_t((unsigned)entries.size(), hash);
+		return new_ix;
+	}
+	void clear() { // clear only the used slots, in reverse insertion order so that the probe chain of each remaining entry is intact when it's removed
+		for (auto i = entries.rbegin(); i != entries.rend(); ++i) {slots[find_slot(i->v, i->hash)] = slot_t();}
+		entries.clear();
+	}
+};
+
 //template<typename T> class vertex_map_t : public unordered_map<T, unsigned, hash_by_bytes<T>> {
-template<typename T> class vertex_map_t : public map<T, unsigned> {
+template<typename T> class vertex_map_t {
 
+	map<T, unsigned> tree_map;
+	flat_vertex_map_t<T> hash_map;
 	int last_mat_id;
 	unsigned last_obj_id;
-	bool average_normals;
+	bool average_normals, use_hash;
 
 public:
-	vertex_map_t(bool average_normals_=0) : last_mat_id(-1), last_obj_id(0), average_normals(average_normals_) {}
+	vertex_map_t(bool average_normals_=0, bool use_hash_=0) : last_mat_id(-1), last_obj_id(0), average_normals(average_normals_), use_hash(use_hash_) {}
 	bool get_average_normals() const {return average_normals;}
-	
+	size_t size() const {return (use_hash ? hash_map.size() : tree_map.size());}
+	void clear() {tree_map.clear(); hash_map.clear();}
+
+	unsigned insert_or_find(T const &v, unsigned new_ix) {
+		if (use_hash) {return hash_map.insert_or_find(v, new_ix);}
+		return tree_map.insert(make_pair(v, new_ix)).first->second;
+	}
 	void check_for_clear(int mat_id) {
-		if (mat_id != last_mat_id || this->size() >= MAX_VMAP_SIZE) {
+		// the hash map has no size limit; indices are only reset when a new vertex block is started
+		if (mat_id != last_mat_id || (!use_hash && size() >= MAX_VMAP_SIZE)) {
 			last_mat_id = mat_id;
-			this->clear();
+			clear();
 		}
 	}
 };
@@ -250,6 +329,8 @@ public:
 	void remove_excess_cap() {if (20*vector<T>::size() < 19*vector<T>::capacity()) {vector<T>::shrink_to_fit();}}
 	void write(ostream &out) const;
 	void read(istream &in);
+	void write_v2(model3d_file_writer_t &w) const;
+	bool read_v2(model3d_file_reader_t &r);
 };
 
 
@@ -315,6 +396,8 @@ public:
 	void invert_tcy();
 	void write(ostream &out) const;
 	void read(istream &in);
+	void write_v2(model3d_file_writer_t &w) const;
+	bool read_v2(model3d_file_reader_t &r);
 	bool indexing_enabled() const {return !indices.empty();}
 	void mark_need_normalize() {need_normalize = 1;}
 };
@@ -340,6 +423,8 @@ template<typename T> struct vntc_vect_block_t : public deque<indexed_vntc_vect_t
 	void simplify_indices(float reduce_target);
 	bool write(ostream &out) const;
 	bool read(istream &in);
+	void write_v2(model3d_file_writer_t &w) const;
+	bool read_v2(model3d_file_reader_t &r);
 };
 
 
@@ -366,6 +451,8 @@ template<typename T> struct geometry_t {
 	void simplify_indices(float reduce_target);
 	bool write(ostream &out) const {return (triangles.write(out) && quads.write(out));}
 	bool read(istream &in)         {return (triangles.read (in ) && quads.read (in ));}
+	void write_v2(model3d_file_writer_t &w) const {triangles.write_v2(w); quads.write_v2(w);}
+	bool read_v2(model3d_file_reader_t &r)        {return (triangles.read_v2(r) && quads.read_v2(r));}
 };
 
 
@@ -445,6 +532,8 @@ struct material_t : public material_params_t {
 	colorRGBA get_avg_color(texture_manager const &tmgr, int default_tid=-1) const;
 	bool write(ostream &out) const;
 	bool read(istream &in);
+	void write_v2(model3d_file_writer_t &w) const;
+	bool read_v2(model3d_file_reader_t &r);
 };
 
 
@@ -500,6 +589,8 @@ class model3d {
 
 	void update_bbox(polygon_t const &poly);
 	void create_indir_texture();
+	bool write_to_disk_v2(string const &fn) const;
+	bool read_from_disk_v2(istream &in, string const &fn);
 
 public:
 	texture_manager &tmgr; // stores all textures
@@ -582,6 +673,7 @@ public:
 	void get_all_mat_lib_fns(set<std::string> &mat_lib_fns) const;
 	bool write_to_disk (string const &fn) const;
 	bool read_from_disk(string const &fn);
+	void swap_file_data(model3d &m);
 	static void proc_model_normals(vector<counted_normal> &cn, int recalc_normals, float nmag_thresh=0.7);
 	static void proc_model_normals(vector<weighted_normal> &wn, int recalc_normals, float nmag_thresh=0.7);
 	void write_to_cobj_file(std::ostream &out) const;
@@ -632,6 +724,7 @@ void ensure_model_reflection_cube_maps();
 void auto_calc_model_zvals();
 void get_cur_model_polygons(vector<coll_tquad> &ppts, model3d_xform_t const &xf=model3d_xform_t(), unsigned lod_level=0);
 unsigned get_loaded_models_gpu_mem();
+void add_models_mem_usage(mem_usage_t *usage);
 void get_cur_model_edges_as_cubes(vector<cube_t> &cubes, model3d_xform_t const &xf);
 void get_cur_model_as_cubes(vector<cube_t> &cubes, model3d_xform_t const &xf);
 bool add_transform_for_cur_model(model3d_xform_t const &xf);
@@ -648,6 +741,8 @@ bool load_model_file(string const &filename, model3ds &models, geom_xform_t cons
 	int reflective, float metalness, int recalc_normals, int group_cobjs_level, bool write_file, bool verbose);
 bool read_model_file(string const &filename, vector<coll_tquad> *ppts, geom_xform_t const &xf, int def_tid, colorRGBA const &def_c,
 	int reflective, float metalness, bool load_model_file, int recalc_normals, int group_cobjs_level, bool write_file, bool verbose);
+void preload_model3d_files(vector<string> const &fns);
+void clear_preloaded_models();
 
 
 #endif // _MODEL3D_H_
@@ -4,6 +4,7 @@
 #include "universe.h"
 #include <iostream>
 #include <fstream>
+#include <mutex>
 
 using namespace std;
 
@@ -13,6 +14,7 @@ string const def_modmap_fn("universe.modmap");
 
 
 modmap modmaps[N_UMODS];
+std::mutex modmap_mutex; // universe cells can be generated in the background, which reads the destroyed and name modmaps
 
 
 bool import_default_modmap() {
@@ -46,6 +48,7 @@ bool import_modmap(string const &filename) {
 		}
 		modmap_val_t val;
 		s_object sobj;
+		std::lock_guard<std::mutex> lock(modmap_mutex);
 		modmaps[i].clear();
 		
 		for (unsigned j = 0; j < num; ++j) {
@@ -78,13 +81,17 @@ bool export_modmap(string const &filename) {
 
 bool s_object::is_destroyed() const {
 
+	std::lock_guard<std::mutex> lock(modmap_mutex);
 	return (modmaps[MOD_DESTROYED].find(*this) != modmaps[MOD_DESTROYED].end());
 }
 
 
 void s_object::register_destroyed_sobj() const {
 
-	if (type != UTYPE_NONE) modmaps[MOD_DESTROYED][get_shifted_sobj(*this)] = "1";
+	if (type == UTYPE_NONE) return;
+	s_object const sobj(get_shifted_sobj(*this));
+	std::lock_guard<std::mutex> lock(modmap_mutex);
+	modmaps[MOD_DESTROYED][sobj] = "1";
 }
 
 
@@ -98,6 +105,7 @@ int s_object::get_owner() const {
 
 void s_object::set_owner(int owner) const {
 
+	std::lock_guard<std::mutex> lock(modmap_mutex);
 	if (owner == NO_OWNER) {
 		modmaps[MOD_OWNER].erase(get_shifted_sobj(*this)); // should be OK even if doesn't exist (but should exist)
 		return;
@@ -111,6 +119,7 @@ void s_object::set_owner(int owner) const {
 bool named_obj::rename(s_object const &sobj, string const &name_) {
 
 	name = name_;
+	std::lock_guard<std::mutex> lock(modmap_mutex);
 	modmaps[MOD_NAME][sobj] = name;
 	return 1;
 }
@@ -118,6 +127,7 @@ bool named_obj::rename(s_object const &sobj, string const &name_) {
 
 bool named_obj::lookup_given_name(s_object const &sobj) {
 
+	std::lock_guard<std::mutex> lock(modmap_mutex);
 	modmap::const_iterator it(modmaps[MOD_NAME].find(sobj));
 	if (it == modmaps[MOD_NAME].end()) return 0;
 	name = it->second;
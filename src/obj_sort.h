@@ -7,8 +7,6 @@
 
 #include "ship.h"
 
-unsigned const LEFT_EDGE_BIT = 0x80000000U;
-
 
 struct cached_obj : public sphere_t {
 
@@ -32,14 +30,23 @@ struct cached_obj : public sphere_t {
 };
 
 
-struct interval {
+struct sap_entry_t { // extent of an object along the sweep axis
 
-	float val;
+	float lo, hi;
 	unsigned ix;
 
-	interval() : val(0.0f), ix(0) {}
-	interval(float v, unsigned i, bool l) : val(v), ix(i) {if (l) ix |= LEFT_EDGE_BIT;}
-	bool operator<(interval const &iv) const {return (val < iv.val);}
+	sap_entry_t() : lo(0.0f), hi(0.0f), ix(0) {}
+	sap_entry_t(float lo_, float hi_, unsigned ix_) : lo(lo_), hi(hi_), ix(ix_) {}
+	bool operator<(sap_entry_t const &e) const {return (lo < e.lo);}
+};
+
+
+struct coll_pair_t { // pair of sap_entry_t indices, where b < a; sorted by a, then b, which is the order the original single sweep visited them
+
+	unsigned a, b;
+
+	coll_pair_t(unsigned a_=0, unsigned b_=0) : a(a_), b(b_) {}
+	bool operator<(coll_pair_t const &p) const {return ((a == p.a) ? (b < p.b) : (a < p.a));}
 };
 
 
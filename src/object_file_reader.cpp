@@ -10,9 +10,12 @@
 #include <algorithm> // for transform()
 #include <cctype> // for tolower()
 #include "fast_atof.h"
+#include <thread>
+#include <future>
+#include <atomic>
 
 
-extern bool use_obj_file_bump_grayscale;
+extern bool use_obj_file_bump_grayscale, model_hash_vertex_map, model3d_write_coll_tree;
 extern float model_auto_tc_scale, model_mat_lod_thresh;
 extern model3ds all_models;
 
@@ -279,9 +282,72 @@ bool endswith(string const &value, string const &ending) {
 	return std::equal(ending.rbegin(), ending.rend(), value.rbegin());
 }
 
+
+// reads model3d files on worker threads ahead of the scene file parser; the parser still creates and finishes each model in scene order,
+// so only the geometry/material read is done early; object and 3ds files aren't preloaded because they create textures in the shared texture manager
+class model3d_preloader_t {
+
+	struct entry_t {
+		string filename;
+		model3d model;
+		std::promise<bool> done; // set to the result of read_from_disk()
+		std::shared_future<bool> result;
+		bool used;
+
+		entry_t(string const &fn, texture_manager &tmgr) : filename(fn), model(fn, tmgr), used(0) {result = done.get_future().share();}
+	};
+	deque<entry_t> entries; // deque so that entries stay in place while the workers are running
+	vector<std::thread> threads;
+	std::atomic<unsigned> next_entry;
+
+	void worker_loop() { // entries are started in scene order, so the parser never waits on a model queued behind a later one
+		while (1) {
+			unsigned const ix(next_entry++);
+			if (ix >= entries.size()) return;
+			entry_t &e(entries[ix]);
+			e.done.set_value(e.model.read_from_disk(e.filename));
+		}
+	}
+public:
+	model3d_preloader_t() : next_entry(0) {}
+	~model3d_preloader_t() {clear();}
+
+	void start(vector<string> const &fns, texture_manager &tmgr) {
+		clear();
+
+		for (vector<string>::const_iterator i = fns.begin(); i != fns.end(); ++i) {
+			if (get_file_extension(*i, 0, 1) == "model3d") {entries.emplace_back(*i, tmgr);}
+		}
+		unsigned const num_threads(min((unsigned)entries.size(), max(1U, std::thread::hardware_concurrency())));
+		for (unsigned i = 0; i < num_threads; ++i) {threads.push_back(std::thread(&model3d_preloader_t::worker_loop, this));}
+	}
+	bool take(string const &fn, model3d &model) { // returns 1 if fn was preloaded successfully; otherwise the caller reads it serially
+		for (deque<entry_t>::iterator i = entries.begin(); i != entries.end(); ++i) {
+			if (i->used || i->filename != fn) continue;
+			i->used = 1;
+			if (!i->result.get()) return 0; // read failed; let the caller retry and report the error
+			model.swap_file_data(i->model);
+			return 1;
+		}
+		return 0; // not preloaded
+	}
+	void clear() { // waits for any unused entries to finish, then frees them
+		for (vector<std::thread>::iterator t = threads.begin(); t != threads.end(); ++t) {t->join();}
+		threads.clear();
+		entries.clear();
+		next_entry = 0;
+	}
+};
+
+model3d_preloader_t model3d_preloader;
+
+void preload_model3d_files(vector<string> const &fns) {model3d_preloader.start(fns, all_models.tmgr);}
+void clear_preloaded_models() {model3d_preloader.clear();}
+
+
 class object_file_reader_model : public object_file_reader, public model_from_file_t {
 
-	bool had_empty_mat_error;
+	bool had_empty_mat_error, use_hash_vmap;
 
 	bool read_map_name(ifstream &in, string &name, float *scale=nullptr) {
 		if (!(in >> name)) {return 0;} // no name read (EOF?)
@@ -317,7 +383,7 @@ class object_file_reader_model : public object_file_reader, public model_from_fi
 	}
 
 public:
-	object_file_reader_model(string const &fn, model3d &model_) : object_file_reader(fn), model_from_file_t(fn, model_), had_empty_mat_error(0) {}
+	object_file_reader_model(string const &fn, model3d &model_) : object_file_reader(fn), model_from_file_t(fn, model_), had_empty_mat_error(0), use_hash_vmap(model_hash_vertex_map) {}
 
 	bool load_mat_lib(string const &fn) { // Note: could cache filename, but seems to never be included more than once
 		ifstream mat_in;
@@ -485,7 +551,7 @@ public:
 	bool load_from_model3d_file(bool verbose) {
 		RESET_TIME;
 
-		if (!model.read_from_disk(filename)) {
+		if (!model3d_preloader.take(filename, model) && !model.read_from_disk(filename)) {
 			cerr << "Error reading model3d file " << filename << endl;
 			return 0;
 		}
@@ -747,8 +813,8 @@ public:
 			poly_data_block const &pd(pblocks.back());
 			unsigned pix(0);
 			polygon_t poly;
-			vntc_map_t vmap[2]; // {triangles, quads}
-			vntct_map_t vmap_tan[2]; // {triangles, quads}
+			vntc_map_t vmap[2] = {vntc_map_t(0, use_hash_vmap), vntc_map_t(0, use_hash_vmap)}; // {triangles, quads}
+			vntct_map_t vmap_tan[2] = {vntct_map_t(0, use_hash_vmap), vntct_map_t(0, use_hash_vmap)}; // {triangles, quads}
 
 			for (vector<poly_header_t>::const_iterator j = pd.polys.begin(); j != pd.polys.end(); ++j) {
 				poly.resize(j->npts);
@@ -810,6 +876,7 @@ bool write_model3d_file(string const &base_fn, model3d &cur_model) {
 	string out_fn(base_fn.begin(), base_fn.end()-4); // strip off the '.obj'
 	out_fn += ".model3d";
 	cur_model.calc_tangent_vectors(); // tangent vectors are needed for writing
+	if (model3d_write_coll_tree) {cur_model.build_cobj_tree(0);} // stored in the file so that it doesn't need to be built on load
 				
 	if (!cur_model.write_to_disk(out_fn)) {
 		cerr << "Error writing model3d file " << out_fn << endl;
@@ -3,11 +3,22 @@
 // 4/20/13
 
 #include "3DWorld.h"
+#include "function_registry.h"
+#include "model3d.h"
+#include <fstream>
+#include <chrono>
+#include <mutex>
+#include <unordered_map>
 
 using std::string;
+using std::cerr;
 
 
-class timing_profiler {
+bool hier_profiler_enabled(0);
+string profiler_trace_fn; // Chrome trace JSON file written by timing_profiler_stats(), if nonempty
+
+
+class timing_profiler { // flat per-name stats for PRINT_TIME()/timer_t, in ms
 
 	struct entry_t {
 		unsigned count;
@@ -17,6 +28,7 @@ class timing_profiler {
 	};
 
 	map<string, entry_t> entries;
+	std::mutex mutex; // may be called from worker threads
 
 public:
 	bool enabled;
@@ -25,6 +37,8 @@ public:
 	void clear() {entries.clear();}
 
 	void register_time(const char *str, int delta_time) {
+		std::lock_guard<std::mutex> lock(mutex);
+
 		if (enabled) {
 			entries[str].add(delta_time);
 		}
@@ -48,8 +62,210 @@ public:
 timing_profiler global_profiler;
 
 
+// hierarchical profiler: each thread records into its own call tree and ring buffer of completed scopes;
+// the only lock taken on the recording path is the per-thread one, which is contended only while stats or a trace are being read
+uint64_t get_profile_time_ns() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+unsigned const PROF_RING_SIZE = (1<<16); // max completed scopes per thread kept for trace export
+
+class hier_profiler_t {
+
+	struct event_t {
+		uint64_t start, end;
+		unsigned name_id, depth;
+	};
+	struct node_t {
+		unsigned name_id, parent, count;
+		uint64_t total_ns, max_ns;
+		vector<unsigned> children;
+		node_t(unsigned name_id_, unsigned parent_) : name_id(name_id_), parent(parent_), count(0), total_ns(0), max_ns(0) {}
+	};
+	struct open_scope_t {
+		unsigned node;
+		uint64_t start;
+		open_scope_t(unsigned node_, uint64_t start_) : node(node_), start(start_) {}
+	};
+
+public:
+	struct thread_data_t {
+		unsigned thread_ix;
+		uint64_t num_events; // total ever recorded; the ring buffer holds the last PROF_RING_SIZE
+		std::mutex mutex; // protects events and nodes against readers; the owning thread is the only writer
+		vector<event_t> events;
+		vector<node_t> nodes; // call tree; node 0 is the root
+		vector<open_scope_t> stack;
+		std::unordered_map<string, unsigned> name_cache; // avoids the global name lock
+
+		thread_data_t(unsigned ix) : thread_ix(ix), num_events(0) {nodes.push_back(node_t(0, 0));}
+
+		unsigned begin(unsigned name_id, uint64_t time) {
+			unsigned const parent(stack.empty() ? 0 : stack.back().node);
+			vector<unsigned> const &children(nodes[parent].children);
+			unsigned node(0);
+
+			for (auto i = children.begin(); i != children.end(); ++i) {
+				if (nodes[*i].name_id == name_id) {node = *i; break;}
+			}
+			if (node == 0) { // first time in this context
+				std::lock_guard<std::mutex> lock(mutex);
+				node = (unsigned)nodes.size();
+				nodes.push_back(node_t(name_id, parent));
+				nodes[parent].children.push_back(node);
+			}
+			stack.push_back(open_scope_t(node, time));
+			return (unsigned)stack.size() - 1;
+		}
+		void end(unsigned depth, uint64_t time) { // also closes any inner scopes that weren't ended, to handle out of order timer_t::end() calls
+			std::lock_guard<std::mutex> lock(mutex);
+			if (events.empty()) {events.resize(PROF_RING_SIZE);}
+
+			while (stack.size() > depth) {
+				open_scope_t const &os(stack.back());
+				node_t &n(nodes[os.node]);
+				uint64_t const dt(time - os.start);
+				++n.count;
+				n.total_ns += dt;
+				n.max_ns    = max(n.max_ns, dt);
+				event_t &e(events[num_events % PROF_RING_SIZE]);
+				e.start   = os.start;
+				e.end     = time;
+				e.name_id = n.name_id;
+				e.depth   = (unsigned)stack.size() - 1;
+				++num_events;
+				stack.pop_back();
+			}
+		}
+		void clear() { // keeps the tree structure since open scopes refer to its nodes
+			std::lock_guard<std::mutex> lock(mutex);
+			num_events = 0;
+			for (auto i = nodes.begin(); i != nodes.end(); ++i) {i->count = 0; i->total_ns = i->max_ns = 0;}
+		}
+	};
+
+private:
+	std::mutex mutex; // protects threads and names
+	vector<std::unique_ptr<thread_data_t>> threads; // never freed, so thread_local pointers to them stay valid
+	map<string, unsigned> name_to_id;
+	vector<string> names;
+
+	void print_node(thread_data_t const &td, unsigned nix, unsigned indent, unsigned max_name) const {
+		node_t const &n(td.nodes[nix]);
+
+		if (nix > 0) {
+			if (n.count == 0) return; // not called since last clear
+			string const &name(names[n.name_id]);
+			string const spaces(indent, ' '), spaces2(((max_name > name.size() + indent) ? (max_name - name.size() - indent) : 0), ' ');
+			cout << spaces << name << spaces2 << ": " << n.count << "\t" << 1.0E-6*n.total_ns << "\t" << 1.0E-6*n.max_ns << "\t" << 1.0E-6*n.total_ns/n.count << endl;
+			indent += 2;
+		}
+		for (auto i = n.children.begin(); i != n.children.end(); ++i) {print_node(td, *i, indent, max_name);}
+	}
+	static void write_json_str(std::ostream &out, string const &str) {
+		out << '"';
+
+		for (auto i = str.begin(); i != str.end(); ++i) {
+			if      (*i == '"' || *i == '\\') {out << '\\' << *i;}
+			else if ((unsigned char)*i < 32)  {out << ' ';} // control chars aren't valid JSON
+			else {out << *i;}
+		}
+		out << '"';
+	}
+
+public:
+	thread_data_t *register_thread() {
+		std::lock_guard<std::mutex> lock(mutex);
+		threads.emplace_back(new thread_data_t((unsigned)threads.size()));
+		return threads.back().get();
+	}
+	unsigned get_name_id(char const *const name) {
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it(name_to_id.find(name));
+		if (it != name_to_id.end()) return it->second;
+		unsigned const id((unsigned)names.size());
+		names.push_back(name);
+		name_to_id[name] = id;
+		return id;
+	}
+	void clear() {
+		std::lock_guard<std::mutex> lock(mutex);
+		for (auto i = threads.begin(); i != threads.end(); ++i) {(*i)->clear();}
+	}
+	void stats() {
+		std::lock_guard<std::mutex> lock(mutex);
+		unsigned max_name(0);
+		for (auto i = names.begin(); i != names.end(); ++i) {max_name = max(max_name, (unsigned)i->size());}
+		max_name += 16; // room for indent
+
+		for (auto i = threads.begin(); i != threads.end(); ++i) {
+			std::lock_guard<std::mutex> lock2((*i)->mutex);
+			if ((*i)->num_events == 0) continue; // nothing recorded in this thread
+			cout << "thread " << (*i)->thread_ix << ": name count total_ms max_ms average_ms" << endl;
+			print_node(**i, 0, 0, max_name);
+		}
+	}
+	bool write_chrome_trace(string const &fn) { // can be loaded in chrome://tracing or Perfetto
+		std::ofstream out(fn);
+		if (!out.good()) {cerr << "Error opening profiler trace file '" << fn << "' for write" << endl; return 0;}
+		std::lock_guard<std::mutex> lock(mutex);
+		uint64_t t0(0);
+		bool first(1);
+
+		for (auto i = threads.begin(); i != threads.end(); ++i) { // find the earliest event so that timestamps are relative to it
+			thread_data_t &td(**i);
+			std::lock_guard<std::mutex> lock2(td.mutex);
+			uint64_t const num(min(td.num_events, (uint64_t)PROF_RING_SIZE));
+			for (uint64_t e = td.num_events - num; e < td.num_events; ++e) {
+				uint64_t const start(td.events[e % PROF_RING_SIZE].start);
+				if (first || start < t0) {t0 = start; first = 0;}
+			}
+		}
+		out << "{\"traceEvents\":[";
+		first = 1;
+
+		for (auto i = threads.begin(); i != threads.end(); ++i) {
+			thread_data_t &td(**i);
+			std::lock_guard<std::mutex> lock2(td.mutex);
+			uint64_t const num(min(td.num_events, (uint64_t)PROF_RING_SIZE));
+
+			for (uint64_t e = td.num_events - num; e < td.num_events; ++e) {
+				event_t const &ev(td.events[e % PROF_RING_SIZE]);
+				out << (first ? "\n" : ",\n") << "{\"name\":";
+				write_json_str(out, names[ev.name_id]);
+				out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << td.thread_ix << ",\"ts\":" << 0.001*(ev.start - t0) << ",\"dur\":" << 0.001*(ev.end - ev.start) << "}";
+				first = 0;
+			}
+		}
+		out << "\n],\"displayTimeUnit\":\"ms\"}" << endl;
+		cout << "Wrote profiler trace file " << fn << endl;
+		return out.good();
+	}
+};
+
+hier_profiler_t hier_profiler;
+thread_local hier_profiler_t::thread_data_t *prof_thread_data(nullptr);
+
+hier_profiler_t::thread_data_t &get_prof_thread_data() {
+	if (prof_thread_data == nullptr) {prof_thread_data = hier_profiler.register_thread();}
+	return *prof_thread_data;
+}
+
+unsigned get_profile_name_id(char const *const name) {
+	auto &name_cache(get_prof_thread_data().name_cache);
+	auto it(name_cache.find(name));
+	if (it != name_cache.end()) return it->second;
+	unsigned const id(hier_profiler.get_name_id(name));
+	name_cache[name] = id;
+	return id;
+}
+unsigned profile_scope_begin(unsigned name_id) {return get_prof_thread_data().begin(name_id, get_profile_time_ns());}
+void profile_scope_end(unsigned depth) {get_prof_thread_data().end(depth, get_profile_time_ns());}
+
+
 void toggle_timing_profiler() {
 	global_profiler.enabled ^= 1;
+	hier_profiler_enabled = global_profiler.enabled;
 }
 
 void register_timing_value(const char *str, int delta_time) {
@@ -59,7 +275,276 @@ void register_timing_value(const char *str, int delta_time) {
 void timing_profiler_stats() {
 	global_profiler.stats();
 	global_profiler.clear();
+	hier_profiler.stats();
+	if (!profiler_trace_fn.empty()) {hier_profiler.write_chrome_trace(profiler_trace_fn);}
+	hier_profiler.clear();
+}
+
+
+// replay benchmark: per-frame subsystem timing of a fixed timestep event list replay (see read_ueventlist())
+bool replay_bench_active(0);
+unsigned replay_bench_warmup(10); // initial frames excluded from the summary
+float replay_bench_tolerance(0.1); // allowed fractional increase over the baseline
+string replay_bench_report, replay_bench_baseline; // report file prefix, baseline summary file
+int replay_bench_exit_code(0); // set when the benchmark finishes in headless mode, where run_headless() exits
+
+extern bool headless_mode;
+extern int read_eventlist;
+
+bool uevent_replay_done();
+void quit_3dworld();
+
+char const *const bench_col_names[NUM_BENCH_SUBSYS+1] = {"total", "physics", "ai", "traffic", "tiles", "lighting"};
+
+
+double get_bench_time_ms() { // higher resolution than GET_TIME_MS(), and doesn't require GLUT
+	return 1000.0*std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+class replay_benchmark_t {
+
+	struct frame_t {
+		double t[NUM_BENCH_SUBSYS+1]; // total, followed by subsystems
+		frame_t() {for (unsigned i = 0; i <= NUM_BENCH_SUBSYS; ++i) {t[i] = 0.0;}}
+	};
+	struct stats_t {
+		double mean, p50, p95, vmax;
+		stats_t() : mean(0.0), p50(0.0), p95(0.0), vmax(0.0) {}
+	};
+
+	vector<frame_t> frames;
+	frame_t cur;
+	double frame_start;
+
+	stats_t calc_stats(unsigned col) const {
+		stats_t stats;
+		unsigned const start((frames.size() > replay_bench_warmup) ? replay_bench_warmup : 0);
+		vector<double> vals;
+		for (auto i = frames.begin()+start; i != frames.end(); ++i) {vals.push_back(i->t[col]);}
+		if (vals.empty()) return stats;
+		sort(vals.begin(), vals.end());
+		for (auto i = vals.begin(); i != vals.end(); ++i) {stats.mean += *i;}
+		stats.mean /= vals.size();
+		stats.p50   = vals[vals.size()/2];
+		stats.p95   = vals[min((unsigned)vals.size()-1, unsigned(0.95*vals.size()))];
+		stats.vmax  = vals.back();
+		return stats;
+	}
+	bool write_frames(string const &fn) const {
+		std::ofstream out(fn);
+		if (!out.good()) {cerr << "Error opening replay benchmark frames file '" << fn << "' for write" << endl; return 0;}
+		out << "frame";
+		for (unsigned c = 0; c <= NUM_BENCH_SUBSYS; ++c) {out << "," << bench_col_names[c];}
+		out << endl;
+
+		for (unsigned f = 0; f < frames.size(); ++f) {
+			out << f;
+			for (unsigned c = 0; c <= NUM_BENCH_SUBSYS; ++c) {out << "," << frames[f].t[c];}
+			out << "\n";
+		}
+		return out.good();
+	}
+	bool write_summary(string const &fn, stats_t const *const stats) const {
+		std::ofstream out(fn);
+		if (!out.good()) {cerr << "Error opening replay benchmark summary file '" << fn << "' for write" << endl; return 0;}
+		out << "name,mean_ms,p50_ms,p95_ms,max_ms" << endl;
+
+		for (unsigned c = 0; c <= NUM_BENCH_SUBSYS; ++c) {
+			out << bench_col_names[c] << "," << stats[c].mean << "," << stats[c].p50 << "," << stats[c].p95 << "," << stats[c].vmax << endl;
+		}
+		return out.good();
+	}
+	bool read_summary(string const &fn, stats_t *stats) const { // returns 0 on failure
+		std::ifstream in(fn);
+		if (!in.good()) {cerr << "Error opening replay benchmark baseline file '" << fn << "'" << endl; return 0;}
+		string line;
+		std::getline(in, line); // skip the header
+		unsigned num_read(0);
+
+		while (std::getline(in, line)) {
+			for (auto i = line.begin(); i != line.end(); ++i) {if (*i == ',') {*i = ' ';}}
+			std::istringstream iss(line);
+			string name;
+			stats_t s;
+			if (!(iss >> name >> s.mean >> s.p50 >> s.p95 >> s.vmax)) continue; // blank or malformed line
+			
+			for (unsigned c = 0; c <= NUM_BENCH_SUBSYS; ++c) {
+				if (name == bench_col_names[c]) {stats[c] = s; ++num_read; break;}
+			}
+		}
+		if (num_read == 0) {cerr << "Error: no entries read from replay benchmark baseline file '" << fn << "'" << endl; return 0;}
+		return 1;
+	}
+	unsigned compare_to_baseline(stats_t const *const stats, stats_t const *const base) const { // returns the number of regressions
+		float const abs_slack_ms(0.1); // ignore tiny absolute differences in nearly empty subsystems
+		unsigned num_regress(0);
+		cout << "name\tmean\tbase\tp95\tbase" << endl;
+
+		for (unsigned c = 0; c <= NUM_BENCH_SUBSYS; ++c) {
+			bool const mean_bad(stats[c].mean > (1.0 + replay_bench_tolerance)*base[c].mean + abs_slack_ms);
+			bool const p95_bad (stats[c].p95  > (1.0 + replay_bench_tolerance)*base[c].p95  + abs_slack_ms);
+			cout << bench_col_names[c] << "\t" << stats[c].mean << "\t" << base[c].mean << "\t" << stats[c].p95 << "\t" << base[c].p95;
+			if (mean_bad || p95_bad) {cout << "\tREGRESSION"; ++num_regress;}
+			cout << endl;
+		}
+		return num_regress;
+	}
+	int finish() const { // returns the process exit code
+		cout << "Replay benchmark finished after " << frames.size() << " frames" << endl;
+		if (headless_mode) {cout << "Note: tiles aren't updated in headless mode, so the tiles column is empty" << endl;}
+		stats_t stats[NUM_BENCH_SUBSYS+1];
+		for (unsigned c = 0; c <= NUM_BENCH_SUBSYS; ++c) {stats[c] = calc_stats(c);}
+		bool had_error(!write_frames(replay_bench_report + ".frames.csv"));
+		had_error |= !write_summary(replay_bench_report + ".summary.csv", stats);
+		unsigned num_regress(0);
+
+		if (!replay_bench_baseline.empty()) {
+			stats_t base[NUM_BENCH_SUBSYS+1];
+			if (read_summary(replay_bench_baseline, base)) {num_regress = compare_to_baseline(stats, base);} else {had_error = 1;}
+			if (num_regress > 0) {cout << "Replay benchmark: " << num_regress << " regression(s) vs. baseline " << replay_bench_baseline << endl;}
+			else if (!had_error) {cout << "Replay benchmark: no regressions vs. baseline " << replay_bench_baseline << endl;}
+		}
+		return ((num_regress > 0 || had_error) ? 1 : 0); // nonzero exit code for scripts
+	}
+
+public:
+	replay_benchmark_t() : frame_start(-1.0) {}
+
+	void add_time(unsigned subsys, double time_ms) {
+		assert(subsys < NUM_BENCH_SUBSYS);
+#pragma omp critical(replay_bench_add)
+		cur.t[subsys+1] += time_ms; // may be called from multiple threads (traffic)
+	}
+	void next_frame() {
+		double const time(get_bench_time_ms());
+
+		if (frame_start >= 0.0) { // finish the previous frame
+			cur.t[0] = time - frame_start;
+			cur.t[BENCH_PHYSICS+1] = max(0.0, (cur.t[BENCH_PHYSICS+1] - cur.t[BENCH_AI+1])); // AI is called from within physics; make it exclusive
+			frames.push_back(cur);
+		}
+		cur = frame_t();
+		frame_start = time;
+		if (!uevent_replay_done()) return;
+		int const exit_code(finish());
+
+		if (headless_mode) { // return to run_headless() so that it can print profiler stats and clean up
+			replay_bench_active   = 0;
+			replay_bench_exit_code = exit_code;
+			return;
+		}
+		if (exit_code != 0) {exit(exit_code);}
+		quit_3dworld(); // never returns
+	}
+};
+
+replay_benchmark_t replay_bench;
+
+
+void add_replay_bench_time(unsigned subsys, double time_ms) {replay_bench.add_time(subsys, time_ms);}
+
+void replay_bench_next_frame() {
+	if (replay_bench_active) {replay_bench.next_frame();}
+}
+
+void init_replay_bench() { // called after loading the config file
+	if (replay_bench_report.empty()) return;
+
+	if (!read_eventlist) {
+		cerr << "Warning: replay_bench_report was specified without an event list to replay; benchmark is disabled" << endl;
+		return;
+	}
+	cout << "Running replay benchmark with report file prefix " << replay_bench_report << endl;
+	replay_bench_active = 1;
+}
+
+
+// memory accounting: polls each subsystem's CPU/GPU usage every mem_stats_interval frames and tracks the peak of each
+unsigned mem_stats_interval(0); // frames between updates; 0 = disabled
+bool mem_stats_print(0), show_mem_stats(0); // print to the console on each update, draw as an onscreen overlay
+
+extern int world_mode, window_width, window_height;
+
+char const *const mem_subsys_names[NUM_MEM_SUBSYS] = {"tiles", "trees", "grass", "buildings", "city", "models", "textures", "lightmap", "voxels", "cobjs", "cobj bvh", "cobj wbvh"};
+
+float mem_in_mb(uint64_t bytes) {return bytes/float(1024*1024);}
+
+
+class mem_stats_t {
+	mem_usage_t cur[NUM_MEM_SUBSYS], peak[NUM_MEM_SUBSYS];
+	unsigned num_updates;
+
+public:
+	mem_stats_t() : num_updates(0) {}
+
+	void update() {
+		mem_usage_t usage[NUM_MEM_SUBSYS];
+		
+		if (world_mode == WMODE_INF_TERRAIN) {add_tiled_terrain_mem_usage(usage);} // includes tile trees and grass
+		else {add_trees_mem_usage(usage); add_grass_mem_usage(usage);}
+		add_buildings_mem_usage(usage);
+		add_city_mem_usage(usage);
+		add_models_mem_usage(usage);
+		add_textures_mem_usage(usage);
+		add_lightmap_mem_usage(usage);
+		add_smoke_mem_usage(usage);
+		add_voxels_mem_usage(usage);
+		add_cobjs_mem_usage(usage);
+
+		for (unsigned i = 0; i < NUM_MEM_SUBSYS; ++i) {
+			cur[i] = usage[i];
+			peak[i].cpu   = max(peak[i].cpu,   usage[i].cpu);
+			peak[i].gpu   = max(peak[i].gpu,   usage[i].gpu);
+			peak[i].count = max(peak[i].count, usage[i].count);
+		}
+		++num_updates;
+	}
+	bool valid() const {return (num_updates > 0);}
+
+	void print() const {
+		uint64_t tot_cpu(0), tot_gpu(0);
+		cout << "memory: name cpu_MB gpu_MB count peak_cpu_MB peak_gpu_MB" << endl;
+
+		for (unsigned i = 0; i < NUM_MEM_SUBSYS; ++i) {
+			string const spaces((10 - strlen(mem_subsys_names[i])), ' ');
+			cout << mem_subsys_names[i] << spaces << ": " << mem_in_mb(cur[i].cpu) << "\t" << mem_in_mb(cur[i].gpu) << "\t" << cur[i].count << "\t"
+				 << mem_in_mb(peak[i].cpu) << "\t" << mem_in_mb(peak[i].gpu) << endl;
+			tot_cpu += cur[i].cpu;
+			tot_gpu += cur[i].gpu;
+		}
+		cout << "total     : " << mem_in_mb(tot_cpu) << "\t" << mem_in_mb(tot_gpu) << endl;
+	}
+	void draw() const {
+		float const ar(((float)window_width)/((float)window_height)), line_spacing(0.0007);
+		float y(0.010);
+		char text[128];
+
+		for (unsigned i = 0; i < NUM_MEM_SUBSYS; ++i, y -= line_spacing) {
+			sprintf(text, "%-10s CPU %7.1f MB (peak %7.1f)  GPU %7.1f MB (peak %7.1f)  N %u",
+				mem_subsys_names[i], mem_in_mb(cur[i].cpu), mem_in_mb(peak[i].cpu), mem_in_mb(cur[i].gpu), mem_in_mb(peak[i].gpu), cur[i].count);
+			draw_text(YELLOW, -0.011*ar, y, -0.02, text);
+		}
+	}
+};
+
+mem_stats_t mem_stats;
+
+
+void update_mem_stats() { // called once per frame
+	if (mem_stats_interval == 0) return; // disabled
+	static unsigned frame_ix(0);
+	if ((frame_ix++ % mem_stats_interval) != 0) return;
+	mem_stats.update();
+	if (mem_stats_print) {mem_stats.print();}
 }
 
+void print_mem_stats() { // on demand
+	mem_stats.update();
+	mem_stats.print();
+}
 
+void draw_mem_stats() {
+	if (show_mem_stats && mem_stats.valid()) {mem_stats.draw();}
+}
 
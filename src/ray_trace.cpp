@@ -8,6 +8,8 @@
 #include "binary_file_io.h"
 #include <atomic>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
 
 
 bool const COLOR_FROM_COBJ_TEX = 0; // 0 = fast/average color, 1 = true color
@@ -19,16 +21,17 @@ float const SNOW_ALBEDO   = 0.9;
 float const ICE_ALBEDO    = 0.8;
 
 bool keep_beams(0); // debugging mode
-bool kill_raytrace(0);
 bool no_stat_moving(0); // generally not thread safe for dynamic lighting update, since BVH is rebuilt per-frame; also, wrong to cache lighting for moving cobjs
 unsigned NPTS(50000), NRAYS(40000), LOCAL_RAYS(1000000), GLOBAL_RAYS(1000000), DYNAMIC_RAYS(1000000), NUM_THREADS(1), MAX_RAY_BOUNCES(20);
 std::atomic<unsigned long long> tot_rays(0), num_hits(0), cells_touched(0);
 unsigned const NUM_RAY_SPLITS [NUM_LIGHTING_TYPES] = {1, 1, 1, 1, 1}; // sky, global, local, cobj_accum, dynamic
 unsigned const INIT_RAY_SPLITS[NUM_LIGHTING_TYPES] = {1, 4, 1, 1, 1}; // sky, global, local, cobj_accum, dynamic
+unsigned const GLOBAL_RAY_TILES = 8; // primary global light rays are grouped into NxN tiles per light face to track which lightmap regions they reach
 
 extern bool has_snow, combined_gu, global_lighting_update, lighting_update_offline, store_cobj_accum_lighting_as_blocked;
+extern unsigned lighting_bake_passes;
 extern int read_light_files[], write_light_files[], display_mode, DISABLE_WATER;
-extern float water_plane_z, temperature, snow_depth, ray_step_size_mult, first_ray_weight[];
+extern float water_plane_z, temperature, snow_depth, ray_step_size_mult, lighting_bake_converge_thresh, first_ray_weight[];
 extern char *lighting_file[];
 extern point sun_pos, moon_pos;
 extern vector<light_source> light_sources_a;
@@ -214,6 +217,8 @@ light_volume_local &get_local_light_volume(int ltype) {
 }
 
 
+thread_local lmap_cell_range_t const *cur_lmap_update_range(nullptr); // if set, only lightmap cells in this range are updated by this thread
+
 void add_path_to_lmcs(lmap_manager_t *lmgr, cube_t *bcube, point p1, point const &p2, float weight, colorRGBA const &color, int ltype, bool first_pt) {
 
 	bool const dynamic(is_ltype_dynamic(ltype));
@@ -237,11 +242,12 @@ void add_path_to_lmcs(lmap_manager_t *lmgr, cube_t *bcube, point p1, point const
 	}
 	else { // use the lmgr
 		assert(lmgr != nullptr && lmgr->is_allocated());
+		point const start_pt(p1);
 
 		for (unsigned s = 0; s < nsteps; ++s) {
 			lmcell *lmc(lmgr->get_lmcell_round_down(p1));
 		
-			if (lmc != NULL) { // could use a mutex here, but it seems too slow
+			if (lmc != NULL && (cur_lmap_update_range == nullptr || cur_lmap_update_range->contains_pt(p1))) { // could use a mutex here, but it seems too slow
 				float *color(lmc->get_offset(ltype));
 				ADD_LIGHT_CONTRIB(cw, color);
 				if (ltype != LIGHTING_LOCAL) {color[3] += weight;}
@@ -249,7 +255,7 @@ void add_path_to_lmcs(lmap_manager_t *lmgr, cube_t *bcube, point p1, point const
 			p1 += step;
 		}
 		if (bcube) {
-			bcube->assign_or_union_with_pt(p1);
+			bcube->assign_or_union_with_pt(start_pt);
 			bcube->union_with_pt(p2);
 		}
 		lmgr->was_updated = 1;
@@ -259,8 +265,16 @@ void add_path_to_lmcs(lmap_manager_t *lmgr, cube_t *bcube, point p1, point const
 }
 
 
+bool clip_light_ray(point &p1, point &p2) { // returns false if the ray misses the scene or starts under the mesh
+	if (!do_line_clip_scene(p1, p2, min(zbottom, czmin), max(ztop, czmax))) return 0;
+	if ((display_mode & 0x01) && is_under_mesh(p1)) return 0;
+	return 1;
+}
+
+
+// pre_query: optional cobj intersection result from a packet query (see light_ray_batch_t), where p1 and p2 have already been clipped
 void cast_light_ray(lmap_manager_t *lmgr, point p1, point p2, float weight, float weight0, colorRGBA color, float line_length,
-	int ignore_cobj, int ltype, unsigned depth, rand_gen_t &rgen, cobj_ray_accum_map_t *accum_map, cube_t *bcube=nullptr)
+	int ignore_cobj, int ltype, unsigned depth, rand_gen_t &rgen, cobj_ray_accum_map_t *accum_map, cube_t *bcube=nullptr, coll_line_query_t const *pre_query=nullptr)
 {
 	if (depth > MAX_RAY_BOUNCES) return;
 	if (ltype == LIGHTING_DYNAMIC && depth > 4) return; // use a sensible default since this is running during rendering
@@ -269,15 +283,24 @@ void cast_light_ray(lmap_manager_t *lmgr, point p1, point p2, float weight, floa
 
 	// find intersection point with scene cobjs
 	point orig_p1(p1);
-	if (!do_line_clip_scene(p1, p2, min(zbottom, czmin), max(ztop, czmax))) return;
-	if ((display_mode & 0x01) && is_under_mesh(p1)) return;
+	if (pre_query) {assert(p1 == pre_query->p1 && p2 == pre_query->p2 && ignore_cobj == pre_query->ignore_cobj);} // already clipped
+	else if (!clip_light_ray(p1, p2)) return;
 	int cindex(-1), xpos(0), ypos(0);
 	point cpos(p2);
 	vector3d cnorm;
 	float t(0.0), zval(0.0);
 	bool snow_coll(0), ice_coll(0), water_coll(0), mesh_coll(0);
 	vector3d const dir((p2 - p1).get_norm());
-	bool coll(check_coll_line_exact(p1, p2, cpos, cnorm, cindex, 0.0, ignore_cobj, 1, 0, 1, 1, (p1 == orig_p1), no_stat_moving)); // fast=1, exclude voxels, maybe skip init colls
+	bool coll(0);
+
+	if (pre_query) {
+		cindex = pre_query->cindex;
+		coll   = (cindex >= 0);
+		if (coll) {cpos = pre_query->cpos; cnorm = pre_query->cnorm;}
+	}
+	else {
+		coll = check_coll_line_exact(p1, p2, cpos, cnorm, cindex, 0.0, ignore_cobj, 1, 0, 1, 1, (p1 == orig_p1), no_stat_moving); // fast=1, exclude voxels, maybe skip init colls
+	}
 	assert(coll ? (cindex >= 0 && cindex < (int)coll_objects.size()) : (cindex == -1));
 
 	// find the intersection point with the model3ds
@@ -495,12 +518,17 @@ struct rt_data {
 	unsigned ix, num, job_id, checksum;
 	int rseed, ltype;
 	bool is_thread, verbose, randomized, is_running;
+	float weight_scale; // global lighting ray weight multiplier
 	cube_t update_bcube;
 	lmap_manager_t *lmgr;
 	cobj_ray_accum_map_t accum_map;
+	vector<cube_t> tile_bcubes; // global lighting: bounds of the lightmap cells reached by the rays of each tile, including bounces; empty if not tracked
+	vector<unsigned char> const *tile_mask; // global lighting: if set, only rays from tiles with nonzero entries are traced
+	lmap_cell_range_t const *update_range; // if set, only lightmap cells in this range are updated
 
 	rt_data(unsigned i=0, unsigned n=0, int s=1, bool t=0, bool v=0, bool r=0, int lt=0, unsigned jid=0)
-		: ix(i), num(n), job_id(jid), checksum(0), rseed(s), ltype(lt), is_thread(t), verbose(v), randomized(r), is_running(0), lmgr(nullptr) {update_bcube.set_to_zeros();}
+		: ix(i), num(n), job_id(jid), checksum(0), rseed(s), ltype(lt), is_thread(t), verbose(v), randomized(r), is_running(0), weight_scale(1.0),
+		lmgr(nullptr), tile_mask(nullptr), update_range(nullptr) {update_bcube.set_to_zeros();}
 
 	void pre_run(rand_gen_t &rgen) {
 		assert(lmgr);
@@ -508,122 +536,195 @@ struct rt_data {
 		assert(!is_running);
 		is_running = 1;
 		rgen.set_state(rseed, 1);
+		cur_lmap_update_range = update_range;
 	}
 	void post_run() {
 		assert(is_running); // can this fail due to race conditions? too strong? remove?
 		is_running = 0;
+		cur_lmap_update_range = nullptr;
 	}
 };
 
 
-template<typename T> class thread_manager_t {
+int const RT_PRIORITY_BACKGROUND = 0; // progressive lighting bake
+int const RT_PRIORITY_FOREGROUND = 1; // blocking jobs
 
-	vector<std::thread> threads;
-public:
-	vector<T> data; // to be filled in by the caller
+struct rt_job_t { // a group of tasks that are run, waited on, and cancelled together
 
-	bool is_active() const {return (!threads.empty());}
+	vector<rt_data> data; // one per task, to be filled in by the caller
+	std::atomic<unsigned> num_pending; // queued or running tasks
+	std::atomic<bool> cancel;
 
-	bool any_threads_running() const {
-		for (auto i = data.begin(); i != data.end(); ++i) {if (i->is_running) return 1;}
-		return 0;
+	rt_job_t() : num_pending(0), cancel(0) {}
+	bool is_active () const {return !data.empty();}
+	bool is_running() const {return (num_pending > 0);}
+};
+
+thread_local std::atomic<bool> const *cur_job_cancel(nullptr); // cancel flag of the job run by this thread
+thread_local int cur_task_priority(RT_PRIORITY_FOREGROUND); // priority of the task run by this thread; the main thread counts as foreground
+
+
+class rt_worker_pool_t { // persistent threads shared by all ray tracing jobs; tasks are run in priority order, then in submission order
+
+	struct task_t {
+		void (*func)(rt_data *);
+		rt_job_t *job;
+		unsigned ix, seq;
+		int priority;
+		bool operator<(task_t const &t) const {return ((priority == t.priority) ? (seq > t.seq) : (priority < t.priority));} // max heap order
+	};
+	vector<std::thread> threads;
+	vector<task_t> tasks; // heap
+	std::mutex mutex;
+	std::condition_variable task_cv, done_cv;
+	unsigned next_seq;
+	bool exiting;
+
+	task_t pop_task() { // mutex must be locked
+		pop_heap(tasks.begin(), tasks.end());
+		task_t const task(tasks.back());
+		tasks.pop_back();
+		if (task.priority > RT_PRIORITY_BACKGROUND) {--num_fg_queued;}
+		return task;
 	}
-	void clear() {
-		data.clear();
-		threads.clear();
+	void run_task(task_t const &task) { // may be nested inside a background task on the same thread, so save and restore the thread state
+		std::atomic<bool> const *const prev_cancel(cur_job_cancel);
+		lmap_cell_range_t const *const prev_range(cur_lmap_update_range);
+		int const prev_priority(cur_task_priority);
+		cur_job_cancel    = &task.job->cancel;
+		cur_task_priority = task.priority;
+		task.func(&task.job->data[task.ix]);
+		cur_job_cancel    = prev_cancel;
+		cur_task_priority = prev_priority;
+		cur_lmap_update_range = prev_range;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			--task.job->num_pending;
+		}
+		done_cv.notify_all();
 	}
-	void create(unsigned num_threads) {
-		assert(!is_active());
-		data.resize(num_threads);
-		threads.resize(num_threads);
+	void worker_loop() {
+		while (1) {
+			task_t task;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				while (!exiting && tasks.empty()) {task_cv.wait(lock);}
+				if (exiting) return;
+				task = pop_task();
+			}
+			run_task(task);
+		}
+	}
+public:
+	std::atomic<unsigned> num_fg_queued; // queued tasks above background priority, checked without the mutex
+
+	rt_worker_pool_t() : next_seq(0), exiting(0), num_fg_queued(0) {}
+	~rt_worker_pool_t() {shutdown();}
+
+	void run_job(rt_job_t &job, void (*func)(rt_data *), int priority) { // adds a task for each entry in job.data
+		assert(job.is_active() && !job.is_running());
+		job.cancel = 0;
+		std::lock_guard<std::mutex> lock(mutex);
+		while (threads.size() < job.data.size()) {threads.push_back(std::thread(&rt_worker_pool_t::worker_loop, this));} // grow the pool as needed
+
+		for (unsigned i = 0; i < job.data.size(); ++i) {
+			task_t const task = {func, &job, i, next_seq++, priority};
+			tasks.push_back(task);
+			push_heap(tasks.begin(), tasks.end());
+			++job.num_pending;
+			if (priority > RT_PRIORITY_BACKGROUND) {++num_fg_queued;}
+		}
+		task_cv.notify_all();
 	}
-	void run(void (*func)(rt_data *)) {
-		assert(threads.size() == data.size());
-		for (unsigned t = 0; t < threads.size(); ++t) {threads[t] = std::thread(func, (rt_data *)(&data[t]));}
+	void run_foreground_tasks() { // called by background tasks so that blocking jobs don't have to wait for them to finish
+		while (1) {
+			task_t task;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (exiting || tasks.empty() || tasks.front().priority <= RT_PRIORITY_BACKGROUND) return; // front is the highest priority task
+				task = pop_task();
+			}
+			run_task(task);
+		}
+	}
+	void wait_for_job(rt_job_t &job) {
+		std::unique_lock<std::mutex> lock(mutex);
+		while (job.num_pending > 0) {done_cv.wait(lock);}
 	}
-	void join() {
-		for (unsigned t = 0; t < threads.size(); ++t) {threads[t].join();}
+	void cancel_job(rt_job_t &job) { // removes queued tasks, signals running tasks to exit early, and waits for them
+		job.cancel = 1;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			unsigned const prev_size(tasks.size());
+
+			for (unsigned i = 0; i < tasks.size();) {
+				if (tasks[i].job != &job) {++i; continue;}
+				if (tasks[i].priority > RT_PRIORITY_BACKGROUND) {--num_fg_queued;}
+				tasks[i] = tasks.back(); tasks.pop_back(); --job.num_pending;
+			}
+			if (tasks.size() < prev_size) {make_heap(tasks.begin(), tasks.end());}
+		}
+		wait_for_job(job);
+	}
+	void shutdown() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			exiting = 1;
+		}
+		task_cv.notify_all();
+		for (auto i = threads.begin(); i != threads.end(); ++i) {i->join();}
+		threads.clear();
 	}
-	void join_and_clear() {join(); clear();}
 };
 
-thread_manager_t<rt_data> thread_manager;
+rt_worker_pool_t rt_worker_pool;
+rt_job_t fg_job; // blocking jobs
 lmap_manager_t thread_temp_lmap;
 
-bool indir_lighting_updated() {return (global_lighting_update && (lmap_manager.was_updated || thread_temp_lmap.was_updated));} // only for global updates
-
-
-void kill_current_raytrace_threads() {
-
-	if (thread_manager.is_active()) { // can't have two running at once, so kill the existing one
-		// cancel thread?
-		kill_raytrace = 1;
-		thread_manager.join_and_clear();
-		assert(!thread_manager.is_active());
-		kill_raytrace = 0;
-	}
-}
-
-
-void update_lmap_from_temp_copy() {
-
-	if (!thread_temp_lmap.was_updated) return; // no updates
-	float const blend_weight = 1.0; // FIXME: slow blend over time to reduce popping
-	lmap_manager.copy_data(thread_temp_lmap, blend_weight);
-	thread_temp_lmap.was_updated = 0;
-	lmap_manager.was_updated     = 1;
-}
-
-
-void check_for_lighting_finished() { // to be called about once per frame
-
-	if (!thread_manager.is_active()) return; // inactive
-	if (thread_manager.any_threads_running()) return; // still running
-	thread_manager.join_and_clear(); // clear() or join_and_clear()?
-	update_lmap_from_temp_copy();
+// for cooperative cancellation of long running loops; background (bake) tasks also run any queued foreground tasks here,
+// which pauses the bake rather than making the main thread wait for a bake task to finish
+bool rt_job_cancelled() {
+	if (cur_task_priority == RT_PRIORITY_BACKGROUND && rt_worker_pool.num_fg_queued > 0) {rt_worker_pool.run_foreground_tasks();}
+	return (cur_job_cancel != nullptr && *cur_job_cancel);
 }
 
 
 // see https://computing.llnl.gov/tutorials/pthreads/ (for old pthread implementation - now using std::thread)
-void launch_threaded_job(unsigned num_threads, void (*start_func)(rt_data *), bool verbose, bool blocking, bool use_temp_lmap, bool randomized, int ltype, unsigned job_id=0) {
+void launch_threaded_job(unsigned num_threads, void (*start_func)(rt_data *), bool verbose, bool randomized, int ltype, unsigned job_id=0) { // blocking
 
-	kill_current_raytrace_threads();
 	assert(num_threads > 0 && num_threads < 100);
 	assert(!keep_beams || num_threads == 1); // could use a mutex instead to make this legal
+	assert(!fg_job.is_active());
 	bool const single_thread(num_threads == 1);
 	if (verbose) {cout << "Computing lighting on " << num_threads << " threads." << endl;}
-	thread_manager.create(num_threads);
-	vector<rt_data> &data(thread_manager.data);
-	if (use_temp_lmap) {thread_temp_lmap.init_from(lmap_manager);}
+	vector<rt_data> &data(fg_job.data);
+	data.resize(num_threads);
 
 	for (unsigned t = 0; t < data.size(); ++t) {
 		// create a custom lmap_manager_t for each thread then merge them together?
 		data[t] = rt_data(t, num_threads, 234323*(t+1), !single_thread, (verbose && t == 0), randomized, ltype, job_id);
-		data[t].lmgr = (use_temp_lmap ? &thread_temp_lmap : &lmap_manager);
+		data[t].lmgr = &lmap_manager;
 	}
-	if (single_thread && blocking) { // threads disabled
+	if (single_thread) { // threads disabled
 		start_func((rt_data *)(&data[0]));
 	}
 	else {
-		thread_manager.run(start_func);
-		if (blocking) {thread_manager.join();}
-	}
-	if (blocking) {
-		if (enable_platform_lights(ltype)) {
-			merged_accum_map.clear();
-			for (auto i = data.begin(); i != data.end(); ++i) {merged_accum_map.merge(i->accum_map);}
-			if (!merged_accum_map.empty()) {merged_accum_map.stats();}
-		}
-		if (ltype == LIGHTING_COBJ_ACCUM) {
-			for (auto i = data.begin(); i != data.end(); ++i) {
-				lmap_manager.update_bcube.assign_or_union_with_cube(i->update_bcube); // merge update bounding cubes
-			}
+		rt_worker_pool.run_job(fg_job, start_func, RT_PRIORITY_FOREGROUND); // runs ahead of any queued background tasks
+		rt_worker_pool.wait_for_job(fg_job);
+	}
+	if (enable_platform_lights(ltype)) {
+		merged_accum_map.clear();
+		for (auto i = data.begin(); i != data.end(); ++i) {merged_accum_map.merge(i->accum_map);}
+		if (!merged_accum_map.empty()) {merged_accum_map.stats();}
+	}
+	if (ltype == LIGHTING_COBJ_ACCUM) {
+		for (auto i = data.begin(); i != data.end(); ++i) {
+			lmap_manager.update_bcube.assign_or_union_with_cube(i->update_bcube); // merge update bounding cubes
 		}
-		thread_manager.clear();
 	}
+	data.clear();
 	//cout << "total rays: " << tot_rays << ", hits: " << num_hits << ", cells touched: " << cells_touched << endl;
 	//tot_rays = num_hits = cells_touched = 0;
-	// if non-blocking, threads are finished when lmap_manager.was_updated is not set to true during the current frame
 }
 
 
@@ -637,20 +738,101 @@ bool cube_light_src_vect::ray_intersects_any(point const &start_pt, point const
 }
 
 
-void trace_one_global_ray(lmap_manager_t *lmgr, point const &pos, point const &pt, colorRGBA const &color, float ray_wt,
-	int ltype, bool is_scene_cube, rand_gen_t &rgen, cobj_ray_accum_map_t *accum_map, float line_length)
-{
+// batches coherent primary rays with the same weight and color (such as rays from a common origin) so that they can share BVH node tests
+class light_ray_batch_t {
+
+	lmap_manager_t *lmgr;
+	float weight, line_length;
+	colorRGBA color;
+	int ltype;
+	rand_gen_t &rgen;
+	cobj_ray_accum_map_t *accum_map;
+	unsigned num;
+	coll_line_query_t queries[COLL_LINE_PACKET_SIZE];
+	cube_t *bcubes[COLL_LINE_PACKET_SIZE]; // optional bounds of the lightmap updates of each ray
+	unsigned seeds[COLL_LINE_PACKET_SIZE]; // optional per-ray random seeds
+	rand_gen_t ray_rgen;
+
+	rand_gen_t &get_ray_rgen(unsigned seed) { // seed=0 uses the shared rgen
+		if (seed == 0) return rgen;
+		ray_rgen.set_state(1 + (seed % 2147483562U), 1 + ((seed*2654435761U) % 2147483398U)); // both in the generator's valid range
+		return ray_rgen;
+	}
+public:
+	light_ray_batch_t(lmap_manager_t *lmgr_, float weight_, colorRGBA const &color_, float line_length_, int ltype_, rand_gen_t &rgen_, cobj_ray_accum_map_t *accum_map_)
+		: lmgr(lmgr_), weight(weight_), line_length(line_length_), color(color_), ltype(ltype_), rgen(rgen_), accum_map(accum_map_), num(0) {}
+	~light_ray_batch_t() {flush();}
+
+	// seed: if nonzero, the ray's bounces use their own random sequence, so that they don't depend on which other rays were traced
+	void add_ray(point const &p1, point const &p2, cube_t *bcube=nullptr, unsigned seed=0) {
+		if (world_mode != WMODE_GROUND) { // packets only apply to ground mode cobjs
+			cast_light_ray(lmgr, p1, p2, weight, weight, color, line_length, -1, ltype, 0, get_ray_rgen(seed), accum_map, bcube);
+			return;
+		}
+		point p1c(p1), p2c(p2);
+		if (!clip_light_ray(p1c, p2c)) {++tot_rays; return;} // counted but not traced, same as in cast_light_ray()
+		bcubes [num  ] = bcube;
+		seeds  [num  ] = seed;
+		queries[num++] = coll_line_query_t(p1c, p2c, -1, (p1c == p1));
+		if (num == COLL_LINE_PACKET_SIZE) {flush();}
+	}
+	void flush() {
+		if (num == 0) return;
+		check_coll_line_exact_tree_packet(queries, num, 0, 0, 1, 0, no_stat_moving); // same query as in cast_light_ray()
+
+		for (unsigned r = 0; r < num; ++r) {
+			cast_light_ray(lmgr, queries[r].p1, queries[r].p2, weight, weight, color, line_length, -1, ltype, 0, get_ray_rgen(seeds[r]), accum_map, bcubes[r], &queries[r]);
+		}
+		num = 0;
+	}
+};
+
+
+void trace_one_global_ray(light_ray_batch_t &batch, point const &pos, point const &pt, float line_length, bool is_scene_cube, cube_t *bcube, unsigned seed) {
+
 	point const end_pt(pt + (pt - pos).get_norm()*line_length);
 	if (is_scene_cube && global_cube_lights.ray_intersects_any(pt, end_pt)) return; // don't double count
-	cast_light_ray(lmgr, pos, end_pt, ray_wt, ray_wt, color, line_length, -1, ltype, 0, rgen, accum_map);
+	batch.add_ray(pos, end_pt, bcube, seed);
 }
 
 
+// tiles: GLOBAL_RAY_TILES^2 per face of the scene bounds and of each global cube light, for each of the sun and moon
+unsigned get_num_global_ray_tiles() {return 2*(global_cube_lights.size() + 1)*3*GLOBAL_RAY_TILES*GLOBAL_RAY_TILES;}
+
+// returns false if rays from the tile containing launch point pt are masked off; sets bcube to the tile's lightmap update bounds if tracked
+bool get_global_ray_tile(rt_data *tdata, unsigned face_ix, cube_t const &bnds, unsigned d0, unsigned d1, point const &pt, cube_t *&bcube) {
+
+	bcube = nullptr;
+	if (tdata == nullptr) return 1; // tiles not used
+	unsigned tix[2] = {0, 0};
+
+	for (unsigned n = 0; n < 2; ++n) {
+		unsigned const d(n ? d1 : d0);
+		float const len(bnds.d[d][1] - bnds.d[d][0]);
+		if (len > 0.0) {tix[n] = min(GLOBAL_RAY_TILES-1, unsigned(max(0.0f, GLOBAL_RAY_TILES*(pt[d] - bnds.d[d][0])/len)));}
+	}
+	unsigned const ix((face_ix*GLOBAL_RAY_TILES + tix[0])*GLOBAL_RAY_TILES + tix[1]);
+	if (tdata->tile_mask && !(*tdata->tile_mask)[ix]) return 0;
+	if (!tdata->tile_bcubes.empty()) {bcube = &tdata->tile_bcubes[ix];}
+	return 1;
+}
+
+
+unsigned get_global_ray_seed(unsigned seed_base, unsigned face_ix, unsigned ray_ix) {
+	unsigned const key[3] = {seed_base, face_ix, ray_ix};
+	return max(1U, jenkins_one_at_a_time_hash(key, 3)); // nonzero
+}
+
+// tdata: optional task data for ray tiles, where this light face group has tiles starting at face (3*tile_group);
+// ray launch points only use rgen and each ray's bounces are seeded by its index, so skipping masked off tiles doesn't change the other rays
 void trace_ray_block_global_cube(lmap_manager_t *lmgr, cube_t const &bnds, point const &pos, colorRGBA const &color, float ray_wt,
-	unsigned nrays, int ltype, unsigned disabled_edges, bool is_scene_cube, bool verbose, bool randomized, rand_gen_t &rgen, cobj_ray_accum_map_t *accum_map)
+	unsigned nrays, int ltype, unsigned disabled_edges, bool is_scene_cube, bool verbose, bool randomized, rand_gen_t &rgen, cobj_ray_accum_map_t *accum_map,
+	rt_data *tdata=nullptr, unsigned tile_group=0)
 {
 	float const line_length(2.0*get_scene_radius());
+	light_ray_batch_t batch(lmgr, ray_wt, color, line_length, ltype, rgen, accum_map); // rays share a common origin
 	vector3d const ldir((bnds.get_cube_center() - pos).get_norm());
+	unsigned const seed_base(rgen.rand());
 	float proj_area[3] = {0}, tot_area(0.0);
 
 	for (unsigned i = 0; i < 3; ++i) { // adjust the number or weight of rays based on sun/moon position, or simply modify color scale?
@@ -666,18 +848,20 @@ void trace_ray_block_global_cube(lmap_manager_t *lmgr, cube_t const &bnds, point
 		assert(tot_area > 0.0);
 		bool const dir(ldir[i] < 0.0);
 		unsigned const d0((i+1)%3), d1((i+2)%3);
-		unsigned const num_rays(unsigned(nrays*proj_area[i]/tot_area + 0.5));
+		unsigned const num_rays(unsigned(nrays*proj_area[i]/tot_area + 0.5)), face_ix(3*tile_group + i);
 		point pt;
 		pt[i] = bnds.d[i][dir];
+		cube_t *bcube(nullptr);
 		if (verbose) {cout << "Dim " << i+1 << " of 3, num (this thread): " << num_rays << ", progress (of " << 1+num_rays/1000 << "): 0";}
 
 		if (randomized) {
 			for (unsigned s = 0; s < num_rays; ++s) {
-				if (kill_raytrace) break;
+				if (rt_job_cancelled()) break;
 				if (verbose && ((s%1000) == 0)) {increment_printed_number(s/1000);}
 				pt[d0] = rgen.rand_uniform(bnds.d[d0][0], bnds.d[d0][1]);
 				pt[d1] = rgen.rand_uniform(bnds.d[d1][0], bnds.d[d1][1]);
-				trace_one_global_ray(lmgr, pos, pt, color, ray_wt, ltype, is_scene_cube, rgen, accum_map, line_length);
+				if (!get_global_ray_tile(tdata, face_ix, bnds, d0, d1, pt, bcube)) continue;
+				trace_one_global_ray(batch, pos, pt, line_length, is_scene_cube, bcube, get_global_ray_seed(seed_base, face_ix, s));
 			}
 		}
 		else {
@@ -687,42 +871,49 @@ void trace_ray_block_global_cube(lmap_manager_t *lmgr, cube_t const &bnds, point
 			unsigned num(0);
 
 			for (unsigned s0 = 0; s0 < n0; ++s0) {
-				if (kill_raytrace) break;
+				if (rt_job_cancelled()) break;
 				pt[d0] = bnds.d[d0][0] + (s0 + rgen.rand_uniform(0.0, 1.0))*len0/n0;
 
 				for (unsigned s1 = 0; s1 < n1; ++s1, ++num) {
-					if (kill_raytrace) break;
+					if (rt_job_cancelled()) break;
 					if (verbose && ((num%1000) == 0)) increment_printed_number(num/1000);
 					pt[d1] = bnds.d[d1][0] + (s1 + rgen.rand_uniform(0.0, 1.0))*len1/n1;
-					trace_one_global_ray(lmgr, pos, pt, color, ray_wt, ltype, is_scene_cube, rgen, accum_map, line_length);
+					if (!get_global_ray_tile(tdata, face_ix, bnds, d0, d1, pt, bcube)) continue;
+					trace_one_global_ray(batch, pos, pt, line_length, is_scene_cube, bcube, get_global_ray_seed(seed_base, face_ix, num));
 				}
 			}
 		}
+		batch.flush();
 		if (verbose) {cout << endl;}
 	} // for i
 }
 
 
-void trace_ray_block_global_light(rt_data *data, point const &pos, colorRGBA const &color, float weight) {
+void trace_ray_block_global_light(rt_data *data, point const &pos, colorRGBA const &color, float weight, unsigned light_ix) {
 
 	if (pos.z < 0.0 || weight == 0.0 || color.alpha == 0.0) return; // below the horizon or zero weight, skip it
 	assert(data);
 	rand_gen_t rgen;
 	data->pre_run(rgen);
+	weight *= data->weight_scale;
 	unsigned long long cube_start_rays(0);
+	unsigned const num_groups(global_cube_lights.size() + 1), tile_group(light_ix*num_groups);
+	assert(data->tile_bcubes.empty() || data->tile_bcubes.size() == get_num_global_ray_tiles());
+	assert(data->tile_mask == nullptr || data->tile_mask->size() == get_num_global_ray_tiles());
 
 	if (GLOBAL_RAYS > 0) {
 		float const ray_wt(RAY_WEIGHT*weight*color.alpha/GLOBAL_RAYS);
 		assert(ray_wt > 0.0);
 		cube_t const bnds(get_scene_bounds());
-		trace_ray_block_global_cube(data->lmgr, bnds, pos, color, ray_wt, max(1U, GLOBAL_RAYS/data->num), LIGHTING_GLOBAL, 0, 1, data->verbose, data->randomized, rgen, &data->accum_map);
+		trace_ray_block_global_cube(data->lmgr, bnds, pos, color, ray_wt, max(1U, GLOBAL_RAYS/data->num), LIGHTING_GLOBAL, 0, 1, data->verbose, data->randomized, rgen, &data->accum_map, data, tile_group);
 	}
 	for (cube_light_src_vect::const_iterator i = global_cube_lights.begin(); i != global_cube_lights.end(); ++i) {
 		if (data->num == 0 || i->num_rays == 0) continue; // disabled
 		if (data->verbose) {cout << "Cube volume light source " << (i - global_cube_lights.begin()) << " of " << global_cube_lights.size() << endl;}
 		unsigned const num_rays(i->num_rays/data->num);
 		float const cube_weight(RAY_WEIGHT*weight*i->intensity/i->num_rays);
-		trace_ray_block_global_cube(data->lmgr, i->bounds, pos, color, cube_weight, num_rays, LIGHTING_GLOBAL, i->disabled_edges, 0, data->verbose, data->randomized, rgen, &data->accum_map);
+		trace_ray_block_global_cube(data->lmgr, i->bounds, pos, color, cube_weight, num_rays, LIGHTING_GLOBAL, i->disabled_edges, 0, data->verbose, data->randomized, rgen, &data->accum_map,
+			data, (tile_group + 1 + (i - global_cube_lights.begin())));
 		cube_start_rays += num_rays;
 	}
 	if (data->verbose) {
@@ -733,14 +924,17 @@ void trace_ray_block_global_light(rt_data *data, point const &pos, colorRGBA con
 }
 
 
+bool is_global_sun_lighting () {return (light_factor >= 0.4 && !combined_gu);}
+bool is_global_moon_lighting() {return (light_factor <= 0.6);}
+
 void trace_ray_block_global(rt_data *data) {
 
 	if (GLOBAL_RAYS == 0 && global_cube_lights.empty()) return; // nothing to do
 	// Note: The light color here is white because it will be multiplied by the ambient color later,
 	//       and the moon color is generally similar to the sun color so they can be approximated as equal
 	float const lfn(CLIP_TO_01(1.0f - 5.0f*(light_factor - 0.4f)));
-	if (light_factor >= 0.4 && !combined_gu) trace_ray_block_global_light(data, sun_pos,  WHITE, 1.0-lfn);
-	if (light_factor <= 0.6) trace_ray_block_global_light(data, moon_pos, WHITE, lfn);
+	if (is_global_sun_lighting ()) trace_ray_block_global_light(data, sun_pos,  WHITE, 1.0-lfn, 0);
+	if (is_global_moon_lighting()) trace_ray_block_global_light(data, moon_pos, WHITE, lfn,     1);
 }
 
 
@@ -769,7 +963,7 @@ void trace_ray_block_sky(rt_data *data) {
 		if (data->verbose) {cout << "Sky light source progress (of " << block_npts << "): 0";}
 
 		for (unsigned p = 0; p < block_npts; ++p) {
-			if (kill_raytrace) break;
+			if (rt_job_cancelled()) break;
 			if (data->verbose) {increment_printed_number(p);}
 			point const &pt(pts[p]);
 
@@ -779,20 +973,21 @@ void trace_ray_block_sky(rt_data *data) {
 				//dirs[r].z = -fabs(dirs[r].z); // pointing down
 			}
 			sort(dirs.begin(), dirs.end());
+			light_ray_batch_t batch(data->lmgr, ray_wt, WHITE, line_length, LIGHTING_SKY, rgen, &data->accum_map); // rays share a common origin
 
 			for (unsigned r = 0; r < NRAYS; ++r) {
-				if (kill_raytrace) break;
+				if (rt_job_cancelled()) break;
 				if (dot_product(dirs[r], pt) >= 0.0) continue; // can get here when (-Z_SCENE_SIZE, Z_SCENE_SIZE) does not contain (czmin, czmax)
 				point const end_pt(pt + dirs[r]*line_length);
 				if (sky_cube_lights.ray_intersects_any(pt, end_pt)) continue; // don't double count
-				cast_light_ray(data->lmgr, pt, end_pt, ray_wt, ray_wt, WHITE, line_length, -1, LIGHTING_SKY, 0, rgen, &data->accum_map);
+				batch.add_ray(pt, end_pt);
 				++start_rays;
 			}
 		}
 		if (data->verbose) {cout << endl;}
 	}
 	for (cube_light_src_vect::const_iterator i = sky_cube_lights.begin(); i != sky_cube_lights.end(); ++i) {
-		if (kill_raytrace) break;
+		if (rt_job_cancelled()) break;
 		if (data->num == 0 || i->num_rays == 0) continue; // disabled
 		unsigned const num_rays(i->num_rays/data->num);
 		float const cube_weight(RAY_WEIGHT*i->intensity/i->num_rays);
@@ -800,7 +995,7 @@ void trace_ray_block_sky(rt_data *data) {
 		cube_start_rays += num_rays;
 
 		for (unsigned p = 0; p < num_rays; ++p) {
-			if (kill_raytrace) break;
+			if (rt_job_cancelled()) break;
 			if (data->verbose && ((p%1000) == 0)) {increment_printed_number(p/1000);}
 			point const pt(rgen.gen_rand_cube_point(i->bounds));
 			vector3d dir(rgen.signed_rand_vector_spherical().get_norm()); // need high quality distribution
@@ -850,7 +1045,7 @@ void trace_ray_block_cobj_accum(rt_data *data) {
 
 		// round robin distribute rays across threads
 		for (auto r = (i->second.rays.begin() + data->ix); r < i->second.rays.end(); r += data->num) {
-			if (kill_raytrace) break; // not needed?
+			if (rt_job_cancelled()) break; // not needed?
 			assert(r->weight > 0.0);
 			float const weight0(ray_wt ? ray_wt : r->weight);
 			cast_light_ray(data->lmgr, r->pos, r->get_p2(line_length), r->weight, weight0, r->get_color(), line_length, -1, LIGHTING_COBJ_ACCUM, 0, rgen, nullptr, nullptr);
@@ -935,7 +1130,7 @@ void ray_trace_local_light_source(lmap_manager_t *lmgr, light_source const &ls,
 				//cout << TXT(dim) << TXT(dir) << TXT(d1) << TXT(d2) << TXT(side_area[dim]) << TXT(side_rays) << endl;
 
 				for (unsigned n = 0; n < side_rays; ++n) {
-					if (kill_raytrace) break;
+					if (rt_job_cancelled()) break;
 					vector3d dir(rgen.signed_rand_vector_spherical(1.0).get_norm());
 					if (dot_product(dir, normal) < 0.0) {dir.negate();}
 					start_pt[d1] = rgen.rand_uniform(cube.d[d1][0], cube.d[d1][1]);
@@ -953,7 +1148,7 @@ void ray_trace_local_light_source(lmap_manager_t *lmgr, light_source const &ls,
 	assert(init_cobj < (int)coll_objects.size());
 
 	for (unsigned n = 0; n < num_rays; ++n) {
-		if (kill_raytrace) break;
+		if (rt_job_cancelled()) break;
 		vector3d dir;
 		float weight(0.0);
 
@@ -1041,6 +1236,205 @@ typedef void (*ray_trace_func)(rt_data *);
 ray_trace_func const rt_funcs[NUM_LIGHTING_TYPES] = {trace_ray_block_sky, trace_ray_block_global, trace_ray_block_local, trace_ray_block_cobj_accum, trace_ray_block_dynamic};
 
 
+// expands bcube to the lightmap region whose global lighting can change when cobjs inside bcube change: bcube's shadow from each active global light
+// out to the scene bounds, plus a margin for nearby bounces; light that bounced off of the changed cobjs and landed outside this region isn't updated
+cube_t get_global_lighting_update_region(cube_t const &bcube) {
+
+	cube_t const scene_bounds(get_scene_bounds());
+	cube_t region(bcube);
+	region.expand_by(2.0*max(DX_VAL, DY_VAL));
+
+	for (unsigned l = 0; l < 2; ++l) {
+		if (!(l ? is_global_moon_lighting() : is_global_sun_lighting())) continue;
+		point const &pos(l ? moon_pos : sun_pos);
+		if (pos.z < 0.0) continue; // below the horizon, not traced
+		cube_t shadow(bcube);
+
+		for (unsigned d = 0; d < 3; ++d) { // extend away from the light; in both directions if the light is within bcube's range in this dim
+			if (pos[d] <= bcube.d[d][1]) {shadow.d[d][1] = max(shadow.d[d][1], scene_bounds.d[d][1]);}
+			if (pos[d] >= bcube.d[d][0]) {shadow.d[d][0] = min(shadow.d[d][0], scene_bounds.d[d][0]);}
+		}
+		region.union_with_cube(shadow);
+	}
+	return region;
+}
+
+
+int get_bake_task_seed(unsigned t, unsigned pass) {return (234323*(t+1) + 1299709*pass);}
+
+void trace_ray_block_global_replay(rt_data *data) { // re-traces passes [0, job_id) of bake task ix, with the same rays as the original passes
+
+	for (unsigned p = 0; p < data->job_id && !rt_job_cancelled(); ++p) {
+		data->rseed = get_bake_task_seed(data->ix, p);
+		trace_ray_block_global(data);
+	}
+}
+
+
+// progressive background update of global (sun/moon) indirect lighting; rays are split into passes that are each published to lmap_manager
+// when complete, so that lighting converges over time while the scene is interactive; the bake also records the lightmap bounds reached by
+// the rays of each launch tile so that a later cobj change only re-traces the tiles that reach the changed region, and only updates that region
+class lighting_bake_t {
+
+	rt_job_t job;
+	unsigned num_threads, num_passes, pass;
+	bool use_temp_lmap, baking, repairing; // baking: there are passes left to trace; repairing: the current job is an incremental update
+	float last_change; // relative change of the published lighting from the last pass, used as the convergence metric
+	vector<cube_t> tile_bcubes; // lightmap bounds reached by the rays of each tile over all traced passes, all zeros for none
+	vector<unsigned char> tile_mask; // tiles to re-trace in the current repair
+	cube_t repair_bcube; // region of the current repair
+	lmap_cell_range_t repair_range;
+
+	lmap_manager_t *get_target_lmap() {return ((baking && use_temp_lmap) ? &thread_temp_lmap : &lmap_manager);}
+
+	void launch_pass() {
+		job.data.resize(num_threads);
+
+		for (unsigned t = 0; t < num_threads; ++t) { // each thread traces 1/(num_threads*num_passes) of the rays
+			job.data[t] = rt_data((pass*num_threads + t), (num_threads*num_passes), get_bake_task_seed(t, pass), 1, 0, 0, LIGHTING_GLOBAL);
+			job.data[t].lmgr = get_target_lmap();
+			job.data[t].tile_bcubes.resize(tile_bcubes.size(), cube_t(all_zeros));
+		}
+		rt_worker_pool.run_job(job, rt_funcs[LIGHTING_GLOBAL], RT_PRIORITY_BACKGROUND);
+	}
+	void launch_repair() { // re-traces the selected tiles of the completed passes, only updating lighting in repair_range
+		// during a bake the unscaled pass sum is repaired; otherwise the published lighting, which was scaled up to the full number of passes
+		float const weight_scale((baking || !use_temp_lmap) ? 1.0 : float(num_passes)/float(pass));
+		job.data.resize(num_threads);
+
+		for (unsigned t = 0; t < num_threads; ++t) {
+			job.data[t] = rt_data(t, (num_threads*num_passes), 1, 1, 0, 0, LIGHTING_GLOBAL, pass); // same rays per task as launch_pass()
+			job.data[t].lmgr         = get_target_lmap();
+			job.data[t].weight_scale = weight_scale;
+			job.data[t].tile_mask    = &tile_mask;
+			job.data[t].update_range = &repair_range;
+			job.data[t].tile_bcubes.resize(tile_bcubes.size(), cube_t(all_zeros));
+		}
+		rt_worker_pool.run_job(job, trace_ray_block_global_replay, RT_PRIORITY_BACKGROUND);
+	}
+	void merge_tile_bcubes() { // from the tasks of the current job, which must not be running
+		for (auto d = job.data.begin(); d != job.data.end(); ++d) {
+			if (d->tile_bcubes.size() != tile_bcubes.size()) continue; // the number of global cube lights changed?
+
+			for (unsigned i = 0; i < tile_bcubes.size(); ++i) {
+				cube_t const &bc(d->tile_bcubes[i]);
+				if (bc.is_all_zeros()) continue;
+				if (tile_bcubes[i].is_all_zeros()) {tile_bcubes[i] = bc;} else {tile_bcubes[i].union_with_cube(bc);}
+			}
+		}
+	}
+	void publish() {
+		if (!use_temp_lmap) return; // rays were added directly to lmap_manager
+		// scale the partial sum up to the full number of rays; lighting values are a sum over rays, weighted for the total ray count
+		last_change = lmap_manager.copy_ltype_data(thread_temp_lmap, LIGHTING_GLOBAL, float(num_passes)/float(pass));
+		thread_temp_lmap.was_updated = 0;
+		lmap_manager.was_updated     = 1;
+	}
+public:
+	lighting_bake_t() : num_threads(0), num_passes(0), pass(0), use_temp_lmap(0), baking(0), repairing(0), last_change(0.0) {repair_bcube.set_to_zeros();}
+	bool is_active() const {return job.is_active();}
+
+	void start() {
+		cancel();
+		num_threads   = max(1U, NUM_THREADS-1); // reserve a thread for rendering
+		num_passes    = max(1U, lighting_bake_passes);
+		use_temp_lmap = (lighting_update_offline || num_passes > 1); // passes must be accumulated separately to be published
+		pass          = 0;
+		last_change   = 1.0;
+		baking        = 1;
+		repairing     = 0;
+		repair_bcube.set_to_zeros();
+		tile_bcubes.assign(get_num_global_ray_tiles(), cube_t(all_zeros));
+
+		if (use_temp_lmap) { // keep the previous lighting until the first pass is published
+			thread_temp_lmap.init_from(lmap_manager);
+			thread_temp_lmap.clear_lighting_values(LIGHTING_GLOBAL);
+		}
+		else {lmap_manager.clear_lighting_values(LIGHTING_GLOBAL);}
+		launch_pass();
+	}
+	bool cancel() { // returns true if a bake was in progress
+		if (!is_active()) return 0;
+		rt_worker_pool.cancel_job(job);
+		merge_tile_bcubes(); // partially traced passes may have added lighting
+		job.data.clear();
+		return 1;
+	}
+	// to be called after static cobjs inside bcube have changed and the cobj tree has been rebuilt, whether or not a bake is in progress
+	void invalidate(cube_t const &bcube) {
+		cancel();
+		if (num_passes == 0) return; // global lighting has never been computed
+		if (baking && !use_temp_lmap) {start(); return;} // a single pass bake adds rays directly to lmap_manager and has no completed passes to keep
+		cube_t region(get_global_lighting_update_region(bcube));
+		if (repairing) {region.union_with_cube(repair_bcube);} // the previous repair was interrupted, so its region must be redone
+		repairing = 0;
+
+		if (baking) { // restore the accumulated lighting to the end of the last completed pass, dropping the partially traced current pass
+			if (pass == 0) { // nothing completed to repair; the current pass will use the new cobjs
+				thread_temp_lmap.clear_lighting_values(LIGHTING_GLOBAL);
+				launch_pass();
+				return;
+			}
+			thread_temp_lmap.copy_ltype_data(lmap_manager, LIGHTING_GLOBAL, float(pass)/float(num_passes));
+		}
+		repair_bcube = region;
+		repair_range = lmap_cell_range_t(region);
+		if (repair_range.is_empty()) {if (baking) {launch_pass();} return;}
+		tile_mask.resize(tile_bcubes.size());
+		unsigned num_tiles(0);
+
+		for (unsigned i = 0; i < tile_bcubes.size(); ++i) {
+			tile_mask[i] = (!tile_bcubes[i].is_all_zeros() && tile_bcubes[i].intersects(region));
+			num_tiles   += tile_mask[i];
+		}
+		//cout << "Lighting repair of " << num_tiles << " of " << tile_bcubes.size() << " tiles" << endl;
+		get_target_lmap()->clear_lighting_values(LIGHTING_GLOBAL, repair_range);
+		lmap_manager.was_updated = 1;
+		repairing = 1;
+		launch_repair();
+	}
+	void update() { // to be called about once per frame
+		if (!is_active() || job.is_running()) return; // inactive or current job still running
+		merge_tile_bcubes();
+
+		if (repairing) {
+			repairing = 0;
+			repair_bcube.set_to_zeros();
+			if (baking) {publish(); launch_pass(); return;} // show the repaired lighting, then continue with the next pass
+			job.data.clear();
+			return;
+		}
+		++pass;
+		publish();
+		bool const converged(pass > 1 && lighting_bake_converge_thresh > 0.0 && last_change < lighting_bake_converge_thresh);
+		if (pass < num_passes && !converged) {launch_pass(); return;}
+		//cout << "Lighting bake finished after " << pass << " of " << num_passes << " passes, change: " << last_change << endl;
+		baking = 0;
+		job.data.clear();
+	}
+};
+
+lighting_bake_t lighting_bake;
+
+bool indir_lighting_updated() {return (global_lighting_update && (lmap_manager.was_updated || thread_temp_lmap.was_updated || lighting_bake.is_active()));} // only for global updates
+
+void check_for_lighting_finished() {lighting_bake.update();} // to be called about once per frame
+
+void kill_current_raytrace_threads() { // wait for threads to finish since they may be using the current lightmap or cobjs
+	lighting_bake.cancel();
+	if (fg_job.is_running()) {rt_worker_pool.cancel_job(fg_job);}
+}
+
+void shutdown_raytrace_threads() { // join the worker threads at exit rather than relying on the destruction order of the globals they reference
+	kill_current_raytrace_threads();
+	rt_worker_pool.shutdown();
+}
+
+// to be called when static cobjs change: the bake must be stopped while the cobj BVH is rebuilt, then the lighting of the changed region is updated
+void pause_lighting_bake_for_cobj_update() {lighting_bake.cancel();}
+void invalidate_global_lighting(cube_t const &bcube) {lighting_bake.invalidate(bcube);}
+
+
 void compute_ray_trace_lighting(unsigned ltype, bool verbose) {
 
 	bool const dynamic(is_ltype_dynamic(ltype));
@@ -1054,7 +1448,7 @@ void compute_ray_trace_lighting(unsigned ltype, bool verbose) {
 
 			if (store_cobj_accum_lighting_as_blocked) {
 				timer_t t("Cobj Accum Lighting");
-				launch_threaded_job(NUM_THREADS, rt_funcs[c_ltype], verbose, 1, 0, 0, ltype); // update fully blocked lighting with currently blocked portion
+				launch_threaded_job(NUM_THREADS, rt_funcs[c_ltype], verbose, 0, ltype); // update fully blocked lighting with currently blocked portion
 			}
 		}
 		else {lmap_manager.read_data_from_file(fn, c_ltype);}
@@ -1063,7 +1457,7 @@ void compute_ray_trace_lighting(unsigned ltype, bool verbose) {
 		if (c_ltype != LIGHTING_LOCAL && !dynamic) {cout << X_SCENE_SIZE << " " << Y_SCENE_SIZE << " " << Z_SCENE_SIZE << " " << czmin << " " << czmax << endl;}
 		all_models.build_cobj_trees(1);
 		if (enable_platform_lights(ltype)) {pre_rt_bvh_build_hook();}
-		launch_threaded_job(NUM_THREADS, rt_funcs[c_ltype], verbose, 1, 0, 0, ltype);
+		launch_threaded_job(NUM_THREADS, rt_funcs[c_ltype], verbose, 0, ltype);
 		if (enable_platform_lights(ltype)) {post_rt_bvh_build_hook();}
 	}
 	if (!dynamic && write_light_files[c_ltype]) {
@@ -1095,8 +1489,7 @@ void check_update_global_lighting(unsigned lights) {
 	if (!pre_lighting_update()) return; // lmap is not yet allocated
 	// Note: we could check if the sun/moon is visible, but it might have been visible previously and now is not, and in that case we still need to update lighting
 	no_stat_moving = 1; // disable static moving cobjs for async updates, which aren't thread safe because the BVH is rebuilt every frame; no need to set back after first frame
-	lmap_manager.clear_lighting_values(LIGHTING_GLOBAL);
-	launch_threaded_job(max(1U, NUM_THREADS-1), rt_funcs[LIGHTING_GLOBAL], 0, 0, lighting_update_offline, 0, LIGHTING_GLOBAL); // reserve a thread for rendering
+	lighting_bake.start(); // cancels and restarts any bake in progress
 }
 
 void check_all_platform_cobj_lighting_update() {
@@ -1111,7 +1504,7 @@ void check_all_platform_cobj_lighting_update() {
 		coll_obj &cobj(coll_objects.get_cobj(*i));
 		if (platforms.get_cobj_platform(cobj).get_last_delta() == zero_vector) continue; // not moving
 		if (!cobj.is_update_light_platform()) continue; // no updates
-		launch_threaded_job(NUM_THREADS, trace_ray_block_cobj_accum_single_update, 0, 1, 0, 0, LIGHTING_COBJ_ACCUM, *i); // blocking, on all threads, using cobj_id as job_id
+		launch_threaded_job(NUM_THREADS, trace_ray_block_cobj_accum_single_update, 0, 0, LIGHTING_COBJ_ACCUM, *i); // blocking, on all threads, using cobj_id as job_id
 	}
 	if (lmap_manager.was_updated && !lm_bc.is_zero_area()) {
 		lmap_manager.was_updated = 0; // unset to enable multi-threaded updates (though it doesn't seem to matter much)
@@ -1137,9 +1530,11 @@ bool lmap_manager_t::read_data_from_file(char const *const fn, int ltype) {
 	unsigned data_size(0);
 	if (!reader.read(&data_size, sizeof(unsigned), 1)) return 0;
 
-	if (data_size != vldata_alloc.size()) {
+	bool const full_cols(data_size != num_cells && data_size == get_num_dense_cells()); // file written with full height columns
+
+	if (data_size != num_cells && !full_cols) {
 		cerr << "Error: Lighting file " << fn << " data size of " << data_size
-			 << " does not equal the expected size of " << vldata_alloc.size() << ". Ignoring file." << endl;
+			 << " does not equal the expected size of " << num_cells << ". Ignoring file." << endl;
 		return 0;
 	}
 	unsigned const sz = lmcell::get_dsz(ltype);
@@ -1150,9 +1545,17 @@ bool lmap_manager_t::read_data_from_file(char const *const fn, int ltype) {
 		cerr << "Error reading data from ligthing file " << fn << endl;
 		return 0;
 	}
-	for (vector<lmcell>::iterator i = vldata_alloc.begin(); i != vldata_alloc.end(); ++i) {
-		float *ptr(i->get_offset(ltype));
-		for (unsigned n = 0; n < sz; ++n) {ptr[n] = data[pos++];}
+	for (unsigned y = 0; y < lm_ysize; ++y) { // cells are stored in {y, x, z} order, which matches the layout of dense lightmaps
+		for (unsigned x = 0; x < lm_xsize; ++x) {
+			if (!has_column(x, y)) continue;
+
+			for (unsigned z = 0; z < lm_zsize; ++z) {
+				lmcell *const lmc(get_lmcell_ptr(x, y, z));
+				if (lmc == NULL) {pos += (full_cols ? sz : 0); continue;} // skip cells above zmax in full height columns
+				float *ptr(lmc->get_offset(ltype));
+				for (unsigned n = 0; n < sz; ++n) {ptr[n] = data[pos++];}
+			}
+		}
 	}
 	assert(pos == data.size());
 	return 1;
@@ -1165,14 +1568,23 @@ bool lmap_manager_t::write_data_to_file(char const *const fn, int ltype) const {
 	binary_file_writer writer;
 	if (!writer.open(fn)) return 0;
 	cout << "Writing lighting file to " << fn << endl;
-	unsigned const data_size((unsigned)vldata_alloc.size()); // should be size_t?
+	unsigned const data_size(num_cells); // should be size_t?
 	if (!writer.write(&data_size, sizeof(unsigned), 1)) return 0;
 	unsigned const sz(lmcell::get_dsz(ltype));
 
-	for (vector<lmcell>::const_iterator i = vldata_alloc.begin(); i != vldata_alloc.end(); ++i) { // const_iterator?
-		if (!writer.write(i->get_offset(ltype), sizeof(float), sz)) {
-			cerr << "Error writing data to ligthing file " << fn << endl;
-			return 0;
+	for (unsigned y = 0; y < lm_ysize; ++y) { // same order as read_data_from_file()
+		for (unsigned x = 0; x < lm_xsize; ++x) {
+			if (!has_column(x, y)) continue;
+
+			for (unsigned z = 0; z < lm_zsize; ++z) {
+				lmcell const *const lmc(get_lmcell_ptr(x, y, z));
+				if (lmc == NULL) continue;
+
+				if (!writer.write(lmc->get_offset(ltype), sizeof(float), sz)) {
+					cerr << "Error writing data to ligthing file " << fn << endl;
+					return 0;
+				}
+			}
 		}
 	}
 	return 1;
@@ -1190,3 +1602,44 @@ void lmap_manager_t::clear_lighting_values(int ltype) {
 	}
 }
 
+void lmap_manager_t::clear_lighting_values(int ltype, lmap_cell_range_t const &range) {
+
+	assert(ltype < NUM_LIGHTING_TYPES && !is_ltype_dynamic(ltype));
+	unsigned const num(lmcell::get_dsz(ltype));
+	int const x2(min(range.x2, (int)lm_xsize)), y2(min(range.y2, (int)lm_ysize)), z2(min(range.z2, (int)lm_zsize));
+
+	for (int y = range.y1; y < y2; ++y) {
+		for (int x = range.x1; x < x2; ++x) {
+			for (int z = range.z1; z < z2; ++z) {
+				lmcell *const lmc(get_lmcell_ptr(x, y, z));
+				if (lmc == NULL) break; // unused column or above zmax
+				float *color(lmc->get_offset(ltype));
+				for (unsigned j = 0; j < num; ++j) {color[j] = 0.0;}
+			}
+		}
+	}
+}
+
+
+// copies the ltype lighting values of src multiplied by scale; returns the relative change in values, for use as a convergence metric
+float lmap_manager_t::copy_ltype_data(lmap_manager_t const &src, int ltype, float scale) {
+
+	assert(src.vldata_alloc.size() == vldata_alloc.size());
+	assert(ltype < NUM_LIGHTING_TYPES && !is_ltype_dynamic(ltype));
+	unsigned const num(lmcell::get_dsz(ltype));
+	double diff(0.0), total(0.0);
+
+	for (vector<lmcell>::iterator i = vldata_alloc.begin(); i != vldata_alloc.end(); ++i) {
+		float *color(i->get_offset(ltype));
+		float const *src_color(src.vldata_alloc[i - vldata_alloc.begin()].get_offset(ltype));
+
+		for (unsigned j = 0; j < num; ++j) {
+			float const val(scale*src_color[j]);
+			diff    += fabs(val - color[j]);
+			total   += fabs(val);
+			color[j] = val;
+		}
+	}
+	return ((total > 0.0) ? diff/total : 0.0);
+}
+
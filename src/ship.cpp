@@ -16,6 +16,7 @@ bool const TIMETEST          = (GLOBAL_TIMETEST || 0);
 bool const ERROR_CHECK       = 0;
 unsigned const NUM_TIMESTEPS = 4;
 unsigned const NUM_EXTRA_DAM = 4;
+unsigned const MIN_PAR_COLL_OBJS = 256; // use multiple threads for collision detection above this many objects
 
 
 bool player_autopilot(0), player_auto_stop(0), hold_fighters(0), dock_fighters(0), ship_cube_map_reflection(0);
@@ -608,7 +609,7 @@ void sort_uobjects() { // originally part of apply_univ_physics()
 }
 
 
-bool proc_coll(free_obj *o1, free_obj *o2) {
+bool can_coll(free_obj const *const o1, free_obj const *const o2) { // side effect free part of proc_coll(); safe to call from multiple threads
 
 	assert(o1 != NULL && o2 != NULL);
 
@@ -617,7 +618,14 @@ bool proc_coll(free_obj *o1, free_obj *o2) {
 		if (o1->get_src() != NULL && o1->get_src() == o2->get_src()) return 0; // ship's projectiles don't collide with each other
 	}
 	if (o1->is_stationary() && o2->is_stationary()) return 0; // two stationary objects - if they collide we can't do anything
-	if (!o1->obj_int_obj(o2)) return 0;
+	intersect_params ip; // local rather than def_int_params, which some intersection functions write to
+	return o1->obj_int_obj(o2, ip);
+}
+
+
+bool proc_coll(free_obj *o1, free_obj *o2) {
+
+	if (!can_coll(o1, o2)) return 0;
 	point const p1(o1->get_pos()), p2(o2->get_pos()); // cache these in case they change
 	vector3d const v1(o1->get_tot_vel_at(p2)), v2(o2->get_tot_vel_at(p1)); // cache these in case they change
 	float const elasticity(o1->get_elasticity()*o2->get_elasticity());
@@ -630,13 +638,25 @@ bool proc_coll(free_obj *o1, free_obj *o2) {
 }
 
 
+bool skip_obj_pair(unsigned f1, unsigned f2) {
+
+	if ((f1 | f2) & OBJ_FLAGS_BAD_) return 1;
+	unsigned const both(f1 & f2);
+	if (both & OBJ_FLAGS_PART) return 1; // skip particle-particle collisions
+	if (both & OBJ_FLAGS_NOC2) return 1; // both objects have their C2 flags set, skip the collision
+	if ((both & OBJ_FLAGS_PROJ) && ((f1 | f2) & OBJ_FLAGS_NOPC)) return 1; // no projectile-projectile collision
+	return 0;
+}
+
+
+// broadphase: sweep and prune along the axis with the largest spread of object centers, with the other two axes and the sphere distance tested per pair;
+// narrowphase: the intersection tests of all candidate pairs run in parallel and have no side effects, then the collision responses are applied
+// serially in sweep order, rechecking each pair against the updated object state
 void collision_detect_objects(vector<cached_obj> &objs, unsigned t) {
 
 	//RESET_TIME;
 	unsigned const size((unsigned)objs.size());
-	static vector<interval> intervals;
-	intervals.clear();
-	intervals.reserve(2*size);
+	double sum[3] = {0.0}, sum_sq[3] = {0.0};
 
 	for (unsigned i = 0; i < size; ++i) {
 		if (objs[i].flags & OBJ_FLAGS_BAD_) continue;
@@ -646,59 +666,74 @@ void collision_detect_objects(vector<cached_obj> &objs, unsigned t) {
 			continue;
 		}
 		if (t > 0) {objs[i].refresh();} // physics advance was run since last refresh
-		double const radius(objs[i].radius), val(objs[i].pos.x);
+		assert(objs[i].radius > 0.0);
+
+		for (unsigned d = 0; d < 3; ++d) {
+			sum   [d] += objs[i].pos[d];
+			sum_sq[d] += objs[i].pos[d]*objs[i].pos[d];
+		}
+	}
+	unsigned dim(0); // sweep axis
+	double max_var(0.0);
+
+	for (unsigned d = 0; d < 3; ++d) {
+		double const var(size*sum_sq[d] - sum[d]*sum[d]); // variance scaled by size^2
+		if (var > max_var) {max_var = var; dim = d;}
+	}
+	static vector<sap_entry_t> entries;
+	static vector<coll_pair_t> hits;
+	entries.clear();
+	hits.clear();
+
+	for (unsigned i = 0; i < size; ++i) {
+		if (objs[i].flags & OBJ_FLAGS_BAD_) continue;
+		if (t > 0 && (objs[i].flags & (OBJ_FLAGS_DIST | OBJ_FLAGS_ORBT))) continue;
+		double const radius(objs[i].radius), val(objs[i].pos[dim]);
 		float const left(float(val - radius)), right(float(val + radius));
-		assert(radius > 0.0);
 		if (left == right) continue; // floating point precision limitation or bug?
 		assert(left < right);
-		intervals.push_back(interval(left,  i, 1));
-		intervals.push_back(interval(right, i, 0));
+		entries.push_back(sap_entry_t(left, right, i));
+		objs[i].obj->calc_rotation_vectors(); // cache these now so that they're not lazily written by multiple threads
 	}
-	unsigned const size2((unsigned)intervals.size());
-	static vector<unsigned> locs, work;
-	locs.resize(size);
-	work.clear();
-	sort(intervals.begin(), intervals.end());
-
-	for (unsigned i = 0; i < size2; ++i) {
-		unsigned const ix(intervals[i].ix & ~LEFT_EDGE_BIT), ix_flags(objs[ix].flags);
-		unsigned bad_flags(OBJ_FLAGS_BAD_);
-		if ( ix_flags & OBJ_FLAGS_PART) {bad_flags |= OBJ_FLAGS_PART;} // skip particle-particle collisions
-		if ( ix_flags & OBJ_FLAGS_NOC2) {bad_flags |= OBJ_FLAGS_NOC2;} // both objects have their C2 flags set, skip the collision
-		if ((ix_flags & OBJ_FLAGS_PROJ) && (ix_flags & OBJ_FLAGS_NOPC)) {bad_flags |= OBJ_FLAGS_PROJ;} // no projectile-projectile collision
-		
-		if (intervals[i].ix & LEFT_EDGE_BIT) { // start a new sphere
-			unsigned const wsize((unsigned)work.size());
-
-			if (wsize > 0) {
-				point const pos_i(objs[ix].pos);
-				float const c_radius_i(objs[ix].radius), pisd(pos_i.y);
-
-				for (unsigned k = 0; k < wsize; ++k) {
-					cached_obj &obj(objs[work[k]]);
-					if (obj.flags & bad_flags) continue;
-					float const radius(c_radius_i + obj.radius);
-					if (fabs(pisd - obj.pos.y) > radius || !dist_less_than(pos_i, obj.pos, radius)) continue; // no intersection
-
-					if (proc_coll(objs[ix].obj, obj.obj)) {
-						objs[ix].refresh(); // ???
-						obj.refresh(); // ???
-					}
+	sort(entries.begin(), entries.end());
+	int const num((int)entries.size());
+
+#pragma omp parallel if (num > (int)MIN_PAR_COLL_OBJS)
+	{
+		vector<coll_pair_t> thread_hits;
+
+#pragma omp for schedule(dynamic,64)
+		for (int i = 0; i < num; ++i) {
+			cached_obj const &oi(objs[entries[i].ix]);
+			float const hi(entries[i].hi);
+
+			for (int j = i+1; j < num && entries[j].lo <= hi; ++j) {
+				cached_obj const &oj(objs[entries[j].ix]);
+				if (skip_obj_pair(oi.flags, oj.flags)) continue;
+				float const radius(oi.radius + oj.radius);
+				bool overlap(1);
+
+				for (unsigned d = 0; d < 3 && overlap; ++d) {
+					if (d != dim && fabs(oi.pos[d] - oj.pos[d]) > radius) {overlap = 0;}
 				}
+				if (!overlap || !dist_less_than(oi.pos, oj.pos, radius)) continue; // no intersection
+				if (can_coll(oj.obj, oi.obj)) {thread_hits.push_back(coll_pair_t(j, i));} // later object first, as in proc_coll() below
 			}
-			locs[ix] = wsize;
-			work.push_back(ix);
 		}
-		else { // end a current sphere
-			assert(!work.empty());
-			unsigned const lix(locs[ix]);
-			//assert(ix < size && lix < work.size() && work[lix] == ix && locs[work.back()] == work.size()-1);
-			swap(work[lix], work.back());
-			locs[work[lix]] = lix;
-			work.pop_back();
+#pragma omp critical(coll_detect_hits)
+		hits.insert(hits.end(), thread_hits.begin(), thread_hits.end());
+	}
+	sort(hits.begin(), hits.end()); // deterministic order, independent of thread count and scheduling
+
+	for (vector<coll_pair_t>::const_iterator h = hits.begin(); h != hits.end(); ++h) {
+		cached_obj &oa(objs[entries[h->a].ix]), &ob(objs[entries[h->b].ix]);
+		if (skip_obj_pair(oa.flags, ob.flags)) continue; // may have been destroyed by an earlier collision
+
+		if (proc_coll(oa.obj, ob.obj)) {
+			oa.refresh(); // ???
+			ob.refresh(); // ???
 		}
 	}
-	assert(work.empty());
 	//PRINT_TIME("Collision");
 }
 
@@ -142,10 +142,10 @@ void add_smoke(point const &pos, float val) {
 void diffuse_smoke_xy(int x, int y, int z, lmcell &adj, float rate, int dim, int dir) {
 
 	float delta(0.0); // Note: not using fticks due to instability
-	lmcell *vldata(point_outside_mesh(x, y) ? nullptr : lmap_manager.get_column(x, y));
+	lmcell *const lmcp(point_outside_mesh(x, y) ? nullptr : lmap_manager.get_lmcell_ptr(x, y, z));
 
-	if (vldata) {
-		lmcell &lmc(vldata[z]);
+	if (lmcp) {
+		lmcell &lmc(*lmcp);
 		unsigned char const flow(dir ? adj.pflow[dim] : lmc.pflow[dim]);
 		if (flow == 0) return;
 		float const cur_smoke(lmc.smoke);
@@ -160,12 +160,13 @@ void diffuse_smoke_xy(int x, int y, int z, lmcell &adj, float rate, int dim, int
 	adjust_smoke_val(adj.smoke, -delta);
 }
 
-void diffuse_smoke_z(int x, int y, int z, lmcell &adj, lmcell *vldata, float pos_rate, float neg_rate, int dim, int dir) {
+void diffuse_smoke_z(int x, int y, int z, lmcell &adj, float pos_rate, float neg_rate, int dim, int dir) {
 
 	float delta(0.0); // Note: not using fticks due to instability
+	lmcell *const lmcp((z >= 0 && z < MESH_SIZE[2]) ? lmap_manager.get_lmcell_ptr(x, y, z) : nullptr);
 
-	if (z >= 0 && z < MESH_SIZE[2]) {
-		lmcell &lmc(vldata[z]);
+	if (lmcp) {
+		lmcell &lmc(*lmcp);
 		unsigned char const flow(dir ? adj.pflow[dim] : lmc.pflow[dim]);
 		if (flow == 0) return;
 		float const cur_smoke(lmc.smoke);
@@ -208,15 +209,16 @@ void distribute_smoke() { // called at most once per frame
 	// openmp doesn't really help here
 	for (int y = cur_skip; y < MESH_Y_SIZE; y += SMOKE_SKIPVAL) { // split the computation across several frames
 		for (int x = 0; x < MESH_X_SIZE; ++x) {
-			lmcell *vldata(lmap_manager.get_column(x, y));
-			if (vldata == NULL) continue;
+			if (!lmap_manager.has_column(x, y)) continue;
 			smoke_entry_t &zrange(smoke_grid.get_z_range(x, y));
 			//smoke_entry_t zrange; zrange.zmin = 0; zrange.zmax = MESH_Z_SIZE;
 			if (!zrange.valid()) continue;
 			bool any_z_has_smoke(0);
 			
 			for (int z = zrange.zmin; z < zrange.zmax; ++z) {
-				lmcell &lmc(vldata[z]);
+				lmcell *const lmcp(lmap_manager.get_lmcell_ptr(x, y, z));
+				if (lmcp == NULL) continue; // unallocated brick
+				lmcell &lmc(*lmcp);
 				if (lmc.smoke < SMOKE_THRESH) {lmc.smoke = 0.0;}
 				if (lmc.smoke == 0.0) continue;
 				//if (get_zval(z) > v_collision_matrix[y][x].zmax) {lmc.smoke = 0.0; continue;} // open space above - smoke goes up
@@ -236,8 +238,8 @@ void distribute_smoke() { // called at most once per frame
 					diffuse_smoke_xy(x, y-1, z, lmc, xy_rate, 1, 0);
 					diffuse_smoke_xy(x, y+1, z, lmc, xy_rate, 1, 1);
 				}
-				diffuse_smoke_z(x, y, (z - 1), lmc, vldata, SMOKE_DIS_ZD, SMOKE_DIS_ZU, 2, 0);
-				diffuse_smoke_z(x, y, (z + 1), lmc, vldata, SMOKE_DIS_ZU, SMOKE_DIS_ZD, 2, 1);
+				diffuse_smoke_z(x, y, (z - 1), lmc, SMOKE_DIS_ZD, SMOKE_DIS_ZU, 2, 0);
+				diffuse_smoke_z(x, y, (z + 1), lmc, SMOKE_DIS_ZU, SMOKE_DIS_ZD, 2, 1);
 				any_z_has_smoke = 1;
 			} // for z
 			if (!any_z_has_smoke) {zrange.clear();} // mark this xy as not having smoke
@@ -254,12 +256,13 @@ float get_smoke_at_pos(point const &pos) {
 	if (pos.z <= czmin0 || pos.z >= czmax) return 0.0;
 	int const x(get_xpos(pos.x)), y(get_ypos(pos.y)), z(get_zpos(pos.z));
 	if (point_outside_mesh(x, y) || z < 0 || z >= MESH_SIZE[2]) return 0.0;
-	lmcell const *const vldata(lmap_manager.get_column(x, y));
-	return ((vldata == NULL) ? 0.0 : vldata[z].smoke);
+	lmcell const *const lmc(lmap_manager.get_lmcell_ptr(x, y, z));
+	return ((lmc == NULL) ? 0.0 : lmc->smoke);
 }
 
 
 void reset_smoke_tex_data() {smoke_tex_data.clear();}
+void add_smoke_mem_usage(mem_usage_t *usage) {usage[MEM_LIGHTMAP].add(smoke_tex_data.capacity(), (smoke_tid ? smoke_tex_data.size() : 0));} // 3D lighting+smoke texture
 
 
 #define CLEAR_Z_RANGE(z1, z2) for (int z = z1; z < (int)z2; ++z) {data[4*(off + z)+3] = 0;}
@@ -274,8 +277,8 @@ void update_smoke_row(vector<unsigned char> &data, vector<unsigned> const &llvol
 	default_lmc.get_final_color(default_color, 1.0);
 
 	for (unsigned x = x_start; x < x_end; ++x) {
-		lmcell const *const vlm(lmap_manager.get_column(x, y));
-		if (vlm == NULL && !update_lighting) continue; // x/y pairs that get into here should also be constant
+		bool const has_col(lmap_manager.has_column(x, y));
+		if (!has_col && !update_lighting) continue; // x/y pairs that get into here should also be constant
 		unsigned const off(zsize*(y*MESH_X_SIZE + x));
 		bool const check_z_thresh((display_mode & 0x01) && !is_mesh_disabled(x, y));
 		float const mh(mesh_height[y][x]);
@@ -300,8 +303,9 @@ void update_smoke_row(vector<unsigned char> &data, vector<unsigned> const &llvol
 		}
 		for (unsigned z = z_start; z < z_end; ++z) {
 			unsigned const off2(ncomp*(off + z));
-			if (vlm == NULL || vlm[z].smoke == 0.0) {data[off2+3] = 0;}
-			else {data[off2+3] = (unsigned char)(255*CLIP_TO_01(smoke_scale*vlm[z].smoke));} // alpha: smoke
+			lmcell const *const lmc(has_col ? lmap_manager.get_lmcell_ptr(x, y, z) : NULL);
+			if (lmc == NULL || lmc->smoke == 0.0) {data[off2+3] = 0;}
+			else {data[off2+3] = (unsigned char)(255*CLIP_TO_01(smoke_scale*lmc->smoke));} // alpha: smoke
 			if (!do_lighting) continue; // lighting not needed
 				
 			if (check_z_thresh && get_zval(z+1) < mh) { // adjust by one because GPU will interpolate the texel
@@ -312,10 +316,10 @@ void update_smoke_row(vector<unsigned char> &data, vector<unsigned> const &llvol
 
 				if (create_voxel_landscape) {
 					float const indir_scale(get_voxel_terrain_ao_lighting_val(get_xyz_pos(x, y, z)));
-					if (vlm == NULL) {color = default_color*indir_scale;} else {vlm[z].get_final_color(color, 1.0, 1.0, indir_scale);}
+					if (lmc == NULL) {color = default_color*indir_scale;} else {lmc->get_final_color(color, 1.0, 1.0, indir_scale);}
 				}
 				else {
-					if (vlm == NULL) {color = default_color;} else {vlm[z].get_final_color(color, 1.0, 1.0);}
+					if (lmc == NULL) {color = default_color;} else {lmc->get_final_color(color, 1.0, 1.0);}
 				}
 				for (unsigned i = llv_ix_s; i < llv_ix_e; ++i) {local_light_volumes[llvol_ixs[i]]->add_lighting(color, x, y, z);} // add local light volumes
 				UNROLL_3X(data[off2+i_] = (unsigned char)(255*CLIP_TO_01(color[i_]));) // lmc.pflow[i_]
@@ -41,10 +41,6 @@ struct zval_avg {
 	count_type c;
 	float z;
 	zval_avg(count_type c_=0, float z_=0.0) : c(c_), z(z_) {}
-	// Note: With a 1024x1024 voxel grid we should get an average of 1 count per 1M snow
-	//       so we can have at max 64M snowflakes.
-	//       However, we can get snow to stack up at a vertical edge so we need to clamp the count
-	void update(float zval) {if (c < MAX_COUNT) {++c; z += zval;}}
 	bool valid() const {return (c > 0);}
 	float getz() const {return z/c;}
 };
@@ -230,34 +226,104 @@ public:
 };
 
 
-class voxel_map : public map<voxel_t, zval_avg> { // must be a sorted map
+struct voxel_entry_t { // packed voxel_z_pair; this is also the record format of the snow file
+	voxel_t v;
+	count_type c;
+	float z;
+
+	voxel_entry_t() : c(0), z(0.0) {}
+	voxel_entry_t(voxel_t const &v_, count_type c_, float z_) : v(v_), c(c_), z(z_) {}
+	zval_avg get_zv() const {return zval_avg(c, z);}
+	bool valid() const {return (c > 0);} // entries consumed by a strip are marked with c=0
+	bool operator<(voxel_entry_t const &e) const {return (v < e.v);}
+};
+
+struct voxel_entry_less {
+	bool operator()(voxel_entry_t const &e, voxel_t const &v) const {return (e.v < v);}
+};
+
+
+class voxel_vect_t : public vector<voxel_entry_t> { // must be sorted by voxel; entries are invalidated rather than erased
 public:
-	zval_avg find_adj_z(voxel_t &v, zval_avg const &zv_old, float depth, voxel_map *cur_x_map=NULL);
+	zval_avg find_adj_z(voxel_t &v, zval_avg const &zv_old, float depth, voxel_vect_t *cur_x_vect=NULL);
 	bool read(char const *const fn);
 	bool write(char const *const fn) const;
 };
 
 
-struct data_block { // packed voxel_z_pair for read/write
-	coord_type p[3];
-	count_type c;
-	float z;
+// open addressing hash map of voxel => {count, zsum}, used to accumulate snowflake hits without locking
+class snow_voxel_accum_t {
 
-	void add_to_map(voxel_map &vmap) const {
+	struct entry_t {
 		voxel_t v;
-		for (unsigned i = 0; i < 3; ++i) v.p[i] = p[i];
-		vmap[v] = zval_avg(c, z);
+		unsigned c;
+		float z;
+		entry_t(voxel_t const &v_, unsigned c_, float z_) : v(v_), c(c_), z(z_) {}
+	};
+	vector<entry_t> entries; // dense, in insertion order
+	vector<unsigned> slots; // entry index+1, 0 = empty; size is a power of 2
+
+	static unsigned hash_voxel(voxel_t const &v) {
+		uint64_t const key((uint64_t(uint16_t(v.p[0])) << 32) | (uint64_t(uint16_t(v.p[1])) << 16) | uint64_t(uint16_t(v.p[2])));
+		return unsigned((key*0x9E3779B97F4A7C15ULL) >> 32);
+	}
+	void insert_slot(unsigned eix) {
+		unsigned const mask((unsigned)slots.size() - 1);
+		unsigned ix(hash_voxel(entries[eix].v) & mask);
+		while (slots[ix]) {ix = (ix + 1) & mask;}
+		slots[ix] = eix + 1;
 	}
-	void set_from_map_iter(voxel_map::const_iterator it) {
-		for (unsigned i = 0; i < 3; ++i) p[i] = it->first.p[i];
-		c = it->second.c;
-		z = it->second.z;
+	void grow() {
+		size_t const new_sz(max((size_t)1024, 2*slots.size()));
+		slots.clear();
+		slots.resize(new_sz, 0);
+		for (unsigned i = 0; i < entries.size(); ++i) {insert_slot(i);}
+	}
+public:
+	bool empty() const {return entries.empty();}
+	size_t size() const {return entries.size();}
+
+	void add(voxel_t const &v, unsigned c, float z) {
+		if (2*(entries.size() + 1) > slots.size()) {grow();} // keep load factor <= 0.5
+		unsigned const mask((unsigned)slots.size() - 1);
+
+		for (unsigned ix = (hash_voxel(v) & mask); ; ix = ((ix + 1) & mask)) {
+			unsigned &slot(slots[ix]);
+
+			if (slot == 0) { // new voxel
+				slot = (unsigned)entries.size() + 1;
+				entries.push_back(entry_t(v, c, z));
+				return;
+			}
+			entry_t &e(entries[slot-1]);
+			if (e.v == v) {e.c += c; e.z += z; return;} // existing voxel
+		}
+	}
+	void merge_from(snow_voxel_accum_t const &a) {
+		for (auto i = a.entries.begin(); i != a.entries.end(); ++i) {add(i->v, i->c, i->z);}
+	}
+	void clear() { // keeps capacity for reuse
+		entries.clear();
+		std::fill(slots.begin(), slots.end(), 0);
+	}
+	void get_sorted(voxel_vect_t &vv) const {
+		vv.clear();
+		vv.reserve(entries.size());
+
+		for (auto i = entries.begin(); i != entries.end(); ++i) {
+			// Note: With a 1024x1024 voxel grid we should get an average of 1 count per 1M snow
+			//       so we can have at max 64M snowflakes.
+			//       However, we can get snow to stack up at a vertical edge so we need to clamp the count
+			if (i->c > MAX_COUNT) {vv.push_back(voxel_entry_t(i->v, MAX_COUNT, i->z*(float(MAX_COUNT)/i->c)));} // keep the average z
+			else {vv.push_back(voxel_entry_t(i->v, i->c, i->z));}
+		}
+		sort(vv.begin(), vv.end()); // voxels are unique, so the order is deterministic
 	}
 };
 
 
 // this tends to take a large fraction of the preprocessing time
-zval_avg voxel_map::find_adj_z(voxel_t &v, zval_avg const &zv_old, float depth, voxel_map *cur_x_map) {
+zval_avg voxel_vect_t::find_adj_z(voxel_t &v, zval_avg const &zv_old, float depth, voxel_vect_t *cur_x_vect) {
 
 	coord_type best_dz(0);
 	zval_avg res;
@@ -265,16 +331,16 @@ zval_avg voxel_map::find_adj_z(voxel_t &v, zval_avg const &zv_old, float depth,
 	v2_s.p[2] -= min(Z_CHECK_RANGE, (int)v2_s.p[2]);
 	v2_e.p[2] += Z_CHECK_RANGE+1; // one past the end
 
-	for (iterator it = lower_bound(v2_s); it != end() && it->first < v2_e;) { // Note: no increment of it
-		zval_avg const z2(it->second);
-		assert(z2.valid());
-		if (zv_old.valid() && fabs(z2.getz() - zv_old.getz()) > depth) {++it; continue;} // delta z too large
-		voxel_t const v2(it->first);
+	for (iterator it = std::lower_bound(begin(), end(), v2_s, voxel_entry_less()); it != end() && it->v < v2_e; ++it) {
+		if (!it->valid()) continue; // already consumed
+		zval_avg const z2(it->get_zv());
+		if (zv_old.valid() && fabs(z2.getz() - zv_old.getz()) > depth) continue; // delta z too large
+		voxel_t const v2(it->v);
 
-		if (cur_x_map) {
-			erase(it++);
-			(*cur_x_map)[v2] = z2;
-		} else {++it;}
+		if (cur_x_vect) {
+			cur_x_vect->push_back(*it);
+			it->c = 0; // mark as consumed
+		}
 		coord_type const dz(v2.p[2] - v.p[2]);
 		if (!res.valid() || abs(dz) < abs(best_dz)) {best_dz = dz;}
 		res.c += z2.c;
@@ -285,7 +351,7 @@ zval_avg voxel_map::find_adj_z(voxel_t &v, zval_avg const &zv_old, float depth,
 }
 
 
-bool voxel_map::read(char const *const fn) {
+bool voxel_vect_t::read(char const *const fn) {
 
 	FILE *fp;
 	assert(fn != NULL);
@@ -296,19 +362,21 @@ bool voxel_map::read(char const *const fn) {
 	unsigned map_size(0);
 	size_t const sz_read(fread(&map_size, sizeof(unsigned), 1, fp));
 	assert(sz_read == 1);
-	
-	for (unsigned i = 0; i < map_size; ++i) {
-		data_block data;
-		size_t const nr(fread(&data, sizeof(data_block), 1, fp));
-		assert(nr == 1);
-		data.add_to_map(*this);
-	}
+	resize(map_size);
+	size_t const nr(map_size ? fread(&front(), sizeof(voxel_entry_t), map_size, fp) : 0); // single bulk read of all records
 	fclose(fp);
+
+	if (nr != map_size) {
+		cerr << "Error: Snow file " << fn << " is truncated: read " << nr << " of " << map_size << " voxels" << endl;
+		clear();
+		return 0;
+	}
+	if (!std::is_sorted(begin(), end())) {sort(begin(), end());} // written sorted, but don't rely on it
 	return 1;
 }
 
 
-bool voxel_map::write(char const *const fn) const {
+bool voxel_vect_t::write(char const *const fn) const {
 
 	FILE *fp;
 	assert(fn != NULL);
@@ -319,13 +387,8 @@ bool voxel_map::write(char const *const fn) const {
 	unsigned const map_size((unsigned)size()); // should be size_t?
 	size_t const sz_write(fwrite(&map_size, sizeof(map_size), 1, fp));
 	assert(sz_write == 1);
-
-	for (const_iterator i = begin(); i != end(); ++i) {
-		data_block data;
-		data.set_from_map_iter(i);
-		size_t const nw(fwrite(&data, sizeof(data_block), 1, fp));
-		assert(nw == 1);
-	}
+	size_t const nw(empty() ? 0 : fwrite(&front(), sizeof(voxel_entry_t), size(), fp));
+	assert(nw == size());
 	fclose(fp);
 	return 1;
 }
@@ -486,63 +549,79 @@ bool check_snow_line_coll(point const &pos1, point const &pos2, point &cpos, vec
 }
 
 
-void create_snow_map(voxel_map &vmap) {
+void trace_snow_row(int y, int num_per_dim, float zval, float zv_scale, float xscale, float yscale, snow_voxel_accum_t &accum) {
+
+	rand_gen_t rgen;
+	rgen.set_state(123, y);
+
+	for (int x = 0; x < num_per_dim; ++x) {
+		point pos1(-X_SCENE_SIZE + x*xscale, -Y_SCENE_SIZE + y*yscale, zval);
+		// add slightly more randomness for numerical precision reasons
+		for (unsigned d = 0; d < 2; ++d) {pos1[d] += SMALL_NUMBER*rgen.signed_rand_float();}
+		point pos2;
+		if (!get_mesh_ice_pt(pos1, pos2)) continue; // invalid point
+		assert(pos2.z < pos1.z);
+		pos1 += get_rand_snow_vect(rgen, 1.0); // add some gaussian randomness for better distribution
+		point cpos;
+		vector3d cnorm;
+		bool invalid(0);
+		unsigned iter(0);
+			
+		while (check_snow_line_coll(pos1, pos2, cpos, cnorm)) {
+			if (cnorm.z > 0.0) { // collision with a surface that points up - we're done
+				pos2 = cpos;
+				break;
+			}
+			if (snow_random == 0.0 || iter > 100) { // something odd happened
+				invalid = 1;
+				break;
+			}
+			// collision with vertical or bottom surface
+			float const val(CLIP_TO_01((pos1.z - zbottom)*zv_scale));
+			vector3d const delta(get_rand_snow_vect(rgen, 0.1*val));
+			pos1 = cpos - (pos2 - pos1).get_norm()*SMALL_NUMBER; // push a small amount back from the object
+			pos2 = pos1 + ((dot_product(delta, cnorm) < 0.0) ? -delta : delta);
+				
+			if (!get_mesh_ice_pt(pos2, pos2)) { // invalid point
+				invalid = 1;
+				break;
+			}
+			++iter;
+		} // end while
+		if (!invalid) {accum.add(voxel_t(pos2), 1, pos2.z);}
+	} // for x
+}
+
+
+void create_snow_map(voxel_vect_t &vmap) {
 
 	// distribute snowflakes over the scene and build the voxel map of hits
+	int const ROWS_PER_BLOCK = 4, BLOCKS_PER_PASS = 64; // fixed, independent of thread count, so that results are deterministic
 	int const num_per_dim(1024*(unsigned)sqrt((float)num_snowflakes)); // in M, so sqrt div by 1024
+	int const num_blocks((num_per_dim + ROWS_PER_BLOCK - 1)/ROWS_PER_BLOCK);
 	float const zval(max(ztop, czmax)), zv_scale(1.0f/(zval - zbottom));
 	float const xscale(2.0*X_SCENE_SIZE/num_per_dim), yscale(2.0*Y_SCENE_SIZE/num_per_dim);
+	vector<snow_voxel_accum_t> block_accum(BLOCKS_PER_PASS); // one per block of rows, reused across passes
+	snow_voxel_accum_t accum;
 	all_models.build_cobj_trees(1);
 	cout << "Snow accumulation progress (out of " << num_per_dim << "):     0";
 
+	for (int b0 = 0; b0 < num_blocks; b0 += BLOCKS_PER_PASS) {
+		int const nb(min(BLOCKS_PER_PASS, num_blocks - b0));
+		increment_printed_number(b0*ROWS_PER_BLOCK);
+
 #pragma omp parallel for schedule(dynamic,1)
-	for (int y = 0; y < num_per_dim; ++y) {
-		if (omp_get_thread_num_3dw() == 0) {increment_printed_number(y);} // progress for thread 0
-		rand_gen_t rgen;
-		rgen.set_state(123, y);
-
-		for (int x = 0; x < num_per_dim; ++x) {
-			point pos1(-X_SCENE_SIZE + x*xscale, -Y_SCENE_SIZE + y*yscale, zval);
-			// add slightly more randomness for numerical precision reasons
-			for (unsigned d = 0; d < 2; ++d) {pos1[d] += SMALL_NUMBER*rgen.signed_rand_float();}
-			point pos2;
-			if (!get_mesh_ice_pt(pos1, pos2)) continue; // invalid point
-			assert(pos2.z < pos1.z);
-			pos1 += get_rand_snow_vect(rgen, 1.0); // add some gaussian randomness for better distribution
-			point cpos;
-			vector3d cnorm;
-			bool invalid(0);
-			unsigned iter(0);
-			
-			while (check_snow_line_coll(pos1, pos2, cpos, cnorm)) {
-				if (cnorm.z > 0.0) { // collision with a surface that points up - we're done
-					pos2 = cpos;
-					break;
-				}
-				if (snow_random == 0.0 || iter > 100) { // something odd happened
-					invalid = 1;
-					break;
-				}
-				// collision with vertical or bottom surface
-				float const val(CLIP_TO_01((pos1.z - zbottom)*zv_scale));
-				vector3d const delta(get_rand_snow_vect(rgen, 0.1*val));
-				pos1 = cpos - (pos2 - pos1).get_norm()*SMALL_NUMBER; // push a small amount back from the object
-				pos2 = pos1 + ((dot_product(delta, cnorm) < 0.0) ? -delta : delta);
-				
-				if (!get_mesh_ice_pt(pos2, pos2)) { // invalid point
-					invalid = 1;
-					break;
-				}
-				++iter;
-			} // end while
-			if (!invalid) {
-				voxel_t const voxel(pos2);
-#pragma omp critical(snow_map_update)
-				vmap[voxel].update(pos2.z);
-			}
-		} // for x
-	} // for y
+		for (int b = 0; b < nb; ++b) {
+			int const y_start((b0 + b)*ROWS_PER_BLOCK), y_end(min(num_per_dim, y_start+ROWS_PER_BLOCK));
+			for (int y = y_start; y < y_end; ++y) {trace_snow_row(y, num_per_dim, zval, zv_scale, xscale, yscale, block_accum[b]);}
+		}
+		for (int b = 0; b < nb; ++b) { // merge serially in block order so that the float z sums don't depend on thread scheduling
+			accum.merge_from(block_accum[b]);
+			block_accum[b].clear();
+		}
+	} // for b0
 	cout << endl;
+	accum.get_sorted(vmap);
 }
 
 
@@ -554,10 +633,10 @@ void add_strip(strip_vect_t const &strip, bool is_edge, int xval, int y_start) {
 }
 
 
-void create_snow_strips(voxel_map &vmap) {
+void create_snow_strips(voxel_vect_t &vmap) {
 
 	// create strips of snow for rendering
-	voxel_map cur_x_map, last_x_map;
+	voxel_vect_t cur_x_map, last_x_map;
 	unsigned const num_xy_voxels(VOXELS_PER_DIV*VOXELS_PER_DIV*XY_MULT_SIZE);
 	float const delta_depth(snow_depth*num_xy_voxels/(1024.0f*1024.0f*num_snowflakes));
 	unsigned n_strips(0), n_edge_strips(0), strip_len(0), edge_strip_len(0);
@@ -567,21 +646,23 @@ void create_snow_strips(voxel_map &vmap) {
 	snow_strips.clear();
 	snow_strips.reserve(8*num_xy_voxels/MAX_STRIP_LEN); // should be more than enough
 
-	while (!vmap.empty()) {
-		pair<voxel_t, zval_avg> start(*vmap.begin());
-		voxel_t v1(start.first);
-		zval_avg zv(start.second);
-		assert(zv.valid());
+	for (size_t next_ix = 0; ; ++next_ix) {
+		while (next_ix < vmap.size() && !vmap[next_ix].valid()) {++next_ix;} // skip voxels consumed by earlier strips
+		if (next_ix == vmap.size()) break; // done
+		voxel_entry_t &start(vmap[next_ix]);
+		voxel_t v1(start.v);
+		zval_avg zv(start.get_zv());
 
 		if (v1.p[0] != last_x) { // we moved on to the next x-value, so update the x maps
 			last_x = v1.p[0];
+			sort(cur_x_map.begin(), cur_x_map.end()); // entries were added in strip order
 			last_x_map.clear();
 			cur_x_map.swap(last_x_map);
 			bool const did_ins(x_strip_map.insert(make_pair(last_x, (unsigned)snow_strips.size())).second);
-			assert(did_ins); // map should guarantee strictly increasing x
+			assert(did_ins); // sorted vector should guarantee strictly increasing x
 		}
-		vmap.erase(vmap.begin());
-		cur_x_map[v1] = zv;
+		cur_x_map.push_back(start);
+		start.c = 0; // mark as consumed
 		vs.resize(0);
 		--v1.p[1];
 		vs.push_back(voxel_z_pair(v1)); // zero start
@@ -666,7 +747,7 @@ void gen_snow_coverage() {
 
 	if (snow_depth <= 0.0 || num_snowflakes == 0) return; // disabled
 	cout << "Determining Snow Coverage" << endl;
-	voxel_map vmap;
+	voxel_vect_t vmap;
 
 	// setup voxel scales
 	vox_delta.assign(VOXELS_PER_DIV/DX_VAL, VOXELS_PER_DIV/DY_VAL, 1.0/(max(DZ_VAL/VOXELS_PER_DIV, snow_depth)));
@@ -7,6 +7,12 @@
 #include "shaders.h"
 #include "openal_wrap.h"
 #include "heightmap.h"
+#include "binary_file_io.h"
+#ifdef _WIN32
+#include <io.h> // for _findfirst()
+#else
+#include <dirent.h>
+#endif
 
 
 bool const DEBUG_TILES        = 0;
@@ -56,7 +62,7 @@ extern int DISABLE_WATER, display_mode, tree_mode, leaf_color_changed, ground_ef
 extern int invert_mh_image, is_cloudy, camera_surf_collide, show_fog, mesh_gen_mode, mesh_gen_shape, cloud_model, precip_mode, auto_time_adv;
 extern float zmax, zmin, water_plane_z, mesh_scale, mesh_scale_z, vegetation, relh_adj_tex, grass_length, grass_width, fticks, cloud_height_offset, clouds_per_tile;
 extern float ocean_wave_height, sm_tree_density, tree_density_thresh, atmosphere, cloud_cover, temperature, flower_density, FAR_CLIP, shadow_map_pcf_offset, biome_x_offset;
-extern float smap_thresh_scale, tt_grass_scale_factor;
+extern float smap_thresh_scale, tt_grass_scale_factor, erode_amount;
 extern double tfticks;
 extern point sun_pos, moon_pos, surface_pos;
 extern vector3d wind;
@@ -69,6 +75,8 @@ extern pt_line_drawer tree_scenery_pld;
 extern tree_cont_t *cur_tile_trees;
 
 bool enable_terrain_env(ENABLE_TERRAIN_ENV);
+unsigned tile_cache_max_mb(1024);
+string tile_cache_dir; // empty = tile disk cache disabled
 void set_water_plane_uniforms(shader_t &s);
 void create_pine_tree_instances();
 unsigned get_tree_inst_gpu_mem();
@@ -247,18 +255,202 @@ bool write_default_hmap_modmap() {
 }
 
 
+// *** tile disk cache ***
+
+// Stores generated tile heights (and AO lighting if enabled) in tile_cache_dir, one file per tile, so that revisiting an area or restarting doesn't regenerate and re-erode them.
+// Files are keyed by a hash of the mesh generation parameters; the least recently used files are deleted when the total size exceeds tile_cache_max_mb.
+// Shadows aren't cached because they depend on the light position and adjacent tiles; normals are cheap to recompute from the heights.
+class tile_disk_cache_t {
+
+	struct entry_t {
+		unsigned size;
+		uint64_t last_use;
+		entry_t(unsigned size_=0, uint64_t last_use_=0) : size(size_), last_use(last_use_) {}
+	};
+	struct file_header_t {
+		unsigned magic, version, zvsize, ao_size;
+		int x1, y1;
+		uint64_t params_hash;
+	};
+	static unsigned const MAGIC = 0x43445454; // "TTDC"
+	static unsigned const VERSION = 1;
+	static unsigned const INDEX_SAVE_INTERVAL = 16; // in stores
+
+	map<string, entry_t> entries; // filename => entry
+	uint64_t use_counter, total_bytes;
+	unsigned stores_since_save;
+	bool index_loaded, index_dirty;
+
+	string get_path(string const &fn) const {return (tile_cache_dir + "/" + fn);}
+	string get_index_path() const {return get_path("tile_cache.idx");}
+
+	static string get_tile_fn(int x1, int y1, uint64_t params_hash) {
+		std::ostringstream oss;
+		oss << "tile_" << std::hex << params_hash << std::dec << "_" << x1 << "_" << y1 << ".bin";
+		return oss.str();
+	}
+	static void list_tile_files(string const &dir, vector<string> &fns) { // all tile files in dir, including ones missing from the index
+#ifdef _WIN32
+		_finddata_t data;
+		intptr_t const handle(_findfirst((dir + "/tile_*.bin").c_str(), &data));
+		if (handle == -1) return;
+		do {fns.push_back(data.name);} while (_findnext(handle, &data) == 0);
+		_findclose(handle);
+#else
+		DIR *const dp(opendir(dir.c_str()));
+		if (dp == nullptr) return;
+
+		for (dirent *de = readdir(dp); de != nullptr; de = readdir(dp)) {
+			string const fn(de->d_name);
+			if (fn.size() > 9 && fn.compare(0, 5, "tile_") == 0 && fn.compare(fn.size()-4, 4, ".bin") == 0) {fns.push_back(fn);}
+		}
+		closedir(dp);
+#endif
+	}
+	void load_index() {
+		if (index_loaded) return;
+		index_loaded = 1;
+		FILE *fp(fopen(get_index_path().c_str(), "r"));
+
+		if (fp != nullptr) { // else new cache, or the index was never written
+			char fn[256] = {0};
+			unsigned size(0);
+			unsigned long long last_use(0);
+
+			while (fscanf(fp, "%255s %u %llu", fn, &size, &last_use) == 3) {
+				entries[fn] = entry_t(size, last_use);
+				use_counter = max(use_counter, (uint64_t)last_use);
+			}
+			fclose(fp);
+		}
+		// reconcile with the directory contents: files written after the last index save (crash or kill) are added as least recently used,
+		// and entries whose files were deleted are dropped; sizes are taken from the files
+		vector<string> fns;
+		list_tile_files(tile_cache_dir, fns);
+		map<string, entry_t> dir_entries;
+
+		for (auto i = fns.begin(); i != fns.end(); ++i) {
+			FILE *const tfp(fopen(get_path(*i).c_str(), "rb"));
+			if (tfp == nullptr) continue;
+			fseek(tfp, 0, SEEK_END);
+			long const size(ftell(tfp));
+			fclose(tfp);
+			if (size <= 0) continue;
+			auto it(entries.find(*i));
+			dir_entries[*i] = entry_t((unsigned)size, ((it == entries.end()) ? 0 : it->second.last_use));
+			if (it == entries.end()) {index_dirty = 1;}
+		}
+		if (dir_entries.size() != entries.size()) {index_dirty = 1;}
+		entries.swap(dir_entries);
+		for (auto i = entries.begin(); i != entries.end(); ++i) {total_bytes += i->second.size;}
+		evict_lru(); // orphan files may have pushed the total over the limit
+	}
+	void remove_entry(map<string, entry_t>::iterator it) {
+		remove(get_path(it->first).c_str());
+		total_bytes -= it->second.size;
+		entries.erase(it);
+		index_dirty = 1;
+	}
+	void evict_lru() {
+		uint64_t const max_bytes(uint64_t(tile_cache_max_mb) << 20), target_bytes(max_bytes - max_bytes/8); // free down to 7/8 of max to avoid evicting on every store
+		if (total_bytes <= max_bytes) return;
+		vector<pair<uint64_t, string> > by_use;
+		for (auto i = entries.begin(); i != entries.end(); ++i) {by_use.push_back(make_pair(i->second.last_use, i->first));}
+		sort(by_use.begin(), by_use.end()); // oldest first
+
+		for (auto i = by_use.begin(); i != by_use.end() && total_bytes > target_bytes; ++i) {
+			auto it(entries.find(i->second));
+			assert(it != entries.end());
+			remove_entry(it);
+		}
+	}
+public:
+	tile_disk_cache_t() : use_counter(0), total_bytes(0), stores_since_save(0), index_loaded(0), index_dirty(0) {}
+	bool is_enabled() const {return (!tile_cache_dir.empty() && !using_tiled_terrain_hmap_tex());} // heightmap tiles are cheap to create and can be edited
+
+	uint64_t get_params_hash(unsigned tile_size) const {
+		uint64_t hash(get_mesh_gen_params_hash());
+		float const fvals[] = {erode_amount, zmin, water_plane_z};
+		hash_add_bytes(hash, fvals, sizeof(fvals));
+		hash_add_bytes(hash, &erosion_iters_tt, sizeof(erosion_iters_tt));
+		hash_add_bytes(hash, &tile_size, sizeof(tile_size));
+		return hash;
+	}
+	bool load(int x1, int y1, uint64_t params_hash, vector<float> &zvals, vector<unsigned char> &ao_lighting, unsigned ao_size) {
+		load_index();
+		auto it(entries.find(get_tile_fn(x1, y1, params_hash)));
+		if (it == entries.end()) return 0; // not cached
+		binary_file_reader reader;
+		file_header_t header;
+		bool valid(reader.open(get_path(it->first)) && reader.read(&header, sizeof(header), 1));
+		valid &= (header.magic == MAGIC && header.version == VERSION && header.params_hash == params_hash && header.x1 == x1 && header.y1 == y1);
+		valid &= (header.zvsize*header.zvsize == zvals.size() && (header.ao_size == 0 || header.ao_size == ao_size));
+		valid = (valid && reader.read(zvals.data(), sizeof(float), zvals.size()));
+
+		if (valid && header.ao_size > 0 && enable_tiled_mesh_ao) {
+			ao_lighting.resize(ao_size);
+			valid = reader.read(ao_lighting.data(), sizeof(unsigned char), ao_size);
+			if (!valid) {ao_lighting.clear();}
+		}
+		reader.close();
+		if (!valid) {remove_entry(it); return 0;} // truncated or stale file
+		it->second.last_use = ++use_counter;
+		index_dirty = 1;
+		return 1;
+	}
+	void store(int x1, int y1, uint64_t params_hash, unsigned zvsize, vector<float> const &zvals, vector<unsigned char> const &ao_lighting) {
+		load_index();
+		string const fn(get_tile_fn(x1, y1, params_hash));
+		file_header_t header;
+		header.magic = MAGIC; header.version = VERSION; header.zvsize = zvsize; header.ao_size = (unsigned)ao_lighting.size();
+		header.x1 = x1; header.y1 = y1; header.params_hash = params_hash;
+		binary_file_writer writer;
+		bool valid(writer.open(get_path(fn)) && writer.write(&header, sizeof(header), 1) && writer.write(zvals.data(), sizeof(float), zvals.size()));
+		if (valid && !ao_lighting.empty()) {valid = writer.write(ao_lighting.data(), sizeof(unsigned char), ao_lighting.size());}
+		writer.close();
+		auto it(entries.find(fn));
+		if (it != entries.end()) {total_bytes -= it->second.size; entries.erase(it);}
+		index_dirty = 1;
+
+		if (!valid) { // disk full or directory doesn't exist; disable the cache rather than retrying every tile
+			remove(get_path(fn).c_str());
+			std::cerr << "Error writing tile cache file; disabling tile cache" << endl;
+			save_index();
+			tile_cache_dir.clear();
+			return;
+		}
+		unsigned const size(sizeof(header) + zvals.size()*sizeof(float) + ao_lighting.size());
+		entries[fn] = entry_t(size, ++use_counter);
+		total_bytes += size;
+		evict_lru();
+		if (++stores_since_save >= INDEX_SAVE_INTERVAL) {save_index();}
+	}
+	void save_index() { // called periodically, when tiles are cleared, and at exit
+		if (!index_dirty || tile_cache_dir.empty()) return;
+		FILE *fp(fopen(get_index_path().c_str(), "w"));
+		if (fp == nullptr) {std::cerr << "Error writing tile cache index " << get_index_path() << endl; return;}
+		for (auto i = entries.begin(); i != entries.end(); ++i) {fprintf(fp, "%s %u %llu\n", i->first.c_str(), i->second.size, (unsigned long long)i->second.last_use);}
+		fclose(fp);
+		index_dirty = 0;
+		stores_since_save = 0;
+	}
+};
+
+tile_disk_cache_t tile_disk_cache;
+
+
 // *** tile_t ***
 
 tile_t::tile_t() : x1(0), y1(0), x2(0), y2(0), wx1(0), wy1(0), wx2(0), wy2(0),
 	last_occluded_frame(0), weight_tid(0), height_tid(0), normal_tid(0), shadow_tid(0), size(0), stride(0), zvsize(0), base_tsize(0), gen_tsize(0), smap_lod_level(0),
 	radius(0), mzmin(0), mzmax(0), mesh_dz(0), ptzmax(0), dtzmax(0), trmax(0), xstart(0), ystart(0), min_normal_z(0.0), deltax(0.0), deltay(0.0),
 	sun_shadows_invalid(1), moon_shadows_invalid(1), recalc_tree_grass_weights(1), mesh_height_invalid(0), in_queue(0), last_occluded(0), has_any_grass(0),
-	is_distant(0), no_trees(0), just_cleared(0), has_tunnel(0), decid_trees(tree_data_manager) {}
+	is_distant(0), no_trees(0), just_cleared(0), has_tunnel(0), zvals_from_cache(0), ao_from_cache(0), gen_params_hash(0), decid_trees(tree_data_manager) {}
 
 tile_t::tile_t(unsigned size_, int x, int y) : last_occluded_frame(0), weight_tid(0), height_tid(0), normal_tid(0), shadow_tid(0),
 	size(size_), stride(size+1), zvsize(stride+1), gen_tsize(0), smap_lod_level(0), mesh_dz(0.0), trmax(0.0), min_normal_z(0.0), deltax(DX_VAL), deltay(DY_VAL),
 	sun_shadows_invalid(1), moon_shadows_invalid(1), recalc_tree_grass_weights(1), mesh_height_invalid(0), in_queue(0), last_occluded(0), has_any_grass(0),
-	is_distant(0), no_trees(0), just_cleared(0), has_tunnel(0), mesh_off(xoff-xoff2, yoff-yoff2), decid_trees(tree_data_manager)
+	is_distant(0), no_trees(0), just_cleared(0), has_tunnel(0), zvals_from_cache(0), ao_from_cache(0), gen_params_hash(0), mesh_off(xoff-xoff2, yoff-yoff2), decid_trees(tree_data_manager)
 {
 	assert(size > 0);
 	x1 = x*size;
@@ -362,6 +554,25 @@ unsigned tile_t::count_shadow_maps() const {
 	return num;
 }
 
+size_t tile_t::get_cpu_mem() const { // mesh and lighting data only; trees, grass, and flowers are counted separately
+
+	size_t mem(sizeof(tile_t) + (zvals.capacity() + ao_zvals.capacity())*sizeof(float) + tree_map.capacity()*sizeof(tree_map_val));
+	mem += mesh_weight_data.capacity() + weight_data.capacity() + ao_lighting.capacity() + grass_blocks.capacity()*sizeof(grass_block_t);
+
+	for (unsigned l = 0; l < NUM_LIGHT_SRC; ++l) {
+		mem += smask[l].capacity() + (sh_out[l][0].capacity() + sh_out[l][1].capacity())*sizeof(float);
+	}
+	return mem;
+}
+
+void tile_t::add_mem_usage(mem_usage_t *usage) const {
+
+	unsigned const tree_gpu_mem(pine_trees.get_gpu_mem() + decid_trees.get_gpu_mem());
+	usage[MEM_TILES].add(get_cpu_mem(), (get_gpu_mem() - tree_gpu_mem - flowers.get_gpu_mem()), 1); // Note: GPU includes shadow maps and scenery
+	usage[MEM_TREES].add(get_tree_mem(), tree_gpu_mem, (num_pine_trees() + num_decid_trees()));
+	usage[MEM_GRASS].add(flowers.get_cpu_mem(), flowers.get_gpu_mem(), 0);
+}
+
 
 void tile_t::clear() {
 
@@ -413,20 +624,16 @@ bool setup_height_gen(mesh_xy_grid_cache_t &height_gen, float x0, float y0, floa
 	bool const add_detail(using_hmap_with_detail());
 	if (!add_detail && using_tiled_terrain_hmap_tex()) return 1; // nothing to do
 	float const xy_scale(add_detail ? HMAP_DETAIL_SCALE : 1.0);
-	bool const results_avail(height_gen.build_arrays(xy_scale*x0, xy_scale*y0, xy_scale*dx, xy_scale*dy, nx, ny, cache_values, 0, no_wait));
+	bool const cache(cache_values || mesh_gen_mode != MGEN_SINE); // noise is faster to generate for the whole grid at once
+	bool const results_avail(height_gen.build_arrays(xy_scale*x0, xy_scale*y0, xy_scale*dx, xy_scale*dy, nx, ny, cache, 0, no_wait));
 	height_gen.enable_glaciate();
 	return results_avail;
 }
 
 
-bool tile_t::create_zvals(mesh_xy_grid_cache_t &height_gen, bool no_wait) {
+bool tile_t::gen_zvals(mesh_xy_grid_cache_t &height_gen, bool no_wait) {
 
-	//timer_t timer("Create Zvals");
-	if (enable_terrain_env) {update_terrain_params();}
-	zvals.resize(zvsize*zvsize);
-	mzmin =  FAR_DISTANCE;
-	mzmax = -FAR_DISTANCE;
-	unsigned const block_size(zvsize/4), context_sz(stride + 2*AO_RAY_LEN);
+	unsigned const context_sz(stride + 2*AO_RAY_LEN);
 	bool const using_hmap(using_tiled_terrain_hmap_tex()), add_detail(using_hmap_with_detail()); // add procedural detail to heightmap
 
 	// When using AO + GPU noise generation, it's faster to compute the AO + context and clip the zvals from this rather than making two separate compute calls (one without blocking)
@@ -444,7 +651,7 @@ bool tile_t::create_zvals(mesh_xy_grid_cache_t &height_gen, bool no_wait) {
 		bool results_ready(setup_height_gen(height_gen, get_xval(x1), get_yval(y1), deltax, deltay, zvsize, zvsize, 0, no_wait)); // cache_values=0
 		if (!results_ready) {assert(no_wait); return 0;} // cached heights are not yet ready
 	}
-	float const xy_mult(1.0/float(size)), wpz_max(get_water_z_height() + ocean_wave_height);
+	float const xy_mult(1.0/float(size));
 
 #pragma omp parallel for schedule(static,1)
 	for (int y = 0; y < (int)zvsize; ++y) {
@@ -467,6 +674,23 @@ bool tile_t::create_zvals(mesh_xy_grid_cache_t &height_gen, bool no_wait) {
 		} // for x
 	} // for y
 	if (!using_hmap) {apply_erosion(&zvals.front(), zvsize, zvsize, zmin, erosion_iters_tt);} // heightmap is eroded during load
+	return 1; // results are ready
+}
+
+bool tile_t::create_zvals(mesh_xy_grid_cache_t &height_gen, bool no_wait) {
+
+	//timer_t timer("Create Zvals");
+	if (enable_terrain_env) {update_terrain_params();}
+	zvals.resize(zvsize*zvsize);
+	zvals_from_cache = ao_from_cache = 0;
+	gen_params_hash  = (tile_disk_cache.is_enabled() ? tile_disk_cache.get_params_hash(size) : 0);
+	if (gen_params_hash) {zvals_from_cache = tile_disk_cache.load(x1, y1, gen_params_hash, zvals, ao_lighting, stride*stride);}
+	ao_from_cache = !ao_lighting.empty();
+	if (!zvals_from_cache && !gen_zvals(height_gen, no_wait)) return 0; // cached heights are not yet ready
+	mzmin =  FAR_DISTANCE;
+	mzmax = -FAR_DISTANCE;
+	unsigned const block_size(zvsize/4);
+	float const wpz_max(get_water_z_height() + ocean_wave_height);
 
 	for (unsigned yy = 0; yy < 4; ++yy) {
 		for (unsigned xx = 0; xx < 4; ++xx) {
@@ -499,6 +723,14 @@ bool tile_t::create_zvals(mesh_xy_grid_cache_t &height_gen, bool no_wait) {
 	return 1; // results are ready
 }
 
+void tile_t::write_to_disk_cache() const {
+
+	if (gen_params_hash == 0 || zvals.empty() || mesh_height_invalid || !tile_disk_cache.is_enabled()) return; // not cached, not generated, or stale
+	bool const has_ao(ao_lighting.size() == stride*stride);
+	if (zvals_from_cache && (ao_from_cache || !has_ao)) return; // file is already up-to-date
+	tile_disk_cache.store(x1, y1, gen_params_hash, zvsize, zvals, (has_ao ? ao_lighting : vector<unsigned char>()));
+}
+
 void tile_t::get_z_minmax_for_area(point const &pos, float radius, float &zmin, float &zmax) const {
 
 	float const rx1(pos.x - radius), ry1(pos.y - radius), rx2(pos.x + radius), ry2(pos.y + radius);
@@ -2067,9 +2299,15 @@ tile_draw_t::tile_draw_t() : buildings_valid(0), tiles_gen_prev_frame(0), terrai
 	assert(MESH_X_SIZE == MESH_Y_SIZE && X_SCENE_SIZE == Y_SCENE_SIZE);
 }
 
+void tile_draw_t::flush_disk_cache() const { // writes all live tiles to the disk cache and saves its index
+	for (tile_map::const_iterator i = tiles.begin(); i != tiles.end(); ++i) {i->second->write_to_disk_cache();}
+	tile_disk_cache.save_index();
+}
+
 void tile_draw_t::clear(bool no_regen_buildings) {
 
 	clear_vbos_tids(); // needed to clear vbo, ivbo, and free list
+	flush_disk_cache();
 	for (tile_map::iterator i = tiles.begin(); i != tiles.end(); ++i) {i->second->clear();} // may not be necessary
 	to_draw.clear();
 	tiles.clear();
@@ -2086,13 +2324,8 @@ void tile_draw_t::free_compute_shader() {
 	for (auto i = height_gens.begin(); i != height_gens.end(); ++i) {i->clear_context();}
 }
 
-float tile_draw_t::update(float &min_camera_dist) { // view-independent updates; returns terrain zmin
+void tile_draw_t::load_hmap_and_gen_buildings() {
 
-	//timer_t timer("TT Update");
-	unsigned const max_tile_gen_per_frame = 16; // higher = less overall gen time (more parallel), but longer wait for first render
-	unsigned const max_cpu_tiles          = 3; // 0 = GPU only
-	unsigned const max_defer_tiles        = 8; // 0 = disable
-	if (height_gens.empty()) {height_gens.resize(max(max_defer_tiles, 1U));}
 	if (terrain_hmap_manager.maybe_load(mh_filename_tt, (invert_mh_image != 0))) {read_default_hmap_modmap();}
 	
 	if (!buildings_valid) {
@@ -2100,6 +2333,24 @@ float tile_draw_t::update(float &min_camera_dist) { // view-independent updates;
 		gen_city_details(); // after building generation
 		buildings_valid = 1;
 	}
+}
+
+void tile_draw_t::add_mem_usage(mem_usage_t *usage) const {
+
+	for (tile_map::const_iterator i = tiles.begin(); i != tiles.end(); ++i) {i->second->add_mem_usage(usage);}
+	usage[MEM_TILES].add(0, smap_manager.get_free_list_mem_usage());
+	usage[MEM_TREES].add(0, (tree_data_manager.get_gpu_mem() + get_tree_inst_gpu_mem()));
+	usage[MEM_GRASS].add(grass_tile_manager.get_cpu_mem(), grass_tile_manager.get_gpu_mem(), grass_tile_manager.size());
+}
+
+float tile_draw_t::update(float &min_camera_dist) { // view-independent updates; returns terrain zmin
+
+	//timer_t timer("TT Update");
+	unsigned const max_tile_gen_per_frame = 16; // higher = less overall gen time (more parallel), but longer wait for first render
+	unsigned const max_cpu_tiles          = 3; // 0 = GPU only
+	unsigned const max_defer_tiles        = 8; // 0 = disable
+	if (height_gens.empty()) {height_gens.resize(max(max_defer_tiles, 1U));}
+	load_hmap_and_gen_buildings();
 	auto_calc_model_zvals(); // must be done after heightmap loading but before any tiles are created
 	to_draw.clear();
 	terrain_zmin = FAR_DISTANCE;
@@ -2128,6 +2379,7 @@ float tile_draw_t::update(float &min_camera_dist) { // view-independent updates;
 	}
 	for (tile_map::iterator i = tiles.begin(); i != tiles.end(); ) { // update tiles and free old tiles (Note: no ++i)
 		if (!i->second->update_range(smap_manager)) { // delete this tile
+			i->second->write_to_disk_cache();
 			i->second->clear();
 			tiles.erase(i++);
 			++num_erased;
@@ -3307,6 +3559,8 @@ bool tile_draw_t::line_intersect_mesh(point const &v1, point const &v2, float &t
 
 tile_draw_t terrain_tile_draw;
 
+void gen_tiled_terrain_buildings() {terrain_tile_draw.load_hmap_and_gen_buildings();} // for headless mode, where update() isn't called
+
 
 void update_tiled_grass_length_width(float lscale, float wscale) {
 	grass_tile_manager.scale_grass(lscale, wscale);
@@ -3329,7 +3583,8 @@ bool tile_smap_data_t::needs_update(point const &lpos) {
 
 
 tile_t *get_tile_from_xy  (tile_xy_pair const &tp) {return terrain_tile_draw.get_tile_from_xy(tp);}
-float update_tiled_terrain(float &min_camera_dist) {return terrain_tile_draw.update(min_camera_dist);}
+void add_tiled_terrain_mem_usage(mem_usage_t *usage) {terrain_tile_draw.add_mem_usage(usage);}
+float update_tiled_terrain(float &min_camera_dist) {PROFILE_SCOPE("Update Tiled Terrain"); bench_timer_t bench_timer(BENCH_TILES); return terrain_tile_draw.update(min_camera_dist);}
 void pre_draw_tiled_terrain(bool reflection_pass) {terrain_tile_draw.pre_draw(reflection_pass);}
 
 
@@ -3419,6 +3674,7 @@ void draw_tiled_terrain(bool reflection_pass) {
 void draw_tiled_terrain_lightning(bool reflection_pass) {terrain_tile_draw.update_lightning(reflection_pass);}
 void end_tiled_terrain_lightning() {terrain_tile_draw.end_lightning();}
 void clear_tiled_terrain(bool no_regen_buildings) {terrain_tile_draw.clear(no_regen_buildings);}
+void flush_tiled_terrain_disk_cache() {terrain_tile_draw.flush_disk_cache();}
 void draw_tiled_terrain_clouds(bool reflection_pass) {terrain_tile_draw.draw_tile_clouds(reflection_pass);}
 void draw_tiled_terrain_decid_tree_shadows() {terrain_tile_draw.draw_decid_tree_shadows();}
 void reset_tiled_terrain_state() {terrain_tile_draw.clear_vbos_tids();}
@@ -169,7 +169,8 @@ private:
 	unsigned size, stride, zvsize, base_tsize, gen_tsize, smap_lod_level;
 	float radius, mzmin, mzmax, mesh_dz, ptzmax, dtzmax, trmax, xstart, ystart, min_normal_z, deltax, deltay;
 	bool sun_shadows_invalid, moon_shadows_invalid, recalc_tree_grass_weights, mesh_height_invalid, in_queue, last_occluded, has_any_grass;
-	bool is_distant, no_trees, just_cleared, has_tunnel;
+	bool is_distant, no_trees, just_cleared, has_tunnel, zvals_from_cache, ao_from_cache;
+	uint64_t gen_params_hash; // 0 if not using the tile disk cache
 	colorRGB avg_mesh_tex_color;
 	tile_offset_t mesh_off, ptree_off, dtree_off, scenery_off;
 	float sub_zmin[4][4] = {0}, sub_zmax[4][4] = {0};
@@ -203,6 +204,7 @@ private:
 	terrain_params_t params[2][2]; // {ylo,yhi} x {xlo,xhi}
 
 	void update_terrain_params();
+	bool gen_zvals(mesh_xy_grid_cache_t &height_gen, bool no_wait);
 	unsigned get_lod_level(bool reflection_pass) const;
 
 public:
@@ -273,6 +275,8 @@ public:
 	unsigned get_gpu_mem() const;
 	unsigned get_smap_mem() const;
 	unsigned count_shadow_maps() const;
+	size_t get_cpu_mem() const;
+	void add_mem_usage(mem_usage_t *usage) const;
 
 	unsigned get_tree_mem() const { // only accounts for top-level class memory + palm verts
 		return (pine_trees.capacity()*sizeof(small_tree) + decid_trees.capacity()*sizeof(tree) + pine_trees.palm_vbo_mem);
@@ -284,6 +288,7 @@ public:
 	void clear_vbo_tid(tile_shadow_map_manager *smap_manager);
 	void clear_pine_tree_vbos() {pine_trees.clear_vbos();}
 	bool create_zvals(mesh_xy_grid_cache_t &height_gen, bool no_wait);
+	void write_to_disk_cache() const;
 	void get_z_minmax_for_area(point const &pos, float radius, float &zmin, float &zmax) const;
 	float get_zval_at(float x, float y, bool in_global_space) const;
 
@@ -444,8 +449,11 @@ public:
 	tile_draw_t();
 	~tile_draw_t() {/*clear();*/}
 	void clear(bool no_regen_buildings);
+	void flush_disk_cache() const;
 	void free_compute_shader();
+	void load_hmap_and_gen_buildings();
 	float update(float &min_camera_dist);
+	void add_mem_usage(mem_usage_t *usage) const;
 private:
 	static void setup_terrain_textures(shader_t &s, unsigned start_tu_id);
 	static void add_texture_colors(shader_t &s, unsigned start_tu_id);
@@ -16,6 +16,8 @@ using std::endl;
 int read_eventlist(0), make_eventlist(0), curr_event(0), n_events(0), n_frames(0), frame_counter(0);
 vector<uevent> eventlist;
 
+extern bool headless_mode;
+
 bool open_file(FILE *&fp, char const *const fn, std::string const &file_type, char const *const mode="r");
 
 
@@ -81,6 +83,8 @@ int save_ueventlist() {
 }
 
 
+bool is_window_event(int type) {return (type == UE_RESIZE || type == UE_MBUTTON || type == UE_MMOTION || type == UE_KEYBOARD || type == UE_KEYBOARD_SPECIAL || type == UE_KEYBOARD_UP);}
+
 void uevent_advance_frame() {
 
 	if (read_eventlist == 0) {
@@ -92,7 +96,11 @@ void uevent_advance_frame() {
 			++frame_counter;
 			return;
 		}
-		if(eventlist[curr_event].type < (int)NUM_UE_TYPES) {
+		if (headless_mode && is_window_event(eventlist[curr_event].type)) { // the handlers use GLUT and GL, which aren't initialized in headless mode
+			static bool warned(0);
+			if (!warned) {cout << "Note: skipping window and input events when replaying in headless mode" << endl; warned = 1;}
+		}
+		else if (eventlist[curr_event].type < (int)NUM_UE_TYPES) {
 			int *params(eventlist[curr_event].params);
 
 			switch (eventlist[curr_event].type) {
@@ -158,6 +166,11 @@ void uevent_advance_frame() {
 }
 
 
+bool uevent_replay_done() { // all events have been replayed and the recorded number of frames has been reached
+	return (read_eventlist && curr_event >= (int)eventlist.size() && frame_counter >= n_frames);
+}
+
+
 void add_uevent_srand(int rseed) {
 
 	if (read_eventlist == 1) return;
@@ -50,6 +50,7 @@ void proc_kbd_events();
 int  read_ueventlist(char *arg);
 int  save_ueventlist();
 void uevent_advance_frame();
+bool uevent_replay_done();
 void add_uevent_srand(int rseed);
 void add_uevent_resize(int x, int y);
 void add_uevent_mbutton(int button, int state, int x, int y);
@@ -201,11 +201,34 @@ struct rotated_obj { // size = 48
 };
 
 
+class urev_body;
+
+
+class rocky_surface_colors_t : public color_gen_class { // copy of the body params that determine its texture colors, so that it can be generated on another thread
+
+	unsigned char a[3], b[3], wcolor[3];
+	float temp, atmos, water, lava, wr_scale, snow_thresh;
+
+public:
+	rocky_surface_colors_t(urev_body const &body);
+	void get_surface_color(unsigned char *data, float val, float phi) const;
+};
+
+
+struct planet_tex_t { // heightmap and matching RGB texture data for a rocky planet or moon at one texture size
+
+	p_upsurface surface;
+	vector<unsigned char> data;
+	unsigned size;
+
+	planet_tex_t() : size(0) {}
+};
+
+typedef std::shared_ptr<planet_tex_t> p_planet_tex_t;
+
+
 class urev_body : public uobj_solid, public color_gen_class, public rotated_obj { // size = 360
 
-	// for textures/colors
-	unsigned char a[3], b[3];
-	
 protected:
 	void calc_snow_thresh();
 
@@ -213,23 +236,21 @@ public:
 	bool gas_giant; // planets only?
 	int owner;
 	unsigned orbiting_refs, tid, tsize;
-	float orbit, rot_rate, rev_rate, atmos, water, lava, resources, cloud_density, cloud_scale, wr_scale, snow_thresh, population, prev_pop;
+	float orbit, rot_rate, rev_rate, atmos, water, lava, resources, cloud_density, cloud_scale, snow_thresh, population, prev_pop;
 	vector3d rev_axis, v_orbit, orbit_scale;
 	std::shared_ptr<upsurface> surface;
 	string comment;
 
 	urev_body(char type_) : uobj_solid(type_), gas_giant(0), owner(NO_OWNER), orbiting_refs(0), tid(0), tsize(0), orbit(0.0), rot_rate(0.0), rev_rate(0.0), atmos(0.0),
-		water(0.0), lava(0.0), resources(0.0), cloud_density(1.0), cloud_scale(1.0), wr_scale(1.0), snow_thresh(0.0), population(0.0), prev_pop(0.0), orbit_scale(all_ones)
-	{a[0] = a[1] = a[2] = b[0] = b[1] = b[2] = 0;}
+		water(0.0), lava(0.0), resources(0.0), cloud_density(1.0), cloud_scale(1.0), snow_thresh(0.0), population(0.0), prev_pop(0.0), orbit_scale(all_ones) {}
 	virtual ~urev_body() {unset_owner();}
 	void gen_rotrev();
 	template<typename T> bool create_orbit(vector<T> const &objs, int i, point const &pos0, vector3d const &raxis,
 		float radius0, float max_size, float min_size, float rspacing, float ispacing, float minspacing, float min_gap, vector3d const &oscale);
-	void gen_surface();
 	void check_gen_texture(unsigned size);
-	void create_rocky_texture(unsigned size);
+	void create_rocky_texture(planet_tex_t const &tex);
 	void create_gas_giant_texture();
-	void gen_texture_data_and_heightmap(unsigned char *data, unsigned size);
+	void get_surface_params(float &mag, float &freq) const;
 	bool has_heightmap() const {return (surface != nullptr && surface->has_heightmap() && !use_procedural_shader());}
 	bool surface_test(float rad, point const &p, float &coll_r, bool simple) const;
 	float get_radius_at(point const &p, bool exact=0) const;
@@ -471,6 +492,7 @@ public:
 
 	ucell() : last_bkg_color(BLACK), last_player_pos(all_zeros), last_star_cache_ix(0), cached_stars_valid(0) {}
 	void gen_cell(int const ii[3]);
+	void gen_cell(int const ii[3], point const &upt);
 	void draw_nebulas(ushader_group &usg) const;
 	void draw_systems(ushader_group &usg, s_object const &clobj, unsigned pass, bool no_move, bool skip_closest, bool sel_cell, bool gen_only, bool no_asteroid_dust);
 	void free_uobj();
@@ -560,6 +582,32 @@ struct line_query_state {
 };
 
 
+struct univ_search_hint_t { // galaxy/cluster/system of the last closest object search, which are tried first on the next search
+
+	int galaxy, cluster, system;
+	univ_search_hint_t() : galaxy(-1), cluster(-1), system(-1) {}
+};
+
+
+struct univ_obj_query_t { // closest object, temperature, and gravity query for one free object; see universe_t::query_objects()
+
+	// inputs
+	point pos;
+	float r_add;
+	bool find_closest, include_asteroids, calc_temp, calc_gravity;
+	// results
+	int found_close;
+	s_object clobj;
+	float temperature; // not yet scaled by FOBJ_TEMP_SCALE or the object's shadow value
+	point sun_pos;
+	vector3d gravity;
+
+	univ_obj_query_t(point const &pos_, float r_add_, bool find_closest_, bool include_asteroids_, bool calc_temp_, bool calc_gravity_)
+		: pos(pos_), r_add(r_add_), find_closest(find_closest_), include_asteroids(include_asteroids_), calc_temp(calc_temp_), calc_gravity(calc_gravity_),
+		found_close(0), temperature(0.0), sun_pos(all_zeros), gravity(zero_vector) {}
+};
+
+
 class universe_t : protected cell_block {
 
 	icosphere_manager_t planet_manager;
@@ -568,15 +616,17 @@ class universe_t : protected cell_block {
 public:
 	void init();
 	void shift_cells(int dx, int dy, int dz);
+	void prefetch_shift(int dim, int dir, point const &camera);
 	void free_context();
 	void draw_all_cells(s_object const &clobj, bool skip_closest, bool no_move, int no_distant, bool gen_only, bool no_asteroid_dust);
 	int get_closest_object(s_object &result, point pos, int max_level, bool include_asteroids, bool offset, float expand,
-		bool get_destroyed=0, float g_expand=1.0, float r_add=0.0, int galaxy_hint=-1) const;
+		bool get_destroyed=0, float g_expand=1.0, float r_add=0.0, int galaxy_hint=-1, univ_search_hint_t *hint=nullptr) const;
 	bool get_trajectory_collisions(line_query_state &lqs, s_object &result, point &coll, vector3d dir, point start, float dist, float line_radius, bool include_asteroids=1) const;
-	float get_point_temperature(s_object const &clobj, point const &pos, point &sun_pos) const;
+	float get_point_temperature(s_object const &clobj, point const &pos, point &sun_pos, univ_search_hint_t *hint=nullptr) const;
+	void query_objects(vector<univ_obj_query_t> &queries) const;
 
-	int get_object_closest_to_pos(s_object &result, point const &pos, bool include_asteroids, float expand=1.0, float r_add=0.0) const {
-		return get_closest_object(result, pos, UTYPE_MOON, include_asteroids, 1, expand, 0, 1.0, r_add);
+	int get_object_closest_to_pos(s_object &result, point const &pos, bool include_asteroids, float expand=1.0, float r_add=0.0, univ_search_hint_t *hint=nullptr) const {
+		return get_closest_object(result, pos, UTYPE_MOON, include_asteroids, 1, expand, 0, 1.0, r_add, -1, hint);
 	}
 	int get_close_system(point const &pos, s_object &result, float expand) const {
 		if (!get_closest_object(result, pos, UTYPE_SYSTEM, 0, 1, expand)) return 0; // find closest system (check last param=offset?)
@@ -611,6 +661,7 @@ bool import_modmap(string const &filename);
 bool export_modmap(string const &filename);
 s_object get_shifted_sobj(s_object const &sobj);
 float calc_sphere_size(point const &pos, point const &camera, float radius, float d_adj=0.0);
+p_planet_tex_t get_planet_texture(urev_body const &body, unsigned size, bool async);
 bool sphere_size_less_than(point const &pos, point const &camera, float radius, float num_pixels);
 float get_elliptical_orbit_radius(vector3d const &axis, vector3d const &orbit_scale, vector3d vref);
 
@@ -7,6 +7,9 @@
 #include "universe.h"
 #include "sinf.h"
 #include "textures_3dw.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 
 unsigned const ND_TEST     = 32;
@@ -14,8 +17,12 @@ unsigned const ND_CUBE     = 16;
 float const M_ATTEN_FACTOR = 0.5;
 float const F_ATTEN_FACTOR = 0.4;
 
+unsigned const PLANET_TEX_CACHE_SIZE = 64; // generated planet/moon textures kept for reuse (up to ~450KB each)
+unsigned const PLANET_TEX_MAX_AGE    = 16; // background jobs not requested within this many frames are dropped
 
-extern int display_mode;
+bool async_planet_textures(1);
+
+extern int display_mode, frame_counter;
 
 
 void noise_gen_3d::gen_sines(float mag, float freq) {
@@ -180,37 +187,38 @@ upsurface::~upsurface() {
 }
 
 
-void urev_body::gen_surface() {
+void urev_body::get_surface_params(float &mag, float &freq) const {
 
-	set_rseeds();
-	surface.reset(new upsurface(type)); // may delete a previous surface
-	float mag(SURFACE_HEIGHT*radius), freq(((type == UTYPE_MOON) ? 1.5 : 1.0)*INITIAL_FREQ*TWO_PI);
-	surface->rgen = rgen; // just copy it?
-	surface->gen(mag, freq);
+	mag  = SURFACE_HEIGHT*radius;
+	freq = ((type == UTYPE_MOON) ? 1.5 : 1.0)*INITIAL_FREQ*TWO_PI;
 }
 
 
 // Note: many planet/sphere renderers use a texture with width = 2*height, which yields square regions at the equator
 // here we use a square texture for simplicity, so that this code can be shared with (and be similar to)
 // the rest of the 3DWorld sphere generation and drawing code; it also produces more uniform regions near the poles
-void urev_body::gen_texture_data_and_heightmap(unsigned char *data, unsigned size) {
+// surface must already have its sines generated; use_threads=0 is for calls from worker threads, which each generate a different texture
+void gen_texture_data_and_heightmap(upsurface &surface, color_gen_class const &cgen, float hmap_cutoff, unsigned char *data, unsigned size, bool use_threads) {
 
 	//RESET_TIME;
-	get_colors(a, b);
 	unsigned size_p2(0);
 	for (unsigned sz = size; sz > 1; sz >>= 1, ++size_p2);
 	assert((1U<<size_p2) == size); // size must be a power of 2
-	assert(surface != nullptr);
 	unsigned const table_size(MAX_TEXTURE_SIZE << 1); // larger is more accurate
-	static float xtable[TOT_NUM_SINES*table_size], ytable[TOT_NUM_SINES*table_size];
-	surface->setup(size, max(water, lava), 1); // use_heightmap=1
-	unsigned const num_sines(surface->num_sines);
-	float const *const rdata(surface->rdata);
-	float const mt2(0.5*(table_size-1)), scale(1.5/surface->max_mag);
+	vector<float> xtable(TOT_NUM_SINES*table_size), ytable(TOT_NUM_SINES*table_size); // per-call, since this can run on multiple threads
+	surface.setup(size, hmap_cutoff, 1); // use_heightmap=1
+	unsigned const num_sines(surface.num_sines);
+	float const *const rdata(surface.rdata);
+	float const mt2(0.5*(table_size-1)), scale(1.5/surface.max_mag);
 	float const delta(TWO_PI/size), sin_ds(sin(delta)), cos_ds(cos(delta));
 	unsigned const pole_thresh(size>>3);
-	wr_scale = 1.0/max(0.01, (1.0 - water));
+	vector<float> soa(4*num_sines); // x freq, x phase, y freq, y phase as separate arrays for the SSE exact sin path
+	float *const xf(&soa.front()), *const xp(xf + num_sines), *const yf(xp + num_sines), *const yp(yf + num_sines);
 
+	for (unsigned k = 0; k < num_sines; ++k) {
+		unsigned const index2(NUM_SINE_PARAMS*k);
+		xf[k] = rdata[index2+1]; xp[k] = rdata[index2+2]; yf[k] = rdata[index2+3]; yp[k] = rdata[index2+4];
+	}
 	for (unsigned i = 0; i < table_size; ++i) { // build sin table
 		unsigned const offset(i*num_sines);
 		float const sarg(i/mt2 - 1.0);
@@ -222,7 +230,7 @@ void urev_body::gen_texture_data_and_heightmap(unsigned char *data, unsigned siz
 		}
 	}
 
-	#pragma omp parallel for schedule(dynamic,1)
+	#pragma omp parallel for schedule(dynamic,1) if (use_threads)
 	for (int i = 0; i < (int)size; ++i) { // phi values
 		unsigned const hmoff(i*size), ti(size-i-1), texoff(ti*size);
 		float const phi((float(i)/(size-1))*PI);
@@ -241,19 +249,16 @@ void urev_body::gen_texture_data_and_heightmap(unsigned char *data, unsigned siz
 			float val(0.0);
 
 			if (i <= (int)pole_thresh || i >= int(size-pole_thresh-1)) { // slower version near the poles
-				for (unsigned k = 0; k < num_sines; ++k) {
-					unsigned const index2(NUM_SINE_PARAMS*k);
-					val += ztable[k]*SINF(rdata[index2+1]*xval + rdata[index2+2])*SINF(rdata[index2+3]*yval + rdata[index2+4]);
-				}
+				val = sine_sum_2d_sse(ztable, xf, xp, yf, yp, num_sines, xval, yval);
 			}
 			else {
 				// Note: chooses the closest precomputed grid point for efficiency -
 				// no interpolation, so has artifacts closer to the poles
-				for (unsigned k = 0; k < num_sines; ++k) {val += ztable[k]*xtable[ox1+k]*ytable[oy1+k];}
+				val = dot_product3_sse(ztable, &xtable[ox1], &ytable[oy1], num_sines);
 			}
 			val = 0.5*(max(-1.0f, min(1.0f, scale*val)) + 1.0);
-			surface->heightmap[hmoff + j] = val;
-			get_surface_color((data + index), val, phi);
+			surface.heightmap[hmoff + j] = val;
+			cgen.get_surface_color((data + index), val, phi);
 			sin_s = s*cos_ds + c*sin_ds;
 			cos_s = c*cos_ds - s*sin_ds;
 		} // for j
@@ -262,6 +267,146 @@ void urev_body::gen_texture_data_and_heightmap(unsigned char *data, unsigned siz
 }
 
 
+struct planet_tex_key_t {
+
+	int rseed1, rseed2, type;
+	unsigned size;
+
+	planet_tex_key_t(urev_body const &body, unsigned size_) : rseed1(body.rgen.rseed1), rseed2(body.rgen.rseed2), type(body.type), size(size_) {}
+
+	bool operator<(planet_tex_key_t const &k) const {
+		if (rseed1 != k.rseed1) return (rseed1 < k.rseed1);
+		if (rseed2 != k.rseed2) return (rseed2 < k.rseed2);
+		if (type   != k.type  ) return (type   < k.type  );
+		return (size < k.size);
+	}
+};
+
+
+struct planet_tex_job_t { // everything needed to generate a planet texture, copied from the body so that the body can be freed while this runs
+
+	rand_gen_t rgen;
+	int type;
+	unsigned size;
+	float mag, freq, hmap_cutoff;
+	rocky_surface_colors_t colors;
+
+	planet_tex_job_t(urev_body const &body, unsigned size_) : rgen(body.rgen), type(body.type), size(size_), hmap_cutoff(max(body.water, body.lava)), colors(body) {
+		body.get_surface_params(mag, freq);
+	}
+	p_planet_tex_t run(bool use_threads) const {
+		p_planet_tex_t tex(new planet_tex_t);
+		tex->surface.reset(new upsurface(type));
+		tex->surface->rgen = rgen;
+		tex->surface->gen(mag, freq);
+		tex->size = size;
+		tex->data.resize(3*size*size);
+		gen_texture_data_and_heightmap(*tex->surface, colors, hmap_cutoff, &tex->data.front(), size, use_threads);
+		return tex;
+	}
+};
+
+
+class planet_tex_gen_queue_t { // LRU cache of generated planet textures, filled either inline or by background worker threads
+
+	struct entry_t {
+		p_planet_tex_t tex; // null until generated
+		std::shared_ptr<planet_tex_job_t> job; // non-null while waiting for a worker thread
+		unsigned last_used; // frame
+		entry_t() : last_used(0) {}
+	};
+	typedef map<planet_tex_key_t, entry_t> entry_map_t;
+	entry_map_t entries;
+	vector<planet_tex_key_t> pending; // processed newest first, since those are the textures the player is most likely approaching
+	vector<std::thread> threads;
+	std::mutex mutex;
+	std::condition_variable cv;
+	unsigned cur_frame;
+	bool exiting;
+
+	void evict_lru() { // mutex must be locked
+		while (entries.size() > PLANET_TEX_CACHE_SIZE) {
+			entry_map_t::iterator oldest(entries.end());
+
+			for (entry_map_t::iterator i = entries.begin(); i != entries.end(); ++i) {
+				if (i->second.tex != nullptr && (oldest == entries.end() || i->second.last_used < oldest->second.last_used)) {oldest = i;}
+			}
+			if (oldest == entries.end()) return; // all pending
+			entries.erase(oldest); // bodies using this texture keep their own reference
+		}
+	}
+	void worker_loop() {
+		std::unique_lock<std::mutex> lock(mutex);
+
+		while (1) {
+			while (!exiting && pending.empty()) {cv.wait(lock);}
+			if (exiting) return;
+			planet_tex_key_t const key(pending.back());
+			pending.pop_back();
+			entry_map_t::iterator it(entries.find(key));
+			if (it == entries.end() || it->second.job == nullptr) continue; // already generated inline
+			if (cur_frame > it->second.last_used + PLANET_TEX_MAX_AGE) {entries.erase(it); continue;} // no longer needed
+			std::shared_ptr<planet_tex_job_t> const job(it->second.job);
+			lock.unlock();
+			p_planet_tex_t const tex(job->run(0));
+			lock.lock();
+			it = entries.find(key);
+			if (it != entries.end() && it->second.tex == nullptr) {it->second.tex = tex; it->second.job.reset();}
+		}
+	}
+
+public:
+	planet_tex_gen_queue_t() : cur_frame(0), exiting(0) {}
+
+	~planet_tex_gen_queue_t() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			exiting = 1;
+		}
+		cv.notify_all();
+		for (vector<std::thread>::iterator t = threads.begin(); t != threads.end(); ++t) {t->join();}
+	}
+	p_planet_tex_t get(urev_body const &body, unsigned size, bool async) { // called on the main thread; returns null if async and not yet generated
+		planet_tex_key_t const key(body, size);
+		std::unique_lock<std::mutex> lock(mutex);
+		cur_frame = max(cur_frame, (unsigned)frame_counter);
+		entry_t &entry(entries[key]);
+		entry.last_used = cur_frame;
+		if (entry.tex != nullptr) {return entry.tex;} // cached
+		if (async && entry.job != nullptr) {return nullptr;} // already queued
+
+		if (!async) { // generate inline, using all threads
+			lock.unlock();
+			p_planet_tex_t const tex(planet_tex_job_t(body, size).run(1));
+			lock.lock();
+			entry_t &entry2(entries[key]); // entry may have been invalidated
+			entry2.tex = tex;
+			entry2.job.reset();
+			evict_lru();
+			return tex;
+		}
+		entry.job.reset(new planet_tex_job_t(body, size));
+		pending.push_back(key);
+		evict_lru();
+
+		if (threads.empty()) {
+			unsigned const num_threads(max(1U, min(4U, std::thread::hardware_concurrency()/2)));
+			for (unsigned i = 0; i < num_threads; ++i) {threads.push_back(std::thread(&planet_tex_gen_queue_t::worker_loop, this));}
+		}
+		lock.unlock();
+		cv.notify_one();
+		return nullptr;
+	}
+};
+
+planet_tex_gen_queue_t planet_tex_queue;
+
+
+p_planet_tex_t get_planet_texture(urev_body const &body, unsigned size, bool async) {
+	return planet_tex_queue.get(body, size, async);
+}
+
+
 bool urev_body::surface_test(float rad, point const &p, float &coll_r, bool simple) const {
 
 	// not quite right - should take into consideration peaks in surrounding geometry that also intersect the sphere
@@ -964,6 +964,17 @@ sphere_t voxel_model::get_bsphere() const {
 }
 
 
+void voxel_model::add_mem_usage(mem_usage_t &usage) const { // approximate: voxel grids + vertex and index data
+
+	uint64_t cpu_mem(this->capacity()*sizeof(float) + outside.capacity() + ao_lighting.capacity()), gpu_mem(0);
+
+	for (auto t = tri_data.begin(); t != tri_data.end(); ++t) {
+		cpu_mem += t->num_unique_verts()*sizeof(vertex_type_t) + t->num_verts()*sizeof(unsigned);
+		gpu_mem += t->get_gpu_mem();
+	}
+	usage.add(cpu_mem, gpu_mem, this->size());
+}
+
 bool voxel_model::has_triangles() const {
 
 	for (tri_data_t::const_iterator i = tri_data[0].begin(); i != tri_data[0].end(); ++i) {
@@ -2135,6 +2146,8 @@ void get_voxel_coll_sphere_cobjs(point const &center, float radius, int ignore_c
 	terrain_voxel_model.get_coll_sphere_cobjs(center, radius, ignore_cobj, vcd);
 }
 
+void add_voxels_mem_usage(mem_usage_t *usage) {terrain_voxel_model.add_mem_usage(usage[MEM_VOXELS]);}
+
 
 // ************ Voxel Editing ************
 
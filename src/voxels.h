@@ -320,6 +320,7 @@ public:
 	bool from_file(string const &fn);
 	bool to_file(string const &fn) const;
 	bool has_modified_blocks() const {return !modified_blocks.empty();}
+	void add_mem_usage(mem_usage_t &usage) const;
 };
 
 
@@ -18,12 +18,13 @@ float const STEP_SIZE_MULT     = 0.25; // waypoint connectivity algorithm (relat
 float const STEP_SIZE_MULT2    = 0.50; // reachability tests (relative to smiley radius)
 
 bool has_user_placed(0), has_item_placed(0), has_wpt_goal(0);
+unsigned waypoint_graph_version(1); // incremented when waypoint edges or positions change; used to invalidate cached paths
 int show_waypoints(0); // 0=none, 1=waypoints, 2=waypoints+edges
 waypoint_vector waypoints;
 
 extern bool use_waypoints;
 extern int DISABLE_WATER, camera_change, frame_counter, num_smileys, num_groups, display_mode;
-extern float temperature, zmin, water_plane_z, waypoint_sz_thresh, CAMERA_RADIUS;
+extern float temperature, zmin, water_plane_z, waypoint_sz_thresh, waypoint_max_conn_dist, CAMERA_RADIUS;
 extern double tfticks;
 extern int coll_id[];
 extern obj_group obj_groups[];
@@ -73,8 +74,8 @@ bool waypt_used_set::is_valid(unsigned wp) { // called to determine whether or n
 
 
 waypoint_t::waypoint_t(point const &p, int cid, bool up, bool i, bool g, bool t)
-	: user_placed(up), placed_item(i), goal(g), temp(t), visited(0), disabled(0), next_valid(0),
-	came_from(-1), item_group(-1), item_ix(-1), coll_id(cid), connected_to(-1), g_score(0), h_score(0), f_score(0), pos(p)
+	: user_placed(up), placed_item(i), goal(g), temp(t), visited(0), disabled(0),
+	item_group(-1), item_ix(-1), coll_id(cid), connected_to(-1), pos(p)
 {
 	clear();
 }
@@ -181,6 +182,83 @@ bool check_step_dz(point &cur, point const &lpos, float radius) {
 }
 
 
+// uniform grid in xy of a range of waypoints, used to find connection candidates within a max distance rather than testing all pairs
+class waypoint_grid_t {
+
+	float dmax, x0, y0, cell_sz_inv;
+	unsigned start, end, nx, ny;
+	vector<unsigned> cell_start, ixs; // waypoints in cell c are ixs[cell_start[c]..cell_start[c+1]]
+
+	unsigned get_xcell(float x) const {return min(nx-1, unsigned(max(0.0f, (x - x0)*cell_sz_inv)));}
+	unsigned get_ycell(float y) const {return min(ny-1, unsigned(max(0.0f, (y - y0)*cell_sz_inv)));}
+	unsigned get_cell(point const &pos) const {return (get_ycell(pos.y)*nx + get_xcell(pos.x));}
+
+public:
+	waypoint_grid_t(unsigned start_, unsigned end_, float dmax_) : dmax(dmax_), x0(0.0), y0(0.0), cell_sz_inv(0.0), start(start_), end(end_), nx(1), ny(1) {
+		if (dmax <= 0.0 || end <= start) return; // unbounded or empty
+		unsigned const max_cells_per_dim = 256;
+		float x1(FAR_DISTANCE), y1(FAR_DISTANCE), x2(-FAR_DISTANCE), y2(-FAR_DISTANCE);
+
+		for (unsigned i = start; i < end; ++i) {
+			point const &pos(waypoints[i].pos);
+			x1 = min(x1, pos.x); y1 = min(y1, pos.y); x2 = max(x2, pos.x); y2 = max(y2, pos.y);
+		}
+		float const cell_sz(max(dmax, max((x2 - x1), (y2 - y1))/max_cells_per_dim));
+		x0 = x1; y0 = y1; cell_sz_inv = 1.0/cell_sz;
+		nx = unsigned((x2 - x1)*cell_sz_inv) + 1;
+		ny = unsigned((y2 - y1)*cell_sz_inv) + 1;
+		cell_start.resize(nx*ny+1, 0);
+		for (unsigned i = start; i < end; ++i) {++cell_start[get_cell(waypoints[i].pos)+1];}
+		for (unsigned c = 0; c < nx*ny; ++c) {cell_start[c+1] += cell_start[c];}
+		ixs.resize(end - start);
+		vector<unsigned> pos(cell_start.begin(), cell_start.end()-1);
+		for (unsigned i = start; i < end; ++i) {ixs[pos[get_cell(waypoints[i].pos)]++] = i;} // in increasing index order within each cell
+	}
+	void get_cands(point const &pos, vector<unsigned> &cands) const { // returns waypoints within dmax of pos in increasing index order
+		cands.clear();
+
+		if (cell_start.empty()) { // unbounded, or no waypoints
+			for (unsigned i = start; i < end; ++i) {cands.push_back(i);}
+			return;
+		}
+		unsigned const cx1(get_xcell(pos.x - dmax)), cx2(get_xcell(pos.x + dmax)), cy1(get_ycell(pos.y - dmax)), cy2(get_ycell(pos.y + dmax));
+
+		for (unsigned y = cy1; y <= cy2; ++y) {
+			for (unsigned x = cx1; x <= cx2; ++x) {
+				unsigned const c(y*nx + x);
+
+				for (unsigned i = cell_start[c]; i < cell_start[c+1]; ++i) {
+					if (dist_less_than(pos, waypoints[ixs[i]].pos, dmax)) {cands.push_back(ixs[i]);}
+				}
+			}
+		}
+		sort(cands.begin(), cands.end());
+	}
+	void get_in_region(cube_t const &bc, vector<unsigned> &cands) const { // returns waypoints in the xy range of bc in increasing index order
+		cands.clear();
+
+		if (cell_start.empty()) {
+			for (unsigned i = start; i < end; ++i) {
+				if (bc.contains_pt_xy(waypoints[i].pos)) {cands.push_back(i);}
+			}
+			return;
+		}
+		unsigned const cx1(get_xcell(bc.x1())), cx2(get_xcell(bc.x2())), cy1(get_ycell(bc.y1())), cy2(get_ycell(bc.y2()));
+
+		for (unsigned y = cy1; y <= cy2; ++y) {
+			for (unsigned x = cx1; x <= cx2; ++x) {
+				unsigned const c(y*nx + x);
+
+				for (unsigned i = cell_start[c]; i < cell_start[c+1]; ++i) {
+					if (bc.contains_pt_xy(waypoints[ixs[i]].pos)) {cands.push_back(ixs[i]);}
+				}
+			}
+		}
+		sort(cands.begin(), cands.end());
+	}
+};
+
+
 class waypoint_builder {
 
 	float const radius, size_thresh;
@@ -352,8 +430,10 @@ public:
 
 	unsigned add_new_waypoint(point const &pos, int coll_id, bool connect_in, bool connect_out, bool goal, bool temp) {
 		unsigned const ix(waypoints.add(waypoint_t(pos, coll_id, 0, 0, goal, temp)));
-		if (connect_in ) connect_waypoints(0,  ix,    ix, ix+1, 0, 1); // from existing waypoints to new waypoint
-		if (connect_out) connect_waypoints(ix, ix+1,  0,  ix,   0, 1); // from new waypoint to existing waypoints
+		++waypoint_graph_version; // even if not connected, it may be a goal
+		float const dmax(get_max_conn_dist(1));
+		if (connect_in ) connect_waypoint_range(0,  ix,    ix, ix+1, 0, dmax); // from existing waypoints to new waypoint
+		if (connect_out) connect_waypoint_range(ix, ix+1,  0,  ix,   0, dmax); // from new waypoint to existing waypoints
 		return ix;
 	}
 
@@ -391,6 +471,7 @@ public:
 			remove_adj(waypoints[*i].prev_wpts, ix, is_last);
 		}
 		w.clear();
+		++waypoint_graph_version;
 	}
 
 	void remove_waypoint(unsigned const ix) {
@@ -420,93 +501,178 @@ public:
 		}
 	}
 
+	static float get_max_conn_dist(bool incremental) { // returns 0 for unbounded
+		if (waypoint_max_conn_dist > 0.0) return waypoint_max_conn_dist;
+		if (waypoint_max_conn_dist < 0.0 && !incremental) return 0.0; // unbounded all pairs
+		return 0.25f*(X_SCENE_SIZE + Y_SCENE_SIZE);
+	}
+
 	void connect_all_waypoints() {
-		connect_waypoints(0, (unsigned)waypoints.size(), 0, (unsigned)waypoints.size(), 1, 0);
+		connect_waypoint_range(0, (unsigned)waypoints.size(), 0, (unsigned)waypoints.size(), 1, get_max_conn_dist(0));
+	}
+
+	void connect_waypoint_range(unsigned from_start, unsigned from_end, unsigned to_start, unsigned to_end, bool verbose, float dmax) {
+		vector<unsigned> from;
+		for (unsigned i = from_start; i < from_end; ++i) {from.push_back(i);}
+		connect_waypoints(from, to_start, to_end, verbose, dmax);
 	}
 
-	void connect_waypoints(unsigned from_start, unsigned from_end, unsigned to_start,
-		unsigned to_end, bool verbose, bool fast)
+	// Note: deterministic regardless of the number of threads, since each waypoint only writes its own edges,
+	// and redundant edges are removed in a second pass that reads the edges from the first pass
+	// cross_bc: if set, only adds new edges whose line crosses cross_bc, keeping the existing edges
+	void connect_waypoints(vector<unsigned> const &from, unsigned to_start, unsigned to_end, bool verbose, float dmax, cube_t const *cross_bc=nullptr) {
+		unsigned visible(0), cand_edges(0), num_edges(0), tot_steps(0), num_redundant(0);
+		waypoint_grid_t const grid(to_start, to_end, dmax);
+		vector<unsigned> orig_num_next(from.size());
+		for (unsigned n = 0; n < from.size(); ++n) {orig_num_next[n] = (unsigned)waypoints[from[n]].next_wpts.size();}
+
+		#pragma omp parallel for schedule(dynamic,1) reduction(+:visible, cand_edges, num_edges, tot_steps)
+		for (int n = 0; n < (int)from.size(); ++n) {
+			add_waypoint_edges(from[n], to_start, to_end, grid, cross_bc, visible, cand_edges, num_edges, tot_steps);
+		}
+		vector<waypt_adj_vect> pruned(from.size());
+
+		#pragma omp parallel for schedule(dynamic,16) reduction(+:num_redundant)
+		for (int n = 0; n < (int)from.size(); ++n) {
+			if (waypoints[from[n]].next_wpts.size() > orig_num_next[n]) {num_redundant += get_non_redundant_edges(from[n], orig_num_next[n], pruned[n]);}
+		}
+		for (unsigned n = 0; n < from.size(); ++n) {
+			unsigned const i(from[n]);
+			waypt_adj_vect &next(waypoints[i].next_wpts);
+			if (next.size() == orig_num_next[n]) continue; // no new edges
+			next.swap(pruned[n]);
+
+			for (unsigned j = orig_num_next[n]; j < next.size(); ++j) { // new edges
+				assert(next[j] >= to_start && next[j] < to_end);
+				waypoints[next[j]].prev_wpts.push_back(i);
+			}
+		}
+		++waypoint_graph_version;
+
+		if (verbose) {
+			cout << "Waypoints: " << waypoints.size() << ", vis edges: " << visible << ", cand edges: " << cand_edges
+				 << ", true edges: " << (num_edges - num_redundant) << ", tot steps: " << tot_steps << endl;
+		}
+	}
+
+	void add_waypoint_edges(unsigned i, unsigned to_start, unsigned to_end, waypoint_grid_t const &grid, cube_t const *cross_bc,
+		unsigned &visible, unsigned &cand_edges, unsigned &num_edges, unsigned &tot_steps) const
 	{
-		unsigned visible(0), cand_edges(0), num_edges(0), tot_steps(0);
-		float const fast_dmax(0.25f*(X_SCENE_SIZE + Y_SCENE_SIZE));
-		for (int i = from_start; i < (int)from_end; ++i) {waypoints[i].next_valid = 0;}
+		assert(i < waypoints.size());
+		waypoint_t &w(waypoints[i]);
+		if (w.disabled) return;
+		point const start(w.pos);
+		int const tele_ix(w.connected_to);
+		int cindex(-1);
+		vector<unsigned> to_test;
 		vector<pair<float, unsigned> > cands;
+		grid.get_cands(start, to_test);
 
-		#pragma omp parallel for schedule(dynamic,1) private(cands) // is this fully thread safe? it's not determinstic across threads
-		for (int i = from_start; i < (int)from_end; ++i) {
-			assert(i < (int)waypoints.size());
-			if (waypoints[i].disabled) continue;
-			point const start(waypoints[i].pos);
-			int cindex(-1);
-			cands.clear();
-
-			for (unsigned j = to_start; j < to_end; ++j) {
-				if (i == (int)j || waypoints[j].disabled) continue;
+		if (!cross_bc && tele_ix >= (int)to_start && tele_ix < (int)to_end && tele_ix != (int)i && !waypoints[tele_ix].disabled) { // connected by a teleporter
+			cands.push_back(make_pair(CAMERA_RADIUS, tele_ix)); // small but nonzero distance
+		}
+		for (auto j = to_test.begin(); j != to_test.end(); ++j) {
+			if (*j == i || (int)*j == tele_ix || waypoints[*j].disabled) continue;
+			point const end(waypoints[*j].pos);
+			if (cross_bc && (!check_line_clip(start, end, cross_bc->d) || find(w.next_wpts.begin(), w.next_wpts.end(), *j) != w.next_wpts.end())) continue;
+			if (cindex >= 0 && coll_objects.get_cobj(cindex).line_intersect(start, end)) continue; // hit last cobj
+			if (check_coll_line(start, end, cindex, -1, 1, 0, 1, 0, 1)) continue; // no line of sight (skip dynamic/movable)
+			cands.push_back(make_pair(p2p_dist_sq(start, end), *j));
+			++visible;
+		}
+		sort(cands.begin(), cands.end()); // closest to furthest, then by index
+		waypt_adj_vect &next(w.next_wpts);
+
+		for (unsigned j = 0; j < cands.size(); ++j) {
+			unsigned const k(cands[j].second);
+			assert(k < waypoints.size());
+			point const end(waypoints[k].pos);
+			vector3d const dir(end - start), dir_xy(vector3d(dir.x, dir.y, 0.0).get_norm());
+			bool colinear(0);
+
+			for (unsigned l = 0; l < next.size() && !colinear; ++l) {
+				assert(next[l] < waypoints.size());
+				if (next[l] < to_start || next[l] >= to_end) continue; // no in the target range
+				vector3d const dir2(waypoints[next[l]].pos - start), dir_xy2(vector3d(dir2.x, dir2.y, 0.0).get_norm());
+				colinear = (dot_product(dir_xy, dir_xy2) > 0.99);
+			}
+			if (colinear) continue;
 
-				if (waypoints[i].connected_to == (int)j) { // connected by a teleporter
-					cands.push_back(make_pair(CAMERA_RADIUS, j)); // small but nonzero distance
-					continue;
-				}
-				point const end(waypoints[j].pos);
-				if (cindex >= 0 && coll_objects.get_cobj(cindex).line_intersect(start, end)) continue; // hit last cobj
-				if (fast && !dist_less_than(start, end, fast_dmax)) continue; // too far away
-				if (check_coll_line(start, end, cindex, -1, 1, 0, 1, 0, 1)) continue; // no line of sight (skip dynamic/movable)
-				cands.push_back(make_pair(p2p_dist_sq(start, end), j));
-				++visible;
+			if (tele_ix == (int)k || is_point_reachable(start, end, tot_steps, STEP_SIZE_MULT, 1)) {
+				next.push_back(k);
+				++num_edges;
 			}
-			sort(cands.begin(), cands.end()); // closest to furthest
-			waypt_adj_vect &next(waypoints[i].next_wpts);
+			++cand_edges;
+		} // for j
+	}
 
-			for (unsigned j = 0; j < cands.size(); ++j) {
-				unsigned const k(cands[j].second);
-				assert(k < waypoints.size());
-				point const end(waypoints[k].pos);
-				vector3d const dir(end - start), dir_xy(vector3d(dir.x, dir.y, 0.0).get_norm());
-				bool colinear(0), redundant(0);
-
-				for (unsigned l = 0; l < next.size() && !colinear; ++l) {
-					assert(next[l] < waypoints.size());
-					if (next[l] < to_start || next[l] >= to_end) continue; // no in the target range
-					vector3d const dir2(waypoints[next[l]].pos - start), dir_xy2(vector3d(dir2.x, dir2.y, 0.0).get_norm());
-					colinear = (dot_product(dir_xy, dir_xy2) > 0.99);
-				}
-				if (colinear) continue;
+	// copies edges of waypoint i to pruned, skipping new edges i => k where an edge i => l => k is nearly as short; returns the number skipped
+	unsigned get_non_redundant_edges(unsigned i, unsigned num_orig, waypt_adj_vect &pruned) const {
+		waypoint_t const &w(waypoints[i]);
+		waypt_adj_vect const &next(w.next_wpts);
+		point const &start(w.pos);
+		unsigned num_redundant(0);
+		pruned.reserve(next.size());
+
+		for (unsigned j = 0; j < next.size(); ++j) {
+			unsigned const k(next[j]);
+			bool redundant(0);
+
+			if (j >= num_orig && w.connected_to != (int)k) { // only new, non-teleporter edges can be removed
+				point const &wk(waypoints[k].pos);
+				float const dist_max(1.02f*p2p_dist(start, wk));
 
 				for (unsigned l = 0; l < next.size() && !redundant; ++l) {
-					assert(next[l] < waypoints.size());
-					if (!waypoints[next[l]].next_valid) continue; // another thread is working on this waypoint, so don't use it
+					if (next[l] == k) continue;
 					waypt_adj_vect const &next_next(waypoints[next[l]].next_wpts);
 					point const &wl(waypoints[next[l]].pos);
-
-					for (unsigned m = 0; m < next_next.size() && !redundant; ++m) {
-						assert(next_next[m] < waypoints.size());
-						point const &wm(waypoints[next_next[m]].pos);
-						redundant = (next_next[m] == k && (p2p_dist(start, wl) + p2p_dist(wl, wm) < 1.02f*p2p_dist(start, wm)));
-					}
-				}
-				if (redundant) continue;
-
-				if (waypoints[i].connected_to == (int)k || is_point_reachable(start, end, tot_steps, STEP_SIZE_MULT, 1)) {
-					next.push_back(k);
-					++num_edges;
+					if (p2p_dist(start, wl) + p2p_dist(wl, wk) >= dist_max) continue; // path through l is too long
+					for (unsigned m = 0; m < next_next.size() && !redundant; ++m) {redundant = (next_next[m] == k);}
 				}
-				++cand_edges;
-			} // for j
-			waypoints[i].next_valid = 1;
+			}
+			if (redundant) {++num_redundant;} else {pruned.push_back(k);}
 		}
-		for (unsigned i = from_start; i < from_end; ++i) {
-			if (waypoints[i].disabled) continue;
-			waypt_adj_vect const &next(waypoints[i].next_wpts);
+		return num_redundant;
+	}
 
-			for (unsigned j = 0; j < next.size(); ++j) {
-				assert(next[j] < waypoints.size());
-				if (next[j] >= to_start && next[j] < to_end) {waypoints[next[j]].prev_wpts.push_back(i);}
+	// reconnects waypoints near a region where cobjs were added or removed, and waypoints with edges through it;
+	// also adds edges between farther apart waypoints whose line through the region may no longer be blocked
+	void reconnect_waypoints_near(cube_t const &region) {
+		if (waypoints.empty()) return;
+		cube_t edge_bc(region), near_bc(region);
+		vector3d const sz(region.get_size());
+		edge_bc.expand_by(radius);
+		near_bc.expand_by(max(radius, max(sz.x, max(sz.y, sz.z)))); // proportional to the size of the change
+		vector<unsigned> from;
+
+		for (unsigned i = 0; i < waypoints.size(); ++i) {
+			waypoint_t const &w(waypoints[i]);
+			if (w.disabled) continue;
+			bool add(near_bc.contains_pt(w.pos));
+
+			for (auto j = w.next_wpts.begin(); j != w.next_wpts.end() && !add; ++j) {
+				add = check_line_clip(w.pos, waypoints[*j].pos, edge_bc.d);
 			}
+			if (add) {from.push_back(i);}
 		}
-		if (verbose) {
-			cout << "Waypoints: " << waypoints.size() << ", vis edges: " << visible << ", cand edges: " << cand_edges
-				 << ", true edges: " << num_edges << ", tot steps: " << tot_steps << endl;
+		for (auto i = from.begin(); i != from.end(); ++i) { // remove outgoing edges
+			waypt_adj_vect &next(waypoints[*i].next_wpts);
+			for (auto j = next.begin(); j != next.end(); ++j) {remove_adj(waypoints[*j].prev_wpts, *i, 0);}
+			next.clear();
+		}
+		float const dmax(get_max_conn_dist(1));
+		connect_waypoints(from, 0, (unsigned)waypoints.size(), 0, dmax);
+		// edges can only cross the region if both ends are within dmax of it; waypoints in from already have all of their edges
+		cube_t cross_src_bc(edge_bc);
+		cross_src_bc.expand_by(dmax);
+		vector<unsigned> cross_src, cands;
+		waypoint_grid_t const grid(0, (unsigned)waypoints.size(), dmax);
+		grid.get_in_region(cross_src_bc, cands);
+
+		for (auto i = cands.begin(); i != cands.end(); ++i) {
+			if (!waypoints[*i].disabled && !binary_search(from.begin(), from.end(), *i)) {cross_src.push_back(*i);}
 		}
+		if (!cross_src.empty()) {connect_waypoints(cross_src, 0, (unsigned)waypoints.size(), 0, dmax, &edge_bc);}
 	}
 
 	bool check_cobj_placement(point &pos, int coll_id, bool check_uw) const {
@@ -572,14 +738,139 @@ bool find_closest_waypoint(point const &pos, unsigned &closest, bool check_visib
 // ********** waypoint_search **********
 
 
-struct waypoint_cache {
+bool is_goal_waypoint(wpt_goal const &goal, unsigned cur) {
+
+	waypoint_t const &w(waypoints[cur]);
+	if (goal.mode == 1) return w.user_placed;     // user waypoint
+	if (goal.mode == 3) return w.goal;            // goal waypoint
+	if (goal.mode >= 4) return (cur == goal.wpt); // goal position or specific waypoint
+
+	if (goal.mode == 2 && w.placed_item) { // placed item waypoint
+		if (w.item_group >= 0) { // check if item is present
+			assert(w.item_group < NUM_TOT_OBJS);
+			obj_group const &objg(obj_groups[w.item_group]);
+			if (!objg.is_enabled()) return 0;
+			vector<predef_obj> const &objs(objg.get_predef_objs());
+			assert(w.item_ix >= 0 && (unsigned)w.item_ix < objs.size());
+			return (objs[w.item_ix].obj_used >= 0); // in use
+		}
+		return 1;
+	}
+	return 0;
+}
+
+
+// shortest path distance and next waypoint towards the closest goal for every waypoint, for goal modes 1-3 (a set of goal waypoints independent of position);
+// built with a multi-source Dijkstra search over incoming edges and reused by all smileys until the waypoint graph or the set of goals changes
+class waypoint_goal_table_t {
+
+	unsigned graph_version, cand_version;
+	vector<unsigned> goals, cands, cur_goals; // cands: waypoints that can be goals in this mode, rescanned only when the graph changes
+	vector<float> dist; // -1.0 = unreachable
+	vector<int> next_hop; // -1 = unreachable, self for goals
+
+	bool is_goal_cand(wpt_goal const &goal, waypoint_t const &w) const {
+		if (w.disabled) return 0;
+		if (goal.mode == 1) return w.user_placed;
+		if (goal.mode == 2) return w.placed_item; // item may or may not be present
+		return w.goal;
+	}
+public:
+	waypoint_goal_table_t() : graph_version(0), cand_version(0) {}
+	bool is_valid(vector<unsigned> const &goals_) const {return (graph_version == waypoint_graph_version && dist.size() == waypoints.size() && goals == goals_);}
+
+	vector<unsigned> const &get_cur_goals(wpt_goal const &goal) { // only items can change without a graph change, so only the candidates need to be rechecked
+		if (cand_version != waypoint_graph_version) {
+			cands.clear();
+
+			for (unsigned i = 0; i < waypoints.size(); ++i) {
+				if (is_goal_cand(goal, waypoints[i])) {cands.push_back(i);}
+			}
+			cand_version = waypoint_graph_version;
+		}
+		cur_goals.clear();
+
+		for (auto i = cands.begin(); i != cands.end(); ++i) {
+			if (is_goal_waypoint(goal, *i)) {cur_goals.push_back(*i);}
+		}
+		return cur_goals;
+	}
+	float get_dist    (unsigned w) const {assert(w < dist.size()    ); return dist[w];}
+	int   get_next_hop(unsigned w) const {assert(w < next_hop.size()); return next_hop[w];}
+
+	void build(vector<unsigned> const &goals_) {
+		graph_version = waypoint_graph_version;
+		goals = goals_;
+		dist.clear();
+		dist.resize(waypoints.size(), -1.0);
+		next_hop.clear();
+		next_hop.resize(waypoints.size(), -1);
+		std::priority_queue<pair<float, unsigned> > open_queue;
+
+		for (auto i = goals.begin(); i != goals.end(); ++i) {
+			dist[*i] = 0.0;
+			next_hop[*i] = *i;
+			open_queue.push(make_pair(0.0f, *i));
+		}
+		while (!open_queue.empty()) {
+			float const cur_dist(-open_queue.top().first);
+			unsigned const cur(open_queue.top().second);
+			open_queue.pop();
+			if (cur_dist > dist[cur]) continue; // already found a shorter path (duplicate)
+			waypoint_t const &cw(waypoints[cur]);
+
+			for (auto i = cw.prev_wpts.begin(); i != cw.prev_wpts.end(); ++i) { // edge *i => cur
+				assert(*i < waypoints.size());
+				waypoint_t const &wp(waypoints[*i]);
+				// if not connected by a teleporter, use distance between the waypoints; otherswise, use a small but nonzero value
+				float const new_dist(cur_dist + ((wp.connected_to == (int)cur) ? CAMERA_RADIUS : p2p_dist(cw.pos, wp.pos)));
+				if (dist[*i] >= 0.0 && new_dist >= dist[*i]) continue; // not shorter
+				dist    [*i] = new_dist;
+				next_hop[*i] = cur;
+				open_queue.push(make_pair(-new_dist, *i));
+			}
+		}
+	}
+};
+
+waypoint_goal_table_t goal_tables[3]; // one per goal mode 1-3
+
+
+bool uses_goal_table(wpt_goal const &goal) {return (goal.mode >= 1 && goal.mode <= 3);}
+
+// returns {distance to goal, next hop} for each waypoint in wpts using the table for this goal mode, rebuilding it if needed
+void query_goal_table(wpt_goal const &goal, vector<unsigned> const &wpts, vector<pair<float, int> > &results) {
+
+	assert(uses_goal_table(goal));
+	results.clear();
+
+#pragma omp critical(waypoint_goal_table)
+	{
+		waypoint_goal_table_t &table(goal_tables[goal.mode-1]);
+		vector<unsigned> const &goals(table.get_cur_goals(goal));
+		if (!table.is_valid(goals)) {table.build(goals);}
+		for (auto i = wpts.begin(); i != wpts.end(); ++i) {results.push_back(make_pair(table.get_dist(*i), table.get_next_hop(*i)));}
+	}
+}
+
+
+struct waypoint_cache { // A* search state, one per thread so that smileys can path in parallel
 
 	vector<unsigned> open, closed; // tentative/already evaulated nodes
+	vector<int> came_from;
+	vector<float> g_score; // cost from start along best known path
 	unsigned call_ix; // incremented each run_a_star() call
 	waypoint_cache() : call_ix(0) {}
+
+	void resize(unsigned size) { // already resized after the first call
+		open.resize(size, 0);
+		closed.resize(size, 0);
+		came_from.resize(size, -1);
+		g_score.resize(size, 0.0);
+	}
 };
 
-waypoint_cache global_wpt_cache;
+thread_local waypoint_cache wpt_cache;
 
 
 class waypoint_search {
@@ -591,28 +882,9 @@ class waypoint_search {
 	float get_h_dist(unsigned cur) const {
 		return ((goal.mode >= 4) ? p2p_dist(waypoints[cur].pos, goal.pos) : 0.0);
 	}
-	bool is_goal(unsigned cur) const {
-		waypoint_t const &w(waypoints[cur]);
-		if (goal.mode == 1) return w.user_placed;     // user waypoint
-		if (goal.mode == 3) return w.goal;            // goal waypoint
-		if (goal.mode >= 4) return (cur == goal.wpt); // goal position or specific waypoint
-
-		if (goal.mode == 2 && waypoints[cur].placed_item) { // placed item waypoint
-			if (w.item_group >= 0) { // check if item is present
-				assert(w.item_group < NUM_TOT_OBJS);
-				obj_group const &objg(obj_groups[w.item_group]);
-				if (!objg.is_enabled()) return 0;
-				vector<predef_obj> const &objs(objg.get_predef_objs());
-				assert(w.item_ix >= 0 && (unsigned)w.item_ix < objs.size());
-				return (objs[w.item_ix].obj_used >= 0); // in use
-			}
-			return 1;
-		}
-		return 0;
-	}
 	void reconstruct_path(unsigned cur, vector<unsigned> &path) {
 		assert(cur < waypoints.size());
-		if (waypoints[cur].came_from >= 0) {reconstruct_path(waypoints[cur].came_from, path);}
+		if (wc.came_from[cur] >= 0) {reconstruct_path(wc.came_from[cur], path);}
 		path.push_back(cur);
 	}
 	void on_a_star_return(wpt_goal const &goal, bool orig_has_wpt_goal) {
@@ -626,6 +898,7 @@ public:
 	waypoint_search(wpt_goal const &goal_, waypoint_cache &wc_) : goal(goal_), wc(wc_) {}
 
 	// returns min distance to goal following connected waypoints along path
+	// Note: goal mode 7 adds a temporary waypoint, so it modifies the waypoint graph and can't be run in parallel
 	float run_a_star(vector<pair<unsigned, float> > const &start, vector<unsigned> &path, set<unsigned> const &wps_penalty) {
 		if (!goal.is_reachable()) return 0.0; // nothing to do
 		assert(path.empty());
@@ -646,27 +919,24 @@ public:
 		//cout << "start: " << start.size() << ", goal: mode: " << goal.mode << ", pos: " << goal.pos.str() << ", wpt: " << goal.wpt << endl;
 		if (int(goal.wpt) < 0) return 0.0; // no current waypoint, maybe none visible (this code may be unreachable)
 		std::priority_queue<pair<float, unsigned> > open_queue;
-		wc.open.resize(waypoints.size(), 0); // already resized after the first call
-		wc.closed.resize(waypoints.size(), 0);
+		wc.resize((unsigned)waypoints.size());
 		++wc.call_ix;
 
 		for (vector<pair<unsigned, float> >::const_iterator i = start.begin(); i != start.end(); ++i) {
 			unsigned const ix(i->first);
 			assert(ix < waypoints.size());
-			waypoint_t &w(waypoints[ix]);
-			w.g_score   = i->second; // cost from start along best known path
-			w.h_score   = get_h_dist(ix);
-			//if (wps_penalty.find(ix) != wps_penalty.end()) {w.h_score *= 10.0;} // distance penalty for this waypoint
-			w.f_score   = w.h_score; // estimated total cost from start to goal through current
-			w.came_from = -1;
-
-			if (is_goal(ix)) { // already at the goal
+			wc.g_score  [ix] = i->second;
+			wc.came_from[ix] = -1;
+			float const f_score(wc.g_score[ix] + get_h_dist(ix)); // estimated total cost from start to goal through current
+			//if (wps_penalty.find(ix) != wps_penalty.end()) {f_score += 10.0*get_h_dist(ix);} // distance penalty for this waypoint
+
+			if (is_goal_waypoint(goal, ix)) { // already at the goal
 				path.push_back(ix);
 				on_a_star_return(goal, orig_has_wpt_goal);
-				return w.f_score;
+				return f_score;
 			}
 			wc.open[ix] = wc.call_ix;
-			open_queue.push(make_pair(-w.f_score, ix));
+			open_queue.push(make_pair(-f_score, ix));
 		}
 		if (goal.mode >= 4) {
 			assert(goal.wpt < waypoints.size());
@@ -680,9 +950,9 @@ public:
 			if (wc.closed[cur] == wc.call_ix) continue; // already closed (duplicate)
 			waypoint_t const &cw(waypoints[cur]);
 
-			if (is_goal(cur)) {
+			if (is_goal_waypoint(goal, cur)) {
 				reconstruct_path(cur, path);
-				min_dist = cw.f_score;
+				min_dist = wc.g_score[cur] + get_h_dist(cur);
 				break; // we're done
 			}
 			assert(wc.closed[cur] != wc.call_ix);
@@ -692,24 +962,22 @@ public:
 			for (waypt_adj_vect::const_iterator i = cw.next_wpts.begin(); i != cw.next_wpts.end(); ++i) {
 				if (wc.closed[*i] == wc.call_ix) continue; // already closed (duplicate)
 				assert(*i < waypoints.size());
-				waypoint_t &wn(waypoints[*i]);
+				waypoint_t const &wn(waypoints[*i]);
 				// if not connected by a teleporter, use distance between the waypoints; otherswise, use a small but nonzero value
-				float const new_g_score(cw.g_score + ((cw.connected_to == *i) ? CAMERA_RADIUS : p2p_dist(cw.pos, wn.pos)));
+				float const new_g_score(wc.g_score[cur] + ((cw.connected_to == *i) ? CAMERA_RADIUS : p2p_dist(cw.pos, wn.pos)));
 				bool better(0);
 
 				if (wc.open[*i] != wc.call_ix) {
 					wc.open[*i] = wc.call_ix;
 					better = 1;
 				}
-				else if (new_g_score < wn.g_score) {
+				else if (new_g_score < wc.g_score[*i]) {
 					better = 1;
 				}
 				if (better) {
-					wn.came_from = cur;
-					wn.g_score   = new_g_score;
-					wn.h_score   = get_h_dist(*i);
-					wn.f_score   = wn.g_score + wn.h_score;
-					open_queue.push(make_pair(-wn.f_score, *i));
+					wc.came_from[*i] = cur;
+					wc.g_score  [*i] = new_g_score;
+					open_queue.push(make_pair(-(new_g_score + get_h_dist(*i)), *i));
 				}
 			} // for i
 		}
@@ -727,6 +995,7 @@ void create_waypoints(vector<user_waypt_t> const &user_waypoints) {
 	RESET_TIME;
 	clear_cached_waypoints();
 	waypoints.clear();
+	++waypoint_graph_version;
 	has_user_placed = (!user_waypoints.empty());
 	has_item_placed = 0;
 	has_wpt_goal    = 0;
@@ -752,9 +1021,16 @@ void create_waypoints(vector<user_waypt_t> const &user_waypoints) {
 int find_optimal_next_waypoint(unsigned cur, wpt_goal const &goal, set<unsigned> const &wps_penalty) {
 
 	if (!goal.is_reachable()) return -1; // nothing to do
+
+	if (uses_goal_table(goal)) {
+		vector<pair<float, int> > results;
+		query_goal_table(goal, vector<unsigned>(1, cur), results);
+		assert(results.size() == 1);
+		return results[0].second; // cur if at goal, -1 if no path to goal
+	}
 	//RESET_TIME;
 	vector<unsigned> path;
-	waypoint_search ws(goal, global_wpt_cache);
+	waypoint_search ws(goal, wpt_cache);
 	vector<pair<unsigned, float> > start;
 	start.push_back(make_pair(cur, 0.0));
 	ws.run_a_star(start, path, wps_penalty);
@@ -795,16 +1071,33 @@ void find_optimal_waypoint(point const &pos, vector<od_data> &oddatav, wpt_goal
 			start.push_back(make_pair(id, dist));
 		}
 	}
-	waypoint_search ws(goal, global_wpt_cache);
-	vector<unsigned> path;
-	ws.run_a_star(start, path, set<unsigned>());
+	int best(-1);
+
+	if (uses_goal_table(goal)) { // choose the start with the shortest total distance to a goal
+		vector<unsigned> wpts;
+		vector<pair<float, int> > results;
+		for (auto i = start.begin(); i != start.end(); ++i) {wpts.push_back(i->first);}
+		query_goal_table(goal, wpts, results);
+		assert(results.size() == start.size());
+		float best_dist(0.0);
+
+		for (unsigned i = 0; i < start.size(); ++i) {
+			if (results[i].first < 0.0) continue; // no path to goal
+			float const dist(start[i].second + results[i].first);
+			if (best < 0 || dist < best_dist) {best = start[i].first; best_dist = dist;}
+		}
+	}
+	else {
+		waypoint_search ws(goal, wpt_cache);
+		vector<unsigned> path;
+		ws.run_a_star(start, path, set<unsigned>());
+		if (!path.empty()) {best = path[0];}
+	}
 	//PRINT_TIME("Find Optimal Waypoint");
-	//cout << "query size: " << oddatav.size() << ", start size: " << start.size() << ", path length: " << path.size() << endl;
-	if (path.empty()) return; // no path found, nothing to do
-	unsigned const best(path[0]);
+	if (best < 0) return; // no path found, nothing to do
 
 	for (unsigned i = 0; i < oddatav.size(); ++i) {
-		oddatav[i].dist = ((oddatav[i].id == (int)best) ? 1.0 : 1000.0); // large/small distance
+		oddatav[i].dist = ((oddatav[i].id == best) ? 1.0 : 1000.0); // large/small distance
 	}
 }
 
@@ -828,6 +1121,14 @@ bool is_valid_path(point const &start, point const &end, bool check_uw) {
 }
 
 
+// called when cobjs in region were destroyed, which can block or unblock existing waypoint edges
+void reconnect_waypoints_near(cube_t const &region) {
+	if (!use_waypoints) return;
+	waypoint_builder wb;
+	wb.reconnect_waypoints_near(region);
+}
+
+
 void coll_obj::add_connect_waypoint() {
 
 	if (!use_waypoints) return;
@@ -850,6 +1151,7 @@ void shift_waypoints(vector3d const &vd) {
 	for (unsigned i = 0; i < waypoints.size(); ++i) {
 		waypoints[i].pos += vd; // shifting disabled waypoints should be ok
 	}
+	++waypoint_graph_version;
 }
 
 